@@ -0,0 +1,66 @@
+﻿#include "AllocationCounter.h"
+
+#include <cstdlib>
+#include <new>
+
+// グローバルの operator new と operator delete を置き換えて確保した回数を数える
+// スレッドごとに数えるので、バックグラウンドのスレッドでの確保は UI スレッドの回数に含まれない
+// (アラインメントを指定する版は置き換えないので数えない)
+
+namespace {
+	thread_local uint64_t allocationCount = 0;
+
+	void* CountedAllocate(std::size_t size) {
+		allocationCount++;
+		// 0 バイトの場合も異なるポインタを返す
+		return std::malloc(size > 0 ? size : 1);
+	}
+}
+
+uint64_t HeapAllocationCount() {
+	return allocationCount;
+}
+
+void* operator new(std::size_t size) {
+	auto p = CountedAllocate(size);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](std::size_t size) {
+	return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+	return CountedAllocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+	return CountedAllocate(size);
+}
+
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+	std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+	std::free(p);
+}
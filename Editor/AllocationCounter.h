@@ -0,0 +1,7 @@
+﻿#pragma once
+
+#include <cstdint>
+
+// 呼び出したスレッドがこれまでに operator new でヒープから確保した回数
+// 編集や描画の前後の差を見て、定常状態で確保していないことを確かめるために使う
+uint64_t HeapAllocationCount();
@@ -1,6 +1,14 @@
 #include "stdafx.h"
 #include "App.h"
 
+#include <shellapi.h>
+#include <chrono>
+
+#include "Encoding.h"
+#include "Platform.h"
+
+#pragma comment(lib, "windowscodecs")
+
 using namespace D2D1;
 
 App::App() :
@@ -8,7 +16,7 @@ App::App() :
 	direct2dFactory(nullptr),
 	renderTarget(nullptr),
 	dwriteFactory(nullptr),
-	editor(nullptr) {
+	activeEditor(0) {
 }
 
 App::~App() {
@@ -17,14 +25,142 @@ App::~App() {
 	SafeRelease(&renderTarget);
 }
 
-void App::RunMessageLoop() {
+int App::RunMessageLoop() {
+	if (!replayPath.empty()) {
+		return RunReplay();
+	}
+
 	MSG msg;
-	while (GetMessage(&msg, nullptr, 0, 0)) {
-		TranslateMessage(&msg);
-		DispatchMessage(&msg);
+	while (true) {
+		if (!editors.empty() && ActiveEditor()->IsAnimating()) {
+			// スクロールのアニメーション中はメッセージを待たずに描画する
+			if (PeekMessage(&msg, nullptr, 0, 0, PM_REMOVE)) {
+				if (msg.message == WM_QUIT) {
+					break;
+				}
+
+				TranslateMessage(&msg);
+				DispatchMessage(&msg);
+			}
+		} else {
+			if (!GetMessage(&msg, nullptr, 0, 0)) {
+				break;
+			}
+
+			TranslateMessage(&msg);
+			DispatchMessage(&msg);
+		}
 
 		OnRender();
 	}
+
+	return static_cast<int>(msg.wParam);
+}
+
+int App::RunReplay() {
+	std::vector<TraceEvent> events;
+	try {
+		events = LoadInputTrace(replayPath);
+	} catch (const InputTraceException& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 2;
+	}
+
+	// 記録の最初で大きさが変わるまでは、作成したときのウィンドウの大きさで描画する
+	RECT rc;
+	GetClientRect(hwnd, &rc);
+	auto width = static_cast<UINT>(rc.right - rc.left);
+	auto height = static_cast<UINT>(rc.bottom - rc.top);
+	ActiveEditor()->OnResize(width, height);
+
+	IWICImagingFactory* wicFactory = nullptr;
+	IWICBitmap* bitmap = nullptr;
+	ID2D1RenderTarget* target = nullptr;
+	auto result = CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&wicFactory));
+	if (SUCCEEDED(result)) {
+		result = CreateReplayTarget(wicFactory, width, height, &bitmap, &target);
+	}
+
+	ActiveEditor()->BeginReplay();
+
+	LatencyStats inputs[static_cast<int>(TraceEvent::Type::TYPE_COUNT)];
+	LatencyStats frames;
+	// 入力を処理し始めてから次の描画が終わるまで
+	LatencyStats inputToFrame;
+	uint64_t pending = 0;
+	bool hasPending = false;
+	auto replayStart = std::chrono::steady_clock::now();
+
+	for (auto& event : events) {
+		if (FAILED(result)) {
+			break;
+		}
+
+		if (event.type == TraceEvent::Type::Resize) {
+			SafeRelease(&target);
+			SafeRelease(&bitmap);
+			result = CreateReplayTarget(wicFactory, static_cast<UINT>(event.x), static_cast<UINT>(event.y), &bitmap, &target);
+			if (FAILED(result)) {
+				break;
+			}
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		ActiveEditor()->ReplayInput(event);
+		if (event.type == TraceEvent::Type::Frame) {
+			target->BeginDraw();
+			target->SetTransform(Matrix3x2F::Identity());
+			target->Clear(ColorF(ColorF::White));
+			ActiveEditor()->Render(target);
+			result = target->EndDraw();
+		}
+		auto elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+
+		if (event.type == TraceEvent::Type::Frame) {
+			frames.Add(elapsed);
+			if (hasPending) {
+				inputToFrame.Add(pending + elapsed);
+				pending = 0;
+				hasPending = false;
+			}
+		} else {
+			inputs[static_cast<int>(event.type)].Add(elapsed);
+			pending += elapsed;
+			hasPending = true;
+		}
+	}
+
+	auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - replayStart).count();
+	for (int type = 0; type < static_cast<int>(TraceEvent::Type::TYPE_COUNT); type++) {
+		if (inputs[type].Count() > 0) {
+			printf("%s\n", inputs[type].Format(TraceEvent::NameOf(static_cast<TraceEvent::Type>(type))).c_str());
+		}
+	}
+	printf("%s\n", frames.Format("frame").c_str());
+	printf("%s\n", inputToFrame.Format("input to frame").c_str());
+	printf("%zu events in %.3f s\n", events.size(), seconds);
+	auto& shapedRuns = font->ShapedRuns();
+	printf("shaped runs: %.1f%% hit (%llu / %llu)\n", shapedRuns.HitRate() * 100,
+		static_cast<unsigned long long>(shapedRuns.Hits()), static_cast<unsigned long long>(shapedRuns.Hits() + shapedRuns.Misses()));
+
+	SafeRelease(&target);
+	SafeRelease(&bitmap);
+	SafeRelease(&wicFactory);
+
+	if (FAILED(result)) {
+		fprintf(stderr, "Unable to render: 0x%08lx\n", static_cast<unsigned long>(result));
+		return 2;
+	}
+	return 0;
+}
+
+HRESULT App::CreateReplayTarget(IWICImagingFactory* wicFactory, UINT width, UINT height, IWICBitmap** bitmap, ID2D1RenderTarget** target) {
+	// WIC のビットマップへの描画はソフトウェアで行われるので、ウィンドウへの描画より遅くなることがある
+	auto result = wicFactory->CreateBitmap(std::max(1u, width), std::max(1u, height), GUID_WICPixelFormat32bppPBGRA, WICBitmapCacheOnLoad, bitmap);
+	if (SUCCEEDED(result)) {
+		result = direct2dFactory->CreateWicBitmapRenderTarget(*bitmap, RenderTargetProperties(), target);
+	}
+	return result;
 }
 
 HRESULT App::Initialize() {
@@ -45,10 +181,36 @@ HRESULT App::Initialize() {
 
 		RegisterClassEx(&wcex);
 
+		// --replay <記録> [ファイル] の場合はウィンドウを表示せずに再生する
+		int argc = 0;
+		auto argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+		if (argv && argc >= 3 && std::wstring(argv[1]) == L"--replay") {
+			replayPath = argv[2];
+			if (argc >= 4) {
+				openPaths.push_back(argv[3]);
+			}
+		} else if (argv) {
+			// --lsp <コマンド> を指定した場合は開いたファイルごとに言語サーバーを起動する
+			int i = 1;
+			if (argc >= 3 && std::wstring(argv[1]) == L"--lsp") {
+				languageServerCommand = argv[2];
+				i = 3;
+			}
+			// 複数のファイルを指定した場合はすべて開き、Ctrl+Tab で切り替える
+			// "-" は標準入力を表す。ファイルを指定せずにパイプから起動された場合も標準入力を開く
+			for (; i < argc; i++) {
+				openPaths.push_back(argv[i]);
+			}
+			if (openPaths.empty() && IsStandardInputPipe()) {
+				openPaths.push_back(L"-");
+			}
+		}
+		LocalFree(argv);
+
 		FLOAT dpi_x, dpi_y;
 		direct2dFactory->GetDesktopDpi(&dpi_x, &dpi_y);
 
-		// EBhE쐬
+		// ウィンドウを作成
 		hwnd = CreateWindow(
 			L"App",
 			L"This is app",
@@ -64,6 +226,9 @@ HRESULT App::Initialize() {
 
 		result = hwnd ? S_OK : E_FAIL;
 		if (SUCCEEDED(result)) {
+			UpdateTitle();
+		}
+		if (SUCCEEDED(result) && replayPath.empty()) {
 			ShowWindow(hwnd, SW_SHOWNORMAL);
 			UpdateWindow(hwnd);
 		}
@@ -115,17 +280,61 @@ LRESULT CALLBACK App::WndProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lpa
 
 		SetWindowLongPtr(hwnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(app));
 
-		app->editor = std::make_unique<Editor>(hwnd, app->dwriteFactory);
+		// フォントと文字の幅はすべての文書で共有する
+		auto options = DefaultEditorOptions();
+		options.languageServerCommand = app->languageServerCommand;
+		app->font = std::make_shared<FontResources>(app->dwriteFactory, options.fontName, options.fontSize);
 		try {
-			app->editor->Initialize();
-		} catch (const EditorException& e) {
-			MessageBox(hwnd, char_to_wchar(e.what()), L"GfB^̏Ɏs܂", MB_OK | MB_ICONERROR);
+			app->font->Initialize();
+		} catch (const FontException& e) {
+			MessageBox(hwnd, char_to_wchar(e.what()), L"エディタの初期化に失敗しました", MB_OK | MB_ICONERROR);
 			exit(1);
 		}
-		app->editor->SetText(L"H");
 
-		// ^C}[ݒ
-		for (auto& timer : app->editor->timers) {
+		// コマンドライン引数で指定されたファイルを開く (指定されていない場合は空の文書を 1 つ作る)
+		auto paths = app->openPaths;
+		if (paths.empty()) {
+			paths.push_back(L"");
+		}
+
+		for (auto& path : paths) {
+			auto editor = std::make_unique<Editor>(hwnd, app->font, options);
+			editor->Initialize();
+
+			try {
+				if (!app->replayPath.empty()) {
+					// 再生する場合はジャーナルや監視を始めずに内容だけを読み込む
+					std::string bytes;
+					std::wstring text;
+					if (!path.empty() && !ReadFileBytes(path, bytes)) {
+						fprintf(stderr, "Unable to read file: %s\n", EncodeUtf8(path).c_str());
+					}
+					TextStreamDecoder decoder;
+					decoder.Decode(bytes.data(), bytes.size(), text);
+					decoder.Finish(text);
+					editor->SetText(text);
+				} else if (IsStreamPath(path)) {
+					// パイプは割り当てられないので、読み込んだ分から表示する
+					editor->OpenStream(path);
+				} else if (!path.empty()) {
+					editor->OpenFile(path);
+				} else {
+					editor->SetText(L"H");
+				}
+			} catch (const EditorException& e) {
+				MessageBox(hwnd, char_to_wchar(e.what()), L"ファイルを開けませんでした", MB_OK | MB_ICONERROR);
+			}
+
+			// 最初の文書だけを表示し、他は切り替えられるまで休止させる
+			if (!app->editors.empty()) {
+				editor->Suspend();
+			}
+			app->recentEditors.push_back(app->editors.size());
+			app->editors.push_back(std::move(editor));
+		}
+
+		// タイマーを設定
+		for (auto& timer : app->ActiveEditor()->timers) {
 			SetTimer(hwnd, timer->id, timer->elapse, nullptr);
 		}
 
@@ -146,65 +355,109 @@ LRESULT CALLBACK App::WndProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lpa
 			case WM_CHAR:
 			case WM_SYSCHAR:
 			case WM_IME_CHAR:
-				app->editor->OnChar(static_cast<wchar_t>(wparam));
+				app->ActiveEditor()->OnChar(static_cast<wchar_t>(wparam));
 				return 0;
 			case WM_KEYDOWN:
-				app->editor->OnKeyDown(static_cast<int>(wparam));
+				// Ctrl+Tab で次の文書、Ctrl+Shift+Tab で前の文書に切り替える
+				if (wparam == VK_TAB && GetKeyState(VK_CONTROL) < 0) {
+					app->SwitchEditor(GetKeyState(VK_SHIFT) < 0 ? -1 : 1);
+					return 0;
+				}
+				app->ActiveEditor()->OnKeyDown(static_cast<int>(wparam));
 				return 0;
 			case WM_KEYUP:
-				app->editor->OnKeyUp(static_cast<int>(wparam));
+				app->ActiveEditor()->OnKeyUp(static_cast<int>(wparam));
 				return 0;
 			case WM_LBUTTONDOWN:
-				app->editor->OnLButtonDown(static_cast<float>(GET_X_LPARAM(lparam)), static_cast<float>(GET_Y_LPARAM(lparam)));
+				app->ActiveEditor()->OnLButtonDown(static_cast<float>(GET_X_LPARAM(lparam)), static_cast<float>(GET_Y_LPARAM(lparam)));
 				return 0;
 			case WM_LBUTTONUP:
-				app->editor->OnLButtonUp(static_cast<float>(GET_X_LPARAM(lparam)), static_cast<float>(GET_Y_LPARAM(lparam)));
+				app->ActiveEditor()->OnLButtonUp(static_cast<float>(GET_X_LPARAM(lparam)), static_cast<float>(GET_Y_LPARAM(lparam)));
 				return 0;
 			case WM_MOUSEWHEEL:
-				app->editor->OnMouseWheel(GET_WHEEL_DELTA_WPARAM(wparam));
+				app->ActiveEditor()->OnMouseWheel(GET_WHEEL_DELTA_WPARAM(wparam));
+				return 0;
+			case WM_MOUSEHWHEEL:
+				app->ActiveEditor()->OnMouseHWheel(GET_WHEEL_DELTA_WPARAM(wparam));
 				return 0;
+			case WM_SYSKEYDOWN:
+				// Alt+Z で折り返すかどうかを切り替える
+				if (wparam == 'Z') {
+					app->ActiveEditor()->ToggleWordWrap();
+					return 0;
+				}
+				break;
 			case WM_IME_SETCONTEXT:
 				lparam &= ~ISC_SHOWUICOMPOSITIONWINDOW;
 				return 0;
 			case WM_IME_NOTIFY:
 				switch (wparam) {
 				case IMN_OPENCANDIDATE:
-					app->editor->OnOpenCandidate();
+					app->ActiveEditor()->OnOpenCandidate();
 					return 0;
 				}
 				break;
 			case WM_IME_REQUEST:
 				switch (wparam) {
 				case IMR_QUERYCHARPOSITION:
-					app->editor->OnQueryCharPosition(reinterpret_cast<IMECHARPOSITION*>(lparam));
+					app->ActiveEditor()->OnQueryCharPosition(reinterpret_cast<IMECHARPOSITION*>(lparam));
 					return 1;
 				}
 				break;
 			case WM_IME_STARTCOMPOSITION:
-				app->editor->OnIMEStartComposition();
+				app->ActiveEditor()->OnIMEStartComposition();
 				break;
 			case WM_IME_COMPOSITION:
-				app->editor->OnIMEComposition(lparam);
+				app->ActiveEditor()->OnIMEComposition(lparam);
 				break;
 			case WM_IME_ENDCOMPOSITION:
-				app->editor->OnIMEEndComposition();
+				app->ActiveEditor()->OnIMEEndComposition();
 				break;
 			case WM_SIZE:
 			{
 				UINT width = LOWORD(lparam);
 				UINT height = HIWORD(lparam);
 				app->OnResize(width, height);
-				app->editor->OnResize(width, height);
+				// 休止している文書も再開したときの描画に使うので大きさを知らせる
+				for (auto& editor : app->editors) {
+					editor->OnResize(width, height);
+				}
 			}
 				return 0;
 			case WM_TIMER:
-				// ^C}[̎s
-				for (auto& timer : app->editor->timers) {
+				// タイマーの実行
+				for (auto& timer : app->ActiveEditor()->timers) {
 					if (wparam == timer->id && timer->enabled) {
 						timer->func();
 					}
 				}
 				return 0;
+			case Editor::WM_FILE_CHANGED:
+				// 表示していない文書に届いた場合も反映する
+				for (auto& editor : app->editors) {
+					if (reinterpret_cast<LPARAM>(editor.get()) == lparam) {
+						editor->OnFileChanged();
+					}
+				}
+				return 0;
+			case Editor::WM_STREAM_RECEIVED:
+				// 表示していない文書に届いた場合も読み込みを続ける
+				for (auto& editor : app->editors) {
+					if (reinterpret_cast<LPARAM>(editor.get()) == lparam) {
+						editor->OnStreamReceived();
+					}
+				}
+				return 0;
+			case Editor::WM_LANGUAGE_SERVER_UPDATED:
+				for (auto& editor : app->editors) {
+					if (reinterpret_cast<LPARAM>(editor.get()) == lparam) {
+						editor->OnLanguageServerUpdated();
+					}
+				}
+				return 0;
+			case Editor::WM_DIFF_UPDATED:
+				// メッセージを処理した後に描画し直される
+				return 0;
 			case WM_DISPLAYCHANGE:
 				InvalidateRect(hwnd, nullptr, false);
 				return 0;
@@ -227,7 +480,7 @@ HRESULT App::OnRender() {
 		renderTarget->SetTransform(Matrix3x2F::Identity());
 		renderTarget->Clear(ColorF(ColorF::White));
 
-		editor->Render(renderTarget);
+		ActiveEditor()->Render(renderTarget);
 
 		result = renderTarget->EndDraw();
 		if (result == D2DERR_RECREATE_TARGET) {
@@ -243,4 +496,41 @@ void App::OnResize(UINT width, UINT height) {
 	if (renderTarget) {
 		renderTarget->Resize(SizeU(width, height));
 	}
+}
+
+Editor* App::ActiveEditor() {
+	return editors[activeEditor].get();
+}
+
+void App::SwitchEditor(int step) {
+	if (editors.size() < 2) {
+		return;
+	}
+
+	auto next = step > 0 ? (activeEditor + 1) % editors.size() : (activeEditor + editors.size() - 1) % editors.size();
+
+	// 休止している文書を読み直せない場合は、今の文書を表示したままにする
+	try {
+		editors[next]->Resume();
+	} catch (const EditorException& e) {
+		MessageBox(hwnd, char_to_wchar(e.what()), L"文書を再開できませんでした", MB_OK | MB_ICONERROR);
+		return;
+	}
+	activeEditor = next;
+
+	// 最近表示した文書以外は、保存されていればファイルから読み直せるので文字と配置を解放する
+	recentEditors.erase(std::find(recentEditors.begin(), recentEditors.end(), next));
+	recentEditors.insert(recentEditors.begin(), next);
+	for (auto i = RESIDENT_EDITORS; i < recentEditors.size(); i++) {
+		editors[recentEditors[i]]->Suspend();
+	}
+
+	UpdateTitle();
+	InvalidateRect(hwnd, nullptr, false);
+}
+
+void App::UpdateTitle() {
+	auto& path = ActiveEditor()->FilePath();
+	auto name = path.empty() ? std::wstring(L"無題") : path.substr(path.find_last_of(L"\\/") + 1);
+	SetWindowText(hwnd, rswprintf(L"%s (%zu/%zu)", name.c_str(), activeEditor + 1, editors.size()).c_str());
 }
\ No newline at end of file
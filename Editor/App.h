@@ -24,18 +24,42 @@ private:
 	ID2D1HwndRenderTarget* renderTarget;
 	IDWriteFactory* dwriteFactory;
 	ID2D1SolidColorBrush* blackBrush;
-	std::unique_ptr<Editor> editor;
+	// すべての文書で共有するフォントと文字の幅
+	std::shared_ptr<FontResources> font;
+	// 切り替えても休止させずに残す文書の数 (表示している文書を含む)
+	// 交互に切り替える文書をそのたびにファイルから読み直して索引を作り直さないようにする
+	static constexpr std::size_t RESIDENT_EDITORS = 3;
+
+	// 開いている文書。最近表示した RESIDENT_EDITORS 個以外の文書は休止させてメモリを解放する
+	std::vector<std::unique_ptr<Editor>> editors;
+	std::size_t activeEditor;
+	// 最近表示した順の文書の番号 (先頭が表示している文書)
+	std::vector<std::size_t> recentEditors;
+	// コマンドラインで指定されたファイルと、再生する入力の記録 (--replay <記録> <ファイル>)
+	std::vector<std::wstring> openPaths;
+	std::wstring replayPath;
+	// 開いたファイルごとに起動する言語サーバーのコマンド (--lsp <コマンド>)
+	std::wstring languageServerCommand;
 
 	HRESULT CreateDeviceIndependentResources();
 	HRESULT CreateDeviceResources();
 	void DiscardDeviceResources();
 	HRESULT OnRender();
 	void OnResize(UINT width, UINT height);
+	Editor* ActiveEditor();
+	// step が正の場合は次の文書、負の場合は前の文書に切り替える
+	void SwitchEditor(int step);
+	// 表示している文書の名前と番号をタイトルに表示する
+	void UpdateTitle();
+	// ウィンドウを表示せずにビットマップに描画しながら入力を再生し、処理時間の分布を出力する
+	int RunReplay();
+	HRESULT CreateReplayTarget(IWICImagingFactory* wicFactory, UINT width, UINT height, IWICBitmap** bitmap, ID2D1RenderTarget** target);
 	static LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam);
 public:
 	App();
 	~App();
 
 	HRESULT Initialize();
-	void RunMessageLoop();
+	// 終了コードを返す
+	int RunMessageLoop();
 };
\ No newline at end of file
@@ -0,0 +1,51 @@
+﻿#include "Arena.h"
+
+FrameArena::FrameArena(std::size_t initialSize) :
+	used(0),
+	initialSize(initialSize) {
+}
+
+void FrameArena::AddBlock(std::size_t size) {
+	blocks.push_back(Block{ std::unique_ptr<char[]>(new char[size]), size });
+	used = 0;
+}
+
+void* FrameArena::Allocate(std::size_t size, std::size_t alignment) {
+	if (!blocks.empty()) {
+		auto& block = blocks.back();
+		auto address = reinterpret_cast<uintptr_t>(block.data.get()) + used;
+		auto padding = (alignment - address % alignment) % alignment;
+		if (used + padding + size <= block.size) {
+			used += padding + size;
+			return block.data.get() + used - size;
+		}
+	}
+
+	// 足りない場合は前のブロックの 2 倍以上のブロックを追加する
+	auto blockSize = blocks.empty() ? initialSize : blocks.back().size * 2;
+	while (blockSize < size + alignment) {
+		blockSize *= 2;
+	}
+	AddBlock(blockSize);
+
+	return Allocate(size, alignment);
+}
+
+void FrameArena::Reset() {
+	// 複数のブロックを使った場合は次のフレームで 1 つに収まるようにまとめる
+	if (blocks.size() > 1) {
+		auto total = MemoryUsage();
+		blocks.clear();
+		AddBlock(total);
+	}
+
+	used = 0;
+}
+
+std::size_t FrameArena::MemoryUsage() const {
+	std::size_t bytes = 0;
+	for (auto& block : blocks) {
+		bytes += block.size;
+	}
+	return bytes;
+}
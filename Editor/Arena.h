@@ -0,0 +1,127 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// 1 フレームの間だけ使う一時的なデータのための領域
+//
+// 先頭から詰めて確保するだけで個別には解放せず、Reset でまとめて解放する。
+// 足りなくなったらブロックを追加し、Reset のときに 1 つの大きなブロックにまとめ直すので、
+// 毎フレーム同じくらいの量を使う場合は 2 フレーム目以降はヒープから確保しない。
+class FrameArena {
+private:
+	struct Block {
+		std::unique_ptr<char[]> data;
+		std::size_t size;
+	};
+
+	std::vector<Block> blocks;
+	// 最後のブロックで使った大きさ
+	std::size_t used;
+	std::size_t initialSize;
+
+	void AddBlock(std::size_t size);
+public:
+	explicit FrameArena(std::size_t initialSize = 64 * 1024);
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	void* Allocate(std::size_t size, std::size_t alignment);
+	// 確保したものをすべて解放する
+	void Reset();
+	// 確保しているメモリの大きさ (バイト)
+	std::size_t MemoryUsage() const;
+};
+
+// FrameArena から確保する STL のアロケータ
+template <typename T>
+class ArenaAllocator {
+public:
+	using value_type = T;
+
+	FrameArena* arena;
+
+	explicit ArenaAllocator(FrameArena* arena) : arena(arena) {}
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+	T* allocate(std::size_t count) {
+		return static_cast<T*>(arena->Allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T*, std::size_t) {
+		// Reset でまとめて解放する
+	}
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& left, const ArenaAllocator<U>& right) {
+	return left.arena == right.arena;
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& left, const ArenaAllocator<U>& right) {
+	return left.arena != right.arena;
+}
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// 同じ型のノードを使い回すプール
+//
+// blockNodes 個ずつまとめて確保し、解放されたノードは次に確保するときに使う。
+// 確保したブロックはプールを破棄するまで解放しない。
+template <typename T>
+class NodePool {
+private:
+	union Slot {
+		Slot* next;
+		alignas(T) unsigned char storage[sizeof(T)];
+	};
+
+	std::vector<std::unique_ptr<Slot[]>> blocks;
+	Slot* freeList;
+	std::size_t blockNodes;
+public:
+	explicit NodePool(std::size_t blockNodes = 256) :
+		freeList(nullptr),
+		blockNodes(blockNodes) {
+	}
+
+	NodePool(const NodePool&) = delete;
+	NodePool& operator=(const NodePool&) = delete;
+
+	template <typename... Args>
+	T* New(Args&&... args) {
+		if (!freeList) {
+			// 新しいブロックのノードをすべて空きにする
+			std::unique_ptr<Slot[]> block(new Slot[blockNodes]);
+			for (std::size_t i = 0; i < blockNodes; i++) {
+				block[i].next = freeList;
+				freeList = &block[i];
+			}
+			blocks.push_back(std::move(block));
+		}
+
+		auto slot = freeList;
+		freeList = slot->next;
+		return new (slot->storage) T{ std::forward<Args>(args)... };
+	}
+
+	void Delete(T* node) {
+		node->~T();
+		auto slot = reinterpret_cast<Slot*>(node);
+		slot->next = freeList;
+		freeList = slot;
+	}
+
+	// 確保しているメモリの大きさ (バイト)
+	std::size_t MemoryUsage() const {
+		return blocks.size() * blockNodes * sizeof(Slot);
+	}
+};
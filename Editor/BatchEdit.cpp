@@ -0,0 +1,450 @@
+﻿#include "BatchEdit.h"
+#include "Encoding.h"
+#include "Platform.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cwchar>
+
+namespace {
+	// 読み込みと書き出しをまとめて行う単位
+	constexpr std::size_t READ_CHUNK_BYTES = 1 << 20;
+	constexpr std::size_t WRITE_CHUNK_BYTES = 1 << 20;
+	constexpr std::size_t ENCODE_CHUNK_CHARS = 64 * 1024;
+
+	bool IsHighSurrogate(wchar_t ch) {
+		return ch >= 0xD800 && ch <= 0xDBFF;
+	}
+
+	// line 行目 (1 から数える) の先頭。行数より大きい場合は文書の長さ
+	std::size_t LineStartOf(const PieceTable& table, std::size_t line) {
+		if (line <= 1) {
+			return 0;
+		}
+
+		auto remaining = line - 1;
+		std::size_t offset = 0;
+		auto start = table.Length();
+		bool found = false;
+		table.ForEachPiece([&](const wchar_t* text, std::size_t length) {
+			if (found) {
+				return;
+			}
+
+			auto end = text + length;
+			for (auto p = std::wmemchr(text, '\n', length); p; p = std::wmemchr(p + 1, '\n', end - p - 1)) {
+				if (--remaining == 0) {
+					start = offset + (p - text) + 1;
+					found = true;
+					return;
+				}
+			}
+			offset += length;
+		});
+
+		return start;
+	}
+
+	// 最初の行の改行が \r\n であれば \r\n、それ以外は \n
+	std::wstring LineEndingOf(const PieceTable& table) {
+		auto next = LineStartOf(table, 2);
+		if (next >= 2 && next <= table.Length() && table.CharAt(next - 1) == '\n' && table.CharAt(next - 2) == '\r') {
+			return L"\r\n";
+		}
+		return L"\n";
+	}
+
+	bool EndsWithNewline(const PieceTable& table) {
+		auto length = table.Length();
+		return length > 0 && table.CharAt(length - 1) == '\n';
+	}
+
+	std::string LineError(std::size_t lineNumber, const std::string& message) {
+		return "line " + std::to_string(lineNumber) + ": " + message;
+	}
+
+	// スクリプトの 1 行を単語と "" で囲んだ文字列に分ける
+	std::vector<std::wstring> Tokenize(const std::wstring& line, std::size_t lineNumber) {
+		std::vector<std::wstring> tokens;
+		std::size_t i = 0;
+		while (i < line.size()) {
+			auto ch = line[i];
+			if (ch == ' ' || ch == '\t' || ch == '\r') {
+				i++;
+				continue;
+			}
+			if (ch == '#') {
+				break;
+			}
+
+			std::wstring token;
+			if (ch != '"') {
+				while (i < line.size() && line[i] != ' ' && line[i] != '\t' && line[i] != '\r') {
+					token.push_back(line[i++]);
+				}
+				tokens.push_back(std::move(token));
+				continue;
+			}
+
+			i++;
+			bool closed = false;
+			while (i < line.size()) {
+				ch = line[i++];
+				if (ch == '"') {
+					closed = true;
+					break;
+				}
+				if (ch != '\\') {
+					token.push_back(ch);
+					continue;
+				}
+
+				if (i >= line.size()) {
+					break;
+				}
+				switch (line[i++]) {
+				case 'n': token.push_back('\n'); break;
+				case 'r': token.push_back('\r'); break;
+				case 't': token.push_back('\t'); break;
+				case '\\': token.push_back('\\'); break;
+				case '"': token.push_back('"'); break;
+				default:
+					throw BatchException(LineError(lineNumber, "unknown escape sequence"));
+				}
+			}
+			if (!closed) {
+				throw BatchException(LineError(lineNumber, "unterminated string"));
+			}
+			tokens.push_back(std::move(token));
+		}
+
+		return tokens;
+	}
+
+	std::size_t ParseNumber(const std::wstring& token, bool allowLast, std::size_t lineNumber) {
+		if (allowLast && token == L"$") {
+			return BatchOperation::LAST_LINE;
+		}
+		if (token.empty() || token.size() > 18 || token.find_first_not_of(L"0123456789") != std::wstring::npos) {
+			throw BatchException(LineError(lineNumber, "invalid number: " + EncodeUtf8(token)));
+		}
+
+		auto value = static_cast<std::size_t>(std::stoull(token));
+		if (value == 0) {
+			throw BatchException(LineError(lineNumber, "line numbers start at 1"));
+		}
+		return value;
+	}
+}
+
+void FindAll(const PieceTable& table, const std::wstring& pattern, std::vector<std::size_t>& out) {
+	auto patternLength = pattern.size();
+	if (patternLength == 0) {
+		return;
+	}
+
+	// KMP の失敗関数。ピースの境界をまたぐ一致も状態を引き継いで見つける
+	std::vector<std::size_t> failure(patternLength, 0);
+	for (std::size_t i = 1, k = 0; i < patternLength; i++) {
+		while (k > 0 && pattern[i] != pattern[k]) {
+			k = failure[k - 1];
+		}
+		if (pattern[i] == pattern[k]) {
+			k++;
+		}
+		failure[i] = k;
+	}
+
+	std::size_t state = 0;
+	std::size_t offset = 0;
+	table.ForEachPiece([&](const wchar_t* text, std::size_t length) {
+		std::size_t i = 0;
+		while (i < length) {
+			if (state == 0) {
+				// 一致していない間は最初の文字を探して読み飛ばす
+				auto found = std::wmemchr(text + i, pattern[0], length - i);
+				if (!found) {
+					break;
+				}
+				i = found - text + 1;
+				state = 1;
+			} else {
+				auto ch = text[i++];
+				while (state > 0 && ch != pattern[state]) {
+					state = failure[state - 1];
+				}
+				if (ch == pattern[state]) {
+					state++;
+				}
+			}
+
+			if (state == patternLength) {
+				out.push_back(offset + i - patternLength);
+				state = 0;
+			}
+		}
+		offset += length;
+	});
+}
+
+BatchScript BatchScript::Parse(const std::wstring& source) {
+	BatchScript script;
+	std::size_t lineNumber = 0;
+	for (std::size_t pos = 0; pos <= source.size(); ) {
+		auto end = source.find('\n', pos);
+		if (end == std::wstring::npos) {
+			end = source.size();
+		}
+		auto tokens = Tokenize(source.substr(pos, end - pos), ++lineNumber);
+		pos = end + 1;
+		if (tokens.empty()) {
+			continue;
+		}
+
+		auto& command = tokens[0];
+		BatchOperation operation = {};
+		if (command == L"replace" && tokens.size() == 3) {
+			if (tokens[1].empty()) {
+				throw BatchException(LineError(lineNumber, "empty search string"));
+			}
+			operation.type = BatchOperation::Type::Replace;
+			operation.text = tokens[1];
+			operation.replacement = tokens[2];
+		} else if (command == L"insert" && tokens.size() == 3) {
+			operation.type = BatchOperation::Type::Insert;
+			operation.first = ParseNumber(tokens[1], true, lineNumber);
+			operation.text = tokens[2];
+		} else if (command == L"delete-lines" && tokens.size() == 3) {
+			operation.type = BatchOperation::Type::DeleteLines;
+			operation.first = ParseNumber(tokens[1], false, lineNumber);
+			operation.last = ParseNumber(tokens[2], true, lineNumber);
+			if (operation.first > operation.last) {
+				throw BatchException(LineError(lineNumber, "first line is after last line"));
+			}
+		} else if (command == L"macro" && (tokens.size() == 2 || tokens.size() == 3)) {
+			operation.type = BatchOperation::Type::Macro;
+			operation.text = tokens[1];
+			operation.count = 1;
+			if (tokens.size() == 3) {
+				operation.count = tokens[2] == L"*" ? 0 : ParseNumber(tokens[2], false, lineNumber);
+			}
+			try {
+				operation.events = LoadMacro(operation.text);
+			} catch (const MacroException& e) {
+				throw BatchException(LineError(lineNumber, e.what()));
+			}
+		} else {
+			throw BatchException(LineError(lineNumber, "invalid command: " + EncodeUtf8(command)));
+		}
+
+		script.operations.push_back(std::move(operation));
+	}
+
+	return script;
+}
+
+BatchScript BatchScript::Load(const std::wstring& path) {
+	std::string data;
+	if (!ReadFileBytes(path, data)) {
+		throw BatchException("Unable to read script: " + EncodeUtf8(path));
+	}
+
+	return Parse(DecodeUtf8(data));
+}
+
+const std::vector<BatchOperation>& BatchScript::Operations() const {
+	return operations;
+}
+
+void BatchScript::Replace(PieceTable& table, const BatchOperation& operation, BatchResult& result) const {
+	std::vector<std::size_t> positions;
+	FindAll(table, operation.text, positions);
+	if (positions.empty()) {
+		return;
+	}
+
+	table.ReplaceAll(positions, operation.text.size(), operation.replacement.data(), operation.replacement.size());
+	result.replacements += positions.size();
+	result.edits++;
+}
+
+void BatchScript::Insert(PieceTable& table, const BatchOperation& operation, BatchResult& result) const {
+	auto length = table.Length();
+	auto pos = operation.first == BatchOperation::LAST_LINE ? length : LineStartOf(table, operation.first);
+	auto lineEnding = LineEndingOf(table);
+
+	// 改行で終わっていない文書の末尾に追加する場合は、前の行を閉じてから追加する
+	auto text = pos == length && length > 0 && !EndsWithNewline(table) ? lineEnding + operation.text : operation.text + lineEnding;
+	table.Insert(pos, text.data(), text.size());
+	result.edits++;
+}
+
+void BatchScript::DeleteLines(PieceTable& table, const BatchOperation& operation, BatchResult& result) const {
+	auto length = table.Length();
+	auto start = LineStartOf(table, operation.first);
+	auto end = operation.last == BatchOperation::LAST_LINE ? length : LineStartOf(table, operation.last + 1);
+	if (start >= end) {
+		return;
+	}
+
+	// 改行で終わっていない最後の行を消す場合は、前の行の改行も消して末尾に改行が残らないようにする
+	if (end == length && start > 0 && !EndsWithNewline(table)) {
+		start--;
+		if (start > 0 && table.CharAt(start - 1) == '\r') {
+			start--;
+		}
+	}
+
+	table.Erase(start, end - start);
+	result.edits++;
+}
+
+void BatchScript::PlayMacro(PieceTable& table, const BatchOperation& operation, BatchResult& result) const {
+	std::size_t caret = 0;
+	for (std::size_t i = 0; operation.count == 0 || i < operation.count; i++) {
+		auto remaining = table.Length() - caret;
+		::PlayMacro(table, operation.events, caret);
+
+		// 回数を指定していない場合は、キャレットから文書の末尾までが縮まなくなったら終わる
+		if (operation.count == 0 && (caret >= table.Length() || table.Length() - caret >= remaining)) {
+			break;
+		}
+	}
+	result.edits++;
+}
+
+void BatchScript::Apply(PieceTable& table, BatchResult& result) const {
+	for (auto& operation : operations) {
+		switch (operation.type) {
+		case BatchOperation::Type::Replace:
+			Replace(table, operation, result);
+			break;
+		case BatchOperation::Type::Insert:
+			Insert(table, operation, result);
+			break;
+		case BatchOperation::Type::DeleteLines:
+			DeleteLines(table, operation, result);
+			break;
+		case BatchOperation::Type::Macro:
+			PlayMacro(table, operation, result);
+			break;
+		}
+	}
+}
+
+BatchResult BatchScript::ProcessFile(const std::wstring& input, const std::wstring& output) const {
+	BatchResult result = {};
+
+	// 改行は変換しない。BOM は 1 行目の一部として扱わないように外しておき、書き出すときに戻す
+	std::wstring text;
+	bool bom = false;
+	{
+		auto fp = OpenFileStream(input, L"rb");
+		if (!fp) {
+			throw BatchException("Unable to open file");
+		}
+
+		// UTF-8 のバイト数は文字数以上なので、ファイルの大きさだけ確保しておけば途中で確保し直さない
+		if (SeekFileStream(fp, 0, SEEK_END)) {
+			text.reserve(static_cast<std::size_t>(TellFileStream(fp)));
+			SeekFileStream(fp, 0, SEEK_SET);
+		}
+
+		Utf8Decoder decoder;
+		std::vector<char> buffer(READ_CHUNK_BYTES);
+		std::size_t read;
+		while ((read = fread(buffer.data(), 1, buffer.size(), fp)) > 0) {
+			if (result.inputBytes == 0) {
+				bom = read >= 3 && memcmp(buffer.data(), UTF8_BOM, 3) == 0;
+			}
+			result.inputBytes += read;
+			decoder.Decode(buffer.data(), read, text);
+		}
+		bool failed = ferror(fp) != 0;
+		fclose(fp);
+		decoder.Finish(text);
+
+		if (failed) {
+			throw BatchException("Unable to read file");
+		}
+		// 置換文字に置き換えたまま書き出すと元の内容が失われる
+		if (decoder.InvalidCount() > 0) {
+			throw BatchException("File is not valid UTF-8");
+		}
+	}
+
+	PieceTable table(std::move(text));
+	Apply(table, result);
+
+	if (result.edits == 0 && input == output) {
+		result.outputBytes = result.inputBytes;
+		return result;
+	}
+
+	// 文書全体を UTF-8 にしたものは作らず、少しずつ変換して書き出す
+	auto tmpPath = output + L".tmp";
+	auto fp = OpenFileStream(tmpPath, L"wb");
+	if (!fp) {
+		throw BatchException("Unable to create output file");
+	}
+
+	std::string buffer;
+	buffer.reserve(WRITE_CHUNK_BYTES + ENCODE_CHUNK_CHARS * 4);
+	if (bom) {
+		buffer.append(UTF8_BOM, 3);
+	}
+	bool ok = true;
+	auto flush = [&]() {
+		ok = ok && fwrite(buffer.data(), 1, buffer.size(), fp) == buffer.size();
+		result.outputBytes += buffer.size();
+		buffer.clear();
+	};
+
+	// ピースの境界で分かれたサロゲートペアは次のピースと合わせて変換する
+	wchar_t pendingHigh = 0;
+	table.ForEachPiece([&](const wchar_t* text, std::size_t length) {
+		if (pendingHigh && length > 0) {
+			wchar_t pair[] = { pendingHigh, text[0] };
+			auto paired = text[0] >= 0xDC00 && text[0] <= 0xDFFF;
+			EncodeUtf8(pair, paired ? 2 : 1, buffer);
+			if (paired) {
+				text++;
+				length--;
+			}
+			pendingHigh = 0;
+		}
+
+		while (length > 0) {
+			auto count = std::min(length, ENCODE_CHUNK_CHARS);
+			if (count == length && IsHighSurrogate(text[count - 1])) {
+				pendingHigh = text[--count];
+			} else if (count < length && IsHighSurrogate(text[count - 1])) {
+				count++;
+			}
+
+			EncodeUtf8(text, count, buffer);
+			text += count;
+			length -= count + (pendingHigh ? 1 : 0);
+			if (buffer.size() >= WRITE_CHUNK_BYTES) {
+				flush();
+			}
+		}
+	});
+	if (pendingHigh) {
+		EncodeUtf8(&pendingHigh, 1, buffer);
+	}
+	flush();
+
+	// 元のファイルを置き換える場合は、書き込みが完了してから置き換える
+	if (input == output) {
+		ok = SyncFileStream(fp) && ok;
+	}
+	fclose(fp);
+
+	if (!ok || !MoveFileReplacing(tmpPath, output)) {
+		RemoveFileIfExists(tmpPath);
+		throw BatchException("Unable to write output file");
+	}
+
+	return result;
+}
@@ -0,0 +1,78 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <exception>
+
+#include "PieceTable.h"
+#include "Macro.h"
+
+// スクリプトの 1 行分の操作。行番号は 1 から数える
+struct BatchOperation {
+	enum class Type {
+		Replace, // replace "検索する文字列" "置き換える文字列"
+		Insert, // insert <行番号|$> "文字列" (その行の前に 1 行挿入する。$ は末尾)
+		DeleteLines, // delete-lines <最初の行> <最後の行|$>
+		Macro, // macro "ファイル" [回数|*] (* は文書の末尾に向かって進まなくなるまで繰り返す)
+	};
+
+	// 行番号の $ (最後の行)
+	static constexpr std::size_t LAST_LINE = SIZE_MAX;
+
+	Type type;
+	std::wstring text;
+	std::wstring replacement;
+	std::size_t first;
+	std::size_t last;
+	// 0 の場合は進まなくなるまで繰り返す
+	std::size_t count;
+	std::vector<MacroEvent> events;
+};
+
+// 1 つのファイルを処理した結果
+struct BatchResult {
+	uint64_t inputBytes;
+	uint64_t outputBytes;
+	std::size_t replacements;
+	// 文書を変更した操作の数 (0 の場合はファイルを書き換えない)
+	std::size_t edits;
+};
+
+// 画面を使わずにファイルを一括で編集するスクリプト
+//
+// ファイルは PieceTable に読み込み、操作を順に適用してから書き出す。エディタの文字の配列や索引 (折りたたみ、
+// マーカー、括弧など) は使わないので、マクロもエディタでの再生ではなく PlayMacro の規則で PieceTable に適用する。
+// 改行と BOM は読み込んだときのまま残すので、変更していない部分はバイト単位で元のファイルと同じになる。
+// 解析した後は状態を変更しないので、1 つのスクリプトを複数のスレッドから同時に使える。
+class BatchScript {
+private:
+	std::vector<BatchOperation> operations;
+
+	void Replace(PieceTable& table, const BatchOperation& operation, BatchResult& result) const;
+	void Insert(PieceTable& table, const BatchOperation& operation, BatchResult& result) const;
+	void DeleteLines(PieceTable& table, const BatchOperation& operation, BatchResult& result) const;
+	void PlayMacro(PieceTable& table, const BatchOperation& operation, BatchResult& result) const;
+public:
+	// 1 行に 1 つの操作を書く。# から行末まではコメント
+	// 文字列は "" で囲み、\n \r \t \\ \" を使える
+	static BatchScript Parse(const std::wstring& source);
+	static BatchScript Load(const std::wstring& path);
+
+	const std::vector<BatchOperation>& Operations() const;
+	void Apply(PieceTable& table, BatchResult& result) const;
+	// input を読み込んで編集し、output に書き出す (input と同じ場合は置き換える)
+	BatchResult ProcessFile(const std::wstring& input, const std::wstring& output) const;
+};
+
+// table の中で pattern が現れる位置 (重ならないもの) を先頭から順に out に追加する
+void FindAll(const PieceTable& table, const std::wstring& pattern, std::vector<std::size_t>& out);
+
+class BatchException : public std::exception {
+private:
+	std::string message;
+public:
+	BatchException(const std::string& message) : message(message) {}
+	const char* what() const noexcept { return message.c_str(); }
+};
@@ -0,0 +1,119 @@
+﻿// 画面を使わずにスクリプトでファイルを一括編集するコマンド
+//
+//   editor-batch [-j スレッド数] [-o 出力先ディレクトリ] <スクリプト> <ファイル>...
+//
+// ファイルごとに 1 つのスレッドで処理する。-o を指定しない場合は元のファイルを置き換える。
+// エディタ本体とは別に、Direct2D や Win32 を使わないファイルだけでビルドする。
+//   g++ -std=c++14 -O2 -pthread BatchMain.cpp BatchEdit.cpp Macro.cpp PieceTable.cpp Encoding.cpp Platform.cpp Arena.cpp -o editor-batch
+//   cl /std:c++14 /O2 /EHsc BatchMain.cpp BatchEdit.cpp Macro.cpp PieceTable.cpp Encoding.cpp Platform.cpp Arena.cpp /Fe:editor-batch.exe
+#include "BatchEdit.h"
+#include "Encoding.h"
+
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+namespace {
+	void PrintUsage() {
+		fprintf(stderr, "usage: editor-batch [-j threads] [-o output-directory] <script> <files...>\n");
+	}
+
+	std::wstring FileNameOf(const std::wstring& path) {
+		auto pos = path.find_last_of(L"/\\");
+		return pos == std::wstring::npos ? path : path.substr(pos + 1);
+	}
+
+	int Run(const std::vector<std::wstring>& args) {
+		unsigned int threadCount = std::thread::hardware_concurrency();
+		std::wstring outputDirectory;
+		std::size_t i = 0;
+		for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; i++) {
+			if (args[i] == L"-j" && i + 1 < args.size()) {
+				threadCount = static_cast<unsigned int>(std::wcstoul(args[++i].c_str(), nullptr, 10));
+			} else if (args[i] == L"-o" && i + 1 < args.size()) {
+				outputDirectory = args[++i];
+			} else {
+				PrintUsage();
+				return 2;
+			}
+		}
+		if (args.size() - i < 2) {
+			PrintUsage();
+			return 2;
+		}
+
+		BatchScript script;
+		try {
+			script = BatchScript::Load(args[i]);
+		} catch (const BatchException& e) {
+			fprintf(stderr, "%s: %s\n", EncodeUtf8(args[i]).c_str(), e.what());
+			return 2;
+		}
+
+		std::vector<std::wstring> files(args.begin() + i + 1, args.end());
+		threadCount = std::max(1u, std::min(threadCount, static_cast<unsigned int>(files.size())));
+
+		// 空いたスレッドから順に次のファイルを取る
+		std::atomic<std::size_t> next(0);
+		std::atomic<bool> failed(false);
+		std::atomic<uint64_t> totalBytes(0);
+		std::mutex outputMutex;
+		auto startTime = std::chrono::steady_clock::now();
+
+		auto worker = [&]() {
+			for (std::size_t index; (index = next++) < files.size(); ) {
+				auto& input = files[index];
+				auto output = outputDirectory.empty() ? input : outputDirectory + L"/" + FileNameOf(input);
+				auto path = EncodeUtf8(input);
+
+				try {
+					auto fileStart = std::chrono::steady_clock::now();
+					auto result = script.ProcessFile(input, output);
+					auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - fileStart).count();
+					totalBytes += result.inputBytes;
+
+					std::lock_guard<std::mutex> lock(outputMutex);
+					printf("%s: %zu replacements, %llu -> %llu bytes, %.1f MB/s\n", path.c_str(), result.replacements,
+						static_cast<unsigned long long>(result.inputBytes), static_cast<unsigned long long>(result.outputBytes),
+						seconds > 0 ? result.inputBytes / seconds / 1e6 : 0.0);
+				} catch (const std::exception& e) {
+					failed = true;
+					std::lock_guard<std::mutex> lock(outputMutex);
+					fprintf(stderr, "%s: %s\n", path.c_str(), e.what());
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (unsigned int t = 1; t < threadCount; t++) {
+			threads.emplace_back(worker);
+		}
+		worker();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+
+		auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		printf("%zu files, %llu bytes in %.3f s (%.1f MB/s, %u threads)\n", files.size(),
+			static_cast<unsigned long long>(totalBytes.load()), seconds, seconds > 0 ? totalBytes / seconds / 1e6 : 0.0, threadCount);
+
+		return failed ? 1 : 0;
+	}
+}
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t* argv[]) {
+	return Run(std::vector<std::wstring>(argv + 1, argv + argc));
+}
+#else
+int main(int argc, char* argv[]) {
+	std::vector<std::wstring> args;
+	for (int i = 1; i < argc; i++) {
+		args.push_back(DecodeUtf8(argv[i]));
+	}
+	return Run(args);
+}
+#endif
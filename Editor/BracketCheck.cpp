@@ -0,0 +1,212 @@
+﻿// BracketIndex の結果を総当たりで求めた結果と比べるコマンド
+//
+//   editor-bracket-check [-n 回数] [-c チャンクの長さ] [-l 文書の最大の長さ] [-s シード]
+//
+// 括弧を多く含む文字列をランダムに挿入・削除し、そのたびに DepthAt、FindMatch、FindEnclosing を
+// 文字列を先頭から数え直した結果と比べる。チャンクの分割とまとめ直しが起きるように、チャンクは既定で 16 文字にする。
+// チャンクより長い挿入も混ぜる。一致しなかった場合はその操作と位置を表示して 1 を返す。
+// エディタ本体とは別に、Direct2D や Win32 を使わないファイルだけでビルドする。
+//   g++ -std=c++14 -O2 BracketCheck.cpp BracketIndex.cpp MemoryUsage.cpp -o editor-bracket-check
+//   cl /std:c++14 /O2 /EHsc BracketCheck.cpp BracketIndex.cpp MemoryUsage.cpp /Fe:editor-bracket-check.exe
+#include "BracketIndex.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+	void PrintUsage() {
+		fprintf(stderr, "usage: editor-bracket-check [-n steps] [-c chunk-size] [-l max-length] [-s seed]\n");
+	}
+
+	const wchar_t CHARACTERS[] = L"()[]{}(){}ab \n";
+
+	int KindOf(wchar_t ch) {
+		switch (ch) {
+		case '(': case ')': return 1;
+		case '[': case ']': return 2;
+		case '{': case '}': return 3;
+		default: return 0;
+		}
+	}
+
+	bool IsOpen(wchar_t ch) {
+		return ch == '(' || ch == '[' || ch == '{';
+	}
+
+	// 文字列を先頭から数えて BracketIndex と同じ規則で答える
+	class BruteForce {
+	private:
+		const std::wstring& text;
+		// depths[i] は i 文字目の直前の深さ
+		std::vector<int64_t> depths;
+	public:
+		explicit BruteForce(const std::wstring& text) : text(text), depths(text.size() + 1, 0) {
+			for (std::size_t i = 0; i < text.size(); i++) {
+				depths[i + 1] = depths[i] + (KindOf(text[i]) ? (IsOpen(text[i]) ? 1 : -1) : 0);
+			}
+		}
+
+		int64_t DepthAt(std::size_t pos) const {
+			return depths[std::min(pos, text.size())];
+		}
+
+		// from 以降で直後の深さが target より小さくなる最初の括弧
+		bool Forward(std::size_t from, int64_t target, std::size_t* result) const {
+			for (auto i = from; i < text.size(); i++) {
+				if (KindOf(text[i]) && depths[i + 1] < target) {
+					*result = i;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// end より前で直前の深さが target より小さい最後の括弧
+		bool Backward(std::size_t end, int64_t target, std::size_t* result) const {
+			for (auto i = std::min(end, text.size()); i > 0; i--) {
+				if (KindOf(text[i - 1]) && depths[i - 1] < target) {
+					*result = i - 1;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool FindMatch(std::size_t pos, std::size_t* match) const {
+			if (pos >= text.size() || !KindOf(text[pos])) {
+				return false;
+			}
+			auto depth = depths[pos];
+			std::size_t other;
+			if (IsOpen(text[pos]) ? !Forward(pos + 1, depth + 1, &other) : !Backward(pos, depth, &other)) {
+				return false;
+			}
+			if (KindOf(text[other]) != KindOf(text[pos])) {
+				return false;
+			}
+			*match = other;
+			return true;
+		}
+
+		bool FindEnclosing(std::size_t pos, std::size_t* open, std::size_t* close) const {
+			auto depth = DepthAt(pos);
+			if (!Backward(pos, depth, open) || !Forward(pos, depth, close)) {
+				return false;
+			}
+			return KindOf(text[*open]) == KindOf(text[*close]);
+		}
+	};
+
+	// pos について索引と総当たりの結果を比べる
+	bool CheckPosition(const BracketIndex& index, const BruteForce& brute, std::size_t pos, std::size_t step) {
+		if (index.DepthAt(pos) != brute.DepthAt(pos)) {
+			fprintf(stderr, "step %zu: DepthAt(%zu) = %lld, expected %lld\n", step, pos,
+				static_cast<long long>(index.DepthAt(pos)), static_cast<long long>(brute.DepthAt(pos)));
+			return false;
+		}
+
+		std::size_t match = 0, expectedMatch = 0;
+		bool found = index.FindMatch(pos, &match);
+		bool expectedFound = brute.FindMatch(pos, &expectedMatch);
+		if (found != expectedFound || (found && match != expectedMatch)) {
+			fprintf(stderr, "step %zu: FindMatch(%zu) = %d:%zu, expected %d:%zu\n", step, pos, found, match, expectedFound, expectedMatch);
+			return false;
+		}
+
+		std::size_t open = 0, close = 0, expectedOpen = 0, expectedClose = 0;
+		found = index.FindEnclosing(pos, &open, &close);
+		expectedFound = brute.FindEnclosing(pos, &expectedOpen, &expectedClose);
+		if (found != expectedFound || (found && (open != expectedOpen || close != expectedClose))) {
+			fprintf(stderr, "step %zu: FindEnclosing(%zu) = %d:%zu-%zu, expected %d:%zu-%zu\n", step, pos,
+				found, open, close, expectedFound, expectedOpen, expectedClose);
+			return false;
+		}
+
+		return true;
+	}
+
+	int Run(const std::vector<std::string>& args) {
+		std::size_t steps = 20000;
+		std::size_t chunkSize = 16;
+		std::size_t maxLength = 2000;
+		unsigned int seed = 1;
+		for (std::size_t i = 0; i < args.size(); i++) {
+			if (args[i] == "-n" && i + 1 < args.size()) {
+				steps = static_cast<std::size_t>(std::strtoull(args[++i].c_str(), nullptr, 10));
+			} else if (args[i] == "-c" && i + 1 < args.size()) {
+				chunkSize = std::max<std::size_t>(1, static_cast<std::size_t>(std::strtoull(args[++i].c_str(), nullptr, 10)));
+			} else if (args[i] == "-l" && i + 1 < args.size()) {
+				maxLength = std::max<std::size_t>(1, static_cast<std::size_t>(std::strtoull(args[++i].c_str(), nullptr, 10)));
+			} else if (args[i] == "-s" && i + 1 < args.size()) {
+				seed = static_cast<unsigned int>(std::strtoul(args[++i].c_str(), nullptr, 10));
+			} else {
+				PrintUsage();
+				return 2;
+			}
+		}
+
+		std::mt19937 random(seed);
+		std::wstring text;
+		BracketIndex index(chunkSize);
+		std::size_t inserts = 0, erases = 0, checks = 0;
+
+		for (std::size_t step = 0; step < steps; step++) {
+			// 最大の長さに近いほど削除を多くする
+			bool erase = !text.empty() && random() % maxLength < text.size();
+			std::size_t pos = random() % (text.size() + 1);
+			if (erase) {
+				auto length = std::min<std::size_t>(text.size() - pos, random() % 4 == 0 ? random() % (chunkSize * 4 + 1) : random() % 4 + 1);
+				text.erase(pos, length);
+				index.Erase(pos, length);
+				erases++;
+			} else {
+				// たまにチャンクより長い文字列を挿入する
+				auto length = random() % 8 == 0 ? chunkSize + random() % (chunkSize * 4) : random() % 4 + 1;
+				std::wstring inserted;
+				for (std::size_t i = 0; i < length; i++) {
+					inserted.push_back(CHARACTERS[random() % (sizeof(CHARACTERS) / sizeof(CHARACTERS[0]) - 1)]);
+				}
+				text.insert(pos, inserted);
+				index.Insert(pos, inserted.size(), [&inserted](std::size_t i) { return inserted[i]; });
+				inserts++;
+			}
+
+			if (index.Length() != text.size()) {
+				fprintf(stderr, "step %zu: Length() = %zu, expected %zu\n", step, index.Length(), text.size());
+				return 1;
+			}
+
+			// 編集した位置の周りと、ランダムな位置を調べる。ときどきすべての位置を調べる
+			BruteForce brute(text);
+			std::vector<std::size_t> positions;
+			if (step % 500 == 0) {
+				for (std::size_t i = 0; i <= text.size(); i++) {
+					positions.push_back(i);
+				}
+			} else {
+				for (std::size_t i = pos > 2 ? pos - 2 : 0; i <= std::min(text.size(), pos + 2); i++) {
+					positions.push_back(i);
+				}
+				for (int i = 0; i < 16; i++) {
+					positions.push_back(random() % (text.size() + 1));
+				}
+			}
+			for (auto checked : positions) {
+				if (!CheckPosition(index, brute, checked, step)) {
+					return 1;
+				}
+				checks++;
+			}
+		}
+
+		printf("%zu inserts, %zu erases, %zu positions checked, final length %zu\n", inserts, erases, checks, text.size());
+		return 0;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	return Run(std::vector<std::string>(argv + 1, argv + argc));
+}
@@ -0,0 +1,434 @@
+﻿#include "BracketIndex.h"
+
+namespace {
+	constexpr uint8_t OPEN = 0x4;
+	constexpr uint8_t KIND_MASK = 0x3;
+}
+
+BracketIndex::BracketIndex(std::size_t chunkSize) :
+	chunkSize(std::max<std::size_t>(chunkSize, 16)),
+	leafCount(1) {
+	Rebuild();
+}
+
+uint8_t BracketIndex::TypeOf(wchar_t ch) {
+	switch (ch) {
+	case '(':
+		return OPEN | 1;
+	case ')':
+		return 1;
+	case '[':
+		return OPEN | 2;
+	case ']':
+		return 2;
+	case '{':
+		return OPEN | 3;
+	case '}':
+		return 3;
+	default:
+		return 0;
+	}
+}
+
+bool BracketIndex::IsOpen(uint8_t type) {
+	return (type & OPEN) != 0;
+}
+
+int64_t BracketIndex::DeltaOf(uint8_t type) {
+	return IsOpen(type) ? 1 : -1;
+}
+
+BracketIndex::Summary BracketIndex::Combine(const Summary& left, const Summary& right) {
+	Summary summary;
+	summary.length = left.length + right.length;
+	summary.net = left.net + right.net;
+	summary.minAfter = std::min(left.minAfter, left.net + right.minAfter);
+	summary.minBefore = std::min(left.minBefore, left.net + right.minBefore);
+	return summary;
+}
+
+BracketIndex::Summary BracketIndex::Summarize(const Chunk& chunk) const {
+	Summary summary{ chunk.length, 0, NONE, NONE };
+
+	int64_t depth = 0;
+	for (auto& bracket : chunk.brackets) {
+		summary.minBefore = std::min(summary.minBefore, depth);
+		depth += DeltaOf(bracket.type);
+		summary.minAfter = std::min(summary.minAfter, depth);
+	}
+	summary.net = depth;
+
+	return summary;
+}
+
+void BracketIndex::Rebuild() {
+	leafCount = 1;
+	while (leafCount < chunks.size()) {
+		leafCount *= 2;
+	}
+
+	tree.assign(leafCount * 2, Summary{ 0, 0, NONE, NONE });
+	for (std::size_t i = 0; i < chunks.size(); i++) {
+		tree[leafCount + i] = Summarize(chunks[i]);
+	}
+	for (auto node = leafCount - 1; node >= 1; node--) {
+		tree[node] = Combine(tree[node * 2], tree[node * 2 + 1]);
+	}
+}
+
+void BracketIndex::RemoveEmptyChunks() {
+	chunks.erase(std::remove_if(chunks.begin(), chunks.end(), [](const Chunk& chunk) {
+		return chunk.length == 0;
+	}), chunks.end());
+}
+
+void BracketIndex::UpdateChunk(std::size_t index) {
+	auto node = leafCount + index;
+	tree[node] = Summarize(chunks[index]);
+
+	for (node /= 2; node >= 1; node /= 2) {
+		tree[node] = Combine(tree[node * 2], tree[node * 2 + 1]);
+	}
+}
+
+bool BracketIndex::Rebalance(std::size_t index) {
+	auto& chunk = chunks[index];
+
+	if (chunk.length > chunkSize * 2) {
+		// chunkSize ごとに分ける
+		std::vector<Chunk> pieces;
+		auto bracket = chunk.brackets.begin();
+		for (std::size_t start = 0; start < chunk.length; start += chunkSize) {
+			Chunk piece{ std::min(chunkSize, chunk.length - start), {} };
+			for (; bracket != chunk.brackets.end() && bracket->offset < start + piece.length; bracket++) {
+				piece.brackets.push_back(Bracket{ static_cast<uint32_t>(bracket->offset - start), bracket->type });
+			}
+			pieces.push_back(std::move(piece));
+		}
+
+		chunks.erase(chunks.begin() + index);
+		chunks.insert(chunks.begin() + index, std::make_move_iterator(pieces.begin()), std::make_move_iterator(pieces.end()));
+		Rebuild();
+		return true;
+	}
+
+	if (chunk.length < chunkSize / 4 && chunks.size() > 1) {
+		// 隣のチャンクとまとめる
+		auto left = index + 1 < chunks.size() ? index : index - 1;
+		auto& first = chunks[left];
+		auto& second = chunks[left + 1];
+		for (auto& bracket : second.brackets) {
+			first.brackets.push_back(Bracket{ static_cast<uint32_t>(bracket.offset + first.length), bracket.type });
+		}
+		first.length += second.length;
+		chunks.erase(chunks.begin() + left + 1);
+
+		if (!Rebalance(left)) {
+			Rebuild();
+		}
+		return true;
+	}
+
+	return false;
+}
+
+void BracketIndex::Clear() {
+	chunks.clear();
+	Rebuild();
+}
+
+void BracketIndex::Erase(std::size_t pos, std::size_t length) {
+	if (chunks.empty() || pos >= Length()) {
+		return;
+	}
+
+	length = std::min(length, Length() - pos);
+	std::size_t local;
+	auto first = FindChunk(pos, &local);
+	auto index = first;
+
+	while (length > 0) {
+		auto& chunk = chunks[index];
+		auto count = std::min(length, chunk.length - local);
+
+		// 範囲内の括弧を取り除き、後ろの括弧をずらす
+		auto begin = std::lower_bound(chunk.brackets.begin(), chunk.brackets.end(), local, [](const Bracket& bracket, std::size_t local) {
+			return bracket.offset < local;
+		});
+		auto end = std::lower_bound(begin, chunk.brackets.end(), local + count, [](const Bracket& bracket, std::size_t end) {
+			return bracket.offset < end;
+		});
+		for (auto shift = end; shift != chunk.brackets.end(); shift++) {
+			shift->offset -= static_cast<uint32_t>(count);
+		}
+		chunk.brackets.erase(begin, end);
+		chunk.length -= count;
+		length -= count;
+
+		UpdateChunk(index);
+		index++;
+		local = 0;
+	}
+
+	// 空になったチャンクは取り除く
+	if (index - first > 1) {
+		RemoveEmptyChunks();
+		if (chunks.empty()) {
+			Rebuild();
+			return;
+		}
+		Rebuild();
+	}
+
+	Rebalance(std::min(first, chunks.size() - 1));
+}
+
+std::size_t BracketIndex::Length() const {
+	return tree[1].length;
+}
+
+std::size_t BracketIndex::MemoryUsage() const {
+	auto bytes = BytesOf(chunks) + BytesOf(tree);
+	for (auto& chunk : chunks) {
+		bytes += BytesOf(chunk.brackets);
+	}
+	return bytes;
+}
+
+std::size_t BracketIndex::FindChunk(std::size_t pos, std::size_t* local) const {
+	// 末尾の場合は最後のチャンクの末尾
+	if (pos >= Length()) {
+		*local = chunks.back().length;
+		return chunks.size() - 1;
+	}
+
+	std::size_t node = 1;
+	while (node < leafCount) {
+		auto& left = tree[node * 2];
+		if (pos < left.length) {
+			node = node * 2;
+		} else {
+			pos -= left.length;
+			node = node * 2 + 1;
+		}
+	}
+
+	*local = pos;
+	return node - leafCount;
+}
+
+std::size_t BracketIndex::ChunkStart(std::size_t index) const {
+	std::size_t start = 0;
+	for (auto node = leafCount + index; node > 1; node /= 2) {
+		if (node & 1) {
+			start += tree[node - 1].length;
+		}
+	}
+	return start;
+}
+
+int64_t BracketIndex::DepthAtChunk(std::size_t index) const {
+	int64_t depth = 0;
+	for (auto node = leafCount + index; node > 1; node /= 2) {
+		if (node & 1) {
+			depth += tree[node - 1].net;
+		}
+	}
+	return depth;
+}
+
+const BracketIndex::Bracket* BracketIndex::FindBracket(std::size_t pos) const {
+	if (chunks.empty() || pos >= Length()) {
+		return nullptr;
+	}
+
+	std::size_t local;
+	auto& chunk = chunks[FindChunk(pos, &local)];
+	auto itr = std::lower_bound(chunk.brackets.begin(), chunk.brackets.end(), local, [](const Bracket& bracket, std::size_t local) {
+		return bracket.offset < local;
+	});
+
+	return itr != chunk.brackets.end() && itr->offset == local ? &*itr : nullptr;
+}
+
+int64_t BracketIndex::DepthAt(std::size_t pos) const {
+	if (chunks.empty()) {
+		return 0;
+	}
+
+	std::size_t local;
+	auto index = FindChunk(pos, &local);
+	auto depth = DepthAtChunk(index);
+	for (auto& bracket : chunks[index].brackets) {
+		if (bracket.offset >= local) {
+			break;
+		}
+		depth += DeltaOf(bracket.type);
+	}
+
+	return depth;
+}
+
+std::ptrdiff_t BracketIndex::SearchForward(std::size_t node, std::size_t l, std::size_t r, std::size_t from, int64_t* depth, int64_t target) const {
+	if (r <= from) {
+		return -1;
+	}
+
+	if (l >= from) {
+		// 範囲内で深さが target を下回らない場合は読み飛ばす
+		if (*depth + tree[node].minAfter >= target) {
+			*depth += tree[node].net;
+			return -1;
+		}
+		if (r - l == 1) {
+			return static_cast<std::ptrdiff_t>(l);
+		}
+	}
+
+	auto mid = (l + r) / 2;
+	auto result = SearchForward(node * 2, l, mid, from, depth, target);
+	if (result >= 0) {
+		return result;
+	}
+	return SearchForward(node * 2 + 1, mid, r, from, depth, target);
+}
+
+std::ptrdiff_t BracketIndex::SearchBackward(std::size_t node, std::size_t l, std::size_t r, std::size_t end, int64_t* depth, int64_t target) const {
+	if (l >= end) {
+		return -1;
+	}
+
+	if (r <= end) {
+		auto start = *depth - tree[node].net;
+		if (start + tree[node].minBefore >= target) {
+			*depth = start;
+			return -1;
+		}
+		if (r - l == 1) {
+			return static_cast<std::ptrdiff_t>(l);
+		}
+	}
+
+	auto mid = (l + r) / 2;
+	auto result = SearchBackward(node * 2 + 1, mid, r, end, depth, target);
+	if (result >= 0) {
+		return result;
+	}
+	return SearchBackward(node * 2, l, mid, end, depth, target);
+}
+
+bool BracketIndex::FindForward(std::size_t from, int64_t target, std::size_t* result) const {
+	if (chunks.empty() || from >= Length()) {
+		return false;
+	}
+
+	// from を含むチャンクの中を探す
+	std::size_t local;
+	auto index = FindChunk(from, &local);
+	auto depth = DepthAtChunk(index);
+	auto start = from - local;
+	for (auto& bracket : chunks[index].brackets) {
+		depth += DeltaOf(bracket.type);
+		if (bracket.offset >= local && depth < target) {
+			*result = start + bracket.offset;
+			return true;
+		}
+	}
+
+	// 後ろのチャンクから深さが target を下回るものを探す
+	auto found = SearchForward(1, 0, leafCount, index + 1, &depth, target);
+	if (found < 0) {
+		return false;
+	}
+
+	start = ChunkStart(found);
+	for (auto& bracket : chunks[found].brackets) {
+		depth += DeltaOf(bracket.type);
+		if (depth < target) {
+			*result = start + bracket.offset;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool BracketIndex::FindBackward(std::size_t end, int64_t target, std::size_t* result) const {
+	if (chunks.empty() || end == 0) {
+		return false;
+	}
+
+	// end を含むチャンクの中を後ろから探す
+	std::size_t local;
+	auto index = FindChunk(end, &local);
+	auto& chunk = chunks[index];
+	auto start = end - local;
+	auto itr = std::lower_bound(chunk.brackets.begin(), chunk.brackets.end(), local, [](const Bracket& bracket, std::size_t local) {
+		return bracket.offset < local;
+	});
+
+	auto depth = DepthAtChunk(index);
+	for (auto bracket = chunk.brackets.begin(); bracket != itr; bracket++) {
+		depth += DeltaOf(bracket->type);
+	}
+	while (itr != chunk.brackets.begin()) {
+		itr--;
+		depth -= DeltaOf(itr->type);
+		if (depth < target) {
+			*result = start + itr->offset;
+			return true;
+		}
+	}
+
+	// 前のチャンクから深さが target を下回るものを探す
+	auto found = SearchBackward(1, 0, leafCount, index, &depth, target);
+	if (found < 0) {
+		return false;
+	}
+
+	start = ChunkStart(found);
+	auto& brackets = chunks[found].brackets;
+	for (auto bracket = brackets.rbegin(); bracket != brackets.rend(); bracket++) {
+		depth -= DeltaOf(bracket->type);
+		if (depth < target) {
+			*result = start + bracket->offset;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool BracketIndex::FindMatch(std::size_t pos, std::size_t* match) const {
+	auto bracket = FindBracket(pos);
+	if (!bracket) {
+		return false;
+	}
+
+	// 開き括弧なら深さが元に戻る最初の閉じ括弧、閉じ括弧なら深さが下がる直前の開き括弧
+	auto type = bracket->type;
+	auto depth = DepthAt(pos);
+	std::size_t other;
+	if (IsOpen(type) ? !FindForward(pos + 1, depth + 1, &other) : !FindBackward(pos, depth, &other)) {
+		return false;
+	}
+
+	auto otherBracket = FindBracket(other);
+	if (!otherBracket || (otherBracket->type & KIND_MASK) != (type & KIND_MASK)) {
+		return false;
+	}
+
+	*match = other;
+	return true;
+}
+
+bool BracketIndex::FindEnclosing(std::size_t pos, std::size_t* open, std::size_t* close) const {
+	auto depth = DepthAt(pos);
+	if (!FindBackward(pos, depth, open) || !FindForward(pos, depth, close)) {
+		return false;
+	}
+
+	auto openBracket = FindBracket(*open);
+	auto closeBracket = FindBracket(*close);
+	return openBracket && closeBracket && (openBracket->type & KIND_MASK) == (closeBracket->type & KIND_MASK);
+}
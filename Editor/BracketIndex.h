@@ -0,0 +1,159 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+
+#include "MemoryUsage.h"
+
+// 括弧の対応を調べるための索引
+//
+// 文書を一定の長さのチャンクに分け、チャンクごとに括弧の位置と
+// 括弧の深さの変化 (差分、括弧の前後での最小の深さ) を記録する。
+// チャンクの集計をセグメント木で持つので、ある位置から括弧の深さが下がる最初の位置を
+// O(log n) で探せる。編集されたときは編集されたチャンクとその集計だけを更新する。
+// (), [], {} を区別せずに深さを数え、対応する括弧の種類が異なる場合は対応していないものとする。
+// 文字列やコメントの中の括弧も区別しない。
+class BracketIndex {
+private:
+	struct Bracket {
+		uint32_t offset; // チャンクの先頭からの位置
+		uint8_t type;
+	};
+
+	struct Chunk {
+		std::size_t length;
+		std::vector<Bracket> brackets;
+	};
+
+	// チャンクまたはチャンクの範囲の集計
+	// 深さはチャンクの先頭を 0 とした相対的な値
+	struct Summary {
+		std::size_t length;
+		int64_t net;
+		// 閉じ括弧の直後の深さの最小値 (括弧がない場合は NONE)
+		int64_t minAfter;
+		// 括弧の直前の深さの最小値 (括弧がない場合は NONE)
+		int64_t minBefore;
+	};
+
+	static constexpr int64_t NONE = INT64_MAX / 4;
+
+	std::size_t chunkSize;
+	std::vector<Chunk> chunks;
+	// tree[1] が根、tree[leafCount + i] が i 番目のチャンク
+	std::vector<Summary> tree;
+	std::size_t leafCount;
+	// 挿入された括弧を集めるための作業領域 (確保し直さないように使い回す)
+	std::vector<Bracket> insertedBrackets;
+
+	static uint8_t TypeOf(wchar_t ch);
+	static bool IsOpen(uint8_t type);
+	static int64_t DeltaOf(uint8_t type);
+	static Summary Combine(const Summary& left, const Summary& right);
+
+	Summary Summarize(const Chunk& chunk) const;
+	void Rebuild();
+	void RemoveEmptyChunks();
+	void UpdateChunk(std::size_t index);
+	// 大きくなりすぎたチャンクを分け、小さくなりすぎたチャンクをまとめる
+	bool Rebalance(std::size_t index);
+
+	// pos を含むチャンクとその中での位置
+	std::size_t FindChunk(std::size_t pos, std::size_t* local) const;
+	std::size_t ChunkStart(std::size_t index) const;
+	int64_t DepthAtChunk(std::size_t index) const;
+	const Bracket* FindBracket(std::size_t pos) const;
+
+	// from 以降で直後の深さが target より小さくなる最初の括弧
+	bool FindForward(std::size_t from, int64_t target, std::size_t* result) const;
+	// end より前で直前の深さが target より小さい最後の括弧
+	bool FindBackward(std::size_t end, int64_t target, std::size_t* result) const;
+	std::ptrdiff_t SearchForward(std::size_t node, std::size_t l, std::size_t r, std::size_t from, int64_t* depth, int64_t target) const;
+	std::ptrdiff_t SearchBackward(std::size_t node, std::size_t l, std::size_t r, std::size_t end, int64_t* depth, int64_t target) const;
+public:
+	explicit BracketIndex(std::size_t chunkSize = 4096);
+
+	void Clear();
+	// pos に length 文字を挿入する。charAt(std::size_t i) は挿入する i 番目の文字
+	template <typename CharAt>
+	void Insert(std::size_t pos, std::size_t length, CharAt charAt);
+	void Erase(std::size_t pos, std::size_t length);
+
+	std::size_t Length() const;
+	// 確保しているメモリの大きさ (バイト)
+	std::size_t MemoryUsage() const;
+	// pos の直前の括弧の深さ
+	int64_t DepthAt(std::size_t pos) const;
+	// pos にある括弧に対応する括弧の位置
+	bool FindMatch(std::size_t pos, std::size_t* match) const;
+	// pos を囲んでいる括弧の組
+	bool FindEnclosing(std::size_t pos, std::size_t* open, std::size_t* close) const;
+};
+
+template <typename CharAt>
+void BracketIndex::Insert(std::size_t pos, std::size_t length, CharAt charAt) {
+	if (length == 0) {
+		return;
+	}
+
+	if (chunks.empty()) {
+		chunks.push_back(Chunk{ 0, {} });
+	}
+
+	std::size_t local;
+	auto index = FindChunk(pos, &local);
+	auto& chunk = chunks[index];
+	auto itr = std::lower_bound(chunk.brackets.begin(), chunk.brackets.end(), local, [](const Bracket& bracket, std::size_t local) {
+		return bracket.offset < local;
+	});
+
+	if (length > chunkSize) {
+		// 大きな挿入は挿入位置でチャンクを分け、挿入された部分から新しくチャンクを作る
+		std::vector<Chunk> created;
+		for (std::size_t start = 0; start < length; start += chunkSize) {
+			Chunk piece{ std::min(chunkSize, length - start), {} };
+			for (std::size_t i = 0; i < piece.length; i++) {
+				auto type = TypeOf(charAt(start + i));
+				if (type) {
+					piece.brackets.push_back(Bracket{ static_cast<uint32_t>(i), type });
+				}
+			}
+			created.push_back(std::move(piece));
+		}
+
+		Chunk right{ chunk.length - local, {} };
+		for (auto moved = itr; moved != chunk.brackets.end(); moved++) {
+			right.brackets.push_back(Bracket{ static_cast<uint32_t>(moved->offset - local), moved->type });
+		}
+		created.push_back(std::move(right));
+
+		chunk.brackets.erase(itr, chunk.brackets.end());
+		chunk.length = local;
+		chunks.insert(chunks.begin() + index + 1, std::make_move_iterator(created.begin()), std::make_move_iterator(created.end()));
+		RemoveEmptyChunks();
+		Rebuild();
+		return;
+	}
+
+	// 挿入位置より後ろの括弧をずらし、挿入された括弧を間に入れる
+	for (auto shift = itr; shift != chunk.brackets.end(); shift++) {
+		shift->offset += static_cast<uint32_t>(length);
+	}
+
+	insertedBrackets.clear();
+	for (std::size_t i = 0; i < length; i++) {
+		auto type = TypeOf(charAt(i));
+		if (type) {
+			insertedBrackets.push_back(Bracket{ static_cast<uint32_t>(local + i), type });
+		}
+	}
+	chunk.brackets.insert(itr, insertedBrackets.begin(), insertedBrackets.end());
+	chunk.length += length;
+
+	if (!Rebalance(index)) {
+		UpdateChunk(index);
+	}
+}
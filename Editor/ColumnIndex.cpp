@@ -0,0 +1,111 @@
+﻿#include "ColumnIndex.h"
+
+ColumnIndex::ColumnIndex(std::size_t interval, float uniformAdvance) :
+	interval(interval),
+	uniformAdvance(uniformAdvance),
+	maxWidth(0) {
+}
+
+std::size_t ColumnIndex::CheckpointCount(const Line& line) const {
+	return line.uniform ? 0 : (line.length + interval - 1) / interval;
+}
+
+ColumnIndex::Line ColumnIndex::NewLine(std::size_t firstCheckpoint, std::size_t row, bool hidden) {
+	Line line;
+	line.length = 0;
+	line.firstCheckpoint = firstCheckpoint;
+	line.row = row;
+	line.width = 0;
+	line.uniform = true;
+	line.hidden = hidden;
+	return line;
+}
+
+void ColumnIndex::Clear() {
+	lines.clear();
+	checkpoints.clear();
+	maxWidth = 0;
+}
+
+void ColumnIndex::BeginLine(bool hidden) {
+	lines.push_back(NewLine(checkpoints.size(), RowCount(), hidden));
+}
+
+void ColumnIndex::Append(float advance) {
+	AppendTo(lines.back(), checkpoints, advance);
+}
+
+void ColumnIndex::AppendTo(Line& line, std::vector<double>& lineCheckpoints, float advance) {
+	if (line.uniform) {
+		if (advance == uniformAdvance) {
+			line.length++;
+			line.width = line.length * static_cast<double>(uniformAdvance);
+			if (line.width > maxWidth) {
+				maxWidth = line.width;
+			}
+			return;
+		}
+
+		// ここまでの文字はすべて同じ幅なので、チェックポイントを計算で補う
+		line.uniform = false;
+		for (std::size_t column = 0; column < line.length; column += interval) {
+			lineCheckpoints.push_back(column * static_cast<double>(uniformAdvance));
+		}
+	}
+
+	if (line.length % interval == 0) {
+		lineCheckpoints.push_back(line.width);
+	}
+
+	line.width += advance;
+	line.length++;
+
+	if (line.width > maxWidth) {
+		maxWidth = line.width;
+	}
+}
+
+std::size_t ColumnIndex::LineCount() const {
+	return lines.size();
+}
+
+std::size_t ColumnIndex::RowCount() const {
+	if (lines.empty()) {
+		return 0;
+	}
+	auto& last = lines.back();
+	return last.hidden ? last.row : last.row + 1;
+}
+
+std::size_t ColumnIndex::LineLength(std::size_t line) const {
+	return lines[line].length;
+}
+
+double ColumnIndex::LineWidth(std::size_t line) const {
+	return lines[line].width;
+}
+
+double ColumnIndex::MaxWidth() const {
+	return maxWidth;
+}
+
+std::size_t ColumnIndex::MemoryUsage() const {
+	return BytesOf(lines) + BytesOf(checkpoints) + BytesOf(editLines) + BytesOf(editCheckpoints);
+}
+
+std::size_t ColumnIndex::RowOf(std::size_t line) const {
+	return line < lines.size() ? lines[line].row : RowCount() + (line - lines.size());
+}
+
+std::size_t ColumnIndex::LineOfRow(std::size_t row) const {
+	auto rows = RowCount();
+	if (row >= rows) {
+		return lines.size() + (row - rows);
+	}
+
+	// 同じ番号の行のうち、折りたたまれた行の後ろにある表示する行
+	auto itr = std::upper_bound(lines.begin(), lines.end(), row, [](std::size_t row, const Line& line) {
+		return row < line.row;
+	});
+	return static_cast<std::size_t>(std::distance(lines.begin(), itr)) - 1;
+}
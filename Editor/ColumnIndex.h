@@ -0,0 +1,243 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+#include "MemoryUsage.h"
+
+// 折り返さずに表示する場合の各行の文字の位置
+//
+// 行頭からの幅を一定の文字数ごとに記録しておく (チェックポイント) ことで、
+// 数百 MB の 1 行でも表示されている x 座標の文字まで二分探索で移動できる。
+// 文字ごとの幅はチェックポイント間を足し合わせるときにだけ AdvanceAt から取得する。
+// 幅は float では大きな行で誤差が出るので double で保持する。
+//
+// 等幅フォントの場合は uniformAdvance に 1 マスの幅を指定する。すべての文字がその幅の行は
+// チェックポイントを持たず、位置を列の番号から計算で求める。違う幅の文字 (全角など) が現れた時点で
+// それまでのチェックポイントを計算で補い、通常の行として扱う。
+//
+// 行は文書の行 (LineDiff の行) と同じ番号で、先頭から測った行だけを持つ。行の先頭の位置は持たず、使う側が
+// 文書の行の索引から渡す。折りたたまれた行は幅のない行として持ち、表示する行の番号 (row) を数えない。
+// 編集されたときは編集された行だけを測り直し、後ろの行はチェックポイントの位置と表示する行の番号をずらす。
+class ColumnIndex {
+private:
+	struct Line {
+		std::size_t length; // 改行を含む文字数
+		std::size_t firstCheckpoint;
+		std::size_t row; // 表示する行の番号 (折りたたまれた行の場合は次に表示する行の番号)
+		double width;
+		bool uniform; // すべての文字の幅が uniformAdvance
+		bool hidden; // 折りたたまれていて表示しない
+	};
+
+	std::size_t interval;
+	float uniformAdvance;
+	std::vector<Line> lines;
+	// checkpoints[firstCheckpoint + k] は行頭から k * interval 文字目の左端の x 座標
+	std::vector<double> checkpoints;
+	double maxWidth;
+	// 編集された行を測り直すための作業領域 (確保し直さないように使い回す)
+	std::vector<Line> editLines;
+	std::vector<double> editCheckpoints;
+
+	std::size_t CheckpointCount(const Line& line) const;
+	static Line NewLine(std::size_t firstCheckpoint, std::size_t row, bool hidden);
+	void AppendTo(Line& line, std::vector<double>& lineCheckpoints, float advance);
+	// line 行目の行頭から column 文字目の前までを残した行 (チェックポイントは line 行目の先頭の部分をそのまま使う)
+	template <typename AdvanceAt>
+	Line Prefix(std::size_t line, std::size_t start, std::size_t column, AdvanceAt advanceAt) const;
+public:
+	explicit ColumnIndex(std::size_t interval = 256, float uniformAdvance = 0);
+
+	void Clear();
+	// 次の行を追加する。hidden の場合は折りたたまれている行で、Append しない
+	void BeginLine(bool hidden = false);
+	// 最後の行に文字を追加する
+	void Append(float advance);
+	// 先頭から count 行と、count 行目の column 文字目の前までを残し、続きを BeginLine や Append で追加できるようにする
+	// count 行目は表示する行で、column が 0 より大きい場合だけ残す。start は count 行目の先頭の位置
+	// MaxWidth は縮めない (すべての行を調べ直すことになるので Clear するまで最大値を保つ)
+	template <typename AdvanceAt>
+	void Truncate(std::size_t count, std::size_t start, std::size_t column, AdvanceAt advanceAt);
+	// firstLine 行目から removedLines 行を insertedLines 行に置き換える編集をした後に呼ぶ
+	// firstLine 行目は編集された位置 column 文字目から、挿入された行は全体を測り直し、後ろの行はそのまま使う
+	// 編集された行は表示する行であること。まだ測っていない行が含まれる場合は firstLine 行目から後ろを取り除く
+	// lineStart(std::size_t line) は編集後の line 行目の先頭 (文書の行数を渡した場合は文書の長さ)
+	template <typename LineStart, typename AdvanceAt>
+	void Edit(std::size_t firstLine, std::size_t removedLines, std::size_t insertedLines, std::size_t column, LineStart lineStart, AdvanceAt advanceAt);
+
+	// 測った行の数
+	std::size_t LineCount() const;
+	// 測った行の中で表示する行の数
+	std::size_t RowCount() const;
+	std::size_t LineLength(std::size_t line) const;
+	double LineWidth(std::size_t line) const;
+	double MaxWidth() const;
+	// 確保しているメモリの大きさ (バイト)
+	std::size_t MemoryUsage() const;
+	// 行を表示する行の番号と、表示する行の番号の行
+	// まだ測っていない行は最後に測った行から折りたたまれずに続いているものとする
+	std::size_t RowOf(std::size_t line) const;
+	std::size_t LineOfRow(std::size_t row) const;
+
+	// x 座標にある文字の行頭からの位置を返し、left にその文字の左端の x 座標を設定する
+	// x が行末より右の場合は行の長さを返す。start は行の先頭の位置
+	// advanceAt(std::size_t index) は文書の先頭からの位置 index の文字の幅を返す
+	template <typename AdvanceAt>
+	std::size_t FindColumn(std::size_t line, std::size_t start, double x, AdvanceAt advanceAt, double* left) const;
+	// 行頭から column 文字目の左端の x 座標
+	template <typename AdvanceAt>
+	double PositionOf(std::size_t line, std::size_t start, std::size_t column, AdvanceAt advanceAt) const;
+};
+
+template <typename AdvanceAt>
+typename ColumnIndex::Line ColumnIndex::Prefix(std::size_t line, std::size_t start, std::size_t column, AdvanceAt advanceAt) const {
+	auto prefix = lines[line];
+	prefix.length = std::min(column, prefix.length);
+	prefix.width = PositionOf(line, start, prefix.length, advanceAt);
+	return prefix;
+}
+
+template <typename AdvanceAt>
+void ColumnIndex::Truncate(std::size_t count, std::size_t start, std::size_t column, AdvanceAt advanceAt) {
+	if (count >= lines.size()) {
+		return;
+	}
+
+	if (column == 0 || lines[count].hidden) {
+		// count 行目から後ろを取り除く
+		checkpoints.resize(lines[count].firstCheckpoint);
+		lines.resize(count);
+		return;
+	}
+
+	if (column >= lines[count].length && count + 1 == lines.size()) {
+		return;
+	}
+
+	auto prefix = Prefix(count, start, column, advanceAt);
+	checkpoints.resize(prefix.firstCheckpoint + CheckpointCount(prefix));
+	lines.resize(count + 1);
+	lines.back() = prefix;
+}
+
+template <typename LineStart, typename AdvanceAt>
+void ColumnIndex::Edit(std::size_t firstLine, std::size_t removedLines, std::size_t insertedLines, std::size_t column, LineStart lineStart, AdvanceAt advanceAt) {
+	if (firstLine >= lines.size()) {
+		return;
+	}
+	if (firstLine + removedLines > lines.size()) {
+		Truncate(firstLine, lineStart(firstLine), 0, advanceAt);
+		return;
+	}
+
+	// 編集された行を作業領域で測る。最初の行の編集された位置より前はそのまま使う
+	auto& newLines = editLines;
+	auto& newCheckpoints = editCheckpoints;
+	newLines.clear();
+	newCheckpoints.clear();
+	auto row = lines[firstLine].row;
+	auto prefix = Prefix(firstLine, lineStart(firstLine), column, advanceAt);
+	auto begin = checkpoints.begin() + prefix.firstCheckpoint;
+	newCheckpoints.insert(newCheckpoints.end(), begin, begin + CheckpointCount(prefix));
+	prefix.firstCheckpoint = 0;
+	newLines.push_back(prefix);
+	for (std::size_t k = 0; k < insertedLines; k++) {
+		if (k > 0) {
+			newLines.push_back(NewLine(newCheckpoints.size(), row + k, false));
+		}
+		auto end = lineStart(firstLine + k + 1);
+		for (auto i = lineStart(firstLine + k) + (k == 0 ? prefix.length : 0); i < end; i++) {
+			AppendTo(newLines.back(), newCheckpoints, advanceAt(i));
+		}
+	}
+
+	// 置き換え、後ろの行のチェックポイントの位置と表示する行の番号をずらす
+	auto checkpointStart = lines[firstLine].firstCheckpoint;
+	auto checkpointEnd = firstLine + removedLines < lines.size() ? lines[firstLine + removedLines].firstCheckpoint : checkpoints.size();
+	auto checkpointDelta = static_cast<std::ptrdiff_t>(newCheckpoints.size()) - static_cast<std::ptrdiff_t>(checkpointEnd - checkpointStart);
+	auto rowDelta = static_cast<std::ptrdiff_t>(insertedLines) - static_cast<std::ptrdiff_t>(removedLines);
+
+	for (auto& line : newLines) {
+		line.firstCheckpoint += checkpointStart;
+	}
+	if (newCheckpoints.size() == checkpointEnd - checkpointStart) {
+		std::copy(newCheckpoints.begin(), newCheckpoints.end(), checkpoints.begin() + checkpointStart);
+	} else {
+		checkpoints.erase(checkpoints.begin() + checkpointStart, checkpoints.begin() + checkpointEnd);
+		checkpoints.insert(checkpoints.begin() + checkpointStart, newCheckpoints.begin(), newCheckpoints.end());
+	}
+	if (insertedLines == removedLines) {
+		std::copy(newLines.begin(), newLines.end(), lines.begin() + firstLine);
+	} else {
+		lines.erase(lines.begin() + firstLine, lines.begin() + firstLine + removedLines);
+		lines.insert(lines.begin() + firstLine, newLines.begin(), newLines.end());
+	}
+	if (checkpointDelta != 0 || rowDelta != 0) {
+		for (auto i = firstLine + insertedLines; i < lines.size(); i++) {
+			lines[i].firstCheckpoint += checkpointDelta;
+			lines[i].row += rowDelta;
+		}
+	}
+}
+
+template <typename AdvanceAt>
+std::size_t ColumnIndex::FindColumn(std::size_t line, std::size_t start, double x, AdvanceAt advanceAt, double* left) const {
+	auto& l = lines[line];
+	if (l.uniform) {
+		// 同じ幅の文字だけの行は割り算で求める (幅のない文字だけの行は x が負でなければ行末)
+		std::size_t column = x < 0 ? 0 : l.length;
+		if (uniformAdvance > 0 && x / uniformAdvance < l.length) {
+			column = x < 0 ? 0 : static_cast<std::size_t>(x / uniformAdvance);
+		}
+		*left = column * static_cast<double>(uniformAdvance);
+		return column;
+	}
+
+	auto count = CheckpointCount(l);
+	if (count == 0) {
+		*left = 0;
+		return 0;
+	}
+
+	// x 以下で最も右にあるチェックポイントを探す
+	auto begin = checkpoints.begin() + l.firstCheckpoint;
+	auto itr = std::upper_bound(begin, begin + count, x);
+	auto checkpoint = itr == begin ? 0 : static_cast<std::size_t>(std::distance(begin, itr)) - 1;
+
+	auto column = checkpoint * interval;
+	double position = begin[checkpoint];
+	while (column < l.length) {
+		auto advance = advanceAt(start + column);
+		if (position + advance > x) {
+			break;
+		}
+		position += advance;
+		column++;
+	}
+
+	*left = position;
+	return column;
+}
+
+template <typename AdvanceAt>
+double ColumnIndex::PositionOf(std::size_t line, std::size_t start, std::size_t column, AdvanceAt advanceAt) const {
+	auto& l = lines[line];
+	if (l.uniform) {
+		return std::min(column, l.length) * static_cast<double>(uniformAdvance);
+	}
+
+	auto count = CheckpointCount(l);
+	if (count == 0) {
+		return 0;
+	}
+
+	auto checkpoint = std::min(column / interval, count - 1);
+	double position = checkpoints[l.firstCheckpoint + checkpoint];
+	for (auto i = checkpoint * interval; i < column && i < l.length; i++) {
+		position += advanceAt(start + i);
+	}
+
+	return position;
+}
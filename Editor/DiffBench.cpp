@@ -0,0 +1,162 @@
+﻿// 行の差分 (DiffLines) の処理時間を測るコマンド
+//
+//   editor-diff-bench [-n 行数] [-r 繰り返す回数] [-c maxCost] [-s シード]
+//
+// 行のハッシュの列を作り、次の変更を加えた列と比較する。行の内容は少ない種類から選ぶので、
+// 空行や } のように同じ行が何度も現れる文書と同じく、一致する候補が多い。
+//   few        数か所の行を書き換える (普段の編集)
+//   scattered  行数の 1% を書き換え、挿入、削除する
+//   block      中ほどの 1/10 を別の行に置き換える
+//   shuffled   全体を並べ替える (差分が maxCost を超える場合)
+// 結果の差分を元の列に当てはめて変更後の列になるかも確かめ、合わない場合は 1 を返す。
+// エディタ本体とは別に、Direct2D や Win32 を使わないファイルだけでビルドする。
+//   g++ -std=c++14 -O2 -pthread DiffBench.cpp LineDiff.cpp MemoryUsage.cpp -o editor-diff-bench
+//   cl /std:c++14 /O2 /EHsc DiffBench.cpp LineDiff.cpp MemoryUsage.cpp /Fe:editor-diff-bench.exe
+#include "LineDiff.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+	void PrintUsage() {
+		fprintf(stderr, "usage: editor-diff-bench [-n lines] [-r repeats] [-c max-cost] [-s seed]\n");
+	}
+
+	// 行の種類の数。少ないほど同じ行が多くなる
+	constexpr uint64_t LINE_KINDS = 256;
+
+	struct Scenario {
+		const char* name;
+		std::vector<uint64_t> lines;
+	};
+
+	// 差分が base と lines の変換になっているかを確かめる
+	bool Verify(const std::vector<uint64_t>& base, const std::vector<uint64_t>& lines, const std::vector<DiffHunk>& hunks) {
+		std::size_t baseLine = 0, line = 0;
+		for (auto& hunk : hunks) {
+			if (hunk.baseStart < baseLine || hunk.start < line || hunk.baseStart - baseLine != hunk.start - line) {
+				return false;
+			}
+			// 差分の間は一致している
+			for (; baseLine < hunk.baseStart; baseLine++, line++) {
+				if (base[baseLine] != lines[line]) {
+					return false;
+				}
+			}
+			baseLine += hunk.baseCount;
+			line += hunk.count;
+		}
+		if (base.size() - baseLine != lines.size() - line) {
+			return false;
+		}
+		for (; baseLine < base.size(); baseLine++, line++) {
+			if (base[baseLine] != lines[line]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	int Run(const std::vector<std::string>& args) {
+		std::size_t lineCount = 100000;
+		int repeats = 5;
+		std::size_t maxCost = 4096;
+		unsigned int seed = 1;
+		for (std::size_t i = 0; i < args.size(); i++) {
+			if (args[i] == "-n" && i + 1 < args.size()) {
+				lineCount = static_cast<std::size_t>(std::strtoull(args[++i].c_str(), nullptr, 10));
+			} else if (args[i] == "-r" && i + 1 < args.size()) {
+				repeats = std::max(1, std::atoi(args[++i].c_str()));
+			} else if (args[i] == "-c" && i + 1 < args.size()) {
+				maxCost = static_cast<std::size_t>(std::strtoull(args[++i].c_str(), nullptr, 10));
+			} else if (args[i] == "-s" && i + 1 < args.size()) {
+				seed = static_cast<unsigned int>(std::strtoul(args[++i].c_str(), nullptr, 10));
+			} else {
+				PrintUsage();
+				return 2;
+			}
+		}
+
+		std::mt19937_64 random(seed);
+		auto randomLine = [&random]() { return random() % LINE_KINDS; };
+
+		std::vector<uint64_t> base(lineCount);
+		for (auto& line : base) {
+			line = randomLine();
+		}
+
+		std::vector<Scenario> scenarios;
+
+		auto few = base;
+		for (int i = 0; i < 5 && !few.empty(); i++) {
+			few[random() % few.size()] = LINE_KINDS + i;
+		}
+		scenarios.push_back(Scenario{ "few", std::move(few) });
+
+		// 後ろから変更すると、前の変更で位置がずれない
+		std::vector<std::size_t> positions(lineCount / 100);
+		for (auto& pos : positions) {
+			pos = lineCount > 0 ? random() % lineCount : 0;
+		}
+		std::sort(positions.begin(), positions.end(), std::greater<std::size_t>());
+		auto scattered = base;
+		for (std::size_t i = 0; i < positions.size(); i++) {
+			auto pos = positions[i];
+			switch (i % 3) {
+			case 0:
+				scattered[pos] = LINE_KINDS + i;
+				break;
+			case 1:
+				scattered.insert(scattered.begin() + pos, LINE_KINDS + i);
+				break;
+			default:
+				scattered.erase(scattered.begin() + pos);
+				break;
+			}
+		}
+		scenarios.push_back(Scenario{ "scattered", std::move(scattered) });
+
+		auto block = base;
+		for (auto i = lineCount / 2; i < lineCount / 2 + lineCount / 10; i++) {
+			block[i] = LINE_KINDS + i;
+		}
+		scenarios.push_back(Scenario{ "block", std::move(block) });
+
+		auto shuffled = base;
+		std::shuffle(shuffled.begin(), shuffled.end(), random);
+		scenarios.push_back(Scenario{ "shuffled", std::move(shuffled) });
+
+		bool failed = false;
+		for (auto& scenario : scenarios) {
+			std::vector<DiffHunk> hunks;
+			double best = 0;
+			for (int r = 0; r < repeats; r++) {
+				auto start = std::chrono::steady_clock::now();
+				hunks = DiffLines(base.data(), base.size(), scenario.lines.data(), scenario.lines.size(), maxCost);
+				auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				best = r == 0 ? seconds : std::min(best, seconds);
+			}
+
+			std::size_t changed = 0;
+			for (auto& hunk : hunks) {
+				changed += std::max(hunk.baseCount, hunk.count);
+			}
+			bool ok = Verify(base, scenario.lines, hunks);
+			failed = failed || !ok;
+
+			printf("%-10s %zu -> %zu lines, %zu hunks, %zu lines changed, %.3f ms (best of %d)%s\n", scenario.name,
+				base.size(), scenario.lines.size(), hunks.size(), changed, best * 1000, repeats, ok ? "" : ", INVALID");
+		}
+
+		return failed ? 1 : 0;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	return Run(std::vector<std::string>(argv + 1, argv + argc));
+}
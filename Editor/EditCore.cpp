@@ -0,0 +1,45 @@
+#include "EditCore.h"
+
+void EditCore::Release() {
+	std::vector<Char>().swap(chars);
+	std::vector<wchar_t>().swap(erasedText);
+	lineDiff.Clear();
+	wordIndex.Clear();
+	minimap.Clear();
+	brackets.Clear();
+	folds.Clear();
+}
+
+std::wstring EditCore::GetText() const {
+	std::wstring text;
+	text.reserve(chars.size());
+
+	for (auto& character : chars) {
+		text.push_back(character.wchar);
+	}
+
+	return text;
+}
+
+bool EditCore::Erase(std::size_t start, std::size_t end, std::size_t* revealedFrom) {
+	erasedText.clear();
+	for (auto i = start; i < end; i++) {
+		erasedText.push_back(chars[i].wchar);
+	}
+
+	chars.erase(chars.begin() + start, chars.begin() + end);
+	auto revealed = folds.Erase(start, end - start, revealedFrom);
+	markers.Erase(start, end - start);
+	auto charAt = [this](std::size_t i) { return chars[i].wchar; };
+	auto firstLine = lineDiff.LineOf(start);
+	auto lastLine = lineDiff.LineOf(end);
+	lineDiff.Edit(start, end - start, 0, chars.size(), charAt);
+	minimap.Edit(firstLine, lastLine - firstLine + 1, lineDiff.LineStart(firstLine), start, chars.size(), charAt);
+	brackets.Erase(start, end - start);
+	wordIndex.Erase(start, erasedText.data(), erasedText.size(), chars.size(), charAt);
+	return revealed;
+}
+
+std::size_t EditCore::IndexMemoryUsage() {
+	return lineDiff.MemoryUsage() + brackets.MemoryUsage() + minimap.MemoryUsage() + wordIndex.MemoryUsage() + folds.MemoryUsage() + markers.MemoryUsage();
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "LineDiff.h"
+#include "BracketIndex.h"
+#include "Minimap.h"
+#include "WordIndex.h"
+#include "FoldIndex.h"
+#include "MarkerStore.h"
+#include "MemoryUsage.h"
+
+struct Char {
+	float x;
+	float y;
+	float width;
+	wchar_t wchar;
+};
+
+// 文書の文字の配列と、編集に合わせて更新する索引
+//
+// エディタ (Editor) と画面を使わない再生 (editor-replay) の両方がこれを通して文字を挿入・削除するので、
+// 再生でも同じ配列と索引の更新にかかる時間を測れる。
+// 文字の配置と描画、言語サーバーへの通知、ジャーナルへの記録は使う側で行う。
+// Direct2D や Win32 を使わないので、エディタ本体とは別にビルドできる。
+class EditCore {
+private:
+	// 削除した文字を単語の索引に渡すための作業領域 (確保し直さないように使い回す)
+	std::vector<wchar_t> erasedText;
+public:
+	// 文字の位置と幅は使う側が配置するときに決める
+	std::vector<Char> chars;
+	// 保存されている内容との行ごとの差分
+	LineDiff lineDiff;
+	BracketIndex brackets;
+	// 折りたたんで隠している行
+	FoldIndex folds;
+	// ブックマークなど、編集されても同じ文字に付いたままになる印
+	MarkerStore markers;
+	// 補完のための単語の索引
+	WordIndex wordIndex;
+	// 文書全体の縮小表示
+	MinimapSummary minimap;
+
+	// 文書全体を str に置き換え、保存されている内容とみなす。印はそのまま残す
+	// createChar(wchar_t character) は文字から Char を作る
+	template <typename CreateChar>
+	void SetText(const std::wstring& str, CreateChar createChar);
+	// 文字の配列と索引を空にしてメモリを解放する。印はそのまま残す
+	void Release();
+	std::wstring GetText() const;
+	// index に text の length 文字を挿入する
+	// 隠れている行が編集されて折りたたみを解除した場合は true を返し、revealedFrom に解除した範囲の先頭を返す
+	template <typename CreateChar>
+	bool Insert(std::size_t index, const wchar_t* text, std::size_t length, CreateChar createChar, std::size_t* revealedFrom);
+	// [start, end) を削除する。戻り値は Insert と同じ
+	bool Erase(std::size_t start, std::size_t end, std::size_t* revealedFrom);
+	// 索引が確保しているメモリの大きさ (バイト)
+	std::size_t IndexMemoryUsage();
+};
+
+template <typename CreateChar>
+void EditCore::SetText(const std::wstring& str, CreateChar createChar) {
+	// 文字数ちょうどの配列に取り替え、1 文字ずつ追加せずにその場で作る
+	std::vector<Char>(str.size()).swap(chars);
+	for (std::size_t i = 0; i < str.size(); i++) {
+		chars[i] = createChar(str[i]);
+	}
+
+	lineDiff.SetCurrent(str);
+	lineDiff.MarkSaved();
+	wordIndex.SetText(str);
+	minimap.Reset(str.size(), [&str](std::size_t i) { return str[i]; });
+	brackets.Clear();
+	brackets.Insert(0, str.size(), [&str](std::size_t i) { return str[i]; });
+	folds.Clear();
+}
+
+template <typename CreateChar>
+bool EditCore::Insert(std::size_t index, const wchar_t* text, std::size_t length, CreateChar createChar, std::size_t* revealedFrom) {
+	// 一時的な配列を作らずに、挿入した場所で作る
+	chars.insert(chars.begin() + index, length, Char());
+	for (std::size_t i = 0; i < length; i++) {
+		chars[index + i] = createChar(text[i]);
+	}
+
+	auto revealed = folds.Insert(index, length, index == 0 || chars[index - 1].wchar == '\n', revealedFrom);
+	markers.Insert(index, length);
+	auto charAt = [this](std::size_t i) { return chars[i].wchar; };
+	auto firstLine = lineDiff.LineOf(index);
+	lineDiff.Edit(index, 0, length, chars.size(), charAt);
+	minimap.Edit(firstLine, 1, lineDiff.LineStart(firstLine), index + length, chars.size(), charAt);
+	brackets.Insert(index, length, [text](std::size_t i) { return text[i]; });
+	wordIndex.Insert(index, length, chars.size(), charAt);
+	return revealed;
+}
@@ -1,9 +1,51 @@
 ﻿#include "stdafx.h"
 #include "Editor.h"
 #include "Utils.h"
+#include "Encoding.h"
+#include "Platform.h"
+#include "AllocationCounter.h"
 
 using namespace D2D1;
 
+namespace {
+	// 意味的な字句の種類ごとの色。この表の番号を字句の印の値にする (0 は色を付けない字句)
+	struct TokenStyle {
+		const char* type;
+		ColorF::Enum color;
+	};
+
+	const TokenStyle TOKEN_STYLES[] = {
+		{ "", ColorF::Black },
+		{ "keyword", ColorF::Blue },
+		{ "modifier", ColorF::Blue },
+		{ "namespace", ColorF::Teal },
+		{ "type", ColorF::Teal },
+		{ "class", ColorF::Teal },
+		{ "struct", ColorF::Teal },
+		{ "enum", ColorF::Teal },
+		{ "interface", ColorF::Teal },
+		{ "typeParameter", ColorF::Teal },
+		{ "function", ColorF::SaddleBrown },
+		{ "method", ColorF::SaddleBrown },
+		{ "macro", ColorF::Purple },
+		{ "enumMember", ColorF::Purple },
+		{ "string", ColorF::DarkRed },
+		{ "regexp", ColorF::DarkRed },
+		{ "number", ColorF::DarkGreen },
+		{ "comment", ColorF::Green },
+	};
+	constexpr std::size_t TOKEN_STYLE_COUNT = sizeof(TOKEN_STYLES) / sizeof(TOKEN_STYLES[0]);
+
+	uint16_t TokenStyleOf(const std::string& type) {
+		for (std::size_t k = 1; k < TOKEN_STYLE_COUNT; k++) {
+			if (type == TOKEN_STYLES[k].type) {
+				return static_cast<uint16_t>(k);
+			}
+		}
+		return 0;
+	}
+}
+
 RectE::RectE() :
 	x(0),
 	y(0),
@@ -36,133 +78,538 @@ EditorOptions DefaultEditorOptions() {
 	options.fontName = L"Yu Gothic";
 	options.fontSize = 17.0f;
 	options.scrollAmount = 25.0f;
+	options.smoothScroll = true;
+	options.wordWrap = true;
+	options.columnCheckpointInterval = 256;
+	options.renderBandLines = 16;
+	options.renderBandCacheBytes = 32 * 1024 * 1024;
+	options.gutterWidth = 6.0f;
+	options.minimapWidth = 80.0f;
+	options.minimapLineHeight = 2.0f;
+	options.journalCommitIntervalMsec = 50;
+	options.journalCheckpointBytes = 8 * 1024 * 1024;
+	options.macroPath = L"editor.macro";
+	options.tracePath = L"editor.trace";
+	options.layoutCharsPerFrame = 512 * 1024;
+	options.layoutThreads = 0;
+	options.monospaceLayout = true;
+	options.completionCandidates = 8;
+	options.languageServerDebounceMsec = 200;
 
 	return options;
 }
 
-Editor::Editor(HWND hwnd, IDWriteFactory* factory, const EditorOptions& options) :
+Editor::Editor(HWND hwnd, const std::shared_ptr<FontResources>& font, const EditorOptions& options) :
 	hwnd(hwnd),
-	factory(factory),
-	textFormat(nullptr),
+	font(font),
 	options(options),
+	caret(),
+	selection(),
+	dragged(false),
 	compositionStringLength(-1),
 	compositionTextPos(-1),
+	compositionLayoutFrom(0),
 	selectionStart(-1),
 	maxX(0),
 	maxY(0),
 	offsetX(0),
 	offsetY(0),
+	targetOffsetX(0),
+	targetOffsetY(0),
+	compositionWidth(0),
+	textEndX(0),
+	textEndY(0),
+	layoutWidth(0),
+	columns(options.columnCheckpointInterval),
+	layoutInvalid(true),
+	layoutInvalidFrom(0),
+	layoutAnchor(NO_ANCHOR),
+	monospace(false),
+	scrollToCaret(false),
+	horizontalThumbDragged(false),
+	horizontalThumbDragOffset(0),
+	minimapDragged(false),
+	minimapTarget(nullptr),
+	minimapBitmap(nullptr),
+	minimapVersion(0),
+	bandOwner(nullptr),
+	frameCount(0),
+	modified(false),
+	fileChangePosted(false),
+	reloadConfirming(false),
+	completionSelected(0),
+	completionPrefixLength(0),
+	matchedBracket(-1),
+	matchingBracket(-1),
+	memoryOverlayVisible(false),
+	frameAllocations(0),
+	editAllocations(0),
+	macroRecording(false),
+	replaying(false),
+	replayModifiers(0),
+	replayCursor(),
+	clientWidth(0),
+	clientHeight(0),
+	suspended(false),
 	// カーソルを点滅させるタイマー
 	cursorBlinkTimer(ID_CURSOR_BLINK_TIMER, options.cursorBlinkRateMsec, std::bind(&Editor::ToggleCursorVisible, this)) {
 }
 
 Editor::~Editor() {
-	textFormat->Release();
+	// 記録中に終了した場合もそこまでの入力を残す
+	if (trace.IsRecording()) {
+		try {
+			SaveInputTrace(options.tracePath, trace.Events());
+		} catch (const InputTraceException&) {
+		}
+	}
+
+	fileWatcher.Stop();
+	streamReader.Stop();
+	core.lineDiff.Stop();
+	core.wordIndex.Stop();
+	languageServer.Stop();
+	ReleaseBands();
+	ReleaseMinimap();
 }
 
 void Editor::Initialize() {
-	// TextFormat を作成
-	HRESULT hr = factory->CreateTextFormat(
-		options.fontName.c_str(),
-		nullptr,
-		DWRITE_FONT_WEIGHT_REGULAR,
-		DWRITE_FONT_STYLE_NORMAL,
-		DWRITE_FONT_STRETCH_NORMAL,
-		options.fontSize,
-		L"ja-JP",
-		&textFormat);
-
-	if (FAILED(hr)) {
+	// 文字の高さはフォントを作成したときに測定されている
+	charHeight = font->CharHeight();
+	monospace = options.monospaceLayout && font->IsMonospace();
+	columns = ColumnIndex(options.columnCheckpointInterval, monospace ? font->CellWidth() : 0);
+	
+	// タイマーの設定
+	timers.push_back(&cursorBlinkTimer);
+
+	// 差分はバックグラウンドで計算し、終わったら描画し直す
+	// 同じウィンドウに複数の文書があるので、どの文書からのメッセージかを lparam で知らせる
+	auto hwnd = this->hwnd;
+	core.lineDiff.Start([this, hwnd]() {
+		PostMessage(hwnd, WM_DIFF_UPDATED, 0, reinterpret_cast<LPARAM>(this));
+	});
+
+	// 補完のための単語の索引もバックグラウンドで作る
+	core.wordIndex.Start();
+}
+
+void Editor::OpenFile(const std::wstring& path) {
+	filePath = path;
+	core.markers.Clear();
+	diagnostics.clear();
+
+	// ファイルが存在しない場合は新しいファイルとして扱う
+	// 存在する場合はメモリに割り当てて、バイト列をコピーせずにデコードする
+	MappedFile file;
+	if (FileExists(path) && (!file.Open(path) || !file.Map())) {
 		std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
-		std::string fontName = converter.to_bytes(options.fontName);
-		throw EditorException("Unable to create text format. font: '"
-			+ fontName + "', font size: " + std::to_string(options.fontSize));
+		throw EditorException("Unable to read file: '" + converter.to_bytes(path) + "'");
 	}
 
-	textFormat->SetLineSpacing(DWRITE_LINE_SPACING_METHOD_UNIFORM, options.fontSize / 0.8f, options.fontSize);
+	// 改行は \n に統一する
+	// 書き込み途中で末尾の文字が切れている場合は、追記されたときに続きからデコードする
+	std::wstring text;
+	fileTail.Reset(path, file.Data(), file.Size(), text);
+	auto base = JournalBase::Of(file.Data(), file.Size());
+
+	// 前回終了時に保存されていなかった編集があれば復元する
+	// 復元しない場合や、ジャーナルが使えない場合もファイルはそのまま開く
+	bool recovered = EditJournal::Exists(path) && RecoverFromJournal(text, file.Data(), file.Size(), base);
+	file.Close();
+	if (!recovered) {
+		SetText(text);
+		modified = false;
+		try {
+			journal.Open(path, base, fileTail.LoadedBytes(), options.journalCommitIntervalMsec, options.journalCheckpointBytes);
+		} catch (const JournalException& e) {
+			std::wcout << L"Unable to open journal: " << e.what() << std::endl;
+		}
+	}
 
-	// 文字の高さを測定
-	IDWriteTextLayout* layout;
-	// IDWriteTextLayout を作成
-	auto testText = L"abcdefghijklnmopqrstuvwxyzABCDEFGHIJKLNMOPQRSTUVWXYZあいうえお漢字汉字繁體字";
-	auto result = factory->CreateTextLayout(testText, static_cast<UINT32>(wcslen(testText)), textFormat, 100000000, 1000, &layout);
-	if (SUCCEEDED(result)) {
-		DWRITE_TEXT_METRICS metrics;
-		layout->GetMetrics(&metrics);
-		charHeight = metrics.height;
+	MoveCaret(0);
 
-		// IDWriteTextLayout を破棄
-		layout->Release();
+	// 他のプログラムによる変更を監視する。通知は監視スレッドから届くので UI スレッドに送り直す
+	auto hwnd = this->hwnd;
+	if (!fileWatcher.Start(path, [this, hwnd]() {
+		if (!fileChangePosted.exchange(true)) {
+			PostMessage(hwnd, WM_FILE_CHANGED, 0, reinterpret_cast<LPARAM>(this));
+		}
+	})) {
+		std::wcout << L"Unable to watch file: " << path << std::endl;
+	}
+
+	StartLanguageServer();
+}
+
+bool Editor::RecoverFromJournal(const std::wstring& text, const char* data, std::size_t size, const JournalBase& base) {
+	JournalRecovery recovery;
+	try {
+		recovery = EditJournal::Recover(filePath, data, size, text);
+	} catch (const JournalException& e) {
+		// 記録が壊れていたり今のファイルに合わなかったりしてもファイルは開けるようにする。記録は消さずに残しておく
+		auto aside = EditJournal::SetAside(filePath);
+		MessageBox(hwnd,
+			rswprintf(L"%s の編集の記録を復元できません (%s)。\n記録を %s に移し、ファイルをそのまま開きます。",
+				filePath.c_str(), DecodeUtf8(std::string(e.what())).c_str(), aside.c_str()).c_str(),
+			L"警告", MB_OK | MB_ICONWARNING);
+		return false;
+	}
+
+	if (recovery.baseChanged && !recovery.fromCheckpoint) {
+		// 操作は今のファイルとは別の内容に対するものなので、再生すると文書が壊れる
+		auto aside = EditJournal::SetAside(filePath);
+		MessageBox(hwnd,
+			rswprintf(L"%s には保存されていない編集の記録がありますが、記録した後にファイルが変更されているため復元できません。\n記録を %s に移し、ファイルをそのまま開きます。",
+				filePath.c_str(), aside.c_str()).c_str(),
+			L"警告", MB_OK | MB_ICONWARNING);
+		return false;
+	}
+	// ファイルへの追記を読み込んだ記録しかない場合は、保存していない編集はない
+	if (recovery.text == text || (!recovery.fromCheckpoint && recovery.replayedOperations == 0)) {
+		return false;
+	}
+
+	auto message = recovery.baseChanged
+		? L"%s には保存されていない編集がありますが、その後にファイルが他のプログラムで変更されています。\nチェックポイントから編集中の内容を復元しますか?\n「いいえ」を選ぶと記録を破棄してファイルをそのまま開きます。"
+		: L"%s には前回保存されなかった編集があります。復元しますか?\n「いいえ」を選ぶと記録を破棄してファイルをそのまま開きます。";
+	if (MessageBox(hwnd, rswprintf(message, filePath.c_str()).c_str(), L"確認", MB_YESNO | MB_ICONQUESTION) != IDYES) {
+		return false;
+	}
+
+	SetText(recovery.text);
+	core.lineDiff.SetBase(text);
+	modified = true;
+	try {
+		journal.Resume(filePath, base, recovery, options.journalCommitIntervalMsec, options.journalCheckpointBytes);
+		if (recovery.baseChanged) {
+			// 以降の記録は今のファイルに対するものにする
+			journal.Rebase(recovery.text, base, fileTail.LoadedBytes());
+		} else if (recovery.loadedBytes > recovery.tailOffset) {
+			// 終了した後に追記されていた分も読み込んだので、その後の編集の位置と合うように記録しておく
+			journal.RecordAppend(recovery.tailOffset, data + recovery.tailOffset,
+				static_cast<std::size_t>(size - recovery.tailOffset), recovery.loadedBytes);
+		}
+	} catch (const JournalException& e) {
+		std::wcout << L"Unable to resume journal: " << e.what() << std::endl;
+	}
+
+	return true;
+}
+
+void Editor::OpenStream(const std::wstring& path) {
+	filePath.clear();
+	core.markers.Clear();
+	diagnostics.clear();
+	SetText(L"");
+	modified = false;
+	MoveCaret(0);
+
+	auto hwnd = this->hwnd;
+	if (!streamReader.Start(path, [this, hwnd]() {
+		PostMessage(hwnd, WM_STREAM_RECEIVED, 0, reinterpret_cast<LPARAM>(this));
+	})) {
+		throw EditorException("Unable to read stream: '" + EncodeUtf8(path) + "'");
+	}
+}
+
+void Editor::SaveFile() {
+	if (filePath.empty()) {
+		return;
+	}
+
+	// 不正なバイト列を置換文字にして読み込んだ場合は、保存すると元のバイト列が失われる
+	if (fileTail.InvalidCount() > 0 && MessageBox(hwnd,
+		rswprintf(L"%s には UTF-8 として正しくないバイト列があり、置換文字 (U+FFFD) にして読み込んでいます。\n保存すると元のバイト列は失われます。保存しますか?", filePath.c_str()).c_str(),
+		L"確認", MB_YESNO | MB_ICONWARNING) != IDYES) {
+		return;
+	}
+
+	// 読み込んだファイルの BOM と改行に戻す。まだ文書に入れていない末尾のバイト列 (途中まで書かれた文字や \r) はそのまま書き戻す
+	std::string bytes;
+	EncodeText(GetText(), fileTail.Format(), bytes);
+	bytes += fileTail.PendingTail();
+	if (!WriteFileAtomically(filePath, bytes)) {
+		MessageBox(hwnd, rswprintf(L"ファイルを保存できませんでした: %s", filePath.c_str()).c_str(), L"エラー", MB_OK | MB_ICONERROR);
+		return;
+	}
+
+	// 自分で保存した内容を他のプログラムによる変更として読み直さないようにする
+	std::wstring saved;
+	fileTail.Reset(filePath, bytes, saved);
+	modified = false;
+	core.lineDiff.MarkSaved();
+
+	// 保存したファイルを基準にジャーナルを作り直す
+	// 作り直す前に終了した場合は、古いジャーナルの元のファイルと合わないので再生されない
+	try {
+		journal.Open(filePath, JournalBase::Of(bytes.data(), bytes.size()), fileTail.LoadedBytes(), options.journalCommitIntervalMsec, options.journalCheckpointBytes);
+	} catch (const JournalException& e) {
+		std::wcout << L"Unable to reopen journal: " << e.what() << std::endl;
 	}
-	
-	// タイマーの設定
-	timers.push_back(&cursorBlinkTimer);
 }
 
 void Editor::SetText(const std::wstring& str) {
-	chars.clear();
+	InvalidateLayout();
+	core.SetText(str, [this](wchar_t character) { return CreateChar(character); });
+	completions.clear();
+	UpdateBracketMatch();
+}
+
+std::wstring Editor::GetText() {
+	return core.GetText();
+}
+
+const std::wstring& Editor::FilePath() {
+	return filePath;
+}
 
-	for (auto& ch : str) {
-		auto character = CreateChar(ch);
-		chars.push_back(character);
+bool Editor::Suspend() {
+	// 保存していない変更がある文書はファイルから読み直せないのでそのまま残す
+	// ファイルは開いたままにして、他のプログラムに置き換えられたり削除されたりしても今の内容を読めるようにする
+	if (suspended || modified || filePath.empty() || !source.Open(filePath)) {
+		return false;
 	}
+
+	suspended = true;
+	dragged = false;
+	horizontalThumbDragged = false;
+	minimapDragged = false;
+
+	// キャレットと選択範囲、スクロール位置、印だけを残す (印は読み直した同じ内容に付いたままになる)
+	// 言語サーバーは終了させ、診断と意味的な字句は再開したときに受け取り直す
+	languageServer.Stop();
+	core.markers.RemoveAll(MarkerKind::Diagnostic);
+	core.markers.RemoveAll(MarkerKind::SemanticToken);
+	std::vector<LspDiagnostic>().swap(diagnostics);
+	core.Release();
+	std::vector<Char>().swap(compositionChars);
+	std::vector<wchar_t>().swap(compositionBuffer);
+	compositionTextPos = -1;
+	compositionStringLength = -1;
+	columns = ColumnIndex(options.columnCheckpointInterval, monospace ? font->CellWidth() : 0);
+	InvalidateLayout();
+	ReleaseBands();
+	ReleaseMinimap();
+	std::vector<WordCandidate>().swap(completions);
+	matchedBracket = -1;
+	matchingBracket = -1;
+	frameArena.Reset();
+	layoutAnchor = NO_ANCHOR;
+	layoutWorkers.Stop();
+
+	return true;
 }
 
-void Editor::AppendChar(wchar_t wchar) {
-	auto character = CreateChar(wchar);
-	chars.push_back(character);
+void Editor::Resume() {
+	if (!suspended) {
+		return;
+	}
+
+	// 休止したときに開いたファイルから読む (その後に置き換えられていても休止したときの内容が読める)
+	// 割り当てられない場合は今のファイルを読む。どちらも読めない場合は空の文書にせずに休止したままにする
+	std::wstring text;
+	if (source.Map()) {
+		fileTail.Reset(filePath, source.Data(), source.Size(), text);
+	} else {
+		std::wcout << L"Unable to map file: " << filePath << std::endl;
+		std::string bytes;
+		if (!ReadFileBytes(filePath, bytes)) {
+			throw EditorException("Unable to read file: '" + EncodeUtf8(filePath) + "'");
+		}
+		fileTail.Reset(filePath, bytes, text);
+	}
+	source.Close();
+	suspended = false;
+
+	auto savedCaret = caret;
+	auto savedSelection = selection;
+	SetText(text);
+
+	auto clamp = [this](int index) { return std::min(std::max(index, 0), static_cast<int>(core.chars.size())); };
+	caret.index = clamp(savedCaret.index);
+	selection.start = clamp(savedSelection.start);
+	selection.end = clamp(savedSelection.end);
+	UpdateBracketMatch();
+
+	// 休止している間に届いた変更の通知は無視しているので、ここで調べ直す
+	OnFileChanged();
+	StartLanguageServer();
+}
 
-	selection.start = static_cast<int>(chars.size());
-	selection.end = static_cast<int>(chars.size());
+bool Editor::IsSuspended() {
+	return suspended;
 }
 
 void Editor::DeleteSelection() {
-	chars.erase(
-		chars.begin() + (selection.start < selection.end ? selection.start : selection.end),
-		chars.begin() + (selection.start < selection.end ? selection.end : selection.start));
+	EraseChars(
+		selection.start < selection.end ? selection.start : selection.end,
+		selection.start < selection.end ? selection.end : selection.start);
 
 	MoveCaret((selection.start < selection.end ? selection.end : selection.start) - abs(selection.end - selection.start));
 }
 
-int Editor::FindIndexByPosition(float x, float y) {
-	int index = 0;
-	for (auto&& character : chars) {
+int Editor::FindIndexByPosition(double x, float y) {
+	// 描画する前に呼ばれた場合は y 座標の行まで配置する
+	if (layoutInvalid) {
+		Layout(0, y + charHeight);
+	}
+
+	if (!options.wordWrap) {
+		// 折り返さない場合は行と列から直接求める
+		if (y < 0 || core.chars.empty()) {
+			return -1;
+		}
+
+		auto row = static_cast<std::size_t>(y / charHeight);
+		if (row >= columns.RowCount()) {
+			return -1;
+		}
+
+		double left;
+		auto line = columns.LineOfRow(row);
+		auto start = core.lineDiff.LineStart(line);
+		auto column = columns.FindColumn(line, start, x, [this](std::size_t i) { return Advance(i); }, &left);
+		auto length = columns.LineLength(line);
+
+		if (column < length) {
+			// 右半分だった場合は次の文字の前
+			if (x > left + Advance(start + column) / 2) {
+				column++;
+			}
+		}
+
+		// 行末より右の場合は改行の前
+		if (column >= length && length > 0 && core.chars[start + length - 1].wchar == '\n') {
+			column = length - 1;
+		}
+
+		return static_cast<int>(start + std::min(column, length));
+	}
+
+	// 同じ行にある可能性がある文字だけを調べる (折りたたんだ行は飛ばす)
+	auto end = LaidOutEnd();
+	auto i = LowerBoundByY(y - charHeight);
+	auto hint = core.folds.FirstHiddenAfter(i);
+	for (; i < end && core.chars[i].y <= y; i = core.folds.NextVisible(i + 1, hint)) {
+		auto& character = core.chars[i];
 		// 同じ行かどうか
 		if (y >= character.y && y <= character.y + charHeight) {
 			if (x >= character.x && x <= character.x + character.width / 2) {
 				// 左半分だった場合
-				return index;
+				return static_cast<int>(i);
 			} else if (x >= character.x + character.width / 2 && x <= character.x + character.width) {
 				// 右半分だった場合
-				return index + 1;
+				return static_cast<int>(i + 1);
 			}
 		}
-
-		index++;
 	}
 
 	return -1;
 }
 
+MemoryReport Editor::GetMemoryUsage() {
+	MemoryReport report;
+
+	// 文字は内容と配置を一緒に持っているので、文字コードの分を文書、残りを配置として数える
+	report.Add(MemoryCategory::Buffer, core.chars.capacity() * sizeof(wchar_t));
+	report.Add(MemoryCategory::Layout, core.chars.capacity() * (sizeof(Char) - sizeof(wchar_t)) + columns.MemoryUsage());
+	report.Add(MemoryCategory::Composition, BytesOf(compositionChars) + BytesOf(compositionBuffer));
+
+	// 画像は 1 ピクセルあたり 4 バイトとして数える
+	for (auto& band : bands) {
+		auto size = band.bitmap->GetSize();
+		report.Add(MemoryCategory::GlyphCache, static_cast<uint64_t>(size.width * size.height) * 4);
+	}
+	if (minimapBitmap) {
+		auto size = minimapBitmap->GetSize();
+		report.Add(MemoryCategory::GlyphCache, static_cast<uint64_t>(size.width * size.height) * 4);
+	}
+	// 文字の幅の表は他の文書と共有しているが、表示している文書の分として数える
+	report.Add(MemoryCategory::GlyphCache, font->MemoryUsage());
+
+	report.Add(MemoryCategory::Undo, journal.MemoryUsage());
+	report.Add(MemoryCategory::Index, core.IndexMemoryUsage());
+	report.Add(MemoryCategory::Scratch, frameArena.MemoryUsage());
+
+	return report;
+}
+
 Char Editor::CreateChar(wchar_t character) {
 	Char ch;
+	// 位置は配置するまで決まらない
+	ch.x = 0;
+	ch.y = 0;
 	ch.wchar = character;
-	
-	// 空白文字でなかったら文字の幅を取得
-	IDWriteTextLayout* layout;
-	// IDWriteTextLayout を作成
-	auto result = factory->CreateTextLayout(&character, 1, textFormat, 100, 100, &layout);
-	if (SUCCEEDED(result)) {
-		DWRITE_TEXT_METRICS metrics;
-		layout->GetMetrics(&metrics);
-		// widthIncludingTrailingWhitespace は空白文字の幅も返す
-		ch.width = metrics.widthIncludingTrailingWhitespace;
+	// 等幅の場合は何マス分かから計算する。それ以外は同じフォントの文書で共有している表から取る (初めて使われた文字だけを測定する)
+	ch.width = monospace ? font->CellWidth() * FontResources::CellsOf(character) : font->WidthOf(character);
+
+	return ch;
+}
+
+void Editor::InsertChars(int index, const std::wstring& text, bool record) {
+	auto allocationsAtStart = HeapAllocationCount();
 
-		// IDWriteTextLayout を破棄
-		layout->Release();
+	// 言語サーバーには編集した範囲だけを送る
+	if (languageServer.IsRunning()) {
+		auto position = LspPositionOf(index);
+		languageServer.Change(LspTextChange{ position, position, text });
 	}
 
-	return ch;
+	// 一時的な配列を作らずに、挿入した場所で測定する
+	// 隠れている行が編集された場合は折りたたみを解除し、そこから配置し直す
+	auto firstLine = core.lineDiff.LineOf(index);
+	auto lineCount = core.lineDiff.LineCount();
+	std::size_t revealedFrom;
+	if (core.Insert(index, text.data(), text.size(), [this](wchar_t character) { return CreateChar(character); }, &revealedFrom)) {
+		InvalidateLayout(std::min<std::size_t>(index, revealedFrom));
+	} else {
+		InvalidateEditedLayout(index, 0, text.size(), firstLine, 1, core.lineDiff.LineCount() + 1 - lineCount);
+	}
+	UpdateBracketMatch();
+
+	// ファイル側の変更を反映しただけの場合は記録しない
+	if (record) {
+		// 編集をジャーナルに記録する
+		modified = true;
+		journal.RecordInsert(index, text.data(), text.size());
+		if (journal.NeedsCheckpoint(core.chars.size())) {
+			journal.Checkpoint(GetText());
+		}
+	}
+
+	editAllocations = HeapAllocationCount() - allocationsAtStart;
+}
+
+void Editor::EraseChars(int start, int end, bool record) {
+	auto allocationsAtStart = HeapAllocationCount();
+
+	// 位置は編集する前の行の索引で求める
+	if (languageServer.IsRunning()) {
+		languageServer.Change(LspTextChange{ LspPositionOf(start), LspPositionOf(end), std::wstring() });
+	}
+
+	auto firstLine = core.lineDiff.LineOf(start);
+	auto removedLines = core.lineDiff.LineOf(end) - firstLine + 1;
+	auto lineCount = core.lineDiff.LineCount();
+	std::size_t revealedFrom;
+	if (core.Erase(start, end, &revealedFrom)) {
+		InvalidateLayout(std::min<std::size_t>(start, revealedFrom));
+	} else {
+		InvalidateEditedLayout(start, end - start, 0, firstLine, removedLines, core.lineDiff.LineCount() + removedLines - lineCount);
+	}
+	UpdateBracketMatch();
+
+	// ファイル側の変更を反映しただけの場合は記録しない
+	if (record) {
+		// 編集をジャーナルに記録する
+		modified = true;
+		journal.RecordErase(start, end - start);
+		if (journal.NeedsCheckpoint(core.chars.size())) {
+			journal.Checkpoint(GetText());
+		}
+	}
+
+	editAllocations = HeapAllocationCount() - allocationsAtStart;
 }
 
 void Editor::ToggleCursorVisible() {
@@ -170,7 +617,15 @@ void Editor::ToggleCursorVisible() {
 }
 
 void Editor::MoveCaret(int index, bool isSelectRange) {
+	// 隠れている行に移動した場合は折りたたみを解除する
+	FoldRange hiddenRange;
+	if (core.folds.HiddenAt(index, &hiddenRange)) {
+		core.folds.Reveal(index);
+		InvalidateFolds(hiddenRange.start);
+	}
+
 	caret.index = index;
+	scrollToCaret = true;
 
 	if (isSelectRange) {
 		selection.end = index;
@@ -178,139 +633,1560 @@ void Editor::MoveCaret(int index, bool isSelectRange) {
 		selection.start = index;
 		selection.end = index;
 	}
+
+	// 補完の候補は文字を入力したときだけ表示する
+	completions.clear();
+	UpdateBracketMatch();
 }
 
-void Editor::Render(ID2D1HwndRenderTarget* rt) {
-	if (dragged) {
-		// カーソルの座標を取得
-		POINT pos;
-		GetCursorPos(&pos);
+void Editor::UpdateBracketMatch() {
+	matchedBracket = -1;
+	matchingBracket = -1;
+
+	// キャレットの後ろの文字を優先し、括弧でなければ前の文字を調べる
+	auto index = static_cast<std::size_t>(std::max(caret.index, 0));
+	std::size_t match;
+	if (index < core.chars.size() && core.brackets.FindMatch(index, &match)) {
+		matchedBracket = static_cast<int>(index);
+		matchingBracket = static_cast<int>(match);
+	} else if (index > 0 && index <= core.chars.size() && core.brackets.FindMatch(index - 1, &match)) {
+		matchedBracket = static_cast<int>(index - 1);
+		matchingBracket = static_cast<int>(match);
+	}
+}
 
-		// スクリーン座標なのでクライアント座標に変換
-		ScreenToClient(hwnd, &pos);
+void Editor::UpdateCompletions() {
+	completions.clear();
+	completionSelected = 0;
+	if (options.completionCandidates == 0 || selection.start != selection.end) {
+		return;
+	}
 
-		// カーソルの位置の文字のインデックスを検索
-		int index = FindIndexByPosition(static_cast<float>(pos.x), static_cast<float>(pos.y));
-		if (index != -1) {
-			MoveCaret(index, true);
+	// 単語の途中では補完しない
+	auto end = std::min(static_cast<std::size_t>(caret.index), core.chars.size());
+	if (end < core.chars.size() && WordIndex::IsWordChar(core.chars[end].wchar)) {
+		return;
+	}
+
+	auto start = end;
+	while (start > 0 && end - start < WordIndex::MAX_WORD_LENGTH && WordIndex::IsWordChar(core.chars[start - 1].wchar)) {
+		start--;
+	}
+	if (end - start < WordIndex::MIN_WORD_LENGTH) {
+		return;
+	}
+
+	ArenaVector<wchar_t> prefix{ ArenaAllocator<wchar_t>(&frameArena) };
+	for (auto i = start; i < end; i++) {
+		prefix.push_back(core.chars[i].wchar);
+	}
+	completionPrefixLength = prefix.size();
+	core.wordIndex.Complete(prefix.data(), prefix.size(), options.completionCandidates, completions);
+}
+
+void Editor::AcceptCompletion() {
+	auto suffix = completions[completionSelected].word.substr(completionPrefixLength);
+	completions.clear();
+
+	// マクロには挿入した文字として記録する
+	if (macroRecording) {
+		for (auto character : suffix) {
+			macroEvents.push_back(MacroEvent::Char(character));
 		}
 	}
 
-	ID2D1SolidColorBrush* brush;
-	ID2D1SolidColorBrush* compositionCharBrush = nullptr;
-	ID2D1SolidColorBrush* selectionBrush = nullptr;
-	HRESULT hr = rt->CreateSolidColorBrush(ColorF(ColorF::Black), &brush);
+	InsertChars(selection.end, suffix);
+	MoveCaret(caret.index + static_cast<int>(suffix.size()));
+}
 
-	if (SUCCEEDED(hr)) {
-		hr = rt->CreateSolidColorBrush(ColorF(ColorF::LightGray), &compositionCharBrush);
+void Editor::JumpToBracket(bool isSelectRange) {
+	// 括弧の上にある場合は対応する括弧へ、そうでなければ囲んでいる開き括弧へ移動する
+	if (matchingBracket != -1) {
+		MoveCaret(matchingBracket, isSelectRange);
+		return;
 	}
 
-	if (SUCCEEDED(hr)) {
-		hr = rt->CreateSolidColorBrush(ColorF(ColorF::CornflowerBlue), &selectionBrush);
+	std::size_t open, close;
+	if (core.brackets.FindEnclosing(static_cast<std::size_t>(std::max(caret.index, 0)), &open, &close)) {
+		MoveCaret(static_cast<int>(open), isSelectRange);
 	}
+}
 
-	if (SUCCEEDED(hr)) {
+void Editor::ToggleFold() {
+	auto index = std::min(static_cast<std::size_t>(std::max(caret.index, 0)), core.chars.size());
+	auto line = core.lineDiff.LineOf(index);
+	if (line + 1 >= core.lineDiff.LineCount()) {
+		return;
+	}
+
+	// 見出しの行の次の行から隠す。すでに折りたたんでいる場合は解除する
+	auto start = core.lineDiff.LineStart(line + 1);
+	if (core.folds.Unfold(start)) {
+		InvalidateFolds(start);
+		return;
+	}
+
+	std::size_t end;
+	if (FindFoldRegion(line, &end) && core.folds.Fold(start, end)) {
+		InvalidateFolds(start);
+	}
+}
+
+bool Editor::FindFoldRegion(std::size_t line, std::size_t* end) {
+	// 行の後ろにある開き括弧から、対応する閉じ括弧が 2 行以上後ろにあるものを探す (閉じ括弧の行は表示したままにする)
+	auto lineStart = core.lineDiff.LineStart(line);
+	for (auto i = core.lineDiff.LineStart(line + 1); i > lineStart; i--) {
+		std::size_t match;
+		if (core.brackets.FindMatch(i - 1, &match) && match > i - 1) {
+			auto closeLine = core.lineDiff.LineOf(match);
+			if (closeLine > line + 1) {
+				*end = core.lineDiff.LineStart(closeLine);
+				return true;
+			}
+		}
+	}
+
+	// 括弧がなければ、見出しの行より深く字下げされた行が続く範囲 (空白だけの行は続きとみなす)
+	auto indent = IndentOf(line);
+	if (indent < 0) {
+		return false;
+	}
+
+	auto last = line;
+	for (auto next = line + 1; next < core.lineDiff.LineCount(); next++) {
+		auto nextIndent = IndentOf(next);
+		if (nextIndent < 0) {
+			continue;
+		}
+		if (nextIndent <= indent) {
+			break;
+		}
+		last = next;
+	}
+
+	if (last == line) {
+		return false;
+	}
+
+	// 最後に続く空白だけの行は隠さない
+	*end = last + 1 < core.lineDiff.LineCount() ? core.lineDiff.LineStart(last + 1) : core.chars.size();
+	return true;
+}
+
+int Editor::IndentOf(std::size_t line) {
+	int width = 0;
+	for (auto i = core.lineDiff.LineStart(line); i < core.chars.size(); i++) {
+		switch (core.chars[i].wchar) {
+		case ' ':
+			width++;
+			break;
+		case '\t':
+			width = (width / TAB_INDENT + 1) * TAB_INDENT;
+			break;
+		case '\n':
+			return -1;
+		default:
+			return width;
+		}
+	}
+
+	return -1;
+}
+
+void Editor::InvalidateFolds(std::size_t from) {
+	// 幅が変わる前の一番上の文字が隠れている場合があるので使わない
+	// 全体の高さは次に配置するときに隠れていない文字の数から見積もり直す
+	layoutAnchor = NO_ANCHOR;
+	InvalidateLayout(from);
+}
+
+void Editor::ToggleBookmark() {
+	auto index = std::min(static_cast<std::size_t>(std::max(caret.index, 0)), core.chars.size());
+	auto line = core.lineDiff.LineOf(index);
+	auto start = core.lineDiff.LineStart(line);
+	auto end = line + 1 < core.lineDiff.LineCount() ? core.lineDiff.LineStart(line + 1) : core.chars.size() + 1;
+
+	// 行にあるブックマークを外す。なければ行の先頭に付ける
+	ArenaVector<MarkerId> found{ ArenaAllocator<MarkerId>(&frameArena) };
+	core.markers.ForEachInRange(start, end, [&found, start](const Marker& marker) {
+		if (marker.kind == MarkerKind::Bookmark && marker.start >= start) {
+			found.push_back(marker.id);
+		}
+	});
+
+	for (auto id : found) {
+		core.markers.Remove(id);
+	}
+	if (found.empty()) {
+		// 行の先頭に文字を挿入しても、行の内容に付いたままにする
+		core.markers.Add(start, start, MarkerKind::Bookmark, MarkerStickiness::After);
+	}
+}
+
+void Editor::JumpToBookmark(bool isSelectRange) {
+	auto index = std::min(static_cast<std::size_t>(std::max(caret.index, 0)), core.chars.size());
+	auto line = core.lineDiff.LineOf(index);
+	auto from = line + 1 < core.lineDiff.LineCount() ? core.lineDiff.LineStart(line + 1) : core.chars.size() + 1;
+
+	Marker bookmark;
+	if (core.markers.FindFirst(MarkerKind::Bookmark, from, &bookmark) || core.markers.FindFirst(MarkerKind::Bookmark, 0, &bookmark)) {
+		MoveCaret(static_cast<int>(bookmark.start), isSelectRange);
+	}
+}
+
+void Editor::InvalidateLayout(std::size_t from) {
+	layoutInvalidFrom = layoutInvalid ? std::min(layoutInvalidFrom, from) : from;
+	layoutInvalid = true;
+	compositionLayoutFrom = 0;
+}
+
+void Editor::InvalidateEditedLayout(std::size_t index, std::size_t removed, std::size_t inserted, std::size_t firstLine, std::size_t removedLines, std::size_t insertedLines) {
+	auto lineCount = core.lineDiff.LineCount();
+	auto lineStart = [this, lineCount](std::size_t line) { return line < lineCount ? core.lineDiff.LineStart(line) : core.chars.size(); };
+	auto start = lineStart(firstLine);
+
+	// 配置し直す予定の位置が編集された位置より後ろの場合は、編集に合わせてずらす
+	if (layoutInvalid && layoutInvalidFrom > index) {
+		layoutInvalidFrom = layoutInvalidFrom >= index + removed ? layoutInvalidFrom - removed + inserted : index;
+	}
+
+	// 折り返す場合、編集された行がまだ配置されていない場合、折りたたんだ行を含む場合は、編集された位置から配置し直す
+	auto k = core.folds.FirstHiddenAfter(start);
+	if (options.wordWrap || (layoutInvalid && layoutInvalidFrom <= start)
+		|| (k < core.folds.HiddenCount() && core.folds.Hidden(k).start < lineStart(firstLine + insertedLines))) {
+		InvalidateLayout(index);
+		return;
+	}
+
+	// 折り返さない場合は編集された行だけを測り直し、後ろの行は表示する行の番号をずらしてそのまま使う
+	columns.Edit(firstLine, removedLines, insertedLines, index - start, lineStart, [this](std::size_t i) { return Advance(i); });
+
+	// 行数が変わらない場合は測り直した行の描画内容だけを捨てる。変わった場合は下の行がずれるので、それより下をすべて捨てる
+	// まだ測っていない行があればその続きから配置する
+	auto firstRow = columns.RowOf(firstLine);
+	if (insertedLines == removedLines) {
+		InvalidateBands(firstRow * charHeight, (firstRow + insertedLines) * charHeight);
+	} else {
+		InvalidateBands(firstRow * charHeight);
+	}
+	InvalidateLayout(lineStart(columns.LineCount()));
+}
+
+void Editor::InvalidateCompositionLayout(std::size_t from) {
+	// まだ配置していない変更がある場合はそれも含める
+	auto pending = layoutInvalid ? compositionLayoutFrom : from;
+	InvalidateLayout(compositionTextPos);
+	compositionLayoutFrom = std::min(pending, from);
+}
+
+void Editor::Layout(std::size_t untilIndex, float untilY) {
+	// from より前の文字は位置が変わらないので、その続きから配置する
+	auto from = std::min(layoutInvalidFrom, core.chars.size());
+	// 隠れている文字からの場合は、隠れた範囲の先頭 (行の先頭) から配置する
+	FoldRange hiddenRange;
+	if (core.folds.HiddenAt(from, &hiddenRange)) {
+		from = hiddenRange.start;
+	}
+	float fromY = from > 0 ? YOfIndex(core.folds.VisibleBefore(from)) : 0;
+
+	// 指定された範囲がすでに配置されている場合は何もしない
+	if (from > 0 && from < core.chars.size() && from > untilIndex && fromY > untilY) {
+		return;
+	}
+
+	if (from == 0) {
+		maxX = 0;
+	}
+
+	compositionWidth = 0;
+	for (auto& compositionChar : compositionChars) {
+		compositionWidth += compositionChar.width;
+	}
+
+	// end より前の文字を配置し終えた。lastY はその次の文字を置く y 座標
+	std::size_t end;
+	float lastY;
+
+	if (options.wordWrap) {
 		float x = 0;
 		float y = 0;
-		std::size_t i = 0;
-		for (auto& character : chars) {
-			// 未確定文字列を描画
-			if (compositionTextPos != -1 && i == compositionTextPos) {
-				RenderCompositionText(rt, brush, compositionCharBrush, &x, &y);
+		if (from > 0) {
+			auto& last = core.chars[core.folds.VisibleBefore(from)];
+			x = last.x + last.width;
+			y = last.y;
+			if (last.wchar == '\n') {
+				x = 0;
+				y += charHeight;
+			}
+		}
+
+		// 未確定文字列の変わっていない部分はそのまま使い、その続きから配置する
+		auto compositionFrom = from == compositionTextPos ? std::min(compositionLayoutFrom, compositionChars.size()) : 0;
+		if (compositionFrom > 0) {
+			auto& last = compositionChars[compositionFrom - 1];
+			x = last.x + last.width;
+			y = last.y;
+		}
+
+		std::size_t i = from;
+		// 行の先頭からの場合は、行ごとに独立して折り返せるのでスレッドに分ける (未確定文字列がある場合を除く)
+		if (x == 0 && compositionFrom == 0 && (compositionChars.empty() || (compositionTextPos != -1 && static_cast<std::size_t>(compositionTextPos) < from))) {
+			i = WrapLines(from, untilIndex, untilY, &x, &y);
+		}
+
+		// 折りたたんだ行は飛ばす
+		auto hint = core.folds.FirstHiddenAfter(i);
+		for (i = core.folds.NextVisible(i, hint); i <= core.chars.size(); i = core.folds.NextVisible(i + 1, hint)) {
+			// 指定された範囲より後ろは次に呼ばれたときに続きから配置する
+			if (i > from && i < core.chars.size() && i > untilIndex && y > untilY) {
+				break;
 			}
 
-			// 選択範囲を描画
-			if ((selection.start < selection.end && i >= selection.start && i < selection.end) ||
-				(selection.start > selection.end && i < selection.start && i >= selection.end)) {
-				rt->FillRectangle(
-					RectF(x, y + offsetY, x + character.width + 1, y + offsetY + charHeight + 1),
-					selectionBrush);
+			// 未確定文字列は挿入位置に並べる
+			if (compositionTextPos != -1 && i == compositionTextPos) {
+				for (auto j = compositionFrom; j < compositionChars.size(); j++) {
+					LayoutChar(&compositionChars[j], &x, &y);
+				}
 			}
 
-			// 文字を描画
-			RenderChar(rt, &character, &x, &y, brush);
+			if (i < core.chars.size()) {
+				LayoutChar(&core.chars[i], &x, &y);
 
-			maxY = y;
-			if (x > maxX) {
-				maxX = x;
+				if (x > maxX) {
+					maxX = x;
+				}
 			}
+		}
 
-			i++;
+		end = std::min(i, core.chars.size());
+		if (end == core.chars.size()) {
+			textEndX = x;
+			textEndY = y;
+		}
+		lastY = y;
+	} else {
+		// 折り返さない場合は行ごとに幅のチェックポイントを記録する (文字ごとの位置は書き込まない)
+		// 行の先頭は文書の行の索引から取り、from を含む行の from より前はそのまま使う
+		auto advance = [this](std::size_t i) { return Advance(i); };
+		auto lineCount = core.lineDiff.LineCount();
+		auto line = core.lineDiff.LineOf(from);
+		auto column = from - core.lineDiff.LineStart(line);
+		if (line < columns.LineCount()) {
+			columns.Truncate(line, core.lineDiff.LineStart(line), column, advance);
+		} else {
+			// まだ測っていない行からの場合は、測った行の続きから測る
+			line = columns.LineCount();
+		}
+		if (columns.LineCount() == line) {
+			column = 0;
 		}
 
-		// 未確定文字列が末尾にあった場合
-		if (compositionTextPos == chars.size()) {
-			RenderCompositionText(rt, brush, compositionCharBrush, &x, &y);
+		auto hint = core.folds.FirstHiddenAfter(line < lineCount ? core.lineDiff.LineStart(line) : core.chars.size());
+		for (; line < lineCount; line++, column = 0) {
+			auto start = core.lineDiff.LineStart(line);
+			if (column == 0) {
+				// 指定された範囲より後ろは次に呼ばれたときに行の先頭から配置する
+				// 改行で終わる場合の最後の空の行は、末尾まで配置したことになるように必ず追加する
+				if (start > from && start < core.chars.size() && start > untilIndex && columns.RowCount() * charHeight > untilY) {
+					break;
+				}
+
+				// 折りたたんだ行は幅のない行として追加する
+				auto visible = core.folds.NextVisible(start, hint);
+				if (visible != start) {
+					// 文書の末尾まで隠れている場合は、末尾から始まる空の行だけを表示する
+					auto next = visible < core.chars.size() || core.lineDiff.LineStart(lineCount - 1) == visible ? core.lineDiff.LineOf(visible) : lineCount;
+					for (; line < next; line++) {
+						columns.BeginLine(true);
+					}
+					line--;
+					continue;
+				}
+				columns.BeginLine();
+			}
+
+			auto lineEnd = line + 1 < lineCount ? core.lineDiff.LineStart(line + 1) : core.chars.size();
+			for (auto i = start + column; i < lineEnd; i++) {
+				columns.Append(Advance(i));
+			}
 		}
 
-		// キャレットを描画
-		if (caret.visible) {
-			if (chars.empty()) {
-				// 文字を描画していない場合は左上に描画
-				RenderCursor(rt, 0, 0, brush);
-				caret.x = 0;
-				caret.y = 0;
-			} else if (caret.index >= static_cast<signed int>(chars.size())) {
-				// 末尾を選択している場合
-				RenderCursor(rt, x, y, brush);
-				caret.x = x;
-				caret.y = y;
-			} else {
-				auto character = chars[caret.index];
-				RenderCursor(rt, character.x, character.y, brush);
-				caret.x = character.x;
-				caret.y = character.y;
+		end = line < lineCount ? core.lineDiff.LineStart(line) : core.chars.size();
+		float y = (std::max<std::size_t>(columns.RowCount(), 1) - 1) * charHeight;
+
+		// 未確定文字列は挿入位置の文字の前に並べる
+		if (compositionTextPos != -1 && static_cast<std::size_t>(compositionTextPos) <= end) {
+			auto x = XOfIndex(compositionTextPos) - (compositionTextPos < core.chars.size() ? compositionWidth : 0);
+			for (auto& compositionChar : compositionChars) {
+				compositionChar.x = static_cast<float>(x);
+				compositionChar.y = YOfIndex(compositionTextPos);
+				x += compositionChar.width;
 			}
 		}
 
-		// スクロールバーを描画
-		RenderScrollbar(rt);
+		if (end == core.chars.size()) {
+			textEndX = static_cast<float>(XOfIndex(core.chars.size()));
+			textEndY = y;
+		}
+		maxX = static_cast<float>(columns.MaxWidth());
+		lastY = y;
+	}
 
-		brush->Release();
-		compositionCharBrush->Release();
-		selectionBrush->Release();
+	if (end < core.chars.size()) {
+		// 途中までしか配置していない場合は、残りの文字も同じ割合で並んでいるとして全体の高さを見積もる
+		// 折りたたんで隠れている文字は数えない
+		auto visibleEnd = end - core.folds.HiddenCharsBefore(end);
+		auto visibleCount = core.chars.size() - core.folds.HiddenCharsBefore(core.chars.size());
+		maxY = visibleEnd > 0 ? static_cast<float>(static_cast<double>(lastY) * visibleCount / visibleEnd) : lastY;
+		layoutInvalidFrom = end;
+		// 未確定文字列の前で止めた場合は、続きを配置するときに未確定文字列も並べ直す
+		compositionLayoutFrom = compositionTextPos != -1 && end <= static_cast<std::size_t>(compositionTextPos) ? 0 : compositionChars.size();
+	} else {
+		maxY = lastY;
+		layoutInvalid = false;
+		compositionLayoutFrom = compositionChars.size();
 	}
+
+	// 配置が変わった位置より下にある描画内容は使えない
+	InvalidateBands(fromY);
 }
 
-void Editor::RenderChar(ID2D1HwndRenderTarget* rt, Char* const character, float* const x, float* const y, ID2D1Brush* brush) {
-	auto size = rt->GetSize();
+std::size_t Editor::WrapLines(std::size_t from, std::size_t untilIndex, float untilY, float* x, float* y) {
+	// 少ない場合はスレッドに分けるほうが遅い
+	if (core.chars.size() - from < PARALLEL_WRAP_CHARS * 2) {
+		return from;
+	}
+
+	if (!layoutWorkers.IsRunning()) {
+		auto threads = options.layoutThreads > 0 ? options.layoutThreads : std::thread::hardware_concurrency();
+		if (threads <= 1) {
+			return from;
+		}
+		// 呼び出したスレッドも分担する
+		layoutWorkers.Start(threads - 1);
+	}
+
+	struct Chunk {
+		std::size_t start;
+		std::size_t end;
+		// 範囲の先頭を (0, 0) として配置し終えた位置
+		float x;
+		float y;
+		float maxX;
+		float offsetY;
+	};
+	ArenaVector<Chunk> chunks{ ArenaAllocator<Chunk>(&frameArena) };
+	chunks.resize(layoutWorkers.ThreadCount() + 1);
+
+	auto i = from;
+	while (i < core.chars.size() && !(i > untilIndex && *y > untilY)) {
+		// 決まった文字数ごとに、その前の行の先頭で区切る
+		auto batchEnd = std::min(core.chars.size(), i + chunks.size() * PARALLEL_WRAP_CHARS);
+		auto start = i;
+		for (std::size_t k = 0; k < chunks.size(); k++) {
+			auto end = std::min(batchEnd, i + (k + 1) * PARALLEL_WRAP_CHARS);
+			while (end < core.chars.size() && end > start && core.chars[end - 1].wchar != '\n') {
+				end--;
+			}
+			chunks[k].start = start;
+			chunks[k].end = end;
+			start = end;
+		}
+
+		// 1 行が長すぎて区切れない場合は 1 文字ずつ配置する側に任せる
+		if (start == i) {
+			break;
+		}
+
+		layoutWorkers.Run(chunks.size(), [this, &chunks](std::size_t k) {
+			auto& chunk = chunks[k];
+			float chunkX = 0;
+			float chunkY = 0;
+			float chunkMaxX = 0;
+			// 折りたたんだ行は飛ばす (隠れた範囲は行の先頭から始まるので、範囲をまたいでも x は 0 から続く)
+			auto hint = core.folds.FirstHiddenAfter(chunk.start);
+			for (auto j = core.folds.NextVisible(chunk.start, hint); j < chunk.end; j = core.folds.NextVisible(j + 1, hint)) {
+				LayoutChar(&core.chars[j], &chunkX, &chunkY);
+				chunkMaxX = std::max(chunkMaxX, chunkX);
+			}
+			chunk.x = chunkX;
+			chunk.y = chunkY;
+			chunk.maxX = chunkMaxX;
+		});
+
+		// 前の範囲までの高さを足して文書の中の位置にする
+		for (auto& chunk : chunks) {
+			chunk.offsetY = *y;
+			if (chunk.start < chunk.end) {
+				*x = chunk.x;
+				*y += chunk.y;
+				maxX = std::max(maxX, chunk.maxX);
+			}
+		}
+
+		layoutWorkers.Run(chunks.size(), [this, &chunks](std::size_t k) {
+			auto& chunk = chunks[k];
+			if (chunk.offsetY != 0) {
+				auto hint = core.folds.FirstHiddenAfter(chunk.start);
+				for (auto j = core.folds.NextVisible(chunk.start, hint); j < chunk.end; j = core.folds.NextVisible(j + 1, hint)) {
+					core.chars[j].y += chunk.offsetY;
+				}
+			}
+		});
+
+		i = start;
+	}
+
+	return i;
+}
+
+std::size_t Editor::LaidOutEnd() {
+	return layoutInvalid ? std::min(layoutInvalidFrom, core.chars.size()) : core.chars.size();
+}
+
+bool Editor::IsLaidOut(std::size_t index) {
+	return !layoutInvalid || index < LaidOutEnd();
+}
+
+void Editor::LayoutChar(Char* const character, float* const x, float* const y) {
+	// 文字が画面からはみでる場合は y 座標を更新する
+	if (*x + character->width >= layoutWidth) {
+		*x = 0;
+		*y += charHeight;
+	}
+
+	character->x = *x;
+	character->y = *y;
+	*x += character->width;
+
+	// 改行だったら y 座標を更新する
+	if (character->wchar == '\n') {
+		*x = 0;
+		*y += charHeight;
+	}
+}
+
+float Editor::Advance(std::size_t index) {
+	// 未確定文字列は挿入位置の文字の幅に含める
+	auto width = monospace ? font->CellWidth() * FontResources::CellsOf(core.chars[index].wchar) : core.chars[index].width;
+	return width + (index == compositionTextPos ? compositionWidth : 0);
+}
+
+double Editor::XOfIndex(std::size_t index) {
+	// 隠れている文字は折りたたんだ範囲の次の行の先頭にあるものとする
+	index = core.folds.SkipHidden(index);
+	if (options.wordWrap) {
+		return index < core.chars.size() ? core.chars[index].x : textEndX;
+	}
+
+	// まだ測っていない行は行頭にあるものとする
+	auto line = core.lineDiff.LineOf(index);
+	auto start = core.lineDiff.LineStart(line);
+	auto x = line < columns.LineCount() ? columns.PositionOf(line, start, index - start, [this](std::size_t i) { return Advance(i); }) : 0;
+
+	return x + (index == compositionTextPos ? compositionWidth : 0);
+}
+
+float Editor::YOfIndex(std::size_t index) {
+	index = core.folds.SkipHidden(index);
+	if (options.wordWrap) {
+		return index < core.chars.size() ? core.chars[index].y : textEndY;
+	}
+
+	return columns.RowOf(core.lineDiff.LineOf(index)) * charHeight;
+}
+
+float Editor::YOfLine(std::size_t line) {
+	// 最後の行より後ろの場合は最後の行の下端
+	if (line >= core.lineDiff.LineCount()) {
+		return textEndY + charHeight;
+	}
+
+	return YOfIndex(core.lineDiff.LineStart(line));
+}
+
+void Editor::VisibleLines(float top, float bottom, std::size_t* firstLine, std::size_t* lastLine) {
+	if (options.wordWrap) {
+		*firstLine = core.lineDiff.LineOf(LowerBoundByY(top));
+		*lastLine = core.lineDiff.LineOf(LowerBoundByY(bottom));
+	} else {
+		// 折りたたんだ行は表示する行に数えないので、表示する行の番号から文書の行を求める
+		// まだ配置していない行は最後に配置した行から続いているものとする
+		*firstLine = columns.LineOfRow(static_cast<std::size_t>(std::max(0.0f, floorf(top / charHeight))));
+		*lastLine = columns.LineOfRow(static_cast<std::size_t>(std::max(0.0f, ceilf(bottom / charHeight))));
+	}
+}
+
+void Editor::VisibleRange(float top, float bottom, std::size_t* from, std::size_t* to) {
+	std::size_t firstLine, lastLine;
+	VisibleLines(top, bottom, &firstLine, &lastLine);
+	auto lines = core.lineDiff.LineCount();
+	*from = firstLine < lines ? core.lineDiff.LineStart(firstLine) : core.chars.size();
+	*to = lastLine + 1 < lines ? core.lineDiff.LineStart(lastLine + 1) : core.chars.size() + 1;
+}
+
+template <typename Func>
+void Editor::ForEachVisibleChar(double left, double right, float top, float bottom, Func func) {
+	if (options.wordWrap) {
+		// 折り返す場合は横にはみ出さないので y 座標だけで探す (折りたたんだ行は飛ばす)
+		auto end = LaidOutEnd();
+		auto i = LowerBoundByY(top);
+		auto hint = core.folds.FirstHiddenAfter(i);
+		for (; i < end && core.chars[i].y < bottom; i = core.folds.NextVisible(i + 1, hint)) {
+			func(i, static_cast<double>(core.chars[i].x), core.chars[i].y);
+		}
+		return;
+	}
+
+	// 折り返さない場合は行ごとにチェックポイントから表示されている列まで移動する
+	auto firstRow = static_cast<std::size_t>(std::max(0.0f, floorf(top / charHeight)));
+	auto lastRow = std::min(columns.RowCount(), static_cast<std::size_t>(std::max(0.0f, ceilf(bottom / charHeight))));
+	auto advance = [this](std::size_t i) { return Advance(i); };
+
+	for (auto row = firstRow; row < lastRow; row++) {
+		double x;
+		auto line = columns.LineOfRow(row);
+		auto start = core.lineDiff.LineStart(line);
+		auto column = columns.FindColumn(line, start, left, advance, &x);
+		auto length = columns.LineLength(line);
+		auto y = row * charHeight;
+
+		for (; column < length && x < right; column++) {
+			auto i = start + column;
+			func(i, x + (i == compositionTextPos ? compositionWidth : 0), y);
+			x += Advance(i);
+		}
+	}
+}
+
+std::size_t Editor::LowerBoundByY(float y) {
+	// chars は y 座標の昇順に並んでいる (まだ配置していない文字は除く)
+	// 隠れている文字は位置が決まっていないので、その隠れた範囲の後ろの文字の位置で比べる
+	auto end = LaidOutEnd();
+	std::size_t low = 0;
+	std::size_t high = end;
+	while (low < high) {
+		auto mid = low + (high - low) / 2;
+		auto visible = core.folds.SkipHidden(mid);
+		if (visible < end && core.chars[visible].y < y) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return core.folds.SkipHidden(low);
+}
+
+void Editor::UpdateScroll() {
+	// 目標の位置に少しずつ近づける
+	auto approach = [this](double current, double target) {
+		auto distance = target - current;
+		if (!options.smoothScroll || fabs(distance) < 1.0) {
+			return target;
+		}
+
+		// ぼやけないように整数の位置に合わせる
+		auto step = distance * 0.35;
+		if (fabs(step) < 1.0) {
+			step = distance > 0 ? 1.0 : -1.0;
+		}
+		return round(current + step);
+	};
+
+	offsetX = approach(offsetX, targetOffsetX);
+	offsetY = static_cast<float>(approach(offsetY, targetOffsetY));
+}
+
+void Editor::ScrollHorizontally(double amount) {
+	// 最も長い行の末尾が画面の中央に来るところまでスクロールできる
+	auto viewWidth = layoutWidth;
+	auto maxOffset = std::max(0.0, columns.MaxWidth() - viewWidth / 2);
+
+	targetOffsetX = std::min(0.0, std::max(-maxOffset, targetOffsetX - amount));
+}
+
+void Editor::ResizeView(float width, float height) {
+	verticalScrollbar.bar = RectE(width - 10, 0, 10, height);
+	// 縮小表示は垂直スクロールバーの左に表示する
+	minimapBar = RectE(verticalScrollbar.bar.x - options.minimapWidth, 0, options.minimapWidth, height);
+	horizontalScrollbar.bar = RectE(0, height - 10, minimapBar.x, 10);
+
+	// 文字は左端の変更された行の印の右から縮小表示の左まで表示する
+	// 幅が変わった場合は折り返し位置が変わるので配置し直す
+	if (layoutWidth == minimapBar.x - options.gutterWidth) {
+		return;
+	}
+
+	// ウィンドウの端をドラッグしている間に表示している場所がずれないように、一番上の文字を覚えておく
+	if (options.wordWrap && layoutAnchor == NO_ANCHOR) {
+		auto top = LowerBoundByY(-offsetY);
+		if (top > 0 && top < LaidOutEnd()) {
+			layoutAnchor = top;
+		}
+	}
+
+	layoutWidth = minimapBar.x - options.gutterWidth;
+	ReleaseBands();
+	InvalidateLayout();
+}
+
+void Editor::ScrollToCaret() {
+	if (core.chars.empty()) {
+		return;
+	}
+
+	auto index = std::min(static_cast<std::size_t>(caret.index), core.chars.size());
+
+	// キャレットの位置までは配置が終わっている必要がある
+	if (!IsLaidOut(index)) {
+		Layout(index, 0);
+	}
+
+	// キャレットの行が画面の外にある場合は表示される位置まで垂直方向にスクロールする
+	auto y = YOfIndex(index);
+	auto viewHeight = options.wordWrap ? verticalScrollbar.bar.height : horizontalScrollbar.bar.y;
+	if (y + targetOffsetY < 0) {
+		targetOffsetY = -y;
+	} else if (y + charHeight + targetOffsetY > viewHeight) {
+		targetOffsetY = std::min(0.0f, -(y + charHeight - viewHeight));
+	}
+
+	if (options.wordWrap) {
+		return;
+	}
+
+	// キャレットが画面の外にある場合は表示される位置まで水平方向にスクロールする
+	auto x = XOfIndex(index);
+	auto viewWidth = static_cast<double>(layoutWidth);
+	auto margin = std::min(viewWidth / 4, static_cast<double>(options.scrollAmount) * 4);
+
+	if (x + offsetX < 0) {
+		offsetX = targetOffsetX = std::min(0.0, -x + margin);
+	} else if (x + offsetX > viewWidth - options.cursorWidth) {
+		offsetX = targetOffsetX = -(x - viewWidth + margin);
+	}
+}
+
+float Editor::MinimapScale() {
+	// 行が多い場合は文書全体が縮小表示の高さに収まるように縮める
+	auto lines = std::max(core.minimap.LineCount(), static_cast<std::size_t>(1));
+	return std::min(options.minimapLineHeight, minimapBar.height / lines);
+}
+
+void Editor::ScrollToMinimap(float y) {
+	auto line = static_cast<std::size_t>(std::max(0.0f, y - minimapBar.y) / MinimapScale());
+	// その行までは配置が終わっている必要がある
+	auto start = line < core.lineDiff.LineCount() ? core.lineDiff.LineStart(line) : core.chars.size();
+	if (!IsLaidOut(start)) {
+		Layout(start, 0);
+	}
+	auto viewHeight = options.wordWrap ? verticalScrollbar.bar.height : horizontalScrollbar.bar.y;
+	auto top = YOfLine(line) - viewHeight / 2;
+
+	// 掴んでいる間はアニメーションさせずに追従する
+	offsetY = targetOffsetY = -std::min(maxY, std::max(0.0f, top));
+}
+
+bool Editor::IsAnimating() {
+	// 配置が終わっていない場合もフレームごとに続きを配置する
+	return offsetX != targetOffsetX || offsetY != targetOffsetY || layoutInvalid;
+}
+
+void Editor::ToggleWordWrap() {
+	options.wordWrap = !options.wordWrap;
+	offsetX = targetOffsetX = 0;
+	InvalidateLayout();
+}
+
+void Editor::InvalidateBands(float fromY) {
+	auto bandHeight = charHeight * options.renderBandLines;
+	for (auto& band : bands) {
+		if ((band.index + 1) * bandHeight > fromY) {
+			band.index = -1;
+		}
+	}
+}
+
+void Editor::InvalidateBands(float fromY, float toY) {
+	auto bandHeight = charHeight * options.renderBandLines;
+	for (auto& band : bands) {
+		if ((band.index + 1) * bandHeight > fromY && band.index * bandHeight < toY) {
+			band.index = -1;
+		}
+	}
+}
+
+void Editor::ReleaseBands() {
+	for (auto& band : bands) {
+		band.bitmap->Release();
+		band.target->Release();
+	}
+
+	bands.clear();
+}
+
+void Editor::TrimBands(std::size_t capacity) {
+	while (bands.size() > capacity) {
+		// このフレームで使ったものは解放しない
+		auto oldest = bands.end();
+		for (auto itr = bands.begin(); itr != bands.end(); itr++) {
+			if (itr->lastUsedFrame != frameCount && (oldest == bands.end() || itr->lastUsedFrame < oldest->lastUsedFrame)) {
+				oldest = itr;
+			}
+		}
+
+		if (oldest == bands.end()) {
+			break;
+		}
+
+		oldest->bitmap->Release();
+		oldest->target->Release();
+		bands.erase(oldest);
+	}
+}
+
+void Editor::ReleaseMinimap() {
+	if (minimapTarget) {
+		minimapBitmap->Release();
+		minimapTarget->Release();
+		minimapBitmap = nullptr;
+		minimapTarget = nullptr;
+	}
+}
+
+ID2D1Bitmap* Editor::GetBand(ID2D1RenderTarget* rt, int index, int column, std::size_t capacity, ID2D1Brush* brush) {
+	for (auto& band : bands) {
+		if (band.index == index && band.column == column) {
+			band.lastUsedFrame = frameCount;
+			return band.bitmap;
+		}
+	}
+
+	// キャッシュにない場合は新しく描画する
+	auto size = rt->GetSize();
+	RenderBand* band = nullptr;
+	if (bands.size() < capacity) {
+		RenderBand newBand;
+		if (FAILED(rt->CreateCompatibleRenderTarget(SizeF(size.width, charHeight * options.renderBandLines), &newBand.target))) {
+			return nullptr;
+		}
+		if (FAILED(newBand.target->GetBitmap(&newBand.bitmap))) {
+			newBand.target->Release();
+			return nullptr;
+		}
+
+		// 背景が透明なので ClearType は使えない
+		newBand.target->SetTextAntialiasMode(D2D1_TEXT_ANTIALIAS_MODE_GRAYSCALE);
+		bands.push_back(newBand);
+		band = &bands.back();
+	} else {
+		// 最も長い間使われていないものを再利用する (このフレームで使ったものは除く)
+		for (auto& candidate : bands) {
+			if (candidate.lastUsedFrame != frameCount && (!band || candidate.lastUsedFrame < band->lastUsedFrame)) {
+				band = &candidate;
+			}
+		}
+
+		if (!band) {
+			return nullptr;
+		}
+	}
+
+	band->index = index;
+	band->column = column;
+	band->lastUsedFrame = frameCount;
+
+	// 帯の範囲にある文字だけを描画する
+	float top = index * charHeight * options.renderBandLines;
+	float bottom = top + charHeight * options.renderBandLines;
+	double left = static_cast<double>(column) * size.width;
+	double right = left + size.width;
+
+	band->target->BeginDraw();
+	band->target->Clear(ColorF(0, 0, 0, 0));
+
+	// 帯の範囲にある意味的な字句 (開始位置の順)
+	ArenaVector<Marker> tokens{ ArenaAllocator<Marker>(&frameArena) };
+	std::size_t from, to;
+	VisibleRange(top, bottom, &from, &to);
+	core.markers.ForEachInRange(from, to, [&](const Marker& marker) {
+		if (marker.kind == MarkerKind::SemanticToken && marker.value < TOKEN_STYLE_COUNT) {
+			tokens.push_back(marker);
+		}
+	});
+
+	// i 番目の文字の字句の色。ブラシは使う色の分だけ作る
+	ID2D1SolidColorBrush* tokenBrushes[TOKEN_STYLE_COUNT] = {};
+	auto styleOf = [&](std::size_t i) -> uint16_t {
+		auto itr = std::upper_bound(tokens.begin(), tokens.end(), i, [](std::size_t i, const Marker& token) {
+			return i < token.start;
+		});
+		return itr != tokens.begin() && i < (itr - 1)->end ? (itr - 1)->value : 0;
+	};
+	auto brushOf = [&](uint16_t style) -> ID2D1Brush* {
+		if (style != 0 && !tokenBrushes[style]) {
+			band->target->CreateSolidColorBrush(ColorF(TOKEN_STYLES[style].color), &tokenBrushes[style]);
+		}
+		return tokenBrushes[style] ? static_cast<ID2D1Brush*>(tokenBrushes[style]) : brush;
+	};
+
+	// 空白で区切った同じ色の文字列ごとにまとめて描画する
+	ArenaVector<std::size_t> runIndices{ ArenaAllocator<std::size_t>(&frameArena) };
+	ArenaVector<float> runPositions{ ArenaAllocator<float>(&frameArena) };
+	float runY = 0;
+	uint16_t runStyle = 0;
+	auto flushRun = [&]() {
+		if (!runIndices.empty()) {
+			RenderRun(band->target, runIndices.data(), runPositions.data(), runIndices.size(), runY, brushOf(runStyle));
+			runIndices.clear();
+			runPositions.clear();
+		}
+	};
+
+	ForEachVisibleChar(left, right, top, bottom, [&](std::size_t i, double x, float y) {
+		// 空白と制御文字は何も描画しない
+		auto character = core.chars[i].wchar;
+		if (character <= L' ' || character == L'\u3000') {
+			flushRun();
+			return;
+		}
+
+		auto style = tokens.empty() ? 0 : styleOf(i);
+		if (!runIndices.empty() && (i != runIndices.back() + 1 || y - top != runY || style != runStyle || runIndices.size() >= MAX_RUN_LENGTH)) {
+			flushRun();
+		}
+
+		runIndices.push_back(i);
+		runPositions.push_back(static_cast<float>(x - left));
+		runY = y - top;
+		runStyle = style;
+	});
+	flushRun();
+
+	// ブラシは描画が終わってから解放する
+	auto drawn = SUCCEEDED(band->target->EndDraw());
+	for (auto tokenBrush : tokenBrushes) {
+		if (tokenBrush) {
+			tokenBrush->Release();
+		}
+	}
+
+	if (!drawn) {
+		band->index = -1;
+		return nullptr;
+	}
+
+	return band->bitmap;
+}
+
+void Editor::Render(ID2D1RenderTarget* rt) {
+	auto size = rt->GetSize();
+	frameCount++;
+	auto allocationsAtStart = HeapAllocationCount();
+
+	// ドラッグ中の選択などを再現できるように、描画のたびにカーソルの位置を記録する
+	if (trace.IsRecording()) {
+		auto pos = CursorPosition();
+		RecordInput(TraceEvent::Type::Frame, 0, static_cast<float>(pos.x), static_cast<float>(pos.y));
+	}
+
+	// 描画先が作り直された場合はキャッシュを破棄する
+	if (bandOwner != rt) {
+		ReleaseBands();
+		ReleaseMinimap();
+		bandOwner = rt;
+	}
+
+	// 通常は OnResize で決まっているが、描画先の大きさが違う場合はそれに合わせる
+	ResizeView(size.width, size.height);
+
+	if (layoutInvalid) {
+		// 幅が変わる前に一番上に表示されていた文字の行を一番上に表示する
+		if (layoutAnchor != NO_ANCHOR) {
+			auto anchor = layoutAnchor;
+			layoutAnchor = NO_ANCHOR;
+			if (anchor < core.chars.size()) {
+				Layout(anchor, 0);
+				offsetY = targetOffsetY = -core.chars[anchor].y;
+			}
+		}
+
+		// 表示される帯の下端までを先に配置し、それより下は 1 フレームに決まった数ずつ配置する
+		// 文書を開き直したときや幅が変わったときも、最初のフレームは表示される範囲だけで済む
+		auto bandHeight = charHeight * options.renderBandLines;
+		auto viewBottom = std::max(-offsetY, -targetOffsetY) + size.height;
+		auto bottom = (floorf(viewBottom / bandHeight) + 1) * bandHeight;
+		Layout(LaidOutEnd() + options.layoutCharsPerFrame, bottom);
+	}
+
+	if (dragged || horizontalThumbDragged || minimapDragged) {
+		// カーソルの座標を取得
+		auto pos = CursorPosition();
+
+		if (horizontalThumbDragged) {
+			// つまみの位置から水平方向のスクロール位置を求める
+			auto track = horizontalScrollbar.bar.width - horizontalScrollbar.thumb.width;
+			auto ratio = track > 0 ? (pos.x - horizontalThumbDragOffset) / track : 0.0f;
+			targetOffsetX = offsetX = 0;
+			ScrollHorizontally(std::min(1.0f, std::max(0.0f, ratio)) * std::max(0.0, columns.MaxWidth() - layoutWidth / 2));
+			offsetX = targetOffsetX;
+		} else if (minimapDragged) {
+			ScrollToMinimap(static_cast<float>(pos.y));
+		} else {
+			// カーソルの位置の文字のインデックスを検索
+			int index = FindIndexByPosition(pos.x - options.gutterWidth - offsetX, static_cast<float>(pos.y) - offsetY);
+			if (index != -1) {
+				MoveCaret(index, true);
+			}
+		}
+	}
+
+	if (scrollToCaret) {
+		ScrollToCaret();
+		scrollToCaret = false;
+	}
+
+	// スクロールのアニメーションを進める
+	UpdateScroll();
+
+	ID2D1SolidColorBrush* brush;
+	ID2D1SolidColorBrush* compositionCharBrush = nullptr;
+	ID2D1SolidColorBrush* selectionBrush = nullptr;
+	ID2D1SolidColorBrush* bracketBrush = nullptr;
+	HRESULT hr = rt->CreateSolidColorBrush(ColorF(ColorF::Black), &brush);
+
+	if (SUCCEEDED(hr)) {
+		hr = rt->CreateSolidColorBrush(ColorF(ColorF::LightGray), &compositionCharBrush);
+	}
+
+	if (SUCCEEDED(hr)) {
+		hr = rt->CreateSolidColorBrush(ColorF(ColorF::CornflowerBlue), &selectionBrush);
+	}
+
+	if (SUCCEEDED(hr)) {
+		hr = rt->CreateSolidColorBrush(ColorF(ColorF::Gray), &bracketBrush);
+	}
+
+	if (SUCCEEDED(hr)) {
+		// 文字は変更された行の印の右に描画する
+		rt->PushAxisAlignedClip(RectF(options.gutterWidth, 0, minimapBar.x, size.height), D2D1_ANTIALIAS_MODE_ALIASED);
+		rt->SetTransform(Matrix3x2F::Translation(options.gutterWidth, 0));
+
+		// 画面に表示されている範囲
+		double viewLeft = -offsetX;
+		double viewRight = -offsetX + size.width;
+		float viewTop = -offsetY;
+		float viewBottom = -offsetY + size.height;
+
+		// 印を描画 (選択範囲と文字よりも下に描画する)
+		RenderMarkers(rt);
+
+		// 選択範囲を描画 (文字よりも下に描画する)
+		if (selection.start != selection.end) {
+			std::size_t selectionBegin = selection.start < selection.end ? selection.start : selection.end;
+			std::size_t selectionEnd = selection.start < selection.end ? selection.end : selection.start;
+			ForEachVisibleChar(viewLeft, viewRight, viewTop - charHeight, viewBottom, [&](std::size_t i, double x, float y) {
+				if (i >= selectionBegin && i < selectionEnd) {
+					auto left = static_cast<float>(x + offsetX);
+					rt->FillRectangle(
+						RectF(left, y + offsetY, left + core.chars[i].width + 1, y + offsetY + charHeight + 1),
+						selectionBrush);
+				}
+			});
+		}
+
+		// 対応している括弧を枠で囲む
+		for (auto index : { matchedBracket, matchingBracket }) {
+			if (index >= 0 && index < core.chars.size() && IsLaidOut(index)) {
+				auto left = static_cast<float>(XOfIndex(index) + offsetX);
+				auto top = YOfIndex(index) + offsetY;
+				rt->DrawRectangle(
+					RectF(left, top, left + core.chars[index].width, top + charHeight),
+					bracketBrush);
+			}
+		}
+
+		// 描画済みの帯を並べる。新しく表示された帯だけを描画する
+		float bandHeight = charHeight * options.renderBandLines;
+		int firstBand = static_cast<int>(floorf(viewTop / bandHeight));
+		int lastBand = static_cast<int>(floorf(viewBottom / bandHeight));
+		int firstColumn = static_cast<int>(floor(viewLeft / size.width));
+		int lastColumn = static_cast<int>(floor(viewRight / size.width));
+		auto visibleBands = static_cast<std::size_t>((lastBand - firstBand + 1) * (lastColumn - firstColumn + 1));
+		// キャッシュする帯の数はメモリの上限から決める (表示されている帯は必ず持つ)
+		auto bandBytes = std::max(1.0f, size.width * bandHeight * 4);
+		auto budgetBands = static_cast<std::size_t>(options.renderBandCacheBytes / bandBytes);
+		auto capacity = std::max(budgetBands, visibleBands + 2);
+
+		for (int band = std::max(firstBand, 0); band <= lastBand; band++) {
+			for (int column = std::max(firstColumn, 0); column <= lastColumn; column++) {
+				auto bitmap = GetBand(rt, band, column, capacity, brush);
+				if (bitmap) {
+					auto bitmapSize = bitmap->GetSize();
+					auto left = static_cast<float>(column * static_cast<double>(size.width) + offsetX);
+					auto top = band * bandHeight + offsetY;
+					rt->DrawBitmap(
+						bitmap,
+						RectF(left, top, left + bitmapSize.width, top + bitmapSize.height),
+						1.0f,
+						D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR);
+				}
+			}
+		}
+
+		// 上限を超えている場合は使われていない帯を解放する (ウィンドウが大きくなった場合など)
+		TrimBands(capacity);
+
+		// 折りたたんだ行の印を描画
+		RenderFoldMarkers(rt, brush, bracketBrush);
+
+		// 未確定文字列を描画 (まだ配置していない位置にある場合は画面より下にある)
+		if (compositionTextPos == -1 || IsLaidOut(compositionTextPos)) {
+			RenderCompositionText(rt, brush, compositionCharBrush);
+		}
+
+		// キャレットを描画
+		if (caret.visible && IsLaidOut(std::min(static_cast<std::size_t>(caret.index), core.chars.size()))) {
+			if (core.chars.empty()) {
+				// 文字を描画していない場合は左上に描画
+				RenderCursor(rt, 0, 0, brush);
+				caret.x = 0;
+				caret.y = 0;
+			} else {
+				// 末尾を選択している場合は最後の文字の後ろに描画
+				auto index = std::min(static_cast<std::size_t>(caret.index), core.chars.size());
+				auto x = XOfIndex(index);
+				auto y = YOfIndex(index);
+				RenderCursor(rt, x, y, brush);
+				caret.x = static_cast<float>(x);
+				caret.y = y;
+			}
+		}
+
+		// 補完の候補とキャレットの位置の診断を描画
+		RenderCompletions(rt);
+		RenderDiagnosticMessage(rt);
+
+		rt->SetTransform(Matrix3x2F::Identity());
+		rt->PopAxisAlignedClip();
+
+		// 変更された行の印を描画
+		RenderGutter(rt);
+
+		// 縮小表示を描画
+		RenderMinimap(rt);
+
+		// スクロールバーを描画
+		RenderScrollbar(rt);
+
+		// メモリ使用量の表示で確保する分は含めない
+		frameAllocations = HeapAllocationCount() - allocationsAtStart;
+
+		if (memoryOverlayVisible) {
+			RenderMemoryOverlay(rt);
+		}
+
+		brush->Release();
+		compositionCharBrush->Release();
+		selectionBrush->Release();
+		bracketBrush->Release();
+	}
+
+	// 一時的なデータはこのフレームの終わりにまとめて解放する
+	frameArena.Reset();
+}
+
+void Editor::RenderChar(ID2D1RenderTarget* rt, const Char& character, float x, float y, ID2D1Brush* brush) {
+	// 文字を描画
+	rt->DrawText(
+		&character.wchar,
+		1,
+		font->TextFormat(),
+		RectF(x, y, x + character.width, y + charHeight),
+		brush);
+}
+
+void Editor::RenderRun(ID2D1RenderTarget* rt, const std::size_t* indices, const float* positions, std::size_t length, float y, ID2D1Brush* brush) {
+	ArenaVector<wchar_t> text{ ArenaAllocator<wchar_t>(&frameArena) };
+	for (std::size_t c = 0; c < length; c++) {
+		text.push_back(core.chars[indices[c]].wchar);
+	}
+
+	auto& shapedRuns = font->ShapedRuns();
+	auto& run = shapedRuns.Shape(text.data(), length);
+	if (run.fallback) {
+		for (std::size_t c = 0; c < length; c++) {
+			RenderChar(rt, core.chars[indices[c]], positions[c], y, brush);
+		}
+		return;
+	}
+
+	// 文字の位置は 1 文字ずつ測った幅で決めているので、
+	// クラスタの先頭がその位置に揃うようにクラスタの最後の字形の送り幅を調整する
+	auto glyphCount = run.glyphIndices.size();
+	ArenaVector<float> advances{ run.glyphAdvances.begin(), run.glyphAdvances.end(), ArenaAllocator<float>(&frameArena) };
+	for (std::size_t c = 0; c < length;) {
+		auto next = c + 1;
+		while (next < length && run.clusterMap[next] == run.clusterMap[c]) {
+			next++;
+		}
+
+		std::size_t firstGlyph = run.clusterMap[c];
+		std::size_t endGlyph = next < length ? run.clusterMap[next] : glyphCount;
+		auto clusterEnd = next < length ? positions[next] : positions[length - 1] + core.chars[indices[length - 1]].width;
+		if (endGlyph > firstGlyph) {
+			auto x = positions[c];
+			for (auto g = firstGlyph; g + 1 < endGlyph; g++) {
+				x += advances[g];
+			}
+			advances[endGlyph - 1] = clusterEnd - x;
+		}
+		c = next;
+	}
+
+	DWRITE_GLYPH_RUN glyphRun = {};
+	glyphRun.fontFace = shapedRuns.FontFace();
+	glyphRun.fontEmSize = shapedRuns.FontSize();
+	glyphRun.glyphCount = static_cast<UINT32>(glyphCount);
+	glyphRun.glyphIndices = run.glyphIndices.data();
+	glyphRun.glyphAdvances = advances.data();
+	glyphRun.glyphOffsets = run.glyphOffsets.data();
+	glyphRun.isSideways = FALSE;
+	glyphRun.bidiLevel = 0;
+
+	rt->DrawGlyphRun(Point2F(positions[0], y + font->Baseline()), &glyphRun, brush);
+}
+
+void Editor::RenderCompositionText(ID2D1RenderTarget* rt, ID2D1Brush* brush, ID2D1Brush* backgroundBrush) {
+	for (auto& compositionChar : compositionChars) {
+		auto x = static_cast<float>(compositionChar.x + offsetX);
+		auto y = compositionChar.y + offsetY;
+		rt->FillRectangle(
+			RectF(x, y, x + compositionChar.width + 1, y + charHeight),
+			backgroundBrush);
+
+		RenderChar(rt, compositionChar, x, y, brush);
+	}
+}
+
+void Editor::RenderFoldMarkers(ID2D1RenderTarget* rt, ID2D1Brush* brush, ID2D1Brush* frameBrush) {
+	if (core.folds.Empty()) {
+		return;
+	}
+
+	auto size = rt->GetSize();
+	float viewTop = -offsetY;
+	float viewBottom = -offsetY + size.height;
+
+	// 表示されている文字の範囲
+	std::size_t first, last;
+	if (options.wordWrap) {
+		first = LowerBoundByY(viewTop - charHeight);
+		last = LowerBoundByY(viewBottom);
+	} else {
+		auto firstRow = static_cast<std::size_t>(std::max(0.0f, floorf(viewTop / charHeight)));
+		auto lastRow = static_cast<std::size_t>(std::max(0.0f, ceilf(viewBottom / charHeight)));
+		first = firstRow < columns.RowCount() ? core.lineDiff.LineStart(columns.LineOfRow(firstRow)) : core.chars.size();
+		last = lastRow < columns.RowCount() ? core.lineDiff.LineStart(columns.LineOfRow(lastRow)) : core.chars.size();
+	}
+
+	// 見出しの行の改行の後ろに描画する
+	auto width = charHeight * 1.5f;
+	for (auto k = core.folds.FirstHiddenAfter(first); k < core.folds.HiddenCount() && core.folds.Hidden(k).start <= last; k++) {
+		auto header = core.folds.Hidden(k).start - 1;
+		if (!IsLaidOut(header)) {
+			break;
+		}
+
+		auto left = static_cast<float>(XOfIndex(header) + offsetX) + charHeight / 4;
+		auto top = YOfIndex(header) + offsetY;
+		rt->DrawRectangle(RectF(left, top + 2, left + width, top + charHeight - 2), frameBrush);
+		rt->DrawText(L"\u2026", 1, font->TextFormat(), RectF(left + charHeight / 4, top, left + width, top + charHeight), brush);
+	}
+}
+
+void Editor::RenderMarkers(ID2D1RenderTarget* rt) {
+	if (core.markers.Size() == 0) {
+		return;
+	}
+
+	auto size = rt->GetSize();
+	float viewTop = -offsetY;
+	float viewBottom = -offsetY + size.height;
+
+	// 表示されている行の範囲にある印だけを取り出す
+	std::size_t from, to;
+	VisibleRange(viewTop, viewBottom, &from, &to);
+	auto lines = core.lineDiff.LineCount();
+
+	// 診断の波線は重大度ごとに色を変える (エラー、警告、それ以外)
+	ID2D1SolidColorBrush* bookmarkBrush = nullptr;
+	ID2D1SolidColorBrush* severityBrushes[3] = {};
+	HRESULT hr = rt->CreateSolidColorBrush(ColorF(ColorF::LightYellow), &bookmarkBrush);
+	if (SUCCEEDED(hr)) {
+		hr = rt->CreateSolidColorBrush(ColorF(ColorF::Red), &severityBrushes[0]);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = rt->CreateSolidColorBrush(ColorF(ColorF::Orange), &severityBrushes[1]);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = rt->CreateSolidColorBrush(ColorF(ColorF::SteelBlue), &severityBrushes[2]);
+	}
+
+	if (SUCCEEDED(hr)) {
+		core.markers.ForEachInRange(from, to, [&](const Marker& marker) {
+			FoldRange hiddenRange;
+			if (marker.kind == MarkerKind::Diagnostic) {
+				// 範囲の文字の下に波線を引く (空の範囲は後ろの 1 文字、改行は半分の幅)
+				auto severity = marker.value < diagnostics.size() ? diagnostics[marker.value].severity : 1;
+				auto brush = severityBrushes[std::min(std::max(severity, 1), 3) - 1];
+				auto end = std::min(std::max(marker.end, marker.start + 1), std::min(to, core.chars.size()));
+				for (auto i = std::max(marker.start, from); i < end && IsLaidOut(i); i++) {
+					if (core.folds.HiddenAt(i, &hiddenRange)) {
+						i = hiddenRange.end - 1;
+						continue;
+					}
+
+					auto left = static_cast<float>(XOfIndex(i) + offsetX);
+					auto right = left + (core.chars[i].wchar == '\n' ? charHeight / 2 : core.chars[i].width);
+					auto y = YOfIndex(i) + offsetY + charHeight - 2;
+					// 山と谷の位置を x 座標で決めて、隣の文字の波線とつなげる
+					for (auto x = floorf(left / 2) * 2; x < right; x += 2) {
+						auto up = static_cast<int>(x / 2) % 2 == 0;
+						rt->DrawLine(Point2F(x, up ? y + 1 : y - 1), Point2F(x + 2, up ? y - 1 : y + 1), brush);
+					}
+				}
+				return;
+			}
+
+			// ブックマークは行全体の背景に色を付ける (折りたたんで隠れている行は除く)
+			if (marker.kind != MarkerKind::Bookmark || !IsLaidOut(marker.start) || core.folds.HiddenAt(marker.start, &hiddenRange)) {
+				return;
+			}
+
+			auto line = core.lineDiff.LineOf(marker.start);
+			auto next = line + 1 < lines ? core.lineDiff.LineStart(line + 1) : core.chars.size();
+			auto top = YOfIndex(core.lineDiff.LineStart(line));
+			auto bottom = IsLaidOut(next) ? std::max(YOfIndex(next), top + charHeight) : top + charHeight;
+			rt->FillRectangle(RectF(static_cast<float>(-offsetX), top + offsetY, static_cast<float>(-offsetX) + size.width, bottom + offsetY), bookmarkBrush);
+		});
+	}
+
+	for (auto markerBrush : { bookmarkBrush, severityBrushes[0], severityBrushes[1], severityBrushes[2] }) {
+		if (markerBrush) {
+			markerBrush->Release();
+		}
+	}
+}
+
+void Editor::RenderDiagnosticMessage(ID2D1RenderTarget* rt) {
+	// 補完の候補を表示している間は表示しない
+	auto index = std::min(static_cast<std::size_t>(caret.index), core.chars.size());
+	if (diagnostics.empty() || !completions.empty() || !IsLaidOut(index)) {
+		return;
+	}
+
+	// キャレットが範囲の中か端にある診断のうち、最も重大なもの
+	const LspDiagnostic* shown = nullptr;
+	core.markers.ForEachInRange(index > 0 ? index - 1 : 0, index + 1, [&](const Marker& marker) {
+		if (marker.kind == MarkerKind::Diagnostic && marker.start <= index && index <= marker.end && marker.value < diagnostics.size()) {
+			auto& diagnostic = diagnostics[marker.value];
+			if (!shown || diagnostic.severity < shown->severity) {
+				shown = &diagnostic;
+			}
+		}
+	});
+	if (!shown) {
+		return;
+	}
+
+	// 最初の行だけを表示する
+	auto& message = shown->message;
+	auto length = std::min(message.find(L'\n'), message.size());
+	float width = 0;
+	for (std::size_t i = 0; i < length; i++) {
+		width += font->WidthOf(message[i]);
+	}
+
+	ID2D1SolidColorBrush* backgroundBrush = nullptr;
+	ID2D1SolidColorBrush* textBrush = nullptr;
+	HRESULT hr = rt->CreateSolidColorBrush(ColorF(ColorF::WhiteSmoke, 0.95f), &backgroundBrush);
+	if (SUCCEEDED(hr)) {
+		hr = rt->CreateSolidColorBrush(ColorF(ColorF::Black), &textBrush);
+	}
+
+	if (SUCCEEDED(hr)) {
+		// キャレットのある行のすぐ下に表示する
+		auto left = static_cast<float>(XOfIndex(index) + offsetX);
+		auto top = YOfIndex(index) + offsetY + charHeight;
+		auto rect = RectF(left, top, left + width + 8, top + charHeight);
+		rt->FillRectangle(rect, backgroundBrush);
+		rt->DrawText(message.c_str(), static_cast<UINT32>(length), font->TextFormat(), RectF(rect.left + 4, top, rect.right, rect.bottom), textBrush);
+	}
+
+	for (auto overlayBrush : { backgroundBrush, textBrush }) {
+		if (overlayBrush) {
+			overlayBrush->Release();
+		}
+	}
+}
+
+void Editor::RenderGutter(ID2D1RenderTarget* rt) {
+	auto size = rt->GetSize();
+	float viewTop = -offsetY;
+	float viewBottom = -offsetY + size.height;
+
+	// 表示されている行の範囲
+	std::size_t firstLine, lastLine;
+	VisibleLines(viewTop, viewBottom, &firstLine, &lastLine);
+
+	ArenaVector<DiffHunk> hunks{ ArenaAllocator<DiffHunk>(&frameArena) };
+	core.lineDiff.Hunks(firstLine, lastLine, hunks);
+	if (hunks.empty()) {
+		return;
+	}
+
+	ID2D1SolidColorBrush* addedBrush = nullptr;
+	ID2D1SolidColorBrush* modifiedBrush = nullptr;
+	ID2D1SolidColorBrush* deletedBrush = nullptr;
+	HRESULT hr = rt->CreateSolidColorBrush(ColorF(ColorF::MediumSeaGreen), &addedBrush);
+
+	if (SUCCEEDED(hr)) {
+		hr = rt->CreateSolidColorBrush(ColorF(ColorF::SteelBlue), &modifiedBrush);
+	}
+
+	if (SUCCEEDED(hr)) {
+		hr = rt->CreateSolidColorBrush(ColorF(ColorF::IndianRed), &deletedBrush);
+	}
+
+	if (SUCCEEDED(hr)) {
+		auto width = options.gutterWidth - 2;
+		for (auto& hunk : hunks) {
+			auto top = YOfLine(hunk.start) + offsetY;
+
+			if (hunk.count == 0) {
+				// 削除された場合は行の間に印を付ける
+				rt->FillRectangle(RectF(0, top - 2, options.gutterWidth, top + 2), deletedBrush);
+			} else {
+				auto bottom = YOfLine(hunk.start + hunk.count) + offsetY;
+				rt->FillRectangle(RectF(0, top, width, bottom), hunk.baseCount == 0 ? addedBrush : modifiedBrush);
+			}
+		}
+	}
+
+	for (auto gutterBrush : { addedBrush, modifiedBrush, deletedBrush }) {
+		if (gutterBrush) {
+			gutterBrush->Release();
+		}
+	}
+}
+
+void Editor::RenderMinimap(ID2D1RenderTarget* rt) {
+	if (minimapBar.width <= 0 || minimapBar.height <= 0) {
+		return;
+	}
+
+	// 大きさが変わった場合は作り直す
+	if (minimapBitmap) {
+		auto bitmapSize = minimapBitmap->GetSize();
+		if (bitmapSize.width != minimapBar.width || bitmapSize.height != minimapBar.height) {
+			ReleaseMinimap();
+		}
+	}
+
+	bool redraw = minimapVersion != core.minimap.Version();
+	if (!minimapTarget) {
+		if (FAILED(rt->CreateCompatibleRenderTarget(SizeF(minimapBar.width, minimapBar.height), &minimapTarget))) {
+			minimapTarget = nullptr;
+			return;
+		}
+		if (FAILED(minimapTarget->GetBitmap(&minimapBitmap))) {
+			minimapTarget->Release();
+			minimapTarget = nullptr;
+			return;
+		}
+		redraw = true;
+	}
+
+	// 編集された場合だけ集計から描き直す。スクロールしている間は描画済みの画像を使う
+	if (redraw) {
+		ID2D1SolidColorBrush* wordBrush = nullptr;
+		ID2D1SolidColorBrush* symbolBrush = nullptr;
+		ID2D1SolidColorBrush* wideBrush = nullptr;
+		HRESULT hr = minimapTarget->CreateSolidColorBrush(ColorF(ColorF::DimGray, 0.8f), &wordBrush);
+
+		if (SUCCEEDED(hr)) {
+			hr = minimapTarget->CreateSolidColorBrush(ColorF(ColorF::SteelBlue, 0.8f), &symbolBrush);
+		}
+
+		if (SUCCEEDED(hr)) {
+			hr = minimapTarget->CreateSolidColorBrush(ColorF(ColorF::DarkSlateGray, 0.8f), &wideBrush);
+		}
+
+		if (SUCCEEDED(hr)) {
+			minimapTarget->BeginDraw();
+			minimapTarget->Clear(ColorF(0, 0, 0, 0));
+
+			// 行が多い場合は 1 ピクセルの行に複数の行の平均を表示する
+			auto lines = core.minimap.LineCount();
+			auto scale = MinimapScale();
+			auto rows = scale >= 1 ? lines : static_cast<std::size_t>(minimapBar.height);
+			auto rowHeight = scale >= 1 ? scale : 1.0f;
+			// 120 文字で縮小表示の幅いっぱいになる
+			auto charWidth = minimapBar.width / 120;
+
+			for (std::size_t row = 0; row < rows; row++) {
+				auto density = core.minimap.Sample(row * lines / rows, (row + 1) * lines / rows);
+				auto top = row * rowHeight;
+				float x = 0;
+
+				// 空白以外の文字を種類ごとに並べる
+				std::pair<LineDensity::Class, ID2D1Brush*> classes[] = {
+					{ LineDensity::WORD, wordBrush },
+					{ LineDensity::SYMBOL, symbolBrush },
+					{ LineDensity::WIDE, wideBrush },
+				};
+				for (auto& entry : classes) {
+					auto width = density.counts[entry.first] * charWidth * (entry.first == LineDensity::WIDE ? 2 : 1);
+					if (width > 0 && x < minimapBar.width) {
+						minimapTarget->FillRectangle(RectF(x, top, std::min(x + width, minimapBar.width), top + rowHeight), entry.second);
+						x += width;
+					}
+				}
+			}
+
+			if (SUCCEEDED(minimapTarget->EndDraw())) {
+				minimapVersion = core.minimap.Version();
+			}
+		}
 
-	// 文字が画面からはみでる場合は y 座標を更新する
-	if (*x + character->width >= horizontalScrollbar.bar.x) {
-		*x = 0;
-		*y += charHeight;
+		for (auto minimapBrush : { wordBrush, symbolBrush, wideBrush }) {
+			if (minimapBrush) {
+				minimapBrush->Release();
+			}
+		}
 	}
 
-	// 文字を描画
-	rt->DrawText(
-		&character->wchar,
-		1,
-		textFormat,
-		&RectF(*x, *y + offsetY, *x + character->width, *y + offsetY + charHeight),
-		brush);
-
-	character->x = *x;
-	character->y = *y;
-	*x += character->width;
+	rt->DrawBitmap(minimapBitmap, minimapBar.ToRectF(), 1.0f, D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR);
 
-	// 改行だったら y 座標を更新する
-	if (character->wchar == '\n') {
-		*x = 0;
-		*y += charHeight;
-	}
-}
+	// 表示されている範囲を重ねる
+	ID2D1SolidColorBrush* viewBrush;
+	if (SUCCEEDED(rt->CreateSolidColorBrush(ColorF(ColorF::Gray, 0.25f), &viewBrush))) {
+		auto viewHeight = options.wordWrap ? verticalScrollbar.bar.height : horizontalScrollbar.bar.y;
+		std::size_t firstLine, lastLine;
+		VisibleLines(-offsetY, -offsetY + viewHeight, &firstLine, &lastLine);
 
-void Editor::RenderCompositionText(ID2D1HwndRenderTarget* rt, ID2D1Brush* brush, ID2D1Brush* backgroundBrush, float* const x, float* const y) {
-	for (auto& compositionChar : compositionChars) {
-		rt->FillRectangle(
-			RectF(*x, *y + offsetY, *x + compositionChar.width + 1, *y + offsetY + charHeight),
-			backgroundBrush);
+		auto scale = MinimapScale();
+		auto top = minimapBar.y + firstLine * scale;
+		auto bottom = std::max(top + 2, minimapBar.y + (lastLine + 1) * scale);
+		rt->FillRectangle(RectF(minimapBar.x, top, minimapBar.x + minimapBar.width, bottom), viewBrush);
 
-		RenderChar(rt, &compositionChar, x, y, brush);
+		viewBrush->Release();
 	}
 }
 
-void Editor::RenderScrollbar(ID2D1HwndRenderTarget* rt) {
+void Editor::RenderScrollbar(ID2D1RenderTarget* rt) {
 	ID2D1SolidColorBrush* brush;
 	HRESULT hr = rt->CreateSolidColorBrush(ColorF(ColorF::Gray), &brush);
 
@@ -324,28 +2200,153 @@ void Editor::RenderScrollbar(ID2D1HwndRenderTarget* rt) {
 		// スクロールバーの位置
 		auto scrollbarY = -offsetY * percentageViewingHeight;
 
-		horizontalScrollbar.bar = RectE(size.width - 10, 0, 10, size.height);
-		horizontalScrollbar.thumb = RectE(size.width - 10, scrollbarY, 10, size.height * percentageViewingHeight);
+		verticalScrollbar.thumb = RectE(size.width - 10, scrollbarY, 10, size.height * percentageViewingHeight);
 
 		rt->FillRectangle(
-			horizontalScrollbar.thumb.ToRectF(),
+			verticalScrollbar.thumb.ToRectF(),
 			brush);
 
-		// TODO: 水平スクロールバー
+		// 水平スクロールバー (折り返さない場合のみ)
+		if (!options.wordWrap) {
+			auto viewWidth = horizontalScrollbar.bar.width;
+			auto maxOffset = std::max(0.0, columns.MaxWidth() - layoutWidth / 2);
+
+			// 非常に長い行でもつまみを掴めるように最小の幅を設ける
+			auto thumbWidth = std::max(10.0f, static_cast<float>(viewWidth * viewWidth / (maxOffset + viewWidth)));
+			auto scrollbarX = maxOffset > 0 ? static_cast<float>(-offsetX / maxOffset) * (viewWidth - thumbWidth) : 0.0f;
+
+			horizontalScrollbar.thumb = RectE(scrollbarX, horizontalScrollbar.bar.y, thumbWidth, horizontalScrollbar.bar.height);
+
+			rt->FillRectangle(
+				horizontalScrollbar.thumb.ToRectF(),
+				brush);
+		}
+
+		brush->Release();
+	}
+}
+
+void Editor::RenderMemoryOverlay(ID2D1RenderTarget* rt) {
+	auto report = GetMemoryUsage();
+
+	std::wstring text;
+	for (int i = 0; i < static_cast<int>(MemoryCategory::Count); i++) {
+		auto category = static_cast<MemoryCategory>(i);
+		text += rswprintf(L"%s: %.2f MB\n", MemoryReport::NameOf(category), report.Get(category) / (1024.0 * 1024.0));
+	}
+	text += rswprintf(L"Total: %.2f MB\n", report.Total() / (1024.0 * 1024.0));
+	text += rswprintf(L"Heap allocations: %llu / frame, %llu / key\n", frameAllocations, editAllocations);
+	auto& shapedRuns = font->ShapedRuns();
+	text += rswprintf(L"Shaped runs: %.1f%% hit (%llu / %llu)", shapedRuns.HitRate() * 100,
+		shapedRuns.Hits(), shapedRuns.Hits() + shapedRuns.Misses());
+
+	ID2D1SolidColorBrush* backgroundBrush = nullptr;
+	ID2D1SolidColorBrush* textBrush = nullptr;
+	HRESULT hr = rt->CreateSolidColorBrush(ColorF(ColorF::WhiteSmoke, 0.9f), &backgroundBrush);
+
+	if (SUCCEEDED(hr)) {
+		hr = rt->CreateSolidColorBrush(ColorF(ColorF::Black), &textBrush);
+	}
+
+	if (SUCCEEDED(hr)) {
+		// 縮小表示の左上に表示する
+		auto width = 320.0f;
+		auto height = charHeight * (static_cast<int>(MemoryCategory::Count) + 3) + 8;
+		auto rect = RectF(minimapBar.x - width - 8, 8, minimapBar.x - 8, 8 + height);
+		rt->FillRectangle(rect, backgroundBrush);
+		rt->DrawText(text.c_str(), static_cast<UINT32>(text.size()), font->TextFormat(),
+			RectF(rect.left + 4, rect.top + 4, rect.right - 4, rect.bottom - 4), textBrush);
+	}
+
+	for (auto overlayBrush : { backgroundBrush, textBrush }) {
+		if (overlayBrush) {
+			overlayBrush->Release();
+		}
 	}
 }
 
-void Editor::RenderCursor(ID2D1HwndRenderTarget* rt, float x, float y, ID2D1Brush* brush) {
+void Editor::RenderCursor(ID2D1RenderTarget* rt, double x, float y, ID2D1Brush* brush) {
+	auto left = static_cast<float>(x + offsetX);
 	rt->FillRectangle(
-		RectF(x, y + offsetY, x + options.cursorWidth, y + offsetY + charHeight),
+		RectF(left, y + offsetY, left + options.cursorWidth, y + offsetY + charHeight),
 		brush);
 }
 
+void Editor::RenderCompletions(ID2D1RenderTarget* rt) {
+	auto index = std::min(static_cast<std::size_t>(caret.index), core.chars.size());
+	if (completions.empty() || !IsLaidOut(index)) {
+		return;
+	}
+
+	// 一番長い候補に合わせた幅
+	float width = 0;
+	for (auto& candidate : completions) {
+		float candidateWidth = 0;
+		for (auto character : candidate.word) {
+			candidateWidth += font->WidthOf(character);
+		}
+		width = std::max(width, candidateWidth);
+	}
+
+	ID2D1SolidColorBrush* backgroundBrush = nullptr;
+	ID2D1SolidColorBrush* selectedBrush = nullptr;
+	ID2D1SolidColorBrush* textBrush = nullptr;
+	HRESULT hr = rt->CreateSolidColorBrush(ColorF(ColorF::WhiteSmoke, 0.95f), &backgroundBrush);
+
+	if (SUCCEEDED(hr)) {
+		hr = rt->CreateSolidColorBrush(ColorF(ColorF::LightSteelBlue), &selectedBrush);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = rt->CreateSolidColorBrush(ColorF(ColorF::Black), &textBrush);
+	}
+
+	if (SUCCEEDED(hr)) {
+		// キャレットのある行のすぐ下に表示する
+		auto left = static_cast<float>(XOfIndex(index) + offsetX);
+		auto top = YOfIndex(index) + offsetY + charHeight;
+		auto rect = RectF(left, top, left + width + 8, top + charHeight * completions.size());
+		rt->FillRectangle(rect, backgroundBrush);
+
+		for (std::size_t i = 0; i < completions.size(); i++) {
+			auto itemTop = top + charHeight * i;
+			if (i == completionSelected) {
+				rt->FillRectangle(RectF(rect.left, itemTop, rect.right, itemTop + charHeight), selectedBrush);
+			}
+
+			auto& word = completions[i].word;
+			rt->DrawText(word.c_str(), static_cast<UINT32>(word.size()), font->TextFormat(),
+				RectF(rect.left + 4, itemTop, rect.right, itemTop + charHeight), textBrush);
+		}
+	}
+
+	for (auto overlayBrush : { backgroundBrush, selectedBrush, textBrush }) {
+		if (overlayBrush) {
+			overlayBrush->Release();
+		}
+	}
+}
+
 void Editor::OnChar(wchar_t character) {
+	RecordInput(TraceEvent::Type::Char, character);
+
 	// エンターキーを押すと character は \r になるので \n に置き換え
 	if (character == '\r')
 		character = '\n';
 
+	// 補完の候補を表示している場合は、Tab キーで選んでいる候補を挿入する
+	if (character == '\t' && !completions.empty()) {
+		AcceptCompletion();
+		return;
+	}
+
+	// Ctrl+S などで送られてくる制御文字は挿入しない
+	if (character < 0x20 && character != '\n' && character != '\t' && character != '\b')
+		return;
+
+	if (macroRecording) {
+		macroEvents.push_back(MacroEvent::Char(character));
+	}
+
 	if (character == '\b') {
 		// 選択範囲を削除
 		if (selection.start != selection.end) {
@@ -355,7 +2356,7 @@ void Editor::OnChar(wchar_t character) {
 
 		// バックスペースキーが押された場合はカーソルの前の文字を削除する
 		if (selection.end > 0) {
-			chars.erase(chars.begin() + selection.end - 1);
+			EraseChars(selection.end - 1, selection.end);
 			MoveCaret(caret.index - 1);
 		}
 	} else {
@@ -364,12 +2365,15 @@ void Editor::OnChar(wchar_t character) {
 			DeleteSelection();
 		}
 
-		chars.insert(chars.begin() + selection.end, CreateChar(character));
+		InsertChars(selection.end, std::wstring(1, character));
 		compositionTextPos = selection.end + 1;
 
 		// キャレットを動かす
 		MoveCaret(caret.index + 1);
 	}
+
+	// 入力している単語を補完する候補を探す
+	UpdateCompletions();
 }
 
 void Editor::OnOpenCandidate() {
@@ -381,8 +2385,8 @@ void Editor::OnOpenCandidate() {
 	CANDIDATEFORM form;
 	form.dwIndex = 0;
 	form.dwStyle = CFS_FORCE_POSITION;
-	form.ptCurrentPos.x = static_cast<LONG>(caret.x);
-	form.ptCurrentPos.y = static_cast<LONG>(caret.y + charHeight);
+	form.ptCurrentPos.x = static_cast<LONG>(caret.x + offsetX + options.gutterWidth);
+	form.ptCurrentPos.y = static_cast<LONG>(caret.y + offsetY + charHeight);
 
 	ImmSetCandidateWindow(imc, &form);
 
@@ -403,7 +2407,7 @@ void Editor::OnQueryCharPosition(IMECHARPOSITION* pos) {
 	pos->cLineHeight = static_cast<UINT>(charHeight);
 
 	// 文字の位置をスクリーン座標で指定する
-	pos->pt.x = static_cast<LONG>(caret.x);
+	pos->pt.x = static_cast<LONG>(caret.x + offsetX + options.gutterWidth);
 	pos->pt.y = static_cast<LONG>(caret.y + offsetY);
 	ClientToScreen(hwnd, &pos->pt);
 }
@@ -417,56 +2421,111 @@ void Editor::OnIMEComposition(LPARAM lparam) {
 	}
 
 	if (lparam & GCS_COMPSTR || lparam & GCS_RESULTSTR) {
-		// 未確定文字列を取得
+		// 未確定文字列を取得 (バッファは使い回す)
 		auto bytes = ImmGetCompositionString(imc, GCS_COMPSTR, NULL, 0);
-		auto size = bytes / sizeof(wchar_t);
+		auto size = bytes > 0 ? bytes / sizeof(wchar_t) : 0;
+		if (compositionBuffer.size() < size) {
+			compositionBuffer.resize(size);
+		}
 
-		wchar_t* buf = new wchar_t[size];
-		auto result = ImmGetCompositionString(imc, GCS_COMPSTR, buf, bytes);
+		auto result = ImmGetCompositionString(imc, GCS_COMPSTR, compositionBuffer.data(), bytes);
+		if (trace.IsRecording() && result >= 0) {
+			TraceEvent event = {};
+			event.type = TraceEvent::Type::IMEComposition;
+			event.text.assign(compositionBuffer.data(), size);
+			trace.Record(std::move(event));
+		}
 		if (result == IMM_ERROR_NODATA) {
+			ImmReleaseContext(hwnd, imc);
 			MessageBox(hwnd, rswprintf(L"エラーが発生しました: IMM_ERROR_NODATA (%d)", result).c_str(), L"エラー", MB_OK | MB_ICONERROR);
 			return;
 		} else if (result == IMM_ERROR_GENERAL) {
+			ImmReleaseContext(hwnd, imc);
 			MessageBox(hwnd, rswprintf(L"エラーが発生しました: IMM_ERROR_GENERAL (%d)", result).c_str(), L"エラー", MB_OK | MB_ICONERROR);
 			return;
 		}
 
-		compositionChars.clear();
-		compositionTextPos = selection.end;
+		UpdateComposition(compositionBuffer.data(), size);
+	}
+
+	ImmReleaseContext(hwnd, imc);
+}
 
-		// 未確定文字列を挿入
-		auto str = std::wstring(buf, size);
+void Editor::UpdateComposition(const wchar_t* text, std::size_t length) {
+	// 前の未確定文字列と先頭から一致している部分はそのまま使う
+	std::size_t prefix = 0;
+	if (compositionTextPos == selection.end) {
+		while (prefix < compositionChars.size() && prefix < length && compositionChars[prefix].wchar == text[prefix]) {
+			prefix++;
+		}
 
-		int i = 0;
-		for (auto& c : str) {
-			auto ch = CreateChar(c);
-			compositionChars.push_back(ch);
-			i++;
+		if (prefix == compositionChars.size() && prefix == length) {
+			return;
 		}
+	} else if (compositionTextPos != -1) {
+		// 挿入位置が変わった場合は前の位置から並べ直す
+		InvalidateLayout(std::min(compositionTextPos, selection.end));
+	}
+
+	compositionTextPos = selection.end;
 
-		delete[] buf;
+	// 変わった部分の文字だけを測定する
+	compositionChars.erase(compositionChars.begin() + prefix, compositionChars.end());
+	for (auto i = prefix; i < length; i++) {
+		compositionChars.push_back(CreateChar(text[i]));
 	}
 
-	ImmReleaseContext(hwnd, imc);
+	InvalidateCompositionLayout(prefix);
 }
 
 void Editor::OnIMEStartComposition() {
+	RecordInput(TraceEvent::Type::IMEStartComposition);
+
 	caret.visible = false;
 	cursorBlinkTimer.enabled = false;
 }
 
 void Editor::OnIMEEndComposition() {
+	RecordInput(TraceEvent::Type::IMEEndComposition);
+
+	// 未確定文字列があった位置より後ろだけを並べ直す
+	if (compositionTextPos != -1) {
+		InvalidateLayout(compositionTextPos);
+	}
+
+	compositionChars.clear();
 	compositionStringLength = -1;
 	compositionTextPos = -1;
 }
 
 void Editor::OnKeyDown(int keyCode) {
+	RecordInput(TraceEvent::Type::KeyDown, keyCode);
+
 	// カーソルを表示させて点滅を停止する
 	cursorBlinkTimer.enabled = false;
 	caret.visible = true;
 
+	// 補完の候補を表示している場合は、上下キーで候補を選び、Esc キーで閉じる
+	if (!completions.empty()) {
+		switch (keyCode) {
+		case VK_UP:
+			completionSelected = (completionSelected + completions.size() - 1) % completions.size();
+			return;
+		case VK_DOWN:
+			completionSelected = (completionSelected + 1) % completions.size();
+			return;
+		case VK_ESCAPE:
+			completions.clear();
+			return;
+		}
+	}
+
 	// シフトキーを押しているかどうか
-	bool shiftKey = GetKeyState(VK_SHIFT) < 0;
+	bool shiftKey = IsKeyPressed(VK_SHIFT);
+
+	if (macroRecording) {
+		RecordMacroKey(keyCode);
+	}
 
 	switch (keyCode) {
 	case VK_LEFT:
@@ -475,7 +2534,7 @@ void Editor::OnKeyDown(int keyCode) {
 		}
 		break;
 	case VK_RIGHT:
-		if (selection.end < chars.size()) {
+		if (selection.end < core.chars.size()) {
 			MoveCaret(caret.index + 1, shiftKey);
 		}
 		break;
@@ -503,10 +2562,10 @@ void Editor::OnKeyDown(int keyCode) {
 		}
 
 		bool found = false;
-		for (auto itr = chars.begin() + selection.end - 1; itr != chars.begin(); itr--) {
+		for (auto itr = core.chars.begin() + selection.end - 1; itr != core.chars.begin(); itr--) {
 			auto&& character = *itr;
 			if (character.wchar == '\n') {
-				auto index = static_cast<int>(std::distance(chars.begin(), itr));
+				auto index = static_cast<int>(std::distance(core.chars.begin(), itr));
 				MoveCaret(index + 1, shiftKey);
 				found = true;
 				break;
@@ -522,10 +2581,10 @@ void Editor::OnKeyDown(int keyCode) {
 	case VK_END:
 	{
 		bool found = false;
-		for (auto itr = chars.begin() + selection.end; itr != chars.end(); itr++) {
+		for (auto itr = core.chars.begin() + selection.end; itr != core.chars.end(); itr++) {
 			auto&& character = *itr;
 			if (character.wchar == '\n') {
-				auto index = static_cast<int>(std::distance(chars.begin(), itr));
+				auto index = static_cast<int>(std::distance(core.chars.begin(), itr));
 				MoveCaret(index, shiftKey);
 				found = true;
 				break;
@@ -533,7 +2592,7 @@ void Editor::OnKeyDown(int keyCode) {
 		}
 
 		if (!found) {
-			MoveCaret(static_cast<int>(chars.size()), shiftKey);
+			MoveCaret(static_cast<int>(core.chars.size()), shiftKey);
 		}
 	}
 	
@@ -546,20 +2605,217 @@ void Editor::OnKeyDown(int keyCode) {
 		}
 
 		// カーソルの後の文字を削除する
-		if (caret.index < chars.size()) {
-			chars.erase(chars.begin() + caret.index);
+		if (caret.index < core.chars.size()) {
+			EraseChars(caret.index, caret.index + 1);
+		}
+		break;
+	case VK_OEM_6:
+		// Ctrl+] で対応する括弧に移動
+		if (IsKeyPressed(VK_CONTROL)) {
+			JumpToBracket(shiftKey);
+		}
+		break;
+	case VK_F2:
+		// Ctrl+F2 でキャレットの行のブックマークを切り替え、F2 で次のブックマークに移動する
+		if (IsKeyPressed(VK_CONTROL)) {
+			ToggleBookmark();
+		} else {
+			JumpToBookmark(shiftKey);
+		}
+		break;
+	case VK_OEM_4:
+		// Ctrl+Shift+[ でキャレットの行を折りたたむ、または折りたたみを解除する
+		if (IsKeyPressed(VK_CONTROL) && shiftKey) {
+			ToggleFold();
+		}
+		break;
+	case 'M':
+		// Ctrl+Shift+M でメモリ使用量の表示を切り替える
+		if (IsKeyPressed(VK_CONTROL) && shiftKey) {
+			memoryOverlayVisible = !memoryOverlayVisible;
+		}
+		break;
+	case 'R':
+		// Ctrl+Shift+R でマクロの記録を開始・終了する
+		if (IsKeyPressed(VK_CONTROL) && shiftKey && !replaying) {
+			ToggleMacroRecording();
+		}
+		break;
+	case 'T':
+		// Ctrl+Shift+T で入力の記録を開始・終了する
+		if (IsKeyPressed(VK_CONTROL) && shiftKey && !replaying) {
+			ToggleTraceRecording();
 		}
 		break;
+	case 'S':
+		// Ctrl+S で保存
+		if (IsKeyPressed(VK_CONTROL)) {
+			SaveFile();
+		}
+		break;
+	}
+}
+
+void Editor::ToggleMacroRecording() {
+	if (!macroRecording) {
+		macroEvents.clear();
+		macroRecording = true;
+		return;
+	}
+
+	macroRecording = false;
+	try {
+		SaveMacro(options.macroPath, macroEvents);
+	} catch (const MacroException&) {
+		MessageBox(hwnd, rswprintf(L"マクロを保存できませんでした: %s", options.macroPath.c_str()).c_str(), L"エラー", MB_OK | MB_ICONERROR);
+	}
+}
+
+void Editor::RecordMacroKey(int keyCode) {
+	// 選択範囲は再生できないので、シフトキーを押しながらの移動も普通の移動として記録する
+	MacroKey key;
+	if (MacroKeyOf(keyCode, &key)) {
+		macroEvents.push_back(MacroEvent::Key(key));
+	}
+}
+
+void Editor::ToggleTraceRecording() {
+	if (!trace.IsRecording()) {
+		trace.Start();
+		return;
+	}
+
+	trace.Stop();
+	try {
+		SaveInputTrace(options.tracePath, trace.Events());
+	} catch (const InputTraceException&) {
+		MessageBox(hwnd, rswprintf(L"入力の記録を保存できませんでした: %s", options.tracePath.c_str()).c_str(), L"エラー", MB_OK | MB_ICONERROR);
+	}
+}
+
+void Editor::RecordInput(TraceEvent::Type type, int value, float x, float y) {
+	if (!trace.IsRecording()) {
+		return;
+	}
+
+	TraceEvent event = {};
+	event.type = type;
+	event.modifiers = (IsKeyPressed(VK_SHIFT) ? TraceEvent::SHIFT : 0) |
+		(IsKeyPressed(VK_CONTROL) ? TraceEvent::CONTROL : 0) |
+		(IsKeyPressed(VK_MENU) ? TraceEvent::ALT : 0);
+	event.value = value;
+	event.x = x;
+	event.y = y;
+	trace.Record(std::move(event));
+}
+
+bool Editor::IsKeyPressed(int keyCode) {
+	if (!replaying) {
+		return GetKeyState(keyCode) < 0;
+	}
+
+	switch (keyCode) {
+	case VK_SHIFT:
+		return (replayModifiers & TraceEvent::SHIFT) != 0;
+	case VK_CONTROL:
+		return (replayModifiers & TraceEvent::CONTROL) != 0;
+	case VK_MENU:
+		return (replayModifiers & TraceEvent::ALT) != 0;
+	}
+	return false;
+}
+
+POINT Editor::CursorPosition() {
+	if (replaying) {
+		return replayCursor;
+	}
+
+	POINT pos;
+	GetCursorPos(&pos);
+
+	// スクリーン座標なのでクライアント座標に変換
+	ScreenToClient(hwnd, &pos);
+	return pos;
+}
+
+void Editor::BeginReplay() {
+	replaying = true;
+	trace.Stop();
+	macroRecording = false;
+}
+
+void Editor::ReplayInput(const TraceEvent& event) {
+	replayModifiers = event.modifiers;
+	replayCursor.x = static_cast<LONG>(event.x);
+	replayCursor.y = static_cast<LONG>(event.y);
+
+	switch (event.type) {
+	case TraceEvent::Type::Char:
+		OnChar(static_cast<wchar_t>(event.value));
+		break;
+	case TraceEvent::Type::KeyDown:
+		OnKeyDown(event.value);
+		break;
+	case TraceEvent::Type::KeyUp:
+		OnKeyUp(event.value);
+		break;
+	case TraceEvent::Type::LButtonDown:
+		OnLButtonDown(event.x, event.y);
+		break;
+	case TraceEvent::Type::LButtonUp:
+		OnLButtonUp(event.x, event.y);
+		break;
+	case TraceEvent::Type::MouseWheel:
+		OnMouseWheel(static_cast<short>(event.value));
+		break;
+	case TraceEvent::Type::MouseHWheel:
+		OnMouseHWheel(static_cast<short>(event.value));
+		break;
+	case TraceEvent::Type::Resize:
+		OnResize(static_cast<unsigned int>(event.x), static_cast<unsigned int>(event.y));
+		break;
+	case TraceEvent::Type::IMEStartComposition:
+		OnIMEStartComposition();
+		break;
+	case TraceEvent::Type::IMEComposition:
+		// IME には問い合わせずに記録した未確定文字列を使う
+		UpdateComposition(event.text.data(), event.text.size());
+		break;
+	case TraceEvent::Type::IMEEndComposition:
+		OnIMEEndComposition();
+		break;
+	case TraceEvent::Type::Frame:
+	case TraceEvent::Type::TYPE_COUNT:
+		break;
 	}
 }
 
 void Editor::OnKeyUp(int keyCode) {
+	RecordInput(TraceEvent::Type::KeyUp, keyCode);
+
 	cursorBlinkTimer.enabled = true;
 }
 
 void Editor::OnLButtonDown(float x, float y) {
+	RecordInput(TraceEvent::Type::LButtonDown, 0, x, y);
+
+	// 水平スクロールバーをクリックした場合はつまみを掴む
+	auto& bar = horizontalScrollbar.bar;
+	if (!options.wordWrap && x >= bar.x && x < bar.x + bar.width && y >= bar.y && y < bar.y + bar.height) {
+		auto& thumb = horizontalScrollbar.thumb;
+		horizontalThumbDragOffset = x >= thumb.x && x < thumb.x + thumb.width ? x - thumb.x : thumb.width / 2;
+		horizontalThumbDragged = true;
+		return;
+	}
+
+	// 縮小表示をクリックした場合はその位置までスクロールし、離すまで追従する
+	if (x >= minimapBar.x && x < minimapBar.x + minimapBar.width) {
+		minimapDragged = true;
+		return;
+	}
+
 	// クリックされた位置から文字のインデックスを探す
-	int index = FindIndexByPosition(x, y);
+	int index = FindIndexByPosition(x - options.gutterWidth - offsetX, y - offsetY);
 	// 文字が見つかったらカーソルを動かす
 	if (index != -1) {
 		MoveCaret(index);
@@ -569,26 +2825,275 @@ void Editor::OnLButtonDown(float x, float y) {
 }
 
 void Editor::OnLButtonUp(float x, float y) {
+	RecordInput(TraceEvent::Type::LButtonUp, 0, x, y);
+
 	dragged = false;
+	horizontalThumbDragged = false;
+	minimapDragged = false;
 }
 
 void Editor::OnMouseWheel(short delta) {
-	RECT rect;
-	GetClientRect(hwnd, &rect);
+	RecordInput(TraceEvent::Type::MouseWheel, delta);
+
+	auto height = static_cast<float>(clientHeight);
 
-	auto width = rect.right;
-	auto height = rect.bottom;
+	// シフトキーを押している場合は水平方向にスクロール
+	if (IsKeyPressed(VK_SHIFT)) {
+		ScrollByHorizontalWheel(-delta);
+		return;
+	}
 
+	// スクロール先を更新し、実際の位置は描画のたびに近づけていく
 	// 下方向へのスクロール
-	if (delta < 0 && maxY + offsetY + height > height) {
-		offsetY -= options.scrollAmount;
+	if (delta < 0 && maxY + targetOffsetY + height > height) {
+		targetOffsetY -= options.scrollAmount;
 	}
 
 	// 上方向へのスクロール
-	if (delta > 0 && offsetY < 0) {
-		offsetY += options.scrollAmount;
+	if (delta > 0 && targetOffsetY < 0) {
+		targetOffsetY = std::min(targetOffsetY + options.scrollAmount, 0.0f);
+	}
+}
+
+void Editor::OnMouseHWheel(short delta) {
+	RecordInput(TraceEvent::Type::MouseHWheel, delta);
+
+	ScrollByHorizontalWheel(delta);
+}
+
+void Editor::ScrollByHorizontalWheel(short delta) {
+	// 折り返す場合は水平方向にはスクロールしない
+	if (options.wordWrap) {
+		return;
 	}
+
+	// 右方向が正
+	ScrollHorizontally(delta > 0 ? options.scrollAmount : -options.scrollAmount);
 }
 
 void Editor::OnResize(unsigned int width, unsigned int height) {
+	RecordInput(TraceEvent::Type::Resize, 0, static_cast<float>(width), static_cast<float>(height));
+
+	clientWidth = width;
+	clientHeight = height;
+
+	// 折り返す幅を決め、次の描画で表示されている範囲から配置し直す
+	ResizeView(static_cast<float>(width), static_cast<float>(height));
+}
+
+void Editor::OnFileChanged() {
+	fileChangePosted = false;
+	// 休止している間の変更は再開したときにまとめて調べる
+	if (filePath.empty() || reloadConfirming || suspended) {
+		return;
+	}
+
+	std::wstring appended;
+	FileAppend append;
+	switch (fileTail.Poll(appended, &append)) {
+	case FileTail::Change::Appended:
+		AppendFromFile(appended, append);
+		break;
+	case FileTail::Change::Replaced:
+		ReloadFile();
+		break;
+	case FileTail::Change::None:
+		break;
+	}
+}
+
+void Editor::AppendFromFile(const std::wstring& text, const FileAppend& append) {
+	// 文字の途中までしか書き込まれていない場合は何も追加されない
+	if (text.empty()) {
+		return;
+	}
+
+	// 末尾にキャレットがある場合は追加された内容を追いかける
+	bool follow = caret.index >= core.chars.size() && selection.start == selection.end;
+
+	// 追加された文字だけを測定し、それより前の配置はそのまま使う
+	InsertChars(static_cast<int>(core.chars.size()), text, false);
+	core.lineDiff.AppendToBase(text.data(), text.size());
+
+	if (follow) {
+		MoveCaret(static_cast<int>(core.chars.size()));
+	}
+
+	// ジャーナルの元のファイルはそのままにして、追記を読み込んだことだけを記録する
+	// 内容は書き込まず、復元するときにファイルから読む
+	journal.RecordAppend(append.offset, append.bytes.data(), append.bytes.size(), fileTail.LoadedBytes());
+}
+
+void Editor::OnStreamReceived() {
+	bool finished = streamReader.Take(streamText);
+
+	if (!streamText.empty()) {
+		// 届いた分ずつ広げると毎回全体を写し直すことになり、倍にすると内容の倍近くを確保したままになるので、
+		// 足りなくなったら 1/4 ずつ余裕を持たせて広げる
+		auto needed = core.chars.size() + streamText.size();
+		if (core.chars.capacity() < needed) {
+			core.chars.reserve(std::max(needed, core.chars.capacity() + core.chars.capacity() / 4));
+		}
+
+		// 追加された文字だけを測定し、それより前の配置はそのまま使うので、最初の画面は読み込みの途中でも表示される
+		InsertChars(static_cast<int>(core.chars.size()), streamText, false);
+		core.lineDiff.AppendToBase(streamText.data(), streamText.size());
+	}
+
+	if (finished) {
+		streamReader.Stop();
+		std::wstring().swap(streamText);
+	}
+}
+
+void Editor::ReloadFile() {
+	// 保存していない変更がある場合は確認する
+	// メッセージボックスを表示している間にも通知が届くので、その間は読み直さない
+	if (modified) {
+		reloadConfirming = true;
+		auto answer = MessageBox(hwnd,
+			rswprintf(L"%s は他のプログラムで変更されました。\n再読み込みすると保存していない変更は失われます。再読み込みしますか?", filePath.c_str()).c_str(),
+			L"確認", MB_YESNO | MB_ICONQUESTION);
+		reloadConfirming = false;
+
+		if (answer != IDYES) {
+			// 今のファイルの内容を基準にして、同じ変更について何度も確認しないようにする
+			// ジャーナルも今のファイルに対する記録にし、編集中の内容はチェックポイントに書き出す
+			std::string bytes;
+			std::wstring text;
+			if (ReadFileBytes(filePath, bytes)) {
+				fileTail.Reset(filePath, bytes, text);
+				core.lineDiff.SetBase(text);
+				journal.Rebase(GetText(), JournalBase::Of(bytes.data(), bytes.size()), fileTail.LoadedBytes());
+			}
+			return;
+		}
+	}
+
+	std::string bytes;
+	if (!ReadFileBytes(filePath, bytes)) {
+		return;
+	}
+
+	std::wstring text;
+	fileTail.Reset(filePath, bytes, text);
+	auto base = JournalBase::Of(bytes.data(), bytes.size());
+	bytes.clear();
+	bytes.shrink_to_fit();
+
+	// 先頭と末尾の一致している部分はそのまま残し、異なる部分だけを置き換える
+	std::size_t prefix = 0;
+	while (prefix < core.chars.size() && prefix < text.size() && core.chars[prefix].wchar == text[prefix]) {
+		prefix++;
+	}
+	std::size_t suffix = 0;
+	while (suffix < core.chars.size() - prefix && suffix < text.size() - prefix
+		&& core.chars[core.chars.size() - 1 - suffix].wchar == text[text.size() - 1 - suffix]) {
+		suffix++;
+	}
+
+	// 選択範囲の両端に印を付けて置き換えた後の位置を読み取る。置き換えた範囲の中にある端は範囲の先頭に寄せる
+	auto selectionAnchor = core.markers.Add(selection.start, selection.start, MarkerKind::Anchor, MarkerStickiness::Before);
+	auto selectionActive = core.markers.Add(selection.end, selection.end, MarkerKind::Anchor, MarkerStickiness::Before);
+
+	if (prefix + suffix < core.chars.size()) {
+		EraseChars(static_cast<int>(prefix), static_cast<int>(core.chars.size() - suffix), false);
+	}
+	if (prefix + suffix < text.size()) {
+		InsertChars(static_cast<int>(prefix), text.substr(prefix, text.size() - prefix - suffix), false);
+	}
+
+	auto anchor = core.markers.Get(selectionAnchor).start;
+	auto active = core.markers.Get(selectionActive).start;
+	core.markers.Remove(selectionAnchor);
+	core.markers.Remove(selectionActive);
+	MoveCaret(static_cast<int>(anchor));
+	MoveCaret(static_cast<int>(active), true);
+
+	modified = false;
+	core.lineDiff.MarkSaved();
+
+	// ファイルと同じ内容になったので、今のファイルを元にジャーナルを作り直す
+	try {
+		journal.Open(filePath, base, fileTail.LoadedBytes(), options.journalCommitIntervalMsec, options.journalCheckpointBytes);
+	} catch (const JournalException& e) {
+		std::wcout << L"Unable to reopen journal: " << e.what() << std::endl;
+	}
+}
+
+void Editor::StartLanguageServer() {
+	if (options.languageServerCommand.empty() || filePath.empty()) {
+		return;
+	}
+
+	// 結果は読み込みのスレッドから届くので UI スレッドに送り直す
+	auto hwnd = this->hwnd;
+	if (!languageServer.Start(options.languageServerCommand, filePath, GetText(), options.languageServerDebounceMsec, [this, hwnd]() {
+		PostMessage(hwnd, WM_LANGUAGE_SERVER_UPDATED, 0, reinterpret_cast<LPARAM>(this));
+	})) {
+		std::wcout << L"Unable to start language server: " << options.languageServerCommand << std::endl;
+	}
+}
+
+LspPosition Editor::LspPositionOf(std::size_t index) {
+	// wchar_t は UTF-16 なので、行の先頭からの文字数がそのまま桁になる
+	auto line = core.lineDiff.LineOf(index);
+	return LspPosition{ line, index - core.lineDiff.LineStart(line) };
+}
+
+std::size_t Editor::IndexOfLspPosition(const LspPosition& position) {
+	auto lines = core.lineDiff.LineCount();
+	if (position.line >= lines) {
+		return core.chars.size();
+	}
+
+	auto start = core.lineDiff.LineStart(position.line);
+	auto end = position.line + 1 < lines ? core.lineDiff.LineStart(position.line + 1) - 1 : core.chars.size();
+	return std::min(start + position.character, end);
+}
+
+void Editor::OnLanguageServerUpdated() {
+	if (suspended) {
+		return;
+	}
+
+	// 今の内容に対する結果だけが取り出せるので、そのまま位置に直せる
+	// 次の結果が届くまでは印として編集に合わせてずらす
+	std::vector<LspDiagnostic> receivedDiagnostics;
+	if (languageServer.TakeDiagnostics(receivedDiagnostics)) {
+		core.markers.RemoveAll(MarkerKind::Diagnostic);
+		diagnostics.swap(receivedDiagnostics);
+		// 印の値に番号を入れるので、入りきらない分は表示しない
+		if (diagnostics.size() > UINT16_MAX) {
+			diagnostics.resize(UINT16_MAX);
+		}
+		for (std::size_t k = 0; k < diagnostics.size(); k++) {
+			auto start = IndexOfLspPosition(diagnostics[k].start);
+			auto end = std::max(start, IndexOfLspPosition(diagnostics[k].end));
+			core.markers.Add(start, end, MarkerKind::Diagnostic, MarkerStickiness::Outside, static_cast<uint16_t>(k));
+		}
+	}
+
+	std::vector<LspSemanticToken> tokens;
+	if (languageServer.TakeSemanticTokens(tokens)) {
+		// 種類ごとの色を先に決めておき、色を付けない字句は印にしない
+		std::vector<uint16_t> styles;
+		for (auto& type : languageServer.TokenTypes()) {
+			styles.push_back(TokenStyleOf(type));
+		}
+
+		core.markers.RemoveAll(MarkerKind::SemanticToken);
+		for (auto& token : tokens) {
+			auto style = token.type < styles.size() ? styles[token.type] : 0;
+			if (style == 0) {
+				continue;
+			}
+			auto start = IndexOfLspPosition(token.start);
+			auto end = IndexOfLspPosition(LspPosition{ token.start.line, token.start.character + token.length });
+			core.markers.Add(start, end, MarkerKind::SemanticToken, MarkerStickiness::Outside, style);
+		}
+
+		// 文字の色が変わるので描画済みの帯を描画し直す
+		InvalidateBands();
+	}
 }
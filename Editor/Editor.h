@@ -1,6 +1,19 @@
 #pragma once
 
 #include "stdafx.h"
+#include "Journal.h"
+#include "ColumnIndex.h"
+#include "FileWatcher.h"
+#include "EditCore.h"
+#include "MemoryUsage.h"
+#include "Arena.h"
+#include "Macro.h"
+#include "InputTrace.h"
+#include "FontResources.h"
+#include "Platform.h"
+#include "WorkerPool.h"
+#include "LspClient.h"
+#include "StreamReader.h"
 
 class RectE {
 public:
@@ -47,24 +60,44 @@ struct Caret {
 	bool visible;
 };
 
-struct Char {
-	float x;
-	float y;
-	float width;
-	wchar_t wchar;
-};
-
 struct Scrollbar {
 	RectE thumb;
 	RectE bar;
 };
 
+// 描画済みの数行分の内容を保持するオフスクリーンのレイヤー
+struct RenderBand {
+	int index; // 何番目の帯か (-1 の場合は未使用)
+	int column; // 水平方向に何番目か
+	ID2D1BitmapRenderTarget* target;
+	ID2D1Bitmap* bitmap;
+	unsigned int lastUsedFrame;
+};
+
 struct EditorOptions {
-	int cursorBlinkRateMsec; // J[\̓_őx (~b)
-	float cursorWidth; // J[\̕
-	std::wstring fontName; // tHg̖O
-	float fontSize; // tHgTCY
-	float scrollAmount; // XN[
+	int cursorBlinkRateMsec; // カーソルの点滅速度 (ミリ秒)
+	float cursorWidth; // カーソルの幅
+	std::wstring fontName; // フォントの名前
+	float fontSize; // フォントサイズ
+	float scrollAmount; // スクロール量
+	bool smoothScroll; // スクロールをアニメーションさせるかどうか
+	bool wordWrap; // 画面の端で折り返すかどうか
+	int columnCheckpointInterval; // 折り返さない場合に幅を記録する間隔 (文字数)
+	int renderBandLines; // まとめてキャッシュする行数
+	uint64_t renderBandCacheBytes; // 描画済みの帯のキャッシュに使うメモリの上限 (バイト)
+	float gutterWidth; // 変更された行の印を表示する左端の幅
+	float minimapWidth; // スクロールバーの左に表示する縮小表示の幅
+	float minimapLineHeight; // 縮小表示の 1 行の高さ (行が多い場合は縮める)
+	unsigned int journalCommitIntervalMsec; // ジャーナルをまとめて書き込む間隔 (ミリ秒)
+	uint64_t journalCheckpointBytes; // チェックポイントを作成するジャーナルの大きさ (バイト)
+	std::wstring macroPath; // 記録したマクロを保存するファイル (editor-batch の macro で再生できる)
+	std::wstring tracePath; // 記録した入力を保存するファイル (Editor.exe --replay で再生できる)
+	std::size_t layoutCharsPerFrame; // 画面より下の文字を 1 フレームで配置する数 (残りは次のフレームで続きから配置する)
+	unsigned int layoutThreads; // 折り返しを並列に計算するスレッドの数 (0 の場合は CPU の数)
+	bool monospaceLayout; // 等幅フォントの場合に文字を測定せず、行と列から位置を計算するかどうか
+	std::size_t completionCandidates; // 入力中の単語の補完の候補を表示する数 (0 の場合は補完しない)
+	std::wstring languageServerCommand; // ファイルを開いたときに起動する言語サーバーのコマンド (空の場合は起動しない)
+	unsigned int languageServerDebounceMsec; // 編集をまとめて言語サーバーに送るまで待つ時間 (ミリ秒)
 };
 
 EditorOptions DefaultEditorOptions();
@@ -72,12 +105,20 @@ EditorOptions DefaultEditorOptions();
 class Editor {
 private:
 	static constexpr int ID_CURSOR_BLINK_TIMER = 1;
+	// 並列に折り返すときに 1 つのスレッドがまとめて受け持つ文字数
+	static constexpr std::size_t PARALLEL_WRAP_CHARS = 64 * 1024;
+	static constexpr std::size_t NO_ANCHOR = SIZE_MAX;
+	// まとめて整形する文字列の最大の長さ (空白で区切れない長い文字列はこの長さで区切る)
+	static constexpr std::size_t MAX_RUN_LENGTH = 64;
+	// 字下げの深さを比べるときのタブの幅
+	static constexpr int TAB_INDENT = 4;
 
 	Timer cursorBlinkTimer;
 
 	EditorOptions options;
 	float charHeight;
-	std::vector<Char> chars;
+	// 文字の配列と、編集に合わせて更新する索引
+	EditCore core;
 	Caret caret;
 	Selection selection;
 	int selectionStartWhileDrag;
@@ -85,39 +126,248 @@ private:
 	int compositionStringLength;
 	std::vector<Char> compositionChars;
 	int compositionTextPos;
+	// 未確定文字列を取得するためのバッファ (使い回す)
+	std::vector<wchar_t> compositionBuffer;
+	// compositionChars のこの位置より前の配置はそのまま使える
+	std::size_t compositionLayoutFrom;
 	bool dragged;
 	float maxX;
 	float maxY;
-	float offsetX;
+	double offsetX;
 	float offsetY;
+	double targetOffsetX;
+	float targetOffsetY;
+	float compositionWidth;
+	float textEndX;
+	float textEndY;
+	float layoutWidth;
+	bool layoutInvalid;
+	// この位置より前の文字の配置はそのまま使える
+	std::size_t layoutInvalidFrom;
+	// 幅が変わる前に画面の一番上にあった文字。配置し直した後も一番上に表示する
+	std::size_t layoutAnchor;
+	WorkerPool layoutWorkers;
+	bool scrollToCaret;
+	// 等幅フォントで、文字の幅を行と列から計算する
+	bool monospace;
+	ColumnIndex columns;
+	Scrollbar verticalScrollbar;
 	Scrollbar horizontalScrollbar;
+	bool horizontalThumbDragged;
+	float horizontalThumbDragOffset;
+	RectE minimapBar;
+	bool minimapDragged;
+	ID2D1BitmapRenderTarget* minimapTarget;
+	ID2D1Bitmap* minimapBitmap;
+	// minimapBitmap に描画したときの minimap の版
+	uint64_t minimapVersion;
+	std::vector<RenderBand> bands;
+	ID2D1RenderTarget* bandOwner;
+	unsigned int frameCount;
+	std::wstring filePath;
+	EditJournal journal;
+	// 最後に保存または読み込んでから編集したかどうか
+	bool modified;
+	FileWatcher fileWatcher;
+	FileTail fileTail;
+	std::atomic<bool> fileChangePosted;
+	bool reloadConfirming;
+	// パイプや標準入力から読み込んでいる内容と、それを受け取る領域 (読み込みのスレッドと交互に使い回す)
+	StreamReader streamReader;
+	std::wstring streamText;
+	// 言語サーバーと、そこから届いた診断 (診断の印の値はこの配列の番号)
+	LspClient languageServer;
+	std::vector<LspDiagnostic> diagnostics;
+	// 補完の表示している候補
+	std::vector<WordCandidate> completions;
+	std::size_t completionSelected;
+	std::size_t completionPrefixLength;
+	// キャレットの位置の括弧とそれに対応する括弧 (ない場合は -1)
+	int matchedBracket;
+	int matchingBracket;
+	// メモリ使用量を重ねて表示するかどうか
+	bool memoryOverlayVisible;
+	// 描画中に使う一時的なデータの領域。フレームの終わりにまとめて解放する
+	FrameArena frameArena;
+	// 最後のフレームと最後の文字の入力でヒープから確保した回数
+	uint64_t frameAllocations;
+	uint64_t editAllocations;
+	// 入力をマクロとして記録しているかどうか
+	bool macroRecording;
+	std::vector<MacroEvent> macroEvents;
+	// 受け取った入力の記録
+	InputTraceRecorder trace;
+	// 記録した入力を再生している間は、修飾キーとマウスカーソルの状態を記録から取る
+	bool replaying;
+	unsigned int replayModifiers;
+	POINT replayCursor;
+	unsigned int clientWidth;
+	unsigned int clientHeight;
+	// 使われていない間は文字や配置を解放し、開いたままにしたファイルから読み直す
+	bool suspended;
+	MappedFile source;
 	
 	HWND hwnd;
-	IDWriteFactory* factory;
-	IDWriteTextFormat* textFormat;
+	std::shared_ptr<FontResources> font;
 
 	Char CreateChar(wchar_t character);
+	// record が false の場合はファイル側の変更を反映しただけなのでジャーナルに記録しない
+	void InsertChars(int index, const std::wstring& text, bool record = true);
+	void EraseChars(int start, int end, bool record = true);
+	// ジャーナルに残っている編集を確かめて復元する。text と base は今のファイルの内容
+	// 復元した場合はジャーナルの記録も再開して true を返す。false の場合は呼び出し側でファイルをそのまま開く
+	// data と size はファイルのバイト列で、ジャーナルを付けた後に追記された部分を読むのに使う
+	bool RecoverFromJournal(const std::wstring& text, const char* data, std::size_t size, const JournalBase& base);
+	// append はデコードした追記のバイト列。内容をジャーナルに書かずに、ファイルの中の位置として記録する
+	void AppendFromFile(const std::wstring& text, const FileAppend& append);
+	void ReloadFile();
 
 	void ToggleCursorVisible();
 	void MoveCaret(int index, bool isSelectRange = false);
+	void UpdateBracketMatch();
+	void JumpToBracket(bool isSelectRange);
+	// キャレットの行の折りたたみを切り替える
+	void ToggleFold();
+	// line の次の行から折りたためる範囲の後ろの位置を探す。括弧の対応を優先し、なければ字下げで決める
+	bool FindFoldRegion(std::size_t line, std::size_t* end);
+	// 行頭の空白の幅 (空白だけの行の場合は -1)
+	int IndentOf(std::size_t line);
+	// 折りたたみが変わった位置から配置し直す
+	void InvalidateFolds(std::size_t from);
+	// 言語サーバーを起動して今の内容を開く
+	void StartLanguageServer();
+	// 言語サーバーとやり取りする位置。編集した後に呼ぶ場合も、行の区切りは編集する前のものを使う
+	LspPosition LspPositionOf(std::size_t index);
+	// 行や桁が範囲外の場合は行末や文書の末尾にする
+	std::size_t IndexOfLspPosition(const LspPosition& position);
+	// キャレットの行のブックマークを付ける、または外す
+	void ToggleBookmark();
+	// キャレットの行より後ろの最初のブックマークへ移動する (なければ先頭から探す)
+	void JumpToBookmark(bool isSelectRange);
+	// キャレットの前の単語を補完する候補を探し直す
+	void UpdateCompletions();
+	// 選んでいる候補の残りの部分を挿入する
+	void AcceptCompletion();
+	// 記録を始める、または記録を終えて保存する
+	void ToggleMacroRecording();
+	void RecordMacroKey(int keyCode);
+	void ToggleTraceRecording();
+	void RecordInput(TraceEvent::Type type, int value = 0, float x = 0, float y = 0);
+	// 再生中は記録した状態を返す
+	bool IsKeyPressed(int keyCode);
+	// クライアント座標
+	POINT CursorPosition();
+	// 未確定文字列を text に置き換える
+	void UpdateComposition(const wchar_t* text, std::size_t length);
+
+	void InvalidateLayout(std::size_t from = 0);
+	// index から removed 文字を inserted 文字に置き換えた後に呼ぶ。firstLine から removedLines 行が insertedLines 行になった
+	// 折り返さない場合は編集された行だけを測り直す
+	void InvalidateEditedLayout(std::size_t index, std::size_t removed, std::size_t inserted, std::size_t firstLine, std::size_t removedLines, std::size_t insertedLines);
+	// 未確定文字列の from 文字目以降とその後ろの文字を並べ直す
+	void InvalidateCompositionLayout(std::size_t from);
+	// untilIndex 番目の文字と y 座標が untilY までの文字を少なくとも配置する。残りは次に呼ばれたときに続きから配置する
+	void Layout(std::size_t untilIndex, float untilY);
+	// 配置が終わっている文字の数
+	std::size_t LaidOutEnd();
+	// index 番目の文字の位置が求まっているかどうか (末尾の場合はすべての文字)
+	bool IsLaidOut(std::size_t index);
+	void LayoutChar(Char* const character, float* const x, float* const y);
+	// 行の先頭の from から、行ごとにスレッドに分けて折り返す。(x, y) は from の位置で、配置し終えた位置を返す
+	// 行の先頭で区切れない場合は from を返すので、続きは 1 文字ずつ配置する
+	std::size_t WrapLines(std::size_t from, std::size_t untilIndex, float untilY, float* x, float* y);
+	float Advance(std::size_t index);
+	double XOfIndex(std::size_t index);
+	float YOfIndex(std::size_t index);
+	float YOfLine(std::size_t line);
+	// top から bottom までに表示されている行の範囲
+	void VisibleLines(float top, float bottom, std::size_t* firstLine, std::size_t* lastLine);
+	// top から bottom までに表示されている行の文字の範囲 [from, to)
+	void VisibleRange(float top, float bottom, std::size_t* from, std::size_t* to);
+	template <typename Func>
+	void ForEachVisibleChar(double left, double right, float top, float bottom, Func func);
+	std::size_t LowerBoundByY(float y);
+	void UpdateScroll();
+	void ScrollHorizontally(double amount);
+	void ScrollToCaret();
+	// 描画先の大きさからスクロールバーなどの位置を決め、文字を表示する幅が変わった場合は配置し直す
+	void ResizeView(float width, float height);
+	void ScrollByHorizontalWheel(short delta);
+	// 縮小表示の 1 行の高さ
+	float MinimapScale();
+	// 縮小表示の y 座標の行が画面の中央に来るようにスクロールする
+	void ScrollToMinimap(float y);
 
-	void RenderChar(ID2D1HwndRenderTarget* rt, Char* const character, float* const x, float* const y, ID2D1Brush* brush);
-	void RenderCompositionText(ID2D1HwndRenderTarget* rt, ID2D1Brush* brush, ID2D1Brush* backgroundBrush, float* const x, float* const y);
-	void RenderScrollbar(ID2D1HwndRenderTarget* rt);
+	void InvalidateBands(float fromY = 0);
+	// y 座標が [fromY, toY) にかかる描画内容を捨てる
+	void InvalidateBands(float fromY, float toY);
+	void ReleaseBands();
+	// 最も長い間使われていない帯から解放して capacity 個以下にする
+	void TrimBands(std::size_t capacity);
+	void ReleaseMinimap();
+	ID2D1Bitmap* GetBand(ID2D1RenderTarget* rt, int index, int column, std::size_t capacity, ID2D1Brush* brush);
+
+	void RenderChar(ID2D1RenderTarget* rt, const Char& character, float x, float y, ID2D1Brush* brush);
+	// 同じ行に続けて並んでいる文字を整形してまとめて描画する。positions は文字ごとの x 座標
+	void RenderRun(ID2D1RenderTarget* rt, const std::size_t* indices, const float* positions, std::size_t length, float y, ID2D1Brush* brush);
+	void RenderCompositionText(ID2D1RenderTarget* rt, ID2D1Brush* brush, ID2D1Brush* backgroundBrush);
+	void RenderGutter(ID2D1RenderTarget* rt);
+	void RenderMinimap(ID2D1RenderTarget* rt);
+	void RenderScrollbar(ID2D1RenderTarget* rt);
+	void RenderMemoryOverlay(ID2D1RenderTarget* rt);
+	void RenderCompletions(ID2D1RenderTarget* rt);
+	// 折りたたんだ行の見出しの後ろに印を描画する
+	void RenderFoldMarkers(ID2D1RenderTarget* rt, ID2D1Brush* brush, ID2D1Brush* frameBrush);
+	// 表示されている行に付いている印を描画する
+	void RenderMarkers(ID2D1RenderTarget* rt);
+	// キャレットの位置の診断の内容を描画する
+	void RenderDiagnosticMessage(ID2D1RenderTarget* rt);
 public:
+	// ファイルが変更されたときに監視スレッドから送られるメッセージ
+	static constexpr UINT WM_FILE_CHANGED = WM_APP + 1;
+	// 差分の計算が終わったときに送られるメッセージ
+	static constexpr UINT WM_DIFF_UPDATED = WM_APP + 2;
+	// 言語サーバーから診断や意味的な字句が届いたときに送られるメッセージ
+	static constexpr UINT WM_LANGUAGE_SERVER_UPDATED = WM_APP + 3;
+	// パイプや標準入力から続きを読み込んだときに送られるメッセージ
+	static constexpr UINT WM_STREAM_RECEIVED = WM_APP + 4;
+
 	std::vector<Timer*> timers;
 
-	Editor(HWND hwnd, IDWriteFactory* factory, const EditorOptions& options = DefaultEditorOptions());
+	// フォントは同じウィンドウの他の文書と共有する
+	Editor(HWND hwnd, const std::shared_ptr<FontResources>& font, const EditorOptions& options = DefaultEditorOptions());
 	~Editor();
 	void Initialize();
 
+	void OpenFile(const std::wstring& path);
+	// 割り当てられない入力 ("-" の場合は標準入力) を名前のない文書として開く
+	// 読み込んだ分から表示し、残りはバックグラウンドで読み続ける
+	void OpenStream(const std::wstring& path);
+	void SaveFile();
 	void SetText(const std::wstring& str);
-	void AppendChar(wchar_t wchar);
+	std::wstring GetText();
+	const std::wstring& FilePath();
+	// 表示しなくなった文書の文字と配置、描画のキャッシュを解放する
+	// 保存していない変更がある場合やファイルを開けない場合は何もせずに false を返す
+	bool Suspend();
+	// ファイルから読み直し、表示されている範囲から配置し直す。休止している間のファイルの変更も反映する
+	// ファイルを読めない場合は休止したまま EditorException を投げる
+	void Resume();
+	bool IsSuspended();
 	void DeleteSelection();
-	int FindIndexByPosition(float x, float y);
+	int FindIndexByPosition(double x, float y);
+	// 用途ごとのメモリ使用量
+	MemoryReport GetMemoryUsage();
 
-	void Render(ID2D1HwndRenderTarget* rt);
-	void RenderCursor(ID2D1HwndRenderTarget* rt, float x, float y, ID2D1Brush* brush);
+	bool IsAnimating();
+	void ToggleWordWrap();
+	// 記録した入力を再生する場合は、最初の入力の前に呼ぶ
+	void BeginReplay();
+	// Frame の場合はカーソルの位置だけを反映するので、呼び出し側で描画する
+	void ReplayInput(const TraceEvent& event);
+	// ウィンドウ以外 (再生時のビットマップなど) にも描画できる
+	void Render(ID2D1RenderTarget* rt);
+	void RenderCursor(ID2D1RenderTarget* rt, double x, float y, ID2D1Brush* brush);
 	void OnChar(wchar_t character);
 	void OnOpenCandidate();
 	void OnQueryCharPosition(IMECHARPOSITION* ptr);
@@ -129,5 +379,11 @@ public:
 	void OnLButtonDown(float x, float y);
 	void OnLButtonUp(float x, float y);
 	void OnMouseWheel(short delta);
+	void OnMouseHWheel(short delta);
 	void OnResize(unsigned int width, unsigned int height);
+	void OnFileChanged();
+	// 読み込みのスレッドから届いた分を末尾に追加する
+	void OnStreamReceived();
+	// 届いた診断と意味的な字句のうち、今の内容に対するものを反映する
+	void OnLanguageServerUpdated();
 };
\ No newline at end of file
@@ -0,0 +1,296 @@
+﻿#include "Encoding.h"
+
+namespace {
+	constexpr uint32_t REPLACEMENT_CHARACTER = 0xFFFD;
+}
+
+const char UTF8_BOM[] = "\xEF\xBB\xBF";
+
+Utf8Decoder::Utf8Decoder(bool skipBom, bool allowSurrogates) :
+	codepoint(0),
+	remaining(0),
+	pendingBytes(0),
+	lower(0x80),
+	upper(0xBF),
+	skipBom(skipBom),
+	allowSurrogates(allowSurrogates),
+	bomChecked(!skipBom),
+	bomSkipped(false),
+	invalidCount(0) {
+}
+
+void Utf8Decoder::Emit(uint32_t cp, std::wstring& out) {
+	// 先頭の BOM は読み飛ばす
+	if (!bomChecked) {
+		bomChecked = true;
+		if (cp == 0xFEFF) {
+			bomSkipped = true;
+			return;
+		}
+	}
+
+	if (sizeof(wchar_t) == 2 && cp > 0xFFFF) {
+		// wchar_t が 16 ビットの環境ではサロゲートペアにする
+		cp -= 0x10000;
+		out.push_back(static_cast<wchar_t>(0xD800 + (cp >> 10)));
+		out.push_back(static_cast<wchar_t>(0xDC00 + (cp & 0x3FF)));
+	} else {
+		out.push_back(static_cast<wchar_t>(cp));
+	}
+}
+
+void Utf8Decoder::EmitInvalid(std::wstring& out) {
+	invalidCount++;
+	Emit(REPLACEMENT_CHARACTER, out);
+}
+
+void Utf8Decoder::Decode(const char* data, std::size_t size, std::wstring& out) {
+	for (std::size_t i = 0; i < size; i++) {
+		auto byte = static_cast<unsigned char>(data[i]);
+
+		// ASCII が続く間はまとめて変換する
+		if (byte < 0x80 && remaining == 0 && bomChecked) {
+			auto end = i + 1;
+			while (end < size && static_cast<unsigned char>(data[end]) < 0x80) {
+				end++;
+			}
+			auto length = out.size();
+			out.resize(length + (end - i));
+			for (auto p = &out[length]; i < end; i++) {
+				*p++ = static_cast<wchar_t>(data[i]);
+			}
+			i--;
+			continue;
+		}
+
+		if (remaining > 0) {
+			if (byte >= lower && byte <= upper) {
+				lower = 0x80;
+				upper = 0xBF;
+				codepoint = (codepoint << 6) | (byte & 0x3F);
+				pendingBytes++;
+				if (--remaining == 0) {
+					pendingBytes = 0;
+					Emit(codepoint, out);
+				}
+				continue;
+			}
+
+			// 継続バイトが途切れた場合や、受け付けない範囲だった場合は、そこまでを 1 つの置換文字にして読み直す
+			remaining = 0;
+			pendingBytes = 0;
+			lower = 0x80;
+			upper = 0xBF;
+			EmitInvalid(out);
+		}
+
+		// 各長さで表せる最小の値より小さくなるもの (冗長な表現)、サロゲート、U+10FFFF を超えるものは
+		// 先頭のバイトと 2 バイト目の組み合わせで決まるので、2 バイト目で受け付ける範囲を狭めて弾く
+		if (byte < 0x80) {
+			Emit(byte, out);
+		} else if (byte >= 0xC2 && byte <= 0xDF) {
+			// C0 と C1 は U+0080 より小さい値になる
+			codepoint = byte & 0x1F;
+			remaining = 1;
+			pendingBytes = 1;
+		} else if (byte >= 0xE0 && byte <= 0xEF) {
+			// E0 80 から E0 9F は U+0800 より小さく、ED A0 から ED BF はサロゲートになる
+			codepoint = byte & 0x0F;
+			remaining = 2;
+			pendingBytes = 1;
+			lower = byte == 0xE0 ? 0xA0 : 0x80;
+			upper = byte == 0xED && !allowSurrogates ? 0x9F : 0xBF;
+		} else if (byte >= 0xF0 && byte <= 0xF4) {
+			// F0 80 から F0 8F は U+10000 より小さく、F4 90 以降と F5 以降の先頭のバイトは U+10FFFF を超える
+			codepoint = byte & 0x07;
+			remaining = 3;
+			pendingBytes = 1;
+			lower = byte == 0xF0 ? 0x90 : 0x80;
+			upper = byte == 0xF4 ? 0x8F : 0xBF;
+		} else {
+			EmitInvalid(out);
+		}
+	}
+}
+
+void Utf8Decoder::Finish(std::wstring& out) {
+	if (remaining > 0) {
+		remaining = 0;
+		pendingBytes = 0;
+		lower = 0x80;
+		upper = 0xBF;
+		EmitInvalid(out);
+	}
+}
+
+void Utf8Decoder::Reset() {
+	codepoint = 0;
+	remaining = 0;
+	pendingBytes = 0;
+	lower = 0x80;
+	upper = 0xBF;
+	bomChecked = !skipBom;
+	bomSkipped = false;
+	invalidCount = 0;
+}
+
+std::size_t Utf8Decoder::InvalidCount() const {
+	return invalidCount;
+}
+
+std::size_t Utf8Decoder::PendingBytes() const {
+	return remaining > 0 ? pendingBytes : 0;
+}
+
+bool Utf8Decoder::BomSkipped() const {
+	return bomSkipped;
+}
+
+TextStreamDecoder::TextStreamDecoder(bool skipBom) :
+	decoder(skipBom),
+	pendingCR(false),
+	crlfCount(0),
+	lfCount(0) {
+}
+
+void TextStreamDecoder::Decode(const char* data, std::size_t size, std::wstring& out) {
+	decoded.clear();
+	decoder.Decode(data, size, decoded);
+
+	out.reserve(out.size() + decoded.size() + 1);
+	for (auto ch : decoded) {
+		if (pendingCR) {
+			pendingCR = false;
+			// \r\n の場合は \r を捨てる
+			if (ch != '\n') {
+				out.push_back('\r');
+			} else {
+				crlfCount++;
+			}
+		} else if (ch == '\n') {
+			lfCount++;
+		}
+
+		if (ch == '\r') {
+			pendingCR = true;
+		} else {
+			out.push_back(ch);
+		}
+	}
+}
+
+void TextStreamDecoder::Finish(std::wstring& out) {
+	if (pendingCR) {
+		pendingCR = false;
+		out.push_back('\r');
+	}
+	decoder.Finish(out);
+}
+
+void TextStreamDecoder::Reset() {
+	decoder.Reset();
+	pendingCR = false;
+	crlfCount = 0;
+	lfCount = 0;
+}
+
+std::size_t TextStreamDecoder::PendingBytes() const {
+	return decoder.PendingBytes() + (pendingCR ? 1 : 0);
+}
+
+std::size_t TextStreamDecoder::InvalidCount() const {
+	return decoder.InvalidCount();
+}
+
+TextFormat TextStreamDecoder::Format() const {
+	return TextFormat{ decoder.BomSkipped(), crlfCount > lfCount };
+}
+
+std::wstring DecodeUtf8(const char* data, std::size_t size) {
+	std::wstring out;
+	out.reserve(size);
+
+	Utf8Decoder decoder;
+	decoder.Decode(data, size, out);
+	decoder.Finish(out);
+
+	return out;
+}
+
+std::wstring DecodeUtf8(const std::string& str) {
+	return DecodeUtf8(str.data(), str.size());
+}
+
+void EncodeUtf8(const wchar_t* data, std::size_t size, std::string& out) {
+	for (std::size_t i = 0; i < size; i++) {
+		auto cp = static_cast<uint32_t>(data[i]);
+
+		// ASCII が続く間はまとめて変換する
+		if (cp < 0x80) {
+			auto end = i + 1;
+			while (end < size && static_cast<uint32_t>(data[end]) < 0x80) {
+				end++;
+			}
+			auto length = out.size();
+			out.resize(length + (end - i));
+			for (auto p = &out[length]; i < end; i++) {
+				*p++ = static_cast<char>(data[i]);
+			}
+			i--;
+			continue;
+		}
+
+		// サロゲートペアを結合する (対になっていないサロゲートはそのまま 3 バイトで出力する)
+		if (cp >= 0xD800 && cp <= 0xDBFF && i + 1 < size) {
+			auto low = static_cast<uint32_t>(data[i + 1]);
+			if (low >= 0xDC00 && low <= 0xDFFF) {
+				cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+				i++;
+			}
+		}
+
+		if (cp < 0x80) {
+			out.push_back(static_cast<char>(cp));
+		} else if (cp < 0x800) {
+			out.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+			out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+		} else if (cp < 0x10000) {
+			out.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+			out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+			out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+		} else {
+			out.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+			out.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+			out.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+			out.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+		}
+	}
+}
+
+std::string EncodeUtf8(const std::wstring& str) {
+	std::string out;
+	out.reserve(str.size());
+	EncodeUtf8(str.data(), str.size(), out);
+
+	return out;
+}
+
+void EncodeText(const std::wstring& text, TextFormat format, std::string& out) {
+	out.reserve(out.size() + text.size() + 3);
+	if (format.bom) {
+		out.append(UTF8_BOM, 3);
+	}
+	if (!format.crlf) {
+		EncodeUtf8(text.data(), text.size(), out);
+		return;
+	}
+
+	// 行ごとに変換し、間に \r\n を入れる
+	std::size_t start = 0;
+	for (auto end = text.find(L'\n'); end != std::wstring::npos; end = text.find(L'\n', start)) {
+		EncodeUtf8(text.data() + start, end - start, out);
+		out.append("\r\n", 2);
+		start = end + 1;
+	}
+	EncodeUtf8(text.data() + start, text.size() - start, out);
+}
@@ -0,0 +1,89 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// UTF-8 を wchar_t 列に変換するデコーダ
+// チャンク境界で分割されたマルチバイト文字も正しく扱えるように状態を保持する
+// 冗長な表現、サロゲート (U+D800 から U+DFFF)、U+10FFFF を超える値は不正なバイト列として置換文字にする
+class Utf8Decoder {
+private:
+	uint32_t codepoint;
+	int remaining;
+	// 途中まで読んだ文字のバイト数
+	int pendingBytes;
+	// 次の継続バイトとして受け付ける範囲
+	unsigned char lower;
+	unsigned char upper;
+	bool skipBom;
+	bool allowSurrogates;
+	bool bomChecked;
+	bool bomSkipped;
+	std::size_t invalidCount;
+
+	void Emit(uint32_t cp, std::wstring& out);
+	void EmitInvalid(std::wstring& out);
+public:
+	// skipBom が true の場合は先頭の BOM を読み飛ばす
+	// allowSurrogates が true の場合は、EncodeUtf8 が 3 バイトで書き出した対になっていないサロゲートをそのまま読む
+	// (ジャーナルのように、文書の内容を書いたとおりに読み戻す必要がある場合に使う)
+	explicit Utf8Decoder(bool skipBom = true, bool allowSurrogates = false);
+
+	// data を変換して out の末尾に追加する
+	void Decode(const char* data, std::size_t size, std::wstring& out);
+	// 途中で終わっているバイト列があれば置換文字として出力する
+	void Finish(std::wstring& out);
+	void Reset();
+	// 置換文字に置き換えた不正なバイト列の数
+	std::size_t InvalidCount() const;
+	// 文字の途中で止まっていて、まだ出力していないバイト数
+	std::size_t PendingBytes() const;
+	// 先頭の BOM を読み飛ばした
+	bool BomSkipped() const;
+};
+
+// UTF-8 の BOM (3 バイト)
+extern const char UTF8_BOM[];
+
+// 読み込んだテキストの書式。保存するときにこの書式に戻す
+struct TextFormat {
+	bool bom;
+	// 改行が \r\n (\n だけの改行と混ざっている場合は多い方にそろえる)
+	bool crlf;
+};
+
+// 文書として読み込むテキストのデコーダ
+// UTF-8 を変換しながら改行を \n に統一する。チャンクの末尾の \r は次のチャンクを見るまで保留する
+class TextStreamDecoder {
+private:
+	Utf8Decoder decoder;
+	std::wstring decoded;
+	bool pendingCR;
+	// 読み込んだ \r\n と \n だけの改行の数
+	std::size_t crlfCount;
+	std::size_t lfCount;
+public:
+	// ファイルの途中から読む場合は skipBom を false にする
+	explicit TextStreamDecoder(bool skipBom = true);
+
+	void Decode(const char* data, std::size_t size, std::wstring& out);
+	void Finish(std::wstring& out);
+	void Reset();
+	// 次のチャンクを見るまで出力を保留しているバイト数 (途中まで読んだ文字と末尾の \r)
+	// 入力のこの数だけ前からデコードし直せば、続きから読んだときと同じ結果になる
+	std::size_t PendingBytes() const;
+	// 置換文字に置き換えた不正なバイト列の数
+	std::size_t InvalidCount() const;
+	// これまでに読み込んだ BOM と改行
+	TextFormat Format() const;
+};
+
+std::wstring DecodeUtf8(const char* data, std::size_t size);
+std::wstring DecodeUtf8(const std::string& str);
+
+// wchar_t 列を UTF-8 に変換して out の末尾に追加する
+void EncodeUtf8(const wchar_t* data, std::size_t size, std::string& out);
+std::string EncodeUtf8(const std::wstring& str);
+// 改行が \n の文書の内容を format の書式 (BOM と改行) で UTF-8 に変換して out の末尾に追加する
+void EncodeText(const std::wstring& text, TextFormat format, std::string& out);
@@ -0,0 +1,322 @@
+﻿#include "FileWatcher.h"
+#include "Platform.h"
+#include "Utils.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+namespace {
+	// fp の offset から bytes バイトを buffer に読む。途中で終わっていた場合は false を返す
+	bool ReadStreamRange(FILE* fp, uint64_t offset, std::size_t bytes, std::string& buffer) {
+		buffer.resize(bytes);
+		if (bytes == 0) {
+			return true;
+		}
+		return SeekFileStream(fp, offset, SEEK_SET) && fread(&buffer[0], 1, bytes, fp) == bytes;
+	}
+
+	// 長さ size の内容から先頭と末尾、その間に等間隔に取った見本のハッシュを求める
+	// read(offset, bytes, buffer) で内容を読む。読めなかった場合は false を返す
+	template <typename Read>
+	bool HashSamples(uint64_t size, Read read, uint32_t* hash) {
+		std::string buffer;
+		uint32_t result = FNV32_OFFSET_BASIS;
+
+		auto add = [&](uint64_t offset, uint64_t bytes) {
+			if (!read(offset, static_cast<std::size_t>(bytes), buffer)) {
+				return false;
+			}
+			result = Fnv1a32(result, buffer.data(), buffer.size());
+			return true;
+		};
+
+		if (!add(0, std::min<uint64_t>(size, FileTail::HEAD_CHECK_BYTES))) {
+			return false;
+		}
+		for (std::size_t i = 1; i <= FileTail::SAMPLE_COUNT; i++) {
+			auto offset = size / (FileTail::SAMPLE_COUNT + 1) * i;
+			if (!add(offset, std::min<uint64_t>(size - offset, FileTail::SAMPLE_BYTES))) {
+				return false;
+			}
+		}
+		auto tail = std::min<uint64_t>(size, FileTail::TAIL_CHECK_BYTES);
+		if (!add(size - tail, tail)) {
+			return false;
+		}
+
+		*hash = result;
+		return true;
+	}
+
+	// path をディレクトリとファイル名に分ける
+	void SplitPath(const std::wstring& path, std::wstring& directory, std::wstring& name) {
+		auto pos = path.find_last_of(L"\\/");
+		if (pos == std::wstring::npos) {
+			directory = L".";
+			name = path;
+		} else {
+			directory = pos == 0 ? path.substr(0, 1) : path.substr(0, pos);
+			name = path.substr(pos + 1);
+		}
+	}
+}
+
+FileWatcher::FileWatcher() :
+	stopRequested(false) {
+#ifdef _WIN32
+	stopEvent = nullptr;
+#else
+	stopPipe[0] = stopPipe[1] = -1;
+#endif
+}
+
+FileWatcher::~FileWatcher() {
+	Stop();
+}
+
+bool FileWatcher::Start(const std::wstring& path, std::function<void()> onChanged) {
+	Stop();
+
+	stopRequested = false;
+#ifdef _WIN32
+	stopEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+	if (!stopEvent) {
+		return false;
+	}
+#else
+	if (pipe(stopPipe) != 0) {
+		stopPipe[0] = stopPipe[1] = -1;
+		return false;
+	}
+#endif
+
+	thread = std::thread(&FileWatcher::Run, this, path, std::move(onChanged));
+
+	return true;
+}
+
+void FileWatcher::Stop() {
+	if (!thread.joinable()) {
+		return;
+	}
+
+	stopRequested = true;
+#ifdef _WIN32
+	SetEvent(stopEvent);
+	thread.join();
+	CloseHandle(stopEvent);
+	stopEvent = nullptr;
+#else
+	char c = 0;
+	(void)write(stopPipe[1], &c, 1);
+	thread.join();
+	close(stopPipe[0]);
+	close(stopPipe[1]);
+	stopPipe[0] = stopPipe[1] = -1;
+#endif
+}
+
+bool FileWatcher::IsWatching() const {
+	return thread.joinable();
+}
+
+#ifdef _WIN32
+
+void FileWatcher::Run(std::wstring path, std::function<void()> onChanged) {
+	std::wstring directory, name;
+	SplitPath(path, directory, name);
+
+	// ファイル自体ではなくディレクトリを監視するので、置き換えによる保存も検出できる
+	auto change = FindFirstChangeNotificationW(directory.c_str(), FALSE,
+		FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME);
+	if (change == INVALID_HANDLE_VALUE) {
+		return;
+	}
+
+	HANDLE handles[] = { change, stopEvent };
+	while (!stopRequested) {
+		auto result = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+		if (result != WAIT_OBJECT_0 || stopRequested) {
+			break;
+		}
+
+		onChanged();
+
+		if (!FindNextChangeNotification(change)) {
+			break;
+		}
+	}
+
+	FindCloseChangeNotification(change);
+}
+
+#else
+
+void FileWatcher::Run(std::wstring path, std::function<void()> onChanged) {
+	std::wstring directory, name;
+	SplitPath(path, directory, name);
+	auto target = EncodeUtf8(name);
+
+	auto fd = inotify_init1(IN_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+
+	// ファイル自体ではなくディレクトリを監視するので、置き換えによる保存も検出できる
+	auto wd = inotify_add_watch(fd, EncodeUtf8(directory).c_str(),
+		IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_TO | IN_DELETE);
+	if (wd < 0) {
+		close(fd);
+		return;
+	}
+
+	alignas(inotify_event) char buf[16 * 1024];
+	while (!stopRequested) {
+		pollfd fds[] = {
+			{ fd, POLLIN, 0 },
+			{ stopPipe[0], POLLIN, 0 },
+		};
+		if (poll(fds, 2, -1) < 0 || stopRequested || (fds[1].revents & POLLIN)) {
+			break;
+		}
+
+		auto length = read(fd, buf, sizeof(buf));
+		if (length <= 0) {
+			break;
+		}
+
+		// 一度に読めたイベントはまとめて 1 回の通知にする
+		bool changed = false;
+		for (char* p = buf; p < buf + length; ) {
+			auto event = reinterpret_cast<inotify_event*>(p);
+			if (event->len > 0 && target == event->name) {
+				changed = true;
+			}
+			p += sizeof(inotify_event) + event->len;
+		}
+
+		if (changed) {
+			onChanged();
+		}
+	}
+
+	close(fd);
+}
+
+#endif
+
+// std::min に参照で渡すので、C++14 では定義も必要
+constexpr std::size_t FileTail::HEAD_CHECK_BYTES;
+constexpr std::size_t FileTail::TAIL_CHECK_BYTES;
+constexpr std::size_t FileTail::SAMPLE_COUNT;
+constexpr std::size_t FileTail::SAMPLE_BYTES;
+
+FileTail::FileTail() :
+	size(0),
+	identity{ 0, 0 },
+	hasIdentity(false),
+	sampleHash(0) {
+}
+
+void FileTail::Reset(const std::wstring& path, const std::string& content, std::wstring& out) {
+	Reset(path, content.data(), content.size(), out);
+}
+
+void FileTail::Reset(const std::wstring& path, const char* content, std::size_t length, std::wstring& out) {
+	this->path = path;
+	size = length;
+
+	// 内容を読んだ後に置き換えられていた場合も、見本が合わないので次の Poll で読み直される
+	hasIdentity = false;
+	if (auto fp = OpenFileStream(path, L"rb")) {
+		hasIdentity = GetFileStreamIdentity(fp, &identity);
+		fclose(fp);
+	}
+
+	HashSamples(length, [content](uint64_t offset, std::size_t bytes, std::string& buffer) {
+		buffer.assign(content + offset, bytes);
+		return true;
+	}, &sampleHash);
+
+	// 途中で切れている UTF-8 の文字はデコーダに残し、追記されたときに続きからデコードする
+	decoder.Reset();
+	decoder.Decode(content, length, out);
+	pendingTail.assign(content + length - decoder.PendingBytes(), decoder.PendingBytes());
+}
+
+FileTail::Change FileTail::Poll(std::wstring& appended, FileAppend* append) {
+	auto fp = OpenFileStream(path, L"rb");
+	if (!fp) {
+		// 削除や置き換えの途中の場合は次の通知を待つ
+		return Change::None;
+	}
+
+	auto result = Change::None;
+	FileIdentity current;
+	uint64_t fileSize = 0;
+	bool ok = GetFileStreamIdentity(fp, &current) && SeekFileStream(fp, 0, SEEK_END);
+	if (ok) {
+		fileSize = TellFileStream(fp);
+	}
+
+	auto read = [fp](uint64_t offset, std::size_t bytes, std::string& buffer) {
+		return ReadStreamRange(fp, offset, bytes, buffer);
+	};
+
+	uint32_t hash = 0;
+	if (!ok) {
+	} else if (!hasIdentity || current != identity || fileSize < size) {
+		// 別のファイルに置き換えられたか、切り詰められた
+		result = Change::Replaced;
+	} else if (!HashSamples(size, read, &hash)) {
+	} else if (hash != sampleHash) {
+		result = Change::Replaced;
+	} else if (fileSize > size) {
+		// 前回文字の途中で止まっていた分から読むが、デコーダにはその続きだけを渡す
+		auto pending = decoder.PendingBytes();
+		std::string data;
+		if (ReadStreamRange(fp, size - pending, static_cast<std::size_t>(fileSize - size + pending), data)) {
+			decoder.Decode(data.data() + pending, data.size() - pending, appended);
+			pendingTail.assign(data.data() + data.size() - decoder.PendingBytes(), decoder.PendingBytes());
+			if (append) {
+				append->offset = size - pending;
+				append->bytes.swap(data);
+			}
+			size = fileSize;
+			HashSamples(size, read, &sampleHash);
+			result = Change::Appended;
+		}
+	}
+
+	fclose(fp);
+	return result;
+}
+
+uint64_t FileTail::Size() const {
+	return size;
+}
+
+uint64_t FileTail::LoadedBytes() const {
+	return size - decoder.PendingBytes();
+}
+
+TextFormat FileTail::Format() const {
+	return decoder.Format();
+}
+
+std::size_t FileTail::InvalidCount() const {
+	return decoder.InvalidCount();
+}
+
+const std::string& FileTail::PendingTail() const {
+	return pendingTail;
+}
@@ -0,0 +1,101 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <functional>
+#include <thread>
+#include <atomic>
+
+#include "Encoding.h"
+#include "Platform.h"
+
+// ファイルの変更を監視する
+//
+// Linux では inotify、Windows では FindFirstChangeNotification でディレクトリを監視し、
+// 変更があるたびに監視スレッドから onChanged を呼ぶ。
+// onChanged は監視スレッドで呼ばれるので、UI の更新はメッセージを送るなどして UI スレッドで行うこと。
+// 通知は間引かれることがあり、関係のない変更でも呼ばれることがあるので、実際の変更は FileTail で確かめる。
+class FileWatcher {
+private:
+	std::thread thread;
+	std::atomic<bool> stopRequested;
+#ifdef _WIN32
+	void* stopEvent;
+#else
+	int stopPipe[2];
+#endif
+
+	void Run(std::wstring path, std::function<void()> onChanged);
+public:
+	FileWatcher();
+	~FileWatcher();
+
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	// 監視を開始できなかった場合は false を返す
+	bool Start(const std::wstring& path, std::function<void()> onChanged);
+	void Stop();
+	bool IsWatching() const;
+};
+
+// 追記されたときにデコードしたバイト列とファイルの中の位置
+// 前回の読み込みで文字の途中や \r で止まっていた分も含むので、これだけをデコードすれば追記された文字列になる
+struct FileAppend {
+	uint64_t offset;
+	std::string bytes;
+};
+
+// 読み込んだファイルの末尾を追いかける
+//
+// 読み込み済みのバイト数とファイルの識別子、読み込み済みの部分から取った見本 (先頭と末尾、その間に等間隔に
+// SAMPLE_COUNT か所) のハッシュを覚えておき、ファイルが変更されたときに追記されただけなのか、
+// それ以外の書き換えなのかを判定する。別のファイルに置き換えられた場合は内容によらず書き換えとみなす。
+// 見本以外の部分だけをその場で書き換えられた場合は見分けられない。
+// 追記の場合は増えた部分だけを読み、前回の読み込みで途中まで来ていた UTF-8 の文字や \r\n を続きからデコードする。
+class FileTail {
+public:
+	enum class Change {
+		None,
+		// 末尾に追加された
+		Appended,
+		// 追記以外の変更があった。ファイル全体を読み直す必要がある
+		Replaced
+	};
+private:
+	std::wstring path;
+	uint64_t size;
+	// 読み込んだときのファイルの識別子。読み込んだ後にファイルが存在しなかった場合は hasIdentity が false
+	FileIdentity identity;
+	bool hasIdentity;
+	// 読み込み済みの部分から取った見本のハッシュ
+	uint32_t sampleHash;
+	TextStreamDecoder decoder;
+	// デコードを保留している末尾のバイト列 (途中まで読んだ文字と末尾の \r)
+	std::string pendingTail;
+public:
+	static constexpr std::size_t HEAD_CHECK_BYTES = 4096;
+	static constexpr std::size_t TAIL_CHECK_BYTES = 4096;
+	static constexpr std::size_t SAMPLE_COUNT = 16;
+	static constexpr std::size_t SAMPLE_BYTES = 256;
+
+	FileTail();
+
+	// content はファイル全体。デコードした結果を out に追加する
+	void Reset(const std::wstring& path, const std::string& content, std::wstring& out);
+	// 割り当てたファイルなど、文字列にコピーしていない内容から読み込む場合
+	void Reset(const std::wstring& path, const char* content, std::size_t length, std::wstring& out);
+	// ファイルを調べ、追記されていればデコードした文字列を appended に追加する
+	// append を渡した場合は、デコードしたバイト列とその位置を返す
+	Change Poll(std::wstring& appended, FileAppend* append = nullptr);
+	uint64_t Size() const;
+	// 先頭からデコードし終えたバイト数。文字の途中や \r で止まっている分は含まない
+	uint64_t LoadedBytes() const;
+	// 読み込んだファイルの BOM と改行
+	TextFormat Format() const;
+	// 置換文字に置き換えた不正なバイト列の数 (追記された分も含む)
+	std::size_t InvalidCount() const;
+	// LoadedBytes より後ろの、まだ文書に入れていないバイト列。保存するときはそのまま書き戻す
+	const std::string& PendingTail() const;
+};
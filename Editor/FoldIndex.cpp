@@ -0,0 +1,194 @@
+﻿#include "FoldIndex.h"
+
+FoldIndex::FoldIndex() {
+	Rebuild();
+}
+
+void FoldIndex::Rebuild() {
+	hidden.clear();
+	for (auto& fold : folds) {
+		// 重なっている範囲や接している範囲はまとめる
+		if (!hidden.empty() && fold.start <= hidden.back().end) {
+			hidden.back().end = std::max(hidden.back().end, fold.end);
+		} else {
+			hidden.push_back(fold);
+		}
+	}
+
+	hiddenBefore.assign(1, 0);
+	for (auto& range : hidden) {
+		hiddenBefore.push_back(hiddenBefore.back() + (range.end - range.start));
+	}
+}
+
+void FoldIndex::Clear() {
+	std::vector<FoldRange>().swap(folds);
+	std::vector<FoldRange>().swap(hidden);
+	std::vector<std::size_t>().swap(hiddenBefore);
+	Rebuild();
+}
+
+bool FoldIndex::Empty() const {
+	return hidden.empty();
+}
+
+bool FoldIndex::Fold(std::size_t start, std::size_t end) {
+	if (start == 0 || start >= end) {
+		return false;
+	}
+
+	auto itr = std::lower_bound(folds.begin(), folds.end(), FoldRange{ start, end }, [](const FoldRange& a, const FoldRange& b) {
+		return a.start < b.start || (a.start == b.start && a.end > b.end);
+	});
+	if (itr != folds.end() && itr->start == start && itr->end == end) {
+		return false;
+	}
+
+	folds.insert(itr, FoldRange{ start, end });
+	Rebuild();
+	return true;
+}
+
+bool FoldIndex::Unfold(std::size_t start) {
+	auto size = folds.size();
+	folds.erase(std::remove_if(folds.begin(), folds.end(), [start](const FoldRange& fold) {
+		return fold.start == start;
+	}), folds.end());
+
+	if (folds.size() == size) {
+		return false;
+	}
+
+	Rebuild();
+	return true;
+}
+
+bool FoldIndex::Reveal(std::size_t index) {
+	auto size = folds.size();
+	folds.erase(std::remove_if(folds.begin(), folds.end(), [index](const FoldRange& fold) {
+		return fold.start <= index && index < fold.end;
+	}), folds.end());
+
+	if (folds.size() == size) {
+		return false;
+	}
+
+	Rebuild();
+	return true;
+}
+
+bool FoldIndex::Insert(std::size_t pos, std::size_t length, bool lineStart, std::size_t* revealedFrom) {
+	if (folds.empty()) {
+		return false;
+	}
+
+	// 隠れている部分に挿入された場合は解除する (行の先頭でなくなる場合があるので、先頭に挿入された場合も含める)
+	// 改行で終わっていない最後の行まで隠している場合は、その行に続けて挿入された場合も解除する
+	bool revealed = false;
+	*revealedFrom = pos;
+	auto out = folds.begin();
+	for (auto& fold : folds) {
+		if (pos < fold.start) {
+			fold.start += length;
+			fold.end += length;
+		} else if (pos < fold.end || (pos == fold.end && !lineStart)) {
+			revealed = true;
+			*revealedFrom = std::min(*revealedFrom, fold.start);
+			continue;
+		}
+		*out++ = fold;
+	}
+	folds.erase(out, folds.end());
+
+	Rebuild();
+	return revealed;
+}
+
+bool FoldIndex::Erase(std::size_t pos, std::size_t length, std::size_t* revealedFrom) {
+	if (folds.empty()) {
+		return false;
+	}
+
+	// 隠れている部分と見出しの行の改行 (範囲の直前の文字) が削除された場合は解除する
+	bool revealed = false;
+	*revealedFrom = pos;
+	auto out = folds.begin();
+	for (auto& fold : folds) {
+		if (pos + length < fold.start) {
+			fold.start -= length;
+			fold.end -= length;
+		} else if (pos < fold.end) {
+			revealed = true;
+			*revealedFrom = std::min(*revealedFrom, fold.start);
+			continue;
+		}
+		*out++ = fold;
+	}
+	folds.erase(out, folds.end());
+
+	Rebuild();
+	return revealed;
+}
+
+bool FoldIndex::HiddenAt(std::size_t index, FoldRange* range) const {
+	auto k = FirstHiddenAfter(index);
+	if (k < hidden.size() && hidden[k].start <= index) {
+		*range = hidden[k];
+		return true;
+	}
+
+	return false;
+}
+
+std::size_t FoldIndex::SkipHidden(std::size_t index) const {
+	FoldRange range;
+	return HiddenAt(index, &range) ? range.end : index;
+}
+
+std::size_t FoldIndex::VisibleBefore(std::size_t index) const {
+	// 隠れた範囲の直前の文字は見出しの行の改行で、隠れていない
+	FoldRange range;
+	return HiddenAt(index - 1, &range) ? range.start - 1 : index - 1;
+}
+
+std::size_t FoldIndex::FirstHiddenAfter(std::size_t index) const {
+	auto itr = std::upper_bound(hidden.begin(), hidden.end(), index, [](std::size_t index, const FoldRange& range) {
+		return index < range.end;
+	});
+
+	return static_cast<std::size_t>(std::distance(hidden.begin(), itr));
+}
+
+std::size_t FoldIndex::NextVisible(std::size_t index, std::size_t& hint) const {
+	while (hint < hidden.size() && hidden[hint].end <= index) {
+		hint++;
+	}
+	if (hint < hidden.size() && hidden[hint].start <= index) {
+		// まとめた範囲は接していないので、範囲の後ろは隠れていない
+		return hidden[hint++].end;
+	}
+
+	return index;
+}
+
+std::size_t FoldIndex::HiddenCount() const {
+	return hidden.size();
+}
+
+const FoldRange& FoldIndex::Hidden(std::size_t k) const {
+	return hidden[k];
+}
+
+std::size_t FoldIndex::HiddenCharsBefore(std::size_t index) const {
+	auto k = FirstHiddenAfter(index);
+	auto count = hiddenBefore[k];
+	if (k < hidden.size() && hidden[k].start < index) {
+		count += index - hidden[k].start;
+	}
+
+	return count;
+}
+
+std::size_t FoldIndex::MemoryUsage() const {
+	return BytesOf(folds) + BytesOf(hidden) + BytesOf(hiddenBefore);
+}
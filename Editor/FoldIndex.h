@@ -0,0 +1,66 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+#include "MemoryUsage.h"
+
+// 文書の位置の範囲 [start, end)
+struct FoldRange {
+	std::size_t start;
+	std::size_t end;
+};
+
+// 折りたたんだ範囲の索引
+//
+// 折りたたんだ範囲は入れ子になってもよく、開始位置の順に並べて持つ。
+// 表示するときは重なった範囲をまとめた隠れた範囲 (互いに離れていて、開始位置の順) と
+// その前までに隠れている文字数の累積和を使うので、ある位置が隠れているかどうかや、
+// 隠れていない文字の数を二分探索で O(log n) で求められる。
+// 範囲は行の先頭から行の先頭まで (または文書の末尾まで) とし、先頭の行は隠さない。
+// 編集されたときは後ろにある範囲をずらし、隠れている部分や見出しの行の改行が編集された範囲は解除する。
+class FoldIndex {
+private:
+	// 折りたたんだ範囲 (開始位置の順、同じ場合は長い順)
+	std::vector<FoldRange> folds;
+	// 折りたたんだ範囲をまとめた隠れた範囲
+	std::vector<FoldRange> hidden;
+	// hiddenBefore[k] は hidden[k] より前に隠れている文字数
+	std::vector<std::size_t> hiddenBefore;
+
+	void Rebuild();
+public:
+	FoldIndex();
+
+	void Clear();
+	bool Empty() const;
+	// [start, end) を折りたたむ。同じ範囲がすでにある場合は何もせずに false を返す
+	bool Fold(std::size_t start, std::size_t end);
+	// start から始まる折りたたみを解除する。解除した場合は true を返す
+	bool Unfold(std::size_t start);
+	// index を隠している折りたたみをすべて解除する。解除した場合は true を返す
+	bool Reveal(std::size_t index);
+	// pos に length 文字を挿入した後に呼ぶ。lineStart は pos が行の先頭かどうか
+	// 解除した場合は true を返し、表示が変わる最初の位置を revealedFrom に設定する
+	bool Insert(std::size_t pos, std::size_t length, bool lineStart, std::size_t* revealedFrom);
+	// pos から length 文字を削除した後に呼ぶ
+	bool Erase(std::size_t pos, std::size_t length, std::size_t* revealedFrom);
+
+	// index が隠れている場合は true を返し、それを含む隠れた範囲を range に設定する
+	bool HiddenAt(std::size_t index, FoldRange* range) const;
+	// index が隠れている場合はその隠れた範囲の後ろの位置、そうでなければ index
+	std::size_t SkipHidden(std::size_t index) const;
+	// index より前で隠れていない最後の文字の位置 (index は 1 以上)
+	std::size_t VisibleBefore(std::size_t index) const;
+	// end が index より後ろにある最初の隠れた範囲の番号
+	std::size_t FirstHiddenAfter(std::size_t index) const;
+	// 前から順にたどる場合の SkipHidden。hint は FirstHiddenAfter で初期化し、同じ変数を渡し続ける
+	std::size_t NextVisible(std::size_t index, std::size_t& hint) const;
+	std::size_t HiddenCount() const;
+	const FoldRange& Hidden(std::size_t k) const;
+	// index より前に隠れている文字数
+	std::size_t HiddenCharsBefore(std::size_t index) const;
+	// 確保しているメモリの大きさ (バイト)
+	std::size_t MemoryUsage() const;
+};
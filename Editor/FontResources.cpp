@@ -0,0 +1,170 @@
+﻿#include "stdafx.h"
+#include "FontResources.h"
+#include "MemoryUsage.h"
+#include "Utils.h"
+
+FontResources::FontResources(IDWriteFactory* factory, const std::wstring& fontName, float fontSize) :
+	factory(factory),
+	fontName(fontName),
+	fontSize(fontSize),
+	textFormat(nullptr),
+	charHeight(0),
+	analyzer(nullptr),
+	fontFace(nullptr),
+	monospace(false),
+	cellWidth(0),
+	widthPages(65536 / PAGE_SIZE) {
+}
+
+FontResources::~FontResources() {
+	// キャッシュが参照しているので先に破棄する
+	shapedRuns.reset();
+
+	for (IUnknown* resource : std::initializer_list<IUnknown*>{ textFormat, analyzer, fontFace }) {
+		if (resource) {
+			resource->Release();
+		}
+	}
+}
+
+void FontResources::Initialize() {
+	// TextFormat を作成
+	HRESULT hr = factory->CreateTextFormat(
+		fontName.c_str(),
+		nullptr,
+		DWRITE_FONT_WEIGHT_REGULAR,
+		DWRITE_FONT_STYLE_NORMAL,
+		DWRITE_FONT_STRETCH_NORMAL,
+		fontSize,
+		L"ja-JP",
+		&textFormat);
+
+	if (FAILED(hr)) {
+		std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+		throw FontException("Unable to create text format. font: '"
+			+ converter.to_bytes(fontName) + "', font size: " + std::to_string(fontSize));
+	}
+
+	textFormat->SetLineSpacing(DWRITE_LINE_SPACING_METHOD_UNIFORM, fontSize / 0.8f, Baseline());
+
+	// 文字列を整形するためのフォントを探す
+	IDWriteFontCollection* collection = nullptr;
+	IDWriteFontFamily* family = nullptr;
+	IDWriteFont* dwriteFont = nullptr;
+	UINT32 familyIndex = 0;
+	BOOL exists = FALSE;
+
+	hr = textFormat->GetFontCollection(&collection);
+	if (SUCCEEDED(hr)) {
+		hr = collection->FindFamilyName(fontName.c_str(), &familyIndex, &exists);
+	}
+	if (SUCCEEDED(hr) && !exists) {
+		hr = E_FAIL;
+	}
+	if (SUCCEEDED(hr)) {
+		hr = collection->GetFontFamily(familyIndex, &family);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = family->GetFirstMatchingFont(DWRITE_FONT_WEIGHT_REGULAR, DWRITE_FONT_STRETCH_NORMAL, DWRITE_FONT_STYLE_NORMAL, &dwriteFont);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = dwriteFont->CreateFontFace(&fontFace);
+	}
+	if (SUCCEEDED(hr)) {
+		hr = factory->CreateTextAnalyzer(&analyzer);
+	}
+
+	for (IUnknown* resource : std::initializer_list<IUnknown*>{ collection, family, dwriteFont }) {
+		if (resource) {
+			resource->Release();
+		}
+	}
+
+	if (FAILED(hr)) {
+		std::wstring_convert<std::codecvt_utf8<wchar_t>> converter;
+		throw FontException("Unable to create font face. font: '" + converter.to_bytes(fontName) + "'");
+	}
+
+	// キャッシュのキーにはフォント名と大きさ、太さ、スタイルを含める
+	auto style = fontName + L"/" + std::to_wstring(fontSize) + L"/regular/normal/normal";
+	auto fontKey = Fnv1a(FNV_OFFSET_BASIS, style.c_str(), style.size());
+	shapedRuns.reset(new ShapedRunCache(analyzer, fontFace, fontSize, fontKey));
+
+	// 文字の高さを測定
+	IDWriteTextLayout* layout;
+	auto testText = L"abcdefghijklnmopqrstuvwxyzABCDEFGHIJKLNMOPQRSTUVWXYZあいうえお漢字汉字繁體字";
+	auto result = factory->CreateTextLayout(testText, static_cast<UINT32>(wcslen(testText)), textFormat, 100000000, 1000, &layout);
+	if (SUCCEEDED(result)) {
+		DWRITE_TEXT_METRICS metrics;
+		layout->GetMetrics(&metrics);
+		charHeight = metrics.height;
+
+		layout->Release();
+	}
+
+	// 表示できる ASCII の文字がすべて同じ幅なら等幅とみなす
+	cellWidth = WidthOf(L'M');
+	monospace = cellWidth > 0;
+	for (wchar_t character = 0x21; character < 0x7F && monospace; character++) {
+		monospace = fabsf(WidthOf(character) - cellWidth) < 0.01f;
+	}
+}
+
+IDWriteTextFormat* FontResources::TextFormat() const {
+	return textFormat;
+}
+
+float FontResources::CharHeight() const {
+	return charHeight;
+}
+
+float FontResources::Baseline() const {
+	return fontSize;
+}
+
+ShapedRunCache& FontResources::ShapedRuns() {
+	return *shapedRuns;
+}
+
+bool FontResources::IsMonospace() const {
+	return monospace;
+}
+
+float FontResources::CellWidth() const {
+	return cellWidth;
+}
+
+float FontResources::Measure(wchar_t character) {
+	auto& page = widthPages[character / PAGE_SIZE];
+	if (page.empty()) {
+		page.assign(PAGE_SIZE, -1.0f);
+	}
+
+	// 測定できなかった文字は幅を 0 として扱う
+	float width = 0;
+	IDWriteTextLayout* layout;
+	auto result = factory->CreateTextLayout(&character, 1, textFormat, 100, 100, &layout);
+	if (SUCCEEDED(result)) {
+		DWRITE_TEXT_METRICS metrics;
+		layout->GetMetrics(&metrics);
+		// widthIncludingTrailingWhitespace は空白文字の幅も返す
+		width = metrics.widthIncludingTrailingWhitespace;
+
+		layout->Release();
+	}
+
+	page[character % PAGE_SIZE] = width;
+	return width;
+}
+
+std::size_t FontResources::MemoryUsage() const {
+	auto bytes = BytesOf(widthPages);
+	for (auto& page : widthPages) {
+		bytes += BytesOf(page);
+	}
+	if (shapedRuns) {
+		bytes += shapedRuns->MemoryUsage();
+	}
+
+	return bytes;
+}
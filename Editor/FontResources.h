@@ -0,0 +1,101 @@
+﻿#pragma once
+
+#include "stdafx.h"
+#include "ShapedRunCache.h"
+
+class FontException : public std::exception {
+private:
+	std::string message;
+public:
+	FontException(const std::string& message) : message(message) {}
+	const char* what() const noexcept { return message.c_str(); }
+};
+
+// 複数の文書で共有するフォントと文字の幅
+//
+// 文字の幅は文字コードごとに初めて使われたときに IDWriteTextLayout で測定し、256 文字ずつの表に保持する。
+// 同じフォントで開いているすべての文書から使うので、文書を開き直しても測定し直さない。
+// 文字列を整形した結果のキャッシュも文書の間で共有する。
+//
+// ASCII の表示できる文字がすべて同じ幅のフォントは等幅とみなす。等幅の場合は文字を測定せず、
+// 半角を 1 マス、東アジアの全角の文字を 2 マス、結合文字などを 0 マスとして幅を計算で求められる。
+class FontResources {
+private:
+	static constexpr std::size_t PAGE_SIZE = 256;
+
+	IDWriteFactory* factory;
+	std::wstring fontName;
+	float fontSize;
+	IDWriteTextFormat* textFormat;
+	float charHeight;
+	IDWriteTextAnalyzer* analyzer;
+	IDWriteFontFace* fontFace;
+	std::unique_ptr<ShapedRunCache> shapedRuns;
+	bool monospace;
+	float cellWidth;
+	// 使われた文字を含む表だけを確保する。測定していない文字は負の値
+	std::vector<std::vector<float>> widthPages;
+
+	float Measure(wchar_t character);
+public:
+	FontResources(IDWriteFactory* factory, const std::wstring& fontName, float fontSize);
+	~FontResources();
+
+	FontResources(const FontResources&) = delete;
+	FontResources& operator=(const FontResources&) = delete;
+
+	void Initialize();
+
+	IDWriteTextFormat* TextFormat() const;
+	float CharHeight() const;
+	// 行の上端からベースラインまでの距離
+	float Baseline() const;
+	ShapedRunCache& ShapedRuns();
+	bool IsMonospace() const;
+	// 等幅の場合の 1 マスの幅
+	float CellWidth() const;
+	// 等幅で表示する場合に文字が何マス分の幅か
+	static int CellsOf(wchar_t character);
+	// 1 文字だけを描画したときの幅 (空白文字の幅も含む)
+	float WidthOf(wchar_t character);
+	// 確保しているメモリの大きさ (バイト)
+	std::size_t MemoryUsage() const;
+};
+
+inline float FontResources::WidthOf(wchar_t character) {
+	auto& page = widthPages[character / PAGE_SIZE];
+	if (!page.empty() && page[character % PAGE_SIZE] >= 0) {
+		return page[character % PAGE_SIZE];
+	}
+
+	return Measure(character);
+}
+
+inline int FontResources::CellsOf(wchar_t character) {
+	// 結合文字、幅のない空白と書式文字、異体字セレクタ、サロゲートペアの後半
+	if ((character >= 0x0300 && character <= 0x036F)
+		|| (character >= 0x200B && character <= 0x200F)
+		|| (character >= 0xFE00 && character <= 0xFE0F)
+		|| (character >= 0xDC00 && character <= 0xDFFF)) {
+		return 0;
+	}
+
+	// ハングル字母、CJK の記号と文字、ひらがな、カタカナ、ハングル、互換漢字、全角形
+	// (サロゲートペアの前半は絵文字や CJK 拡張漢字がほとんどなので全角として扱う)
+	if ((character >= 0x1100 && character <= 0x115F)
+		|| (character >= 0x2E80 && character <= 0x303E)
+		|| (character >= 0x3041 && character <= 0x33FF)
+		|| (character >= 0x3400 && character <= 0x4DBF)
+		|| (character >= 0x4E00 && character <= 0x9FFF)
+		|| (character >= 0xA000 && character <= 0xA4CF)
+		|| (character >= 0xAC00 && character <= 0xD7A3)
+		|| (character >= 0xD800 && character <= 0xDBFF)
+		|| (character >= 0xF900 && character <= 0xFAFF)
+		|| (character >= 0xFE30 && character <= 0xFE4F)
+		|| (character >= 0xFF00 && character <= 0xFF60)
+		|| (character >= 0xFFE0 && character <= 0xFFE6)) {
+		return 2;
+	}
+
+	return 1;
+}
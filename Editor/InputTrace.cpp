@@ -0,0 +1,220 @@
+﻿#include "InputTrace.h"
+#include "Encoding.h"
+#include "Platform.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+	const char* const EVENT_NAMES[] = {
+		"char",
+		"keydown",
+		"keyup",
+		"lbuttondown",
+		"lbuttonup",
+		"wheel",
+		"hwheel",
+		"resize",
+		"ime-start",
+		"ime-composition",
+		"ime-end",
+		"frame",
+	};
+	static_assert(sizeof(EVENT_NAMES) / sizeof(EVENT_NAMES[0]) == static_cast<std::size_t>(TraceEvent::Type::TYPE_COUNT), "EVENT_NAMES must match TraceEvent::Type");
+
+	std::string EncodeText(const std::wstring& text) {
+		if (text.empty()) {
+			return "-";
+		}
+
+		std::string out;
+		char buf[16];
+		for (auto ch : text) {
+			snprintf(buf, sizeof(buf), out.empty() ? "%x" : ".%x", static_cast<unsigned int>(ch));
+			out += buf;
+		}
+		return out;
+	}
+
+	bool DecodeText(const char* str, std::wstring& out) {
+		out.clear();
+		if (str[0] == '-' && str[1] == '\0') {
+			return true;
+		}
+
+		while (*str) {
+			char* end;
+			auto code = strtoul(str, &end, 16);
+			if (end == str || code > 0xFFFF) {
+				return false;
+			}
+			out.push_back(static_cast<wchar_t>(code));
+			str = *end == '.' ? end + 1 : end;
+			if (*end != '.' && *end != '\0') {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	std::string FormatMicroseconds(uint64_t nanoseconds) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%.1fus", nanoseconds / 1000.0);
+		return buf;
+	}
+}
+
+const char* TraceEvent::NameOf(Type type) {
+	return EVENT_NAMES[static_cast<int>(type)];
+}
+
+InputTraceRecorder::InputTraceRecorder() :
+	recording(false) {
+}
+
+void InputTraceRecorder::Start() {
+	events.clear();
+	start = std::chrono::steady_clock::now();
+	recording = true;
+}
+
+void InputTraceRecorder::Stop() {
+	recording = false;
+}
+
+bool InputTraceRecorder::IsRecording() const {
+	return recording;
+}
+
+void InputTraceRecorder::Record(TraceEvent event) {
+	if (!recording) {
+		return;
+	}
+
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	event.time = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+	events.push_back(std::move(event));
+}
+
+const std::vector<TraceEvent>& InputTraceRecorder::Events() const {
+	return events;
+}
+
+void SaveInputTrace(const std::wstring& path, const std::vector<TraceEvent>& events) {
+	std::string data = "# editor input trace\n";
+	char buf[128];
+	for (auto& event : events) {
+		snprintf(buf, sizeof(buf), "%llu %s %u %d %g %g ", static_cast<unsigned long long>(event.time), TraceEvent::NameOf(event.type),
+			event.modifiers, event.value, event.x, event.y);
+		data += buf;
+		data += EncodeText(event.text);
+		data += '\n';
+	}
+
+	if (!WriteFileAtomically(path, data)) {
+		throw InputTraceException("Unable to save input trace");
+	}
+}
+
+std::vector<TraceEvent> LoadInputTrace(const std::wstring& path) {
+	std::string data;
+	if (!ReadFileBytes(path, data)) {
+		throw InputTraceException("Unable to read input trace: " + EncodeUtf8(path));
+	}
+
+	std::vector<TraceEvent> events;
+	std::size_t lineNumber = 0;
+	for (std::size_t pos = 0; pos < data.size(); ) {
+		auto end = data.find('\n', pos);
+		if (end == std::string::npos) {
+			end = data.size();
+		}
+		auto line = data.substr(pos, end - pos);
+		pos = end + 1;
+		lineNumber++;
+
+		if (line.empty() || line[0] == '#') {
+			continue;
+		}
+
+		unsigned long long time;
+		char name[32];
+		char text[4096];
+		TraceEvent event;
+		if (sscanf(line.c_str(), "%llu %31s %u %d %f %f %4095s", &time, name, &event.modifiers, &event.value, &event.x, &event.y, text) != 7) {
+			throw InputTraceException("Invalid input trace at line " + std::to_string(lineNumber));
+		}
+
+		auto names = std::begin(EVENT_NAMES);
+		auto found = std::find_if(names, std::end(EVENT_NAMES), [&name](const char* eventName) {
+			return strcmp(eventName, name) == 0;
+		});
+		if (found == std::end(EVENT_NAMES) || !DecodeText(text, event.text)) {
+			throw InputTraceException("Invalid input trace at line " + std::to_string(lineNumber));
+		}
+
+		event.time = time;
+		event.type = static_cast<TraceEvent::Type>(found - names);
+		events.push_back(std::move(event));
+	}
+
+	return events;
+}
+
+LatencyStats::LatencyStats() :
+	sorted(true) {
+}
+
+void LatencyStats::Sort() {
+	if (!sorted) {
+		std::sort(samples.begin(), samples.end());
+		sorted = true;
+	}
+}
+
+void LatencyStats::Add(uint64_t nanoseconds) {
+	samples.push_back(nanoseconds);
+	sorted = false;
+}
+
+std::size_t LatencyStats::Count() const {
+	return samples.size();
+}
+
+double LatencyStats::Mean() const {
+	if (samples.empty()) {
+		return 0;
+	}
+
+	double sum = 0;
+	for (auto sample : samples) {
+		sum += sample;
+	}
+	return sum / samples.size();
+}
+
+uint64_t LatencyStats::Percentile(double p) {
+	if (samples.empty()) {
+		return 0;
+	}
+
+	// 最も近い順位の値を使う
+	Sort();
+	auto rank = static_cast<std::size_t>(p / 100 * samples.size() + 0.5);
+	return samples[std::min(rank == 0 ? 0 : rank - 1, samples.size() - 1)];
+}
+
+uint64_t LatencyStats::Max() {
+	return Percentile(100);
+}
+
+std::string LatencyStats::Format(const std::string& name) {
+	return name + ": n=" + std::to_string(Count()) +
+		" mean=" + FormatMicroseconds(static_cast<uint64_t>(Mean())) +
+		" p50=" + FormatMicroseconds(Percentile(50)) +
+		" p90=" + FormatMicroseconds(Percentile(90)) +
+		" p99=" + FormatMicroseconds(Percentile(99)) +
+		" max=" + FormatMicroseconds(Max());
+}
@@ -0,0 +1,100 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <exception>
+
+// Editor が受け取った入力 1 つ分
+struct TraceEvent {
+	enum class Type {
+		Char,
+		KeyDown,
+		KeyUp,
+		LButtonDown,
+		LButtonUp,
+		MouseWheel,
+		MouseHWheel,
+		Resize,
+		IMEStartComposition,
+		IMEComposition,
+		IMEEndComposition,
+		// 描画した (ドラッグ中の選択などのためにカーソルの位置を持つ)
+		Frame,
+		TYPE_COUNT
+	};
+
+	// 押されていた修飾キー
+	enum Modifier : unsigned int {
+		SHIFT = 1,
+		CONTROL = 2,
+		ALT = 4,
+	};
+
+	// 記録を始めてからの時間 (マイクロ秒)
+	uint64_t time;
+	Type type;
+	unsigned int modifiers;
+	// 文字コード、仮想キーコード、ホイールの回転量
+	int value;
+	// マウスカーソルの座標 (Resize の場合は幅と高さ)
+	float x;
+	float y;
+	// IMEComposition の未確定文字列
+	std::wstring text;
+
+	static const char* NameOf(Type type);
+};
+
+// 入力を時刻と一緒に記録する
+class InputTraceRecorder {
+private:
+	std::vector<TraceEvent> events;
+	std::chrono::steady_clock::time_point start;
+	bool recording;
+public:
+	InputTraceRecorder();
+
+	// 前の記録は破棄する
+	void Start();
+	void Stop();
+	bool IsRecording() const;
+	// event.time は記録した時刻にする
+	void Record(TraceEvent event);
+	const std::vector<TraceEvent>& Events() const;
+};
+
+// 1 行に 1 つずつ "<時刻> <種類> <修飾キー> <値> <x> <y> <文字列>" の形式で保存する
+// 文字列は文字コードを 16 進数で . で区切って並べる (空の場合は -)
+void SaveInputTrace(const std::wstring& path, const std::vector<TraceEvent>& events);
+std::vector<TraceEvent> LoadInputTrace(const std::wstring& path);
+
+// 処理時間の分布 (ナノ秒)
+class LatencyStats {
+private:
+	std::vector<uint64_t> samples;
+	bool sorted;
+
+	void Sort();
+public:
+	LatencyStats();
+
+	void Add(uint64_t nanoseconds);
+	std::size_t Count() const;
+	double Mean() const;
+	// p は 0 から 100
+	uint64_t Percentile(double p);
+	uint64_t Max();
+	// "<name>: n=... mean=...us p50=...us p90=...us p99=...us max=...us"
+	std::string Format(const std::string& name);
+};
+
+class InputTraceException : public std::exception {
+private:
+	std::string message;
+public:
+	InputTraceException(const std::string& message) : message(message) {}
+	const char* what() const noexcept { return message.c_str(); }
+};
@@ -0,0 +1,623 @@
+﻿#include "Journal.h"
+#include "Encoding.h"
+#include "PieceTable.h"
+#include "Platform.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace {
+	const char JOURNAL_MAGIC[4] = { 'E', 'D', 'J', 'L' };
+	const char CHECKPOINT_MAGIC[4] = { 'E', 'D', 'C', 'P' };
+	constexpr uint32_t FORMAT_VERSION = 3;
+	// マジック + バージョン + 世代 + 元のファイルの大きさとハッシュ + 文書に読み込んだバイト数
+	constexpr std::size_t HEADER_SIZE = 40;
+
+	enum RecordType : uint8_t {
+		RECORD_INSERT = 1,
+		RECORD_ERASE = 2,
+		// 元のファイルへの追記を読み込んだ。位置と長さの後に内容のハッシュが続く
+		RECORD_APPEND = 3,
+	};
+
+	void PutU32(std::string& out, uint32_t value) {
+		for (int i = 0; i < 4; i++) {
+			out.push_back(static_cast<char>((value >> (i * 8)) & 0xFF));
+		}
+	}
+
+	void PutU64(std::string& out, uint64_t value) {
+		for (int i = 0; i < 8; i++) {
+			out.push_back(static_cast<char>((value >> (i * 8)) & 0xFF));
+		}
+	}
+
+	uint64_t GetU(const char* data, int bytes) {
+		uint64_t value = 0;
+		for (int i = 0; i < bytes; i++) {
+			value |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (i * 8);
+		}
+
+		return value;
+	}
+
+	uint32_t Checksum(const char* data, std::size_t size) {
+		return Fnv1a32(FNV32_OFFSET_BASIS, data, size);
+	}
+
+	std::string Header(const char magic[4], uint64_t generation, const JournalBase& base, uint64_t loadedBytes) {
+		std::string header(magic, 4);
+		PutU32(header, FORMAT_VERSION);
+		PutU64(header, generation);
+		PutU64(header, base.size);
+		PutU64(header, base.hash);
+		PutU64(header, loadedBytes);
+
+		return header;
+	}
+
+	bool ParseHeader(const std::string& data, const char magic[4], uint64_t* generation, JournalBase* base, uint64_t* loadedBytes) {
+		if (data.size() < HEADER_SIZE || data.compare(0, 4, magic, 4) != 0) {
+			return false;
+		}
+		if (GetU(data.data() + 4, 4) != FORMAT_VERSION) {
+			return false;
+		}
+
+		*generation = GetU(data.data() + 8, 8);
+		base->size = GetU(data.data() + 16, 8);
+		base->hash = GetU(data.data() + 24, 8);
+		*loadedBytes = GetU(data.data() + 32, 8);
+		return true;
+	}
+}
+
+JournalBase JournalBase::Of(const char* data, std::size_t size) {
+	// 開くたびにファイル全体を読むので、1 バイトずつではなく 8 バイトずつ混ぜる (FNV-1a の変形)
+	uint64_t hash = FNV_OFFSET_BASIS ^ size;
+	std::size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		hash = Fnv1a(hash, word);
+		hash ^= hash >> 32;
+	}
+	for (; i < size; i++) {
+		hash = Fnv1a(hash, static_cast<unsigned char>(data[i]));
+	}
+
+	return JournalBase{ size, hash };
+}
+
+bool JournalBase::operator==(const JournalBase& other) const {
+	return size == other.size && hash == other.hash;
+}
+
+bool JournalBase::operator!=(const JournalBase& other) const {
+	return !(*this == other);
+}
+
+EditJournal::EditJournal() :
+	base{ 0, 0 },
+	loadedBytes(0),
+	fp(nullptr),
+	opened(false),
+	commitIntervalMsec(0),
+	checkpointBytes(0),
+	checkpointLoadedBytes(0),
+	checkpointRequested(false),
+	stopRequested(false),
+	generation(0),
+	bytesSinceCheckpoint(0) {
+}
+
+EditJournal::~EditJournal() {
+	Close();
+}
+
+std::wstring EditJournal::JournalPathOf(const std::wstring& documentPath) {
+	return documentPath + L".journal";
+}
+
+std::wstring EditJournal::CheckpointPathOf(const std::wstring& documentPath) {
+	return documentPath + L".checkpoint";
+}
+
+bool EditJournal::Exists(const std::wstring& documentPath) {
+	return FileExists(JournalPathOf(documentPath)) || FileExists(CheckpointPathOf(documentPath));
+}
+
+std::wstring EditJournal::SetAside(const std::wstring& documentPath) {
+	auto journalPath = JournalPathOf(documentPath);
+	auto checkpointPath = CheckpointPathOf(documentPath);
+	if (FileExists(journalPath)) {
+		MoveFileReplacing(journalPath, journalPath + L".bak");
+	}
+	if (FileExists(checkpointPath)) {
+		MoveFileReplacing(checkpointPath, checkpointPath + L".bak");
+	}
+
+	return journalPath + L".bak";
+}
+
+void EditJournal::Open(const std::wstring& documentPath, const JournalBase& base, uint64_t loadedBytes, unsigned int commitIntervalMsec, uint64_t checkpointBytes) {
+	Close();
+
+	journalPath = JournalPathOf(documentPath);
+	checkpointPath = CheckpointPathOf(documentPath);
+	this->base = base;
+	this->loadedBytes = loadedBytes;
+	this->commitIntervalMsec = commitIntervalMsec;
+	this->checkpointBytes = checkpointBytes;
+
+	// 世代 0 のジャーナルは元のファイルに対する操作を表す
+	RemoveFileIfExists(checkpointPath);
+	Start(0, 0);
+}
+
+void EditJournal::Resume(const std::wstring& documentPath, const JournalBase& base, const JournalRecovery& recovery, unsigned int commitIntervalMsec, uint64_t checkpointBytes) {
+	Close();
+
+	journalPath = JournalPathOf(documentPath);
+	checkpointPath = CheckpointPathOf(documentPath);
+	this->base = base;
+	loadedBytes = recovery.loadedBytes;
+	this->commitIntervalMsec = commitIntervalMsec;
+	this->checkpointBytes = checkpointBytes;
+
+	Start(recovery.generation, recovery.journalLength);
+}
+
+void EditJournal::Start(uint64_t generation, uint64_t journalLength) {
+	if (journalLength == 0) {
+		// ジャーナルを作り直す
+		if (!WriteFileAtomically(journalPath, Header(JOURNAL_MAGIC, generation, base, loadedBytes))) {
+			throw JournalException("Unable to create journal");
+		}
+	} else {
+		// 途中まで書き込まれた操作を切り捨てる
+		auto truncated = OpenFileStream(journalPath, L"r+b");
+		if (!truncated || !TruncateFileStream(truncated, journalLength)) {
+			if (truncated) {
+				fclose(truncated);
+			}
+			throw JournalException("Unable to truncate journal");
+		}
+		fclose(truncated);
+	}
+
+	fp = OpenFileStream(journalPath, L"ab");
+	if (!fp) {
+		throw JournalException("Unable to open journal");
+	}
+
+	this->generation = generation;
+	bytesSinceCheckpoint = journalLength > HEADER_SIZE ? journalLength - HEADER_SIZE : 0;
+	opened = true;
+	stopRequested = false;
+	checkpointRequested = false;
+	writer = std::thread(&EditJournal::WriterLoop, this);
+}
+
+void EditJournal::Close(bool discard) {
+	if (writer.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopRequested = true;
+		}
+		condition.notify_one();
+		writer.join();
+	}
+
+	if (fp) {
+		fclose(fp);
+		fp = nullptr;
+	}
+	opened = false;
+
+	if (discard && !journalPath.empty()) {
+		RemoveFileIfExists(journalPath);
+		RemoveFileIfExists(checkpointPath);
+	}
+
+	pending.clear();
+	checkpointText.clear();
+}
+
+bool EditJournal::IsOpen() const {
+	return opened;
+}
+
+void EditJournal::WriterLoop() {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	// pending と交互に使うので、どちらも一度広がった容量をそのまま使い回す
+	std::string records;
+
+	while (true) {
+		condition.wait(lock, [this] { return stopRequested || checkpointRequested || !pending.empty(); });
+
+		// 少し待って後続の操作もまとめて 1 回の fsync で書き込む
+		if (!stopRequested && !checkpointRequested && commitIntervalMsec > 0) {
+			condition.wait_for(lock, std::chrono::milliseconds(commitIntervalMsec), [this] { return stopRequested || checkpointRequested; });
+		}
+
+		records.clear();
+		records.swap(pending);
+
+		bool checkpoint = checkpointRequested;
+		std::wstring text;
+		if (checkpoint) {
+			text.swap(checkpointText);
+			checkpointRequested = false;
+		}
+
+		auto currentGeneration = generation;
+		auto currentBase = base;
+		auto currentLoadedBytes = checkpointLoadedBytes;
+		bool stop = stopRequested;
+		lock.unlock();
+
+		if (checkpoint) {
+			if (!WriteCheckpoint(currentGeneration, currentBase, currentLoadedBytes, text, records)) {
+				std::wcout << L"Unable to write journal checkpoint" << std::endl;
+			}
+		} else if (!records.empty() && fp) {
+			if (fwrite(records.data(), 1, records.size(), fp) != records.size() || !SyncFileStream(fp)) {
+				std::wcout << L"Unable to write journal" << std::endl;
+			}
+		}
+
+		lock.lock();
+		if (stop && pending.empty() && !checkpointRequested) {
+			break;
+		}
+	}
+}
+
+bool EditJournal::WriteCheckpoint(uint64_t generation, const JournalBase& base, uint64_t loadedBytes, const std::wstring& text, const std::string& records) {
+	// チェックポイントを一時ファイルに書き込んでから置き換える
+	auto tmpPath = checkpointPath + L".tmp";
+	auto checkpointFp = OpenFileStream(tmpPath, L"wb");
+	if (!checkpointFp) {
+		return false;
+	}
+
+	std::string buf = Header(CHECKPOINT_MAGIC, generation, base, loadedBytes);
+	uint64_t textBytes = 0;
+	bool ok = true;
+
+	// 文書全体を一度に変換するとメモリを倍使うので少しずつ変換して書き込む
+	constexpr std::size_t CHUNK_SIZE = 64 * 1024;
+	std::size_t pos = 0;
+	while (pos < text.size() && ok) {
+		auto size = std::min(CHUNK_SIZE, text.size() - pos);
+		// サロゲートペアの途中で区切らない
+		if (pos + size < text.size() && text[pos + size - 1] >= 0xD800 && text[pos + size - 1] <= 0xDBFF) {
+			size++;
+		}
+
+		auto before = buf.size();
+		EncodeUtf8(text.data() + pos, size, buf);
+		textBytes += buf.size() - before;
+		pos += size;
+
+		ok = fwrite(buf.data(), 1, buf.size(), checkpointFp) == buf.size();
+		buf.clear();
+	}
+
+	PutU64(buf, textBytes);
+	ok = ok && fwrite(buf.data(), 1, buf.size(), checkpointFp) == buf.size();
+	ok = SyncFileStream(checkpointFp) && ok;
+	fclose(checkpointFp);
+
+	if (!ok || !MoveFileReplacing(tmpPath, checkpointPath)) {
+		RemoveFileIfExists(tmpPath);
+		return false;
+	}
+
+	// チェックポイント以降の操作だけを含むジャーナルに置き換える
+	if (fp) {
+		fclose(fp);
+		fp = nullptr;
+	}
+	if (!WriteFileAtomically(journalPath, Header(JOURNAL_MAGIC, generation, base, loadedBytes) + records)) {
+		return false;
+	}
+
+	fp = OpenFileStream(journalPath, L"ab");
+	return fp != nullptr;
+}
+
+void EditJournal::FinishAppend(std::size_t recordStart) {
+	// pending の recordStart 以降に書き込んだ記録にチェックサムを付ける
+	PutU32(pending, Checksum(pending.data() + recordStart, pending.size() - recordStart));
+	bytesSinceCheckpoint += pending.size() - recordStart;
+}
+
+void EditJournal::RecordInsert(std::size_t pos, const wchar_t* text, std::size_t length) {
+	if (!IsOpen()) {
+		return;
+	}
+
+	// 一時的な文字列を作らずに pending に直接書き込む
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto recordStart = pending.size();
+		pending.push_back(static_cast<char>(RECORD_INSERT));
+		PutU64(pending, pos);
+		PutU64(pending, length);
+
+		// UTF-8 の長さは書き込んでから埋める
+		auto sizeOffset = pending.size();
+		PutU32(pending, 0);
+		EncodeUtf8(text, length, pending);
+		auto payloadSize = static_cast<uint32_t>(pending.size() - sizeOffset - 4);
+		for (int i = 0; i < 4; i++) {
+			pending[sizeOffset + i] = static_cast<char>((payloadSize >> (i * 8)) & 0xFF);
+		}
+
+		FinishAppend(recordStart);
+	}
+	condition.notify_one();
+}
+
+void EditJournal::RecordErase(std::size_t pos, std::size_t length) {
+	if (!IsOpen()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto recordStart = pending.size();
+		pending.push_back(static_cast<char>(RECORD_ERASE));
+		PutU64(pending, pos);
+		PutU64(pending, length);
+
+		FinishAppend(recordStart);
+	}
+	condition.notify_one();
+}
+
+void EditJournal::RecordAppend(uint64_t offset, const char* data, std::size_t size, uint64_t loadedBytes) {
+	if (!IsOpen()) {
+		return;
+	}
+
+	auto hash = JournalBase::Of(data, size).hash;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto recordStart = pending.size();
+		pending.push_back(static_cast<char>(RECORD_APPEND));
+		PutU64(pending, offset);
+		PutU64(pending, size);
+		PutU64(pending, hash);
+		this->loadedBytes = loadedBytes;
+
+		FinishAppend(recordStart);
+	}
+	condition.notify_one();
+}
+
+bool EditJournal::NeedsCheckpoint(std::size_t documentLength) {
+	if (!IsOpen()) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	return !checkpointRequested && bytesSinceCheckpoint >= std::max<uint64_t>(checkpointBytes, documentLength / 2);
+}
+
+std::size_t EditJournal::MemoryUsage() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return BytesOf(pending) + BytesOf(checkpointText);
+}
+
+void EditJournal::Checkpoint(std::wstring text) {
+	if (!IsOpen()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		// まだ書き込まれていない操作はチェックポイントに含まれている
+		pending.clear();
+		checkpointText = std::move(text);
+		checkpointLoadedBytes = loadedBytes;
+		checkpointRequested = true;
+		generation++;
+		bytesSinceCheckpoint = 0;
+	}
+	condition.notify_one();
+}
+
+void EditJournal::Rebase(std::wstring text, const JournalBase& base, uint64_t loadedBytes) {
+	if (!IsOpen()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->base = base;
+		this->loadedBytes = loadedBytes;
+	}
+	Checkpoint(std::move(text));
+}
+
+JournalRecovery EditJournal::Recover(const std::wstring& documentPath, const char* data, std::size_t size, const std::wstring& original) {
+	// 元のファイルの後ろに追記されていても、先頭が同じなら同じファイルとみなす
+	auto matches = [data, size](const JournalBase& base) {
+		return base.size <= size && JournalBase::Of(data, static_cast<std::size_t>(base.size)) == base;
+	};
+
+	JournalRecovery recovery;
+	recovery.generation = 0;
+	recovery.loadedBytes = 0;
+	recovery.tailOffset = 0;
+	recovery.journalLength = 0;
+	recovery.replayedOperations = 0;
+	recovery.fromCheckpoint = false;
+	recovery.baseChanged = false;
+
+	std::string journal;
+	uint64_t journalGeneration = 0;
+	JournalBase journalBase{ 0, 0 };
+	uint64_t journalLoaded = 0;
+	bool journalRead = ReadFileBytes(JournalPathOf(documentPath), journal);
+	bool hasJournal = journalRead && ParseHeader(journal, JOURNAL_MAGIC, &journalGeneration, &journalBase, &journalLoaded);
+
+	std::string checkpoint;
+	uint64_t checkpointGeneration = 0;
+	JournalBase checkpointBase{ 0, 0 };
+	uint64_t checkpointLoaded = 0;
+	bool hasCheckpoint = ReadFileBytes(CheckpointPathOf(documentPath), checkpoint)
+		&& ParseHeader(checkpoint, CHECKPOINT_MAGIC, &checkpointGeneration, &checkpointBase, &checkpointLoaded)
+		&& checkpoint.size() >= HEADER_SIZE + 8
+		&& GetU(checkpoint.data() + checkpoint.size() - 8, 8) == checkpoint.size() - HEADER_SIZE - 8;
+
+	// ジャーナルは一時ファイルから置き換えて作るので、ヘッダーが読めない場合は書き込み途中ではなく壊れている
+	if (journalRead && !hasJournal && !hasCheckpoint) {
+		throw JournalException("Journal header is corrupted");
+	}
+
+	std::wstring base;
+	// base に読み込んだファイルの先頭からのバイト数
+	uint64_t loaded = 0;
+	bool replay = hasJournal;
+	if (hasCheckpoint) {
+		// チェックポイントは文書全体を持っているので、元のファイルが変わっていても復元できる
+		if (hasJournal && journalGeneration > checkpointGeneration) {
+			throw JournalException("Journal checkpoint is missing or corrupted");
+		}
+
+		// 文書の中の対になっていないサロゲートも書いたとおりに読み戻す
+		Utf8Decoder decoder(false, true);
+		decoder.Decode(checkpoint.data() + HEADER_SIZE, checkpoint.size() - HEADER_SIZE - 8, base);
+		decoder.Finish(base);
+		checkpoint.clear();
+		checkpoint.shrink_to_fit();
+
+		recovery.generation = checkpointGeneration;
+		recovery.fromCheckpoint = true;
+		recovery.baseChanged = !matches(checkpointBase) || checkpointLoaded > size;
+		loaded = checkpointLoaded;
+		// チェックポイントの書き込み直後に終了した場合はジャーナルの内容はチェックポイントに含まれている
+		replay = hasJournal && journalGeneration == checkpointGeneration;
+		if (recovery.baseChanged) {
+			// 記録した操作や追記は別の内容に対するものなので、チェックポイントの内容だけを使う
+			recovery.text = std::move(base);
+			return recovery;
+		}
+	} else if (!hasJournal) {
+		recovery.text = original;
+		return recovery;
+	} else if (journalGeneration != 0) {
+		throw JournalException("Journal checkpoint is missing or corrupted");
+	} else if (!matches(journalBase) || journalLoaded > journalBase.size) {
+		// 保存した直後に終了した場合や、終了した後に他のプログラムがファイルを変えた場合
+		// 操作は別の内容に対するものなので再生しない
+		recovery.text = original;
+		recovery.baseChanged = true;
+		return recovery;
+	} else if (journalBase.size == size) {
+		// 開いた後に追記されていないので、今のファイルをデコードした内容が開いたときの内容になる
+		base = original;
+		loaded = journalLoaded;
+	} else {
+		// 開いたときの内容から再生し、その後の追記は記録に従って読み込む
+		TextStreamDecoder decoder;
+		decoder.Decode(data, static_cast<std::size_t>(journalLoaded), base);
+		loaded = journalLoaded;
+	}
+
+	// ジャーナルの操作を再生する
+	PieceTable table(std::move(base));
+	std::size_t pos = HEADER_SIZE;
+	std::wstring text;
+
+	while (replay && pos < journal.size()) {
+		auto record = journal.data() + pos;
+		auto available = journal.size() - pos;
+		if (available < 21) {
+			break;
+		}
+
+		auto type = static_cast<uint8_t>(record[0]);
+		auto offset = GetU(record + 1, 8);
+		auto length = GetU(record + 9, 8);
+		std::size_t recordSize = 17;
+
+		if (type == RECORD_INSERT) {
+			auto payloadSize = GetU(record + 17, 4);
+			if (available < 25 + payloadSize) {
+				break;
+			}
+			recordSize = 21 + static_cast<std::size_t>(payloadSize);
+		} else if (type == RECORD_APPEND) {
+			if (available < 29) {
+				break;
+			}
+			recordSize = 25;
+		} else if (type != RECORD_ERASE) {
+			break;
+		}
+
+		// 書き込み途中で終了した操作は捨てる
+		if (GetU(record + recordSize, 4) != Checksum(record, recordSize)) {
+			break;
+		}
+
+		// 正しく書き込まれた操作が内容に合わない場合は、ここで止めて後ろの操作を捨てずに例外にする
+		if (type == RECORD_INSERT) {
+			text.clear();
+			Utf8Decoder decoder(false, true);
+			decoder.Decode(record + 21, recordSize - 21, text);
+			decoder.Finish(text);
+			if (text.size() != length || offset > table.Length()) {
+				throw JournalException("Journal does not match the document");
+			}
+			table.Insert(static_cast<std::size_t>(offset), text.data(), text.size());
+		} else if (type == RECORD_APPEND) {
+			// 追記された内容はファイルから読む。記録した範囲は前の読み込みで文字の途中だった分から始まるので、新しいデコーダで読める
+			if (offset != loaded || offset > size || length > size - offset
+				|| JournalBase::Of(data + offset, static_cast<std::size_t>(length)).hash != GetU(record + 17, 8)) {
+				throw JournalException("File no longer contains the appended text recorded in the journal");
+			}
+			text.clear();
+			TextStreamDecoder decoder(offset == 0);
+			decoder.Decode(data + offset, static_cast<std::size_t>(length), text);
+			table.Insert(table.Length(), text.data(), text.size());
+			loaded = offset + length - decoder.PendingBytes();
+			pos += recordSize + 4;
+			continue;
+		} else {
+			if (offset > table.Length() || length > table.Length() - offset) {
+				throw JournalException("Journal does not match the document");
+			}
+			table.Erase(static_cast<std::size_t>(offset), static_cast<std::size_t>(length));
+		}
+
+		pos += recordSize + 4;
+		recovery.replayedOperations++;
+	}
+
+	// 最後に記録した後 (終了した後も含む) に追記された分を読み込む
+	// 読み込んだファイルの末尾は Editor が FileTail で覚えるので、文字の途中で切れている分は残す
+	recovery.tailOffset = loaded;
+	if (loaded < size) {
+		text.clear();
+		TextStreamDecoder decoder(loaded == 0);
+		decoder.Decode(data + loaded, static_cast<std::size_t>(size - loaded), text);
+		table.Insert(table.Length(), text.data(), text.size());
+		loaded = size - decoder.PendingBytes();
+	}
+
+	recovery.text = table.ToString();
+	recovery.loadedBytes = loaded;
+	recovery.journalLength = replay ? pos : 0;
+
+	return recovery;
+}
@@ -0,0 +1,135 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "MemoryUsage.h"
+
+// ジャーナルを付けたときの元のファイルの大きさと内容のハッシュ
+// 世代 0 のジャーナルは元のファイルに対する操作なので、ファイルの先頭の size バイトが別の内容に変わっていたら再生できない
+// (その後ろは追記の記録で読み込んだ分として確かめる)
+struct JournalBase {
+	uint64_t size;
+	uint64_t hash;
+
+	static JournalBase Of(const char* data, std::size_t size);
+	bool operator==(const JournalBase& other) const;
+	bool operator!=(const JournalBase& other) const;
+};
+
+// ジャーナルから復元した結果
+struct JournalRecovery {
+	std::wstring text;
+	uint64_t generation;
+	// text に読み込んだ今のファイルの先頭からのバイト数。復元した後はここから続きを読む
+	uint64_t loadedBytes;
+	// 最後の記録の後に追記されていたファイルの位置。ここから loadedBytes までを読み込んで text の末尾に加えてある
+	// ジャーナルに記録されていないので、記録を再開したら RecordAppend で記録すること
+	uint64_t tailOffset;
+	// 正しく読めたジャーナルの長さ (バイト)。0 の場合はジャーナルを作り直す
+	uint64_t journalLength;
+	// 再生した挿入と削除の数 (ファイルへの追記は数えない)
+	std::size_t replayedOperations;
+	// チェックポイントから復元したかどうか
+	bool fromCheckpoint;
+	// ジャーナルを付けた後に元のファイルが変わっていたかどうか
+	// チェックポイントがない場合は復元できないので、text は元のファイルの内容のままになる
+	bool baseChanged;
+};
+
+// クラッシュから復帰するための追記専用の編集ジャーナル
+//
+// <文書>.journal に挿入・削除の操作を追記していき、バックグラウンドスレッドで
+// まとめて fsync する (グループコミット)。ジャーナルが大きくなったら文書全体を
+// <文書>.checkpoint に書き出してジャーナルを空にする。
+// 起動時に Recover で元のファイル (またはチェックポイント) に操作を再生して編集状態を復元する。
+class EditJournal {
+private:
+	std::wstring journalPath;
+	std::wstring checkpointPath;
+	// ヘッダーに書き込む元のファイル
+	JournalBase base;
+	// 文書に読み込んだファイルの先頭からのバイト数。追記を読み込むたびに増える
+	uint64_t loadedBytes;
+	FILE* fp;
+	// fp はチェックポイントの書き込み中に書き込みスレッドが開き直すので、開いているかどうかは別に持つ
+	bool opened;
+	unsigned int commitIntervalMsec;
+	uint64_t checkpointBytes;
+
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable condition;
+	// まだ書き込まれていない操作
+	std::string pending;
+	// 次に書き出すチェックポイント
+	std::wstring checkpointText;
+	// checkpointText を受け取ったときの loadedBytes。その後に読み込んだ追記はジャーナルの方に記録される
+	uint64_t checkpointLoadedBytes;
+	bool checkpointRequested;
+	bool stopRequested;
+	uint64_t generation;
+	// 最後のチェックポイントからジャーナルに追加したバイト数
+	uint64_t bytesSinceCheckpoint;
+
+	void Start(uint64_t generation, uint64_t journalLength);
+	void WriterLoop();
+	bool WriteCheckpoint(uint64_t generation, const JournalBase& base, uint64_t loadedBytes, const std::wstring& text, const std::string& records);
+	// pending に書き込んだ記録を確定する。mutex を取得してから呼ぶ
+	void FinishAppend(std::size_t recordStart);
+public:
+	EditJournal();
+	~EditJournal();
+
+	EditJournal(const EditJournal&) = delete;
+	EditJournal& operator=(const EditJournal&) = delete;
+
+	// ジャーナルを新しく作成する。既存のジャーナルとチェックポイントは削除される
+	// base は今のファイル (編集を記録する元の内容)、loadedBytes はそのうち文書に読み込んだバイト数
+	void Open(const std::wstring& documentPath, const JournalBase& base, uint64_t loadedBytes, unsigned int commitIntervalMsec, uint64_t checkpointBytes);
+	// Recover で復元した状態から記録を再開する。元のファイルが変わっていた場合は今の内容でチェックポイントを作り直すこと
+	void Resume(const std::wstring& documentPath, const JournalBase& base, const JournalRecovery& recovery, unsigned int commitIntervalMsec, uint64_t checkpointBytes);
+	// 書き込みを完了させてジャーナルを閉じる。discard が true の場合はファイルも削除する
+	void Close(bool discard = false);
+	bool IsOpen() const;
+
+	void RecordInsert(std::size_t pos, const wchar_t* text, std::size_t length);
+	void RecordErase(std::size_t pos, std::size_t length);
+	// 元のファイルの offset からの data をデコードして文書の末尾に追加したことを記録する
+	// 内容はファイルにあるので、位置と長さ、ハッシュだけを記録する。loadedBytes は読み込んだ後の値
+	void RecordAppend(uint64_t offset, const char* data, std::size_t size, uint64_t loadedBytes);
+
+	// チェックポイントを作成すべきかどうか
+	// 文書が大きいほどチェックポイントのコストも大きいので、文書の長さに比例して間隔を広げる
+	bool NeedsCheckpoint(std::size_t documentLength);
+	// まだ書き込んでいない操作とチェックポイントが確保しているメモリの大きさ (バイト)
+	std::size_t MemoryUsage();
+	// text は呼び出した時点での文書全体
+	void Checkpoint(std::wstring text);
+	// 元のファイルが変わったときに呼ぶ。今の文書全体をチェックポイントにして、以降の記録の元を base にする
+	void Rebase(std::wstring text, const JournalBase& base, uint64_t loadedBytes);
+
+	static std::wstring JournalPathOf(const std::wstring& documentPath);
+	static std::wstring CheckpointPathOf(const std::wstring& documentPath);
+	static bool Exists(const std::wstring& documentPath);
+	// 今のファイルのバイト列を data、それをデコードした内容を original として復元する
+	// 最後に記録した後にファイルに追記されていた分も読み込む
+	// ジャーナルやチェックポイントが壊れている場合や、操作が内容と合わない場合は例外を投げる
+	static JournalRecovery Recover(const std::wstring& documentPath, const char* data, std::size_t size, const std::wstring& original);
+	// 復元できなかったジャーナルとチェックポイントを消さずに別の名前に移す。移した先のジャーナルのパスを返す
+	static std::wstring SetAside(const std::wstring& documentPath);
+};
+
+class JournalException : public std::exception {
+private:
+	std::string message;
+public:
+	JournalException(const std::string& message) : message(message) {}
+	const char* what() const noexcept { return message.c_str(); }
+};
@@ -0,0 +1,306 @@
+﻿// EditJournal に記録した編集を Recover で正しく復元できるかを確かめるコマンド
+//
+//   editor-journal-check [-n セッション数] [-s シード] <ファイル>
+//
+// セッションごとにファイルを書き直してジャーナルを開き、エディタと同じ手順で次の操作をランダムに記録する。
+//   挿入、削除 (サロゲートペアの途中も含む)
+//   ファイルへの追記 (UTF-8 の文字や \r\n の途中で区切る。続きは前回のデコーダで読んだものとして記録する)
+//   チェックポイント (NeedsCheckpoint に従ったものと、それ以外の時点でのもの)
+// ジャーナルを閉じた後に Recover した内容が最後の文書と一致するかを確かめ、
+// さらにジャーナルをランダムな長さに切り詰めて Recover し、途中のいずれかの時点の文書になるかを確かめる。
+// 復元ではその時点より後にファイルに追記された分も読み込むので、時点ごとに読み込んだバイト数から後ろを足したものと比べる。
+// ヘッダーまで切り詰めた場合は、チェックポイントがなければ壊れているとして例外になるのが正しい。
+// 一致しなかった場合はそのセッションを表示して 1 を返す。<ファイル> と同じ場所にジャーナルを作る。
+// エディタ本体とは別に、Direct2D や Win32 を使わないファイルだけでビルドする。
+//   g++ -std=c++14 -O2 -pthread JournalCheck.cpp Journal.cpp PieceTable.cpp Encoding.cpp Platform.cpp MemoryUsage.cpp Arena.cpp -o editor-journal-check
+//   cl /std:c++14 /O2 /EHsc JournalCheck.cpp Journal.cpp PieceTable.cpp Encoding.cpp Platform.cpp MemoryUsage.cpp Arena.cpp /Fe:editor-journal-check.exe
+#include "Journal.h"
+#include "Encoding.h"
+#include "Platform.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+	void PrintUsage() {
+		fprintf(stderr, "usage: editor-journal-check [-n sessions] [-s seed] <file>\n");
+	}
+
+	// ファイルに書く内容の材料。UTF-8 の 2 から 4 バイトの文字と、\r\n を含む改行
+	const char* const FILE_PIECES[] = {
+		"abc", "0123456789", " ", "\n", "\r\n", "\r", "\xC3\xA9", "\xE3\x81\x82", "\xE6\xBC\xA2\xE5\xAD\x97", "\xF0\x9F\x98\x80",
+	};
+
+	// 挿入する文字列の材料。対になっていない上位サロゲートも入れる (wchar_t が 16 ビットの環境では削除でも対が分かれる)
+	const wchar_t* const TEXT_PIECES[] = {
+		L"x", L"hello", L"\n", L"\t", L"é", L"あい", L"\U0001F600", L"\xD83D",
+	};
+
+	// ある時点の文書と、そのときまでにファイルから読み込んだバイト数
+	struct State {
+		std::wstring text;
+		uint64_t loadedBytes;
+	};
+
+	class Session {
+	private:
+		std::wstring path;
+		std::mt19937& random;
+		EditJournal journal;
+		// ファイルの内容
+		std::string bytes;
+		// ファイルを読み込むデコーダ (FileTail と同じく、文字の途中や \r で止まった分は次の追記で続きから読む)
+		TextStreamDecoder decoder;
+		std::wstring text;
+		std::vector<State> states;
+		std::size_t headerSize;
+
+		std::size_t Random(std::size_t limit) {
+			return limit == 0 ? 0 : random() % limit;
+		}
+
+		std::string FileChunk(std::size_t pieces) {
+			std::string chunk;
+			for (std::size_t i = 0; i < pieces; i++) {
+				chunk += FILE_PIECES[Random(sizeof(FILE_PIECES) / sizeof(FILE_PIECES[0]))];
+			}
+			return chunk;
+		}
+
+		uint64_t LoadedBytes() const {
+			return bytes.size() - decoder.PendingBytes();
+		}
+
+		void Insert() {
+			std::wstring inserted;
+			for (auto pieces = 1 + Random(4); pieces > 0; pieces--) {
+				inserted += TEXT_PIECES[Random(sizeof(TEXT_PIECES) / sizeof(TEXT_PIECES[0]))];
+			}
+			auto pos = Random(text.size() + 1);
+			text.insert(pos, inserted);
+			journal.RecordInsert(pos, inserted.data(), inserted.size());
+		}
+
+		void Erase() {
+			if (text.empty()) {
+				return;
+			}
+			auto pos = Random(text.size());
+			auto length = 1 + Random(std::min<std::size_t>(text.size() - pos, 16));
+			text.erase(pos, length);
+			journal.RecordErase(pos, length);
+		}
+
+		bool Append() {
+			// 区切りを気にせずに切り出すので、文字や \r\n の途中で終わることがある
+			auto chunk = FileChunk(4);
+			chunk.resize(1 + Random(chunk.size()));
+			auto fp = OpenFileStream(path, L"ab");
+			if (!fp) {
+				return false;
+			}
+			bool ok = fwrite(chunk.data(), 1, chunk.size(), fp) == chunk.size();
+			ok = fclose(fp) == 0 && ok;
+
+			// FileTail::Poll と同じく、前回文字の途中で止まっていた分から記録する
+			auto pending = decoder.PendingBytes();
+			auto offset = bytes.size() - pending;
+			bytes += chunk;
+			decoder.Decode(chunk.data(), chunk.size(), text);
+			journal.RecordAppend(offset, bytes.data() + offset, bytes.size() - offset, LoadedBytes());
+			return ok;
+		}
+	public:
+		Session(const std::wstring& path, std::mt19937& random) : path(path), random(random), headerSize(0) {}
+
+		bool Start() {
+			bytes = FileChunk(Random(40));
+			if (!WriteFileAtomically(path, bytes)) {
+				return false;
+			}
+
+			decoder.Reset();
+			text.clear();
+			decoder.Decode(bytes.data(), bytes.size(), text);
+			// 操作のないジャーナルの長さがヘッダーの長さ
+			journal.Open(path, JournalBase::Of(bytes.data(), bytes.size()), LoadedBytes(), 0, 256);
+			std::string header;
+			ReadFileBytes(EditJournal::JournalPathOf(path), header);
+			headerSize = header.size();
+
+			states.assign(1, State{ text, LoadedBytes() });
+			return true;
+		}
+
+		// 操作を 1 つ記録する。ファイルに追記できなかった場合は false を返す
+		bool Step() {
+			bool ok = true;
+			auto kind = Random(20);
+			if (kind < 9) {
+				Insert();
+			} else if (kind < 16) {
+				Erase();
+			} else if (kind < 19) {
+				ok = Append();
+			} else {
+				journal.Checkpoint(text);
+			}
+
+			// エディタと同じく、記録が溜まったらチェックポイントを作る
+			if (journal.NeedsCheckpoint(text.size())) {
+				journal.Checkpoint(text);
+			}
+			states.push_back(State{ text, LoadedBytes() });
+			return ok;
+		}
+
+		// 閉じたジャーナルから最後の文書を復元できるか
+		bool CheckFinal(std::string* error) {
+			journal.Close();
+			std::wstring recovered;
+			if (!Recover(&recovered, error)) {
+				return false;
+			}
+			if (recovered != text) {
+				*error = "recovered text does not match the last document";
+				return false;
+			}
+			return true;
+		}
+
+		// ジャーナルを切り詰めても、途中のいずれかの時点の文書になるか
+		bool CheckTruncated(std::size_t trials, std::string* error) {
+			std::string full;
+			if (!ReadFileBytes(EditJournal::JournalPathOf(path), full)) {
+				*error = "unable to read journal";
+				return false;
+			}
+			bool hasCheckpoint = FileExists(EditJournal::CheckpointPathOf(path));
+
+			for (std::size_t trial = 0; trial < trials; trial++) {
+				auto length = Random(full.size() + 1);
+				if (!WriteFileAtomically(EditJournal::JournalPathOf(path), full.substr(0, length))) {
+					*error = "unable to truncate journal";
+					return false;
+				}
+
+				std::wstring recovered;
+				if (!Recover(&recovered, error)) {
+					if (length < headerSize && !hasCheckpoint) {
+						continue;
+					}
+					*error += " (journal truncated to " + std::to_string(length) + " bytes)";
+					return false;
+				}
+				if (!IsEarlierState(recovered)) {
+					*error = "journal truncated to " + std::to_string(length) + " bytes recovered a text that was never the document";
+					return false;
+				}
+			}
+			return true;
+		}
+
+		bool IsEarlierState(const std::wstring& recovered) const {
+			for (auto& state : states) {
+				// その時点より後にファイルに追記された分は、Recover が新しいデコーダで読み込む
+				std::wstring expected = state.text;
+				TextStreamDecoder tail(state.loadedBytes == 0);
+				tail.Decode(bytes.data() + state.loadedBytes, static_cast<std::size_t>(bytes.size() - state.loadedBytes), expected);
+				if (expected == recovered) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		bool Recover(std::wstring* recovered, std::string* error) {
+			// エディタが開くときと同じく、ファイル全体をデコードした内容を渡す
+			TextStreamDecoder fileDecoder;
+			std::wstring original;
+			fileDecoder.Decode(bytes.data(), bytes.size(), original);
+			try {
+				*recovered = EditJournal::Recover(path, bytes.data(), bytes.size(), original).text;
+				return true;
+			} catch (const JournalException& e) {
+				*error = e.what();
+				return false;
+			}
+		}
+
+		void Close() {
+			journal.Close(true);
+		}
+
+		std::size_t Operations() const {
+			return states.size() - 1;
+		}
+	};
+
+	int Run(const std::vector<std::wstring>& args) {
+		std::size_t sessions = 300;
+		unsigned int seed = 1;
+		std::size_t i = 0;
+		for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; i++) {
+			if (args[i] == L"-n" && i + 1 < args.size()) {
+				sessions = static_cast<std::size_t>(std::wcstoul(args[++i].c_str(), nullptr, 10));
+			} else if (args[i] == L"-s" && i + 1 < args.size()) {
+				seed = static_cast<unsigned int>(std::wcstoul(args[++i].c_str(), nullptr, 10));
+			} else {
+				PrintUsage();
+				return 2;
+			}
+		}
+		if (args.size() - i != 1) {
+			PrintUsage();
+			return 2;
+		}
+		auto path = args[i];
+
+		std::mt19937 random(seed);
+		std::size_t operations = 0;
+		for (std::size_t session = 0; session < sessions; session++) {
+			Session checker(path, random);
+			if (!checker.Start()) {
+				fprintf(stderr, "Unable to write file: %s\n", EncodeUtf8(path).c_str());
+				return 2;
+			}
+
+			auto steps = 1 + random() % 60;
+			for (std::size_t step = 0; step < steps; step++) {
+				if (!checker.Step()) {
+					fprintf(stderr, "session %zu step %zu: unable to append to file\n", session, step);
+					return 2;
+				}
+			}
+
+			std::string error;
+			if (!checker.CheckFinal(&error) || !checker.CheckTruncated(20, &error)) {
+				fprintf(stderr, "session %zu (seed %u, %zu operations): %s\n", session, seed, checker.Operations(), error.c_str());
+				checker.Close();
+				return 1;
+			}
+			operations += checker.Operations();
+			checker.Close();
+		}
+
+		printf("%zu sessions, %zu operations\n", sessions, operations);
+		return 0;
+	}
+}
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t* argv[]) {
+	return Run(std::vector<std::wstring>(argv + 1, argv + argc));
+}
+#else
+int main(int argc, char* argv[]) {
+	std::vector<std::wstring> args;
+	for (int i = 1; i < argc; i++) {
+		args.push_back(DecodeUtf8(argv[i]));
+	}
+	return Run(args);
+}
+#endif
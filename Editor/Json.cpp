@@ -0,0 +1,363 @@
+﻿#include "Json.h"
+#include "Encoding.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+	const JsonValue NULL_VALUE;
+	// 入れ子の深さの上限 (再帰で読むので、壊れた入力でスタックを使い切らないようにする)
+	constexpr int MAX_DEPTH = 256;
+
+	void AppendUtf8(uint32_t codepoint, std::string& out) {
+		if (codepoint < 0x80) {
+			out.push_back(static_cast<char>(codepoint));
+		} else if (codepoint < 0x800) {
+			out.push_back(static_cast<char>(0xC0 | (codepoint >> 6)));
+			out.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+		} else if (codepoint < 0x10000) {
+			out.push_back(static_cast<char>(0xE0 | (codepoint >> 12)));
+			out.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+			out.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+		} else {
+			out.push_back(static_cast<char>(0xF0 | (codepoint >> 18)));
+			out.push_back(static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F)));
+			out.push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+			out.push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+		}
+	}
+}
+
+// 再帰下降で読む
+class JsonParser {
+private:
+	const char* data;
+	std::size_t size;
+	std::size_t pos;
+
+	[[noreturn]] void Fail(const char* reason) {
+		throw JsonException(std::string("Invalid JSON at ") + std::to_string(pos) + ": " + reason);
+	}
+
+	void SkipSpaces() {
+		while (pos < size && (data[pos] == ' ' || data[pos] == '\t' || data[pos] == '\n' || data[pos] == '\r')) {
+			pos++;
+		}
+	}
+
+	bool Consume(const char* literal) {
+		auto length = strlen(literal);
+		if (size - pos >= length && memcmp(data + pos, literal, length) == 0) {
+			pos += length;
+			return true;
+		}
+		return false;
+	}
+
+	uint32_t ParseHex4() {
+		if (size - pos < 4) {
+			Fail("truncated escape");
+		}
+		uint32_t value = 0;
+		for (int i = 0; i < 4; i++) {
+			auto c = data[pos++];
+			value <<= 4;
+			if (c >= '0' && c <= '9') {
+				value |= c - '0';
+			} else if (c >= 'a' && c <= 'f') {
+				value |= c - 'a' + 10;
+			} else if (c >= 'A' && c <= 'F') {
+				value |= c - 'A' + 10;
+			} else {
+				Fail("invalid escape");
+			}
+		}
+		return value;
+	}
+
+	void ParseString(std::string& out) {
+		// 開始の引用符は読んである
+		for (;;) {
+			if (pos >= size) {
+				Fail("unterminated string");
+			}
+
+			auto c = data[pos++];
+			if (c == '"') {
+				return;
+			}
+			if (c != '\\') {
+				out.push_back(c);
+				continue;
+			}
+
+			if (pos >= size) {
+				Fail("unterminated string");
+			}
+			switch (data[pos++]) {
+			case '"': out.push_back('"'); break;
+			case '\\': out.push_back('\\'); break;
+			case '/': out.push_back('/'); break;
+			case 'b': out.push_back('\b'); break;
+			case 'f': out.push_back('\f'); break;
+			case 'n': out.push_back('\n'); break;
+			case 'r': out.push_back('\r'); break;
+			case 't': out.push_back('\t'); break;
+			case 'u':
+			{
+				auto codepoint = ParseHex4();
+				// サロゲートペアは 2 つの \u で表される。対になっていないものは置換文字にする
+				if (codepoint >= 0xD800 && codepoint < 0xDC00) {
+					if (size - pos >= 6 && data[pos] == '\\' && data[pos + 1] == 'u') {
+						pos += 2;
+						auto low = ParseHex4();
+						codepoint = low >= 0xDC00 && low < 0xE000 ? 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00) : 0xFFFD;
+					} else {
+						codepoint = 0xFFFD;
+					}
+				} else if (codepoint >= 0xDC00 && codepoint < 0xE000) {
+					codepoint = 0xFFFD;
+				}
+				AppendUtf8(codepoint, out);
+				break;
+			}
+			default:
+				Fail("invalid escape");
+			}
+		}
+	}
+
+	double ParseNumber() {
+		// strtod は小数点の文字がロケールによって変わるので自分で読む
+		auto start = pos;
+		bool negative = pos < size && data[pos] == '-';
+		if (negative) {
+			pos++;
+		}
+
+		double value = 0;
+		bool digits = false;
+		while (pos < size && data[pos] >= '0' && data[pos] <= '9') {
+			value = value * 10 + (data[pos++] - '0');
+			digits = true;
+		}
+		if (pos < size && data[pos] == '.') {
+			pos++;
+			double scale = 0.1;
+			while (pos < size && data[pos] >= '0' && data[pos] <= '9') {
+				value += (data[pos++] - '0') * scale;
+				scale /= 10;
+				digits = true;
+			}
+		}
+		if (!digits) {
+			pos = start;
+			Fail("invalid number");
+		}
+		if (pos < size && (data[pos] == 'e' || data[pos] == 'E')) {
+			pos++;
+			bool negativeExponent = pos < size && data[pos] == '-';
+			if (pos < size && (data[pos] == '-' || data[pos] == '+')) {
+				pos++;
+			}
+			int exponent = 0;
+			while (pos < size && data[pos] >= '0' && data[pos] <= '9') {
+				exponent = std::min(exponent * 10 + (data[pos++] - '0'), 1000);
+			}
+			value *= std::pow(10.0, negativeExponent ? -exponent : exponent);
+		}
+
+		return negative ? -value : value;
+	}
+
+	void ParseValue(JsonValue& value, int depth) {
+		if (depth > MAX_DEPTH) {
+			Fail("too deeply nested");
+		}
+
+		SkipSpaces();
+		if (pos >= size) {
+			Fail("unexpected end");
+		}
+
+		auto c = data[pos];
+		if (c == '{') {
+			pos++;
+			value.type = JsonValue::Type::Object;
+			SkipSpaces();
+			if (pos < size && data[pos] == '}') {
+				pos++;
+				return;
+			}
+			for (;;) {
+				SkipSpaces();
+				if (pos >= size || data[pos] != '"') {
+					Fail("expected member name");
+				}
+				pos++;
+				value.keys.emplace_back();
+				ParseString(value.keys.back());
+				SkipSpaces();
+				if (pos >= size || data[pos] != ':') {
+					Fail("expected ':'");
+				}
+				pos++;
+				value.items.emplace_back();
+				ParseValue(value.items.back(), depth + 1);
+				SkipSpaces();
+				if (pos < size && data[pos] == ',') {
+					pos++;
+				} else if (pos < size && data[pos] == '}') {
+					pos++;
+					return;
+				} else {
+					Fail("expected ',' or '}'");
+				}
+			}
+		} else if (c == '[') {
+			pos++;
+			value.type = JsonValue::Type::Array;
+			SkipSpaces();
+			if (pos < size && data[pos] == ']') {
+				pos++;
+				return;
+			}
+			for (;;) {
+				value.items.emplace_back();
+				ParseValue(value.items.back(), depth + 1);
+				SkipSpaces();
+				if (pos < size && data[pos] == ',') {
+					pos++;
+				} else if (pos < size && data[pos] == ']') {
+					pos++;
+					return;
+				} else {
+					Fail("expected ',' or ']'");
+				}
+			}
+		} else if (c == '"') {
+			pos++;
+			value.type = JsonValue::Type::String;
+			ParseString(value.text);
+		} else if (Consume("true")) {
+			value.type = JsonValue::Type::Bool;
+			value.boolean = true;
+		} else if (Consume("false")) {
+			value.type = JsonValue::Type::Bool;
+			value.boolean = false;
+		} else if (Consume("null")) {
+			value.type = JsonValue::Type::Null;
+		} else {
+			value.type = JsonValue::Type::Number;
+			value.number = ParseNumber();
+		}
+	}
+public:
+	JsonParser(const char* data, std::size_t size) : data(data), size(size), pos(0) {}
+
+	JsonValue Parse() {
+		JsonValue value;
+		ParseValue(value, 0);
+		SkipSpaces();
+		if (pos != size) {
+			Fail("trailing characters");
+		}
+		return value;
+	}
+};
+
+JsonValue::JsonValue() :
+	type(Type::Null),
+	boolean(false),
+	number(0) {
+}
+
+JsonValue JsonValue::Parse(const char* data, std::size_t size) {
+	return JsonParser(data, size).Parse();
+}
+
+JsonValue::Type JsonValue::GetType() const {
+	return type;
+}
+
+bool JsonValue::IsNull() const {
+	return type == Type::Null;
+}
+
+bool JsonValue::Bool(bool defaultValue) const {
+	return type == Type::Bool ? boolean : defaultValue;
+}
+
+double JsonValue::Number(double defaultValue) const {
+	return type == Type::Number ? number : defaultValue;
+}
+
+int64_t JsonValue::Integer(int64_t defaultValue) const {
+	return type == Type::Number ? static_cast<int64_t>(number) : defaultValue;
+}
+
+const std::string& JsonValue::String() const {
+	return type == Type::String ? text : NULL_VALUE.text;
+}
+
+std::size_t JsonValue::Size() const {
+	return items.size();
+}
+
+const JsonValue& JsonValue::operator[](std::size_t index) const {
+	return index < items.size() ? items[index] : NULL_VALUE;
+}
+
+const JsonValue& JsonValue::operator[](const char* key) const {
+	for (std::size_t i = 0; i < keys.size(); i++) {
+		if (keys[i] == key) {
+			return items[i];
+		}
+	}
+	return NULL_VALUE;
+}
+
+bool JsonValue::Has(const char* key) const {
+	for (auto& name : keys) {
+		if (name == key) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void AppendJsonString(std::string& out, const char* data, std::size_t size) {
+	static const char HEX[] = "0123456789abcdef";
+
+	out.push_back('"');
+	for (std::size_t i = 0; i < size; i++) {
+		auto c = static_cast<unsigned char>(data[i]);
+		switch (c) {
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if (c < 0x20) {
+				out += "\\u00";
+				out.push_back(HEX[c >> 4]);
+				out.push_back(HEX[c & 0xF]);
+			} else {
+				out.push_back(static_cast<char>(c));
+			}
+		}
+	}
+	out.push_back('"');
+}
+
+void AppendJsonString(std::string& out, const std::string& str) {
+	AppendJsonString(out, str.data(), str.size());
+}
+
+void AppendJsonString(std::string& out, const std::wstring& str) {
+	std::string utf8;
+	EncodeUtf8(str.data(), str.size(), utf8);
+	AppendJsonString(out, utf8);
+}
@@ -0,0 +1,70 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <exception>
+
+// JSON の値
+//
+// 言語サーバーとのやり取りに使う。文字列は UTF-8 のまま持つ。
+// オブジェクトのメンバーは出現した順に持ち、名前は線形に探す (メッセージのメンバーは少ないため)。
+class JsonValue {
+public:
+	enum class Type : uint8_t {
+		Null,
+		Bool,
+		Number,
+		String,
+		Array,
+		Object,
+	};
+private:
+	Type type;
+	bool boolean;
+	double number;
+	std::string text;
+	// 配列の要素、またはオブジェクトのメンバーの値
+	std::vector<JsonValue> items;
+	// オブジェクトのメンバーの名前 (items と同じ順)
+	std::vector<std::string> keys;
+
+	friend class JsonParser;
+public:
+	JsonValue();
+
+	// 不正な JSON の場合は JsonException を投げる
+	static JsonValue Parse(const char* data, std::size_t size);
+
+	Type GetType() const;
+	bool IsNull() const;
+	// 型が違う場合は defaultValue を返す
+	bool Bool(bool defaultValue = false) const;
+	double Number(double defaultValue = 0) const;
+	int64_t Integer(int64_t defaultValue = 0) const;
+	// 文字列でない場合は空の文字列を返す
+	const std::string& String() const;
+
+	// 配列の要素数、またはオブジェクトのメンバー数
+	std::size_t Size() const;
+	// 範囲外の場合は null を返す
+	const JsonValue& operator[](std::size_t index) const;
+	// メンバーがない場合やオブジェクトでない場合は null を返す
+	const JsonValue& operator[](const char* key) const;
+	bool Has(const char* key) const;
+};
+
+// JSON の文字列 (引用符を含む) として out の末尾に追加する
+void AppendJsonString(std::string& out, const char* data, std::size_t size);
+void AppendJsonString(std::string& out, const std::string& str);
+// UTF-8 に変換して追加する
+void AppendJsonString(std::string& out, const std::wstring& str);
+
+class JsonException : public std::exception {
+private:
+	std::string message;
+public:
+	JsonException(const std::string& message) : message(message) {}
+	const char* what() const noexcept { return message.c_str(); }
+};
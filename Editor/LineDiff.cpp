@@ -0,0 +1,494 @@
+﻿#include "LineDiff.h"
+
+namespace {
+	struct DiffContext {
+		const uint64_t* a;
+		const uint64_t* b;
+		std::size_t maxCost;
+		std::vector<DiffHunk>* out;
+		std::vector<std::ptrdiff_t> forward;
+		std::vector<std::ptrdiff_t> backward;
+	};
+
+	void Emit(DiffContext& context, std::size_t aStart, std::size_t aCount, std::size_t bStart, std::size_t bCount) {
+		if (aCount == 0 && bCount == 0) {
+			return;
+		}
+
+		// 直前の差分に続いている場合はまとめる
+		auto& out = *context.out;
+		if (!out.empty()) {
+			auto& last = out.back();
+			if (last.baseStart + last.baseCount == aStart && last.start + last.count == bStart) {
+				last.baseCount += aCount;
+				last.count += bCount;
+				return;
+			}
+		}
+
+		out.push_back({ aStart, aCount, bStart, bCount });
+	}
+
+	// 最短の編集経路の中央のスネークを前後から探し、その位置で分割する
+	bool Bisect(DiffContext& context, std::size_t aBegin, std::size_t aEnd, std::size_t bBegin, std::size_t bEnd, std::size_t* splitA, std::size_t* splitB) {
+		auto a = context.a;
+		auto b = context.b;
+		auto n = static_cast<std::ptrdiff_t>(aEnd - aBegin);
+		auto m = static_cast<std::ptrdiff_t>(bEnd - bBegin);
+		auto maxD = std::min<std::ptrdiff_t>((n + m + 1) / 2, static_cast<std::ptrdiff_t>(context.maxCost));
+		auto offset = maxD;
+
+		auto& v1 = context.forward;
+		auto& v2 = context.backward;
+		v1.assign(2 * maxD + 2, -1);
+		v2.assign(2 * maxD + 2, -1);
+		v1[offset + 1] = 0;
+		v2[offset + 1] = 0;
+
+		auto delta = n - m;
+		// 差が奇数なら前向きの探索で、偶数なら後ろ向きの探索で重なりを調べる
+		bool front = (delta & 1) != 0;
+		std::ptrdiff_t k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+
+		for (std::ptrdiff_t d = 0; d < maxD; d++) {
+			for (auto k1 = -d + k1start; k1 <= d - k1end; k1 += 2) {
+				auto k1offset = offset + k1;
+				std::ptrdiff_t x1;
+				if (k1 == -d || (k1 != d && v1[k1offset - 1] < v1[k1offset + 1])) {
+					x1 = v1[k1offset + 1];
+				} else {
+					x1 = v1[k1offset - 1] + 1;
+				}
+				auto y1 = x1 - k1;
+				while (x1 < n && y1 < m && a[aBegin + x1] == b[bBegin + y1]) {
+					x1++;
+					y1++;
+				}
+				v1[k1offset] = x1;
+
+				if (x1 > n) {
+					k1end += 2;
+				} else if (y1 > m) {
+					k1start += 2;
+				} else if (front) {
+					auto k2offset = offset + delta - k1;
+					if (k2offset >= 0 && k2offset < static_cast<std::ptrdiff_t>(v2.size()) && v2[k2offset] != -1) {
+						if (x1 >= n - v2[k2offset]) {
+							if ((x1 == 0 && y1 == 0) || (x1 == n && y1 == m)) {
+								return false;
+							}
+							*splitA = aBegin + x1;
+							*splitB = bBegin + y1;
+							return true;
+						}
+					}
+				}
+			}
+
+			for (auto k2 = -d + k2start; k2 <= d - k2end; k2 += 2) {
+				auto k2offset = offset + k2;
+				std::ptrdiff_t x2;
+				if (k2 == -d || (k2 != d && v2[k2offset - 1] < v2[k2offset + 1])) {
+					x2 = v2[k2offset + 1];
+				} else {
+					x2 = v2[k2offset - 1] + 1;
+				}
+				auto y2 = x2 - k2;
+				while (x2 < n && y2 < m && a[aEnd - x2 - 1] == b[bEnd - y2 - 1]) {
+					x2++;
+					y2++;
+				}
+				v2[k2offset] = x2;
+
+				if (x2 > n) {
+					k2end += 2;
+				} else if (y2 > m) {
+					k2start += 2;
+				} else if (!front) {
+					auto k1offset = offset + delta - k2;
+					if (k1offset >= 0 && k1offset < static_cast<std::ptrdiff_t>(v1.size()) && v1[k1offset] != -1) {
+						auto x1 = v1[k1offset];
+						auto y1 = offset + x1 - k1offset;
+						if (x1 >= n - x2) {
+							if ((x1 == 0 && y1 == 0) || (x1 == n && y1 == m)) {
+								return false;
+							}
+							*splitA = aBegin + x1;
+							*splitB = bBegin + y1;
+							return true;
+						}
+					}
+				}
+			}
+		}
+
+		// 差分が大きすぎるか共通する行がない
+		return false;
+	}
+
+	void Compare(DiffContext& context, std::size_t aBegin, std::size_t aEnd, std::size_t bBegin, std::size_t bEnd) {
+		auto a = context.a;
+		auto b = context.b;
+
+		// 先頭と末尾の共通する部分を除く
+		while (aBegin < aEnd && bBegin < bEnd && a[aBegin] == b[bBegin]) {
+			aBegin++;
+			bBegin++;
+		}
+		while (aBegin < aEnd && bBegin < bEnd && a[aEnd - 1] == b[bEnd - 1]) {
+			aEnd--;
+			bEnd--;
+		}
+
+		if (aBegin == aEnd || bBegin == bEnd) {
+			Emit(context, aBegin, aEnd - aBegin, bBegin, bEnd - bBegin);
+			return;
+		}
+
+		std::size_t splitA, splitB;
+		if (!Bisect(context, aBegin, aEnd, bBegin, bEnd, &splitA, &splitB)) {
+			Emit(context, aBegin, aEnd - aBegin, bBegin, bEnd - bBegin);
+			return;
+		}
+
+		Compare(context, aBegin, splitA, bBegin, splitB);
+		Compare(context, splitA, aEnd, splitB, bEnd);
+	}
+}
+
+std::vector<DiffHunk> DiffLines(const uint64_t* base, std::size_t baseCount, const uint64_t* lines, std::size_t count, std::size_t maxCost) {
+	std::vector<DiffHunk> out;
+
+	DiffContext context;
+	context.a = base;
+	context.b = lines;
+	context.maxCost = std::max<std::size_t>(maxCost, 1);
+	context.out = &out;
+	Compare(context, 0, baseCount, 0, count);
+
+	return out;
+}
+
+LineDiff::LineDiff() :
+	stopRequested(false),
+	dirty(false),
+	dirtyStart(0),
+	dirtyEnd(0),
+	generation(0) {
+	lineStarts.push_back(0);
+	baseHashes.push_back(FNV_OFFSET_BASIS);
+	hashes.push_back(FNV_OFFSET_BASIS);
+}
+
+LineDiff::~LineDiff() {
+	Stop();
+}
+
+void LineDiff::Start(std::function<void()> onUpdated) {
+	Stop();
+
+	this->onUpdated = onUpdated;
+	stopRequested = false;
+	worker = std::thread(&LineDiff::WorkerLoop, this);
+}
+
+void LineDiff::Stop() {
+	if (!worker.joinable()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopRequested = true;
+	}
+	condition.notify_one();
+	worker.join();
+}
+
+void LineDiff::HashLines(const std::wstring& text, std::vector<uint64_t>& hashes, std::vector<std::size_t>* starts) {
+	hashes.clear();
+	if (starts) {
+		starts->clear();
+		starts->push_back(0);
+	}
+
+	auto hash = FNV_OFFSET_BASIS;
+	for (std::size_t i = 0; i < text.size(); i++) {
+		if (text[i] == '\n') {
+			hashes.push_back(hash);
+			hash = FNV_OFFSET_BASIS;
+			if (starts) {
+				starts->push_back(i + 1);
+			}
+		} else {
+			hash = Fnv1a(hash, static_cast<uint64_t>(text[i]));
+		}
+	}
+	hashes.push_back(hash);
+}
+
+void LineDiff::SetBase(const std::wstring& text) {
+	std::vector<uint64_t> newHashes;
+	HashLines(text, newHashes, nullptr);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		baseHashes.swap(newHashes);
+		hunks.clear();
+		dirty = false;
+		MarkDirty(0, hashes.size());
+		generation++;
+	}
+	condition.notify_one();
+}
+
+void LineDiff::AppendToBase(const wchar_t* text, std::size_t length) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// 保存されている内容の最後の行に対応する今の内容の行から末尾までを比較し直す
+		auto line = baseHashes.size() - 1;
+		std::ptrdiff_t offset = 0;
+		for (auto& hunk : hunks) {
+			if (hunk.baseStart + hunk.baseCount > line) {
+				if (hunk.baseStart <= line) {
+					offset = static_cast<std::ptrdiff_t>(hunk.start) - static_cast<std::ptrdiff_t>(line);
+				}
+				break;
+			}
+			offset += static_cast<std::ptrdiff_t>(hunk.count) - static_cast<std::ptrdiff_t>(hunk.baseCount);
+		}
+		auto start = std::min(static_cast<std::size_t>(std::max<std::ptrdiff_t>(0, static_cast<std::ptrdiff_t>(line) + offset)), hashes.size() - 1);
+
+		// 最後の行は続きからハッシュを計算する
+		auto hash = baseHashes.back();
+		for (std::size_t i = 0; i < length; i++) {
+			if (text[i] == '\n') {
+				baseHashes.back() = hash;
+				baseHashes.push_back(FNV_OFFSET_BASIS);
+				hash = FNV_OFFSET_BASIS;
+			} else {
+				hash = Fnv1a(hash, static_cast<uint64_t>(text[i]));
+			}
+		}
+		baseHashes.back() = hash;
+
+		MarkDirty(start, hashes.size());
+		generation++;
+	}
+	condition.notify_one();
+}
+
+void LineDiff::SetCurrent(const std::wstring& text) {
+	std::vector<uint64_t> newHashes;
+	HashLines(text, newHashes, &lineStarts);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		hashes.swap(newHashes);
+		hunks.clear();
+		dirty = false;
+		MarkDirty(0, hashes.size());
+		generation++;
+	}
+	condition.notify_one();
+}
+
+void LineDiff::MarkSaved() {
+	std::lock_guard<std::mutex> lock(mutex);
+	baseHashes = hashes;
+	hunks.clear();
+	dirty = false;
+	generation++;
+}
+
+void LineDiff::Clear() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		// 空の文書は空の行が 1 つある
+		std::vector<uint64_t>(1, FNV_OFFSET_BASIS).swap(baseHashes);
+		std::vector<uint64_t>(1, FNV_OFFSET_BASIS).swap(hashes);
+		std::vector<DiffHunk>().swap(hunks);
+		dirty = false;
+		generation++;
+	}
+
+	std::vector<std::size_t>(1, 0).swap(lineStarts);
+	std::vector<std::size_t>().swap(editStarts);
+	std::vector<uint64_t>().swap(editHashes);
+}
+
+void LineDiff::MarkDirty(std::size_t start, std::size_t end) {
+	if (dirty) {
+		start = std::min(start, dirtyStart);
+		end = std::max(end, dirtyEnd);
+	}
+
+	// 範囲に重なるか接する差分を取り除き、範囲を広げる
+	auto itr = std::lower_bound(hunks.begin(), hunks.end(), start, [](const DiffHunk& hunk, std::size_t start) {
+		return hunk.start + hunk.count < start;
+	});
+	auto first = itr;
+	while (itr != hunks.end() && itr->start <= end) {
+		start = std::min(start, itr->start);
+		end = std::max(end, itr->start + itr->count);
+		itr++;
+	}
+	hunks.erase(first, itr);
+
+	dirty = true;
+	dirtyStart = start;
+	dirtyEnd = end;
+}
+
+void LineDiff::ReplaceLines(std::size_t first, std::size_t removed, const std::vector<std::size_t>& starts, const std::vector<uint64_t>& newHashes, std::ptrdiff_t delta) {
+	auto inserted = starts.size();
+	auto lineDelta = static_cast<std::ptrdiff_t>(inserted) - static_cast<std::ptrdiff_t>(removed);
+
+	// 編集された行を置き換え、後ろの行の開始位置をずらす
+	lineStarts.erase(lineStarts.begin() + first, lineStarts.begin() + first + removed);
+	lineStarts.insert(lineStarts.begin() + first, starts.begin(), starts.end());
+	for (auto i = first + inserted; i < lineStarts.size(); i++) {
+		lineStarts[i] += delta;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		hashes.erase(hashes.begin() + first, hashes.begin() + first + removed);
+		hashes.insert(hashes.begin() + first, newHashes.begin(), newHashes.end());
+
+		// 編集前の行番号を編集後の行番号にする
+		auto mapStart = [&](std::size_t line) {
+			if (line <= first) {
+				return line;
+			}
+			return line >= first + removed ? line + lineDelta : first;
+		};
+		auto mapEnd = [&](std::size_t line) {
+			if (line <= first) {
+				return line;
+			}
+			return line >= first + removed ? line + lineDelta : first + inserted;
+		};
+
+		auto start = first;
+		auto end = first + inserted;
+		if (dirty) {
+			start = std::min(start, mapStart(dirtyStart));
+			end = std::max(end, mapEnd(dirtyEnd));
+			dirty = false;
+		}
+
+		// 編集された行に重なるか接する差分は取り除いて比較し直す
+		auto itr = std::lower_bound(hunks.begin(), hunks.end(), first, [](const DiffHunk& hunk, std::size_t first) {
+			return hunk.start + hunk.count < first;
+		});
+		auto overlapped = itr;
+		while (itr != hunks.end() && itr->start <= first + removed) {
+			start = std::min(start, mapStart(itr->start));
+			end = std::max(end, mapEnd(itr->start + itr->count));
+			itr++;
+		}
+		itr = hunks.erase(overlapped, itr);
+
+		// 後ろの差分は行番号をずらすだけにする
+		for (; itr != hunks.end(); itr++) {
+			itr->start += lineDelta;
+		}
+
+		MarkDirty(start, end);
+		generation++;
+	}
+	condition.notify_one();
+}
+
+void LineDiff::WorkerLoop() {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+		condition.wait(lock, [this]() { return dirty || stopRequested; });
+		if (stopRequested) {
+			break;
+		}
+
+		// 比較し直す範囲の前後の差分から、保存されている内容での範囲を求める
+		auto currentGeneration = generation;
+		auto start = std::min(dirtyStart, hashes.size());
+		auto end = std::min(dirtyEnd, hashes.size());
+		auto after = std::lower_bound(hunks.begin(), hunks.end(), start, [](const DiffHunk& hunk, std::size_t start) {
+			return hunk.start < start;
+		});
+
+		std::ptrdiff_t offsetBefore = 0;
+		for (auto itr = hunks.begin(); itr != after; itr++) {
+			offsetBefore += static_cast<std::ptrdiff_t>(itr->baseCount) - static_cast<std::ptrdiff_t>(itr->count);
+		}
+		std::ptrdiff_t offsetAfter = 0;
+		for (auto itr = after; itr != hunks.end(); itr++) {
+			offsetAfter += static_cast<std::ptrdiff_t>(itr->baseCount) - static_cast<std::ptrdiff_t>(itr->count);
+		}
+
+		auto baseStart = static_cast<std::ptrdiff_t>(start) + offsetBefore;
+		auto baseEnd = static_cast<std::ptrdiff_t>(baseHashes.size()) - (static_cast<std::ptrdiff_t>(hashes.size() - end) + offsetAfter);
+		if (baseStart < 0 || baseEnd < baseStart || baseEnd > static_cast<std::ptrdiff_t>(baseHashes.size())) {
+			// 対応が取れない場合は全体を比較し直す
+			hunks.clear();
+			start = 0;
+			end = hashes.size();
+			baseStart = 0;
+			baseEnd = static_cast<std::ptrdiff_t>(baseHashes.size());
+		}
+
+		std::vector<uint64_t> base(baseHashes.begin() + baseStart, baseHashes.begin() + baseEnd);
+		std::vector<uint64_t> lines(hashes.begin() + start, hashes.begin() + end);
+
+		// 比較している間は編集できるようにロックを外す
+		lock.unlock();
+		auto result = DiffLines(base.data(), base.size(), lines.data(), lines.size());
+		lock.lock();
+
+		if (stopRequested) {
+			break;
+		}
+		if (generation != currentGeneration) {
+			// 比較している間に編集されたのでやり直す
+			continue;
+		}
+
+		for (auto& hunk : result) {
+			hunk.baseStart += baseStart;
+			hunk.start += start;
+		}
+		auto position = std::lower_bound(hunks.begin(), hunks.end(), start, [](const DiffHunk& hunk, std::size_t start) {
+			return hunk.start < start;
+		});
+		hunks.insert(position, result.begin(), result.end());
+		dirty = false;
+
+		if (onUpdated) {
+			lock.unlock();
+			onUpdated();
+			lock.lock();
+		}
+	}
+}
+
+std::size_t LineDiff::LineCount() const {
+	return lineStarts.size();
+}
+
+std::size_t LineDiff::MemoryUsage() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return BytesOf(lineStarts) + BytesOf(baseHashes) + BytesOf(hashes) + BytesOf(hunks);
+}
+
+std::size_t LineDiff::LineStart(std::size_t line) const {
+	return lineStarts[line];
+}
+
+std::size_t LineDiff::LineOf(std::size_t index) const {
+	auto itr = std::upper_bound(lineStarts.begin(), lineStarts.end(), index);
+	return static_cast<std::size_t>(std::distance(lineStarts.begin(), itr)) - 1;
+}
+
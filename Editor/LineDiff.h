@@ -0,0 +1,156 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include "Utils.h"
+
+#include "MemoryUsage.h"
+
+// 保存されている内容 (base) の baseStart 行目から baseCount 行を、
+// 今の内容の start 行目から count 行に置き換えたことを表す
+// baseCount が 0 なら追加、count が 0 なら削除、どちらも 0 でなければ変更
+struct DiffHunk {
+	std::size_t baseStart;
+	std::size_t baseCount;
+	std::size_t start;
+	std::size_t count;
+};
+
+// 行のハッシュの列を Myers の O(ND) アルゴリズム (線形空間の分割統治) で比較する
+// 差分が maxCost を超える部分は細かく比較せずに 1 つの変更として扱う
+std::vector<DiffHunk> DiffLines(const uint64_t* base, std::size_t baseCount, const uint64_t* lines, std::size_t count, std::size_t maxCost = 4096);
+
+// 保存されている内容と今の内容の行ごとの差分
+//
+// 各行を 64 ビットのハッシュにして比較する。編集されたときは編集された行だけハッシュを計算し直し、
+// それより後ろの差分は行番号をずらすだけにする。
+// 差分はバックグラウンドのスレッドで、編集された範囲とそれに接する差分の部分だけを比較し直す。
+// 比較が終わるたびに onUpdated がバックグラウンドのスレッドから呼ばれる。
+class LineDiff {
+private:
+	// 以下は UI スレッドからだけ使う
+	std::vector<std::size_t> lineStarts;
+	// 編集された行を読み直すための作業領域 (確保し直さないように使い回す)
+	std::vector<std::size_t> editStarts;
+	std::vector<uint64_t> editHashes;
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::function<void()> onUpdated;
+	bool stopRequested;
+
+	// 以下は mutex で保護する
+	// 最後の行のハッシュは追記されたときに続きから計算する
+	std::vector<uint64_t> baseHashes;
+	std::vector<uint64_t> hashes;
+	// 比較し直す必要がある今の内容の行の範囲
+	bool dirty;
+	std::size_t dirtyStart;
+	std::size_t dirtyEnd;
+	// 比較中に編集されたかどうかを調べるための世代
+	uint64_t generation;
+	std::vector<DiffHunk> hunks;
+
+	static void HashLines(const std::wstring& text, std::vector<uint64_t>& hashes, std::vector<std::size_t>* starts);
+
+	// 範囲に重なるか接する差分は比較し直す範囲に含める
+	void MarkDirty(std::size_t start, std::size_t end);
+	void ReplaceLines(std::size_t first, std::size_t removed, const std::vector<std::size_t>& starts, const std::vector<uint64_t>& newHashes, std::ptrdiff_t delta);
+	void WorkerLoop();
+public:
+	LineDiff();
+	~LineDiff();
+
+	LineDiff(const LineDiff&) = delete;
+	LineDiff& operator=(const LineDiff&) = delete;
+
+	void Start(std::function<void()> onUpdated);
+	void Stop();
+
+	// 保存されている内容を設定する
+	void SetBase(const std::wstring& text);
+	// 保存されている内容の末尾に追加する
+	void AppendToBase(const wchar_t* text, std::size_t length);
+	// 今の内容を設定する。全体を比較し直す
+	void SetCurrent(const std::wstring& text);
+	// 今の内容を保存されている内容にする
+	void MarkSaved();
+	// 空の文書にして、行ごとのハッシュに確保していたメモリを解放する
+	void Clear();
+
+	// pos から removed 文字を削除して inserted 文字を挿入した後に呼ぶ
+	// charAt(std::size_t index) は編集後の文書の index 番目の文字、length は編集後の文書の長さ
+	template <typename CharAt>
+	void Edit(std::size_t pos, std::size_t removed, std::size_t inserted, std::size_t length, CharAt charAt);
+
+	std::size_t LineCount() const;
+	// 確保しているメモリの大きさ (バイト)
+	std::size_t MemoryUsage();
+	std::size_t LineStart(std::size_t line) const;
+	// index 番目の文字を含む行
+	std::size_t LineOf(std::size_t index) const;
+	// firstLine 行目から lastLine 行目までにかかる差分 (行の順に並んでいる)
+	// 結果は out の末尾に追加する
+	template <typename Allocator>
+	void Hunks(std::size_t firstLine, std::size_t lastLine, std::vector<DiffHunk, Allocator>& out);
+};
+
+template <typename CharAt>
+void LineDiff::Edit(std::size_t pos, std::size_t removed, std::size_t inserted, std::size_t length, CharAt charAt) {
+	// 編集前の位置で、編集された範囲を含む行
+	auto first = LineOf(pos);
+	auto last = LineOf(pos + removed);
+	auto delta = static_cast<std::ptrdiff_t>(inserted) - static_cast<std::ptrdiff_t>(removed);
+
+	// 編集された範囲を含む行を読み直す (挿入された部分の後の最初の改行まで)
+	auto& starts = editStarts;
+	auto& newHashes = editHashes;
+	starts.clear();
+	newHashes.clear();
+	auto start = lineStarts[first];
+	auto hash = FNV_OFFSET_BASIS;
+	starts.push_back(start);
+	for (auto i = start; i < length; i++) {
+		auto ch = charAt(i);
+		if (ch == '\n') {
+			newHashes.push_back(hash);
+			// 挿入された部分より後ろの改行は編集前の last 行の末尾の改行
+			if (i >= pos + inserted) {
+				break;
+			}
+			starts.push_back(i + 1);
+			hash = FNV_OFFSET_BASIS;
+		} else {
+			hash = Fnv1a(hash, static_cast<uint64_t>(ch));
+		}
+	}
+
+	if (newHashes.size() < starts.size()) {
+		// 改行で終わっていない最後の行まで読んだ
+		newHashes.push_back(hash);
+	}
+
+	ReplaceLines(first, last - first + 1, starts, newHashes, delta);
+}
+
+template <typename Allocator>
+void LineDiff::Hunks(std::size_t firstLine, std::size_t lastLine, std::vector<DiffHunk, Allocator>& out) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto itr = std::lower_bound(hunks.begin(), hunks.end(), firstLine, [](const DiffHunk& hunk, std::size_t firstLine) {
+		return hunk.start + hunk.count < firstLine;
+	});
+
+	for (; itr != hunks.end() && itr->start <= lastLine; itr++) {
+		out.push_back(*itr);
+	}
+}
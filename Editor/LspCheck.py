@@ -0,0 +1,54 @@
+# editor-lsp を LspStub.py に対して動かし、まとめて送った変更をサーバーが適用した結果を確かめる
+#
+#   python3 LspCheck.py [editor-lsp のパス]
+#
+# 打鍵、連続した Backspace、打った直後の削除、複数行にまたがる編集、サロゲートペアの後ろの編集を
+# -e で渡し、スタブが診断として返した文書全体が期待した内容と一致するかを比べる。
+# 変更をまとめる場合 (-d 200) と、まとめずに送る場合 (-d 0) の両方で試す。
+# 一致しなかった場合はその場合の出力を表示して 1 を返す。
+import json, os, subprocess, sys, tempfile
+
+CASES = [
+    ('typing', 'abc\n', ['0:3:0:3:x', '0:4:0:4:y', '0:5:0:5:z'], 'abcxyz\n'),
+    ('backspace', 'hello\n', ['0:4:0:5:', '0:3:0:4:', '0:2:0:3:'], 'he\n'),
+    ('type-then-delete', 'ab\n', ['0:1:0:1:123', '0:2:0:4:'], 'a1b\n'),
+    ('lines', 'one\ntwo\nthree\n', ['1:3:1:3:\\nmid', '0:3:2:0:', '1:0:1:5:TODO'], 'onemid\nTODO\n'),
+    ('surrogate', 'a\n', ['0:1:0:1:\U0001F600', '0:3:0:3:b'], 'a\U0001F600b\n'),
+]
+
+def quote(path):
+    return '"' + path + '"'
+
+def run(editor, path, changes, debounce):
+    stub = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'LspStub.py')
+    args = [editor, '-d', str(debounce)]
+    for change in changes:
+        args += ['-e', change]
+    args += [path, quote(sys.executable), quote(stub)]
+    return subprocess.run(args, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, timeout=30).stdout.decode('utf-8')
+
+def check(output, expected):
+    # info の診断がスタブの持つ文書全体、warning の診断が TODO
+    texts = [json.loads(line.split(': info: ', 1)[1]) for line in output.splitlines() if ': info: ' in line]
+    warnings = [line for line in output.splitlines() if ': warning: ' in line]
+    return texts == [expected] and len(warnings) == expected.count('TODO')
+
+def main():
+    editor = sys.argv[1] if len(sys.argv) > 1 else os.path.join('.', 'editor-lsp')
+    failed = 0
+    with tempfile.TemporaryDirectory() as directory:
+        for name, text, changes, expected in CASES:
+            path = os.path.join(directory, name + '.txt')
+            with open(path, 'w', encoding='utf-8', newline='') as file:
+                file.write(text)
+            for debounce in (200, 0):
+                output = run(editor, path, changes, debounce)
+                ok = check(output, expected)
+                print('%s %s (-d %d)' % ('ok' if ok else 'FAILED', name, debounce))
+                if not ok:
+                    print(output)
+                    failed += 1
+    return 1 if failed else 0
+
+if __name__ == '__main__':
+    sys.exit(main())
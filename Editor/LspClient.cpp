@@ -0,0 +1,679 @@
+﻿#include "LspClient.h"
+#include "Encoding.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+	// 対応している意味的な字句の種類 (LSP で定められているもの)
+	const char* const TOKEN_TYPES[] = {
+		"namespace", "type", "class", "enum", "interface", "struct", "typeParameter", "parameter",
+		"variable", "property", "enumMember", "event", "function", "method", "macro", "keyword",
+		"modifier", "comment", "string", "number", "regexp", "operator",
+	};
+
+	bool SamePosition(const LspPosition& a, const LspPosition& b) {
+		return a.line == b.line && a.character == b.character;
+	}
+
+	// start に text を挿入した後の、挿入した部分の後ろの位置
+	LspPosition EndOfInserted(const LspPosition& start, const std::wstring& text) {
+		auto newline = text.rfind(L'\n');
+		if (newline == std::wstring::npos) {
+			return LspPosition{ start.line, start.character + LspClient::Utf16Length(text.data(), text.size()) };
+		}
+
+		auto lines = static_cast<std::size_t>(std::count(text.begin(), text.end(), L'\n'));
+		return LspPosition{ start.line + lines, LspClient::Utf16Length(text.data() + newline + 1, text.size() - newline - 1) };
+	}
+
+	// 直前の変更とまとめられる場合はまとめて true を返す
+	// 続けて入力した文字、続けて Backspace で削除した文字、入力したばかりの文字の削除をまとめる
+	bool MergeChange(LspTextChange& last, const LspTextChange& change) {
+		auto insertedEnd = EndOfInserted(last.start, last.text);
+		if (!change.text.empty()) {
+			if (SamePosition(change.start, change.end) && SamePosition(change.start, insertedEnd)) {
+				last.text += change.text;
+				return true;
+			}
+			return false;
+		}
+
+		if (last.text.empty() && SamePosition(change.end, last.start)) {
+			last.start = change.start;
+			return true;
+		}
+
+		// 挿入した部分の最後の行の中だけを後ろから削除した場合
+		auto lineStart = insertedEnd.line == last.start.line ? last.start.character : 0;
+		if (last.text.empty() || !SamePosition(change.end, insertedEnd) || change.start.line != insertedEnd.line || change.start.character < lineStart) {
+			return false;
+		}
+
+		auto units = change.end.character - change.start.character;
+		auto length = last.text.size();
+		while (units > 0 && length > 0) {
+			auto width = LspClient::Utf16Length(&last.text[length - 1], 1);
+			if (width > units) {
+				return false;
+			}
+			units -= width;
+			length--;
+		}
+		if (units > 0) {
+			return false;
+		}
+
+		last.text.resize(length);
+		return true;
+	}
+
+	void AppendPosition(std::string& out, const LspPosition& position) {
+		out += "{\"line\":" + std::to_string(position.line) + ",\"character\":" + std::to_string(position.character) + "}";
+	}
+
+	LspPosition PositionOf(const JsonValue& value) {
+		return LspPosition{
+			static_cast<std::size_t>(std::max<int64_t>(0, value["line"].Integer())),
+			static_cast<std::size_t>(std::max<int64_t>(0, value["character"].Integer())) };
+	}
+
+	// 要求の ID を JSON にする (サーバーからの要求の ID は文字列のこともある)
+	std::string IdToJson(const JsonValue& id) {
+		std::string out;
+		if (id.GetType() == JsonValue::Type::String) {
+			AppendJsonString(out, id.String());
+		} else {
+			out = std::to_string(id.Integer());
+		}
+		return out;
+	}
+
+	// ヘッダーの Content-Length の値 (ない場合は SIZE_MAX)
+	std::size_t ContentLengthOf(const std::string& buffer, std::size_t start, std::size_t end) {
+		static const char NAME[] = "content-length:";
+		while (start < end) {
+			auto lineEnd = std::min(buffer.find("\r\n", start), end);
+			auto nameLength = sizeof(NAME) - 1;
+			if (lineEnd - start > nameLength && std::equal(NAME, NAME + nameLength, buffer.begin() + start, [](char a, char b) {
+				return a == (b >= 'A' && b <= 'Z' ? b - 'A' + 'a' : b);
+			})) {
+				std::size_t length = 0;
+				bool digits = false;
+				for (auto i = start + nameLength; i < lineEnd; i++) {
+					if (buffer[i] >= '0' && buffer[i] <= '9') {
+						length = length * 10 + (buffer[i] - '0');
+						digits = true;
+					}
+				}
+				return digits ? length : SIZE_MAX;
+			}
+			start = lineEnd + 2;
+		}
+		return SIZE_MAX;
+	}
+}
+
+LspClient::LspClient() :
+	debounceMsec(0),
+	stopRequested(false),
+	initialized(false),
+	opened(false),
+	incrementalSync(false),
+	semanticTokensFull(false),
+	edits(0),
+	version(0),
+	nextId(1),
+	tokensRequest(-1),
+	diagnosticsReceived(false),
+	diagnosticsEdits(0),
+	tokensReceived(false),
+	tokensEdits(0) {
+}
+
+LspClient::~LspClient() {
+	Stop();
+}
+
+bool LspClient::Start(const std::wstring& command, const std::wstring& path, const std::wstring& text, unsigned int debounceMsec, std::function<void()> onUpdated) {
+	Stop();
+	if (!process.Start(command)) {
+		return false;
+	}
+
+	this->onUpdated = onUpdated;
+	this->debounceMsec = debounceMsec;
+	uri = FileUriOf(AbsolutePath(path));
+	languageId = LanguageIdOf(path);
+
+	stopRequested = false;
+	initialized = false;
+	opened = false;
+	incrementalSync = false;
+	semanticTokensFull = false;
+	openText = text;
+	edits = 0;
+	version = 0;
+	nextId = 1;
+	tokensRequest = -1;
+	diagnosticsReceived = false;
+	tokensReceived = false;
+
+	// 文書のあるディレクトリを作業領域とする
+	std::string params = "{\"processId\":null,\"clientInfo\":{\"name\":\"Editor\"},\"rootUri\":";
+	AppendJsonString(params, uri.substr(0, uri.rfind('/')));
+	params += ",\"capabilities\":{\"general\":{\"positionEncodings\":[\"utf-16\"]},\"textDocument\":{"
+		"\"synchronization\":{\"dynamicRegistration\":false},"
+		"\"publishDiagnostics\":{\"versionSupport\":true},"
+		"\"semanticTokens\":{\"requests\":{\"full\":true},\"formats\":[\"relative\"],\"tokenModifiers\":[],\"tokenTypes\":[";
+	for (auto type : TOKEN_TYPES) {
+		if (type != TOKEN_TYPES[0]) {
+			params += ",";
+		}
+		AppendJsonString(params, std::string(type));
+	}
+	params += "]}}}}";
+	AddRequest(RequestKind::Initialize, "initialize", params);
+
+	reader = std::thread(&LspClient::ReaderLoop, this);
+	writer = std::thread(&LspClient::WriterLoop, this);
+	return true;
+}
+
+void LspClient::Stop() {
+	if (!process.IsStarted()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopRequested = true;
+	}
+	condition.notify_all();
+	if (writer.joinable()) {
+		writer.join();
+	}
+
+	// 書き込みのスレッドは終わっているので、ここから直接送る
+	// 終了の要求の応答は待たない (応答しないサーバーは強制終了する)
+	std::vector<std::string> messages;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		AddRequest(RequestKind::Shutdown, "shutdown", "");
+		AddNotification("exit", "");
+		messages.swap(outgoing);
+	}
+	for (auto& message : messages) {
+		Send(message);
+	}
+	process.CloseInput();
+	process.Wait(SHUTDOWN_WAIT_MSEC);
+	if (reader.joinable()) {
+		reader.join();
+	}
+	process.Close();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<std::string>().swap(outgoing);
+	std::vector<LspTextChange>().swap(changes);
+	std::vector<PendingRequest>().swap(pending);
+	std::vector<std::pair<int64_t, uint64_t>>().swap(sentVersions);
+	std::vector<LspDiagnostic>().swap(diagnostics);
+	std::vector<LspSemanticToken>().swap(tokens);
+	std::vector<std::string>().swap(tokenTypes);
+	std::wstring().swap(openText);
+}
+
+bool LspClient::IsRunning() const {
+	return process.IsStarted();
+}
+
+void LspClient::Change(const LspTextChange& change) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto now = Clock::now();
+		edits++;
+		lastChangeTime = now;
+		if (changes.empty()) {
+			firstChangeTime = now;
+			changes.push_back(change);
+		} else if (MergeChange(changes.back(), change)) {
+			// 入力したばかりの文字を削除して何も変わらなくなった場合は送らない
+			auto& last = changes.back();
+			if (last.text.empty() && SamePosition(last.start, last.end)) {
+				changes.pop_back();
+			}
+		} else {
+			changes.push_back(change);
+		}
+	}
+	condition.notify_all();
+}
+
+bool LspClient::TakeDiagnostics(std::vector<LspDiagnostic>& out) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!diagnosticsReceived) {
+		return false;
+	}
+
+	// その後に編集されていれば位置がずれているので捨てる (編集を送った後の結果がまた届く)
+	diagnosticsReceived = false;
+	if (diagnosticsEdits != edits) {
+		return false;
+	}
+
+	out.swap(diagnostics);
+	diagnostics.clear();
+	return true;
+}
+
+bool LspClient::TakeSemanticTokens(std::vector<LspSemanticToken>& out) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!tokensReceived) {
+		return false;
+	}
+
+	tokensReceived = false;
+	if (tokensEdits != edits) {
+		return false;
+	}
+
+	out.swap(tokens);
+	tokens.clear();
+	return true;
+}
+
+std::vector<std::string> LspClient::TokenTypes() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return tokenTypes;
+}
+
+bool LspClient::Send(const std::string& body) {
+	auto message = "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+	return process.Write(message.data(), message.size());
+}
+
+int64_t LspClient::AddRequest(RequestKind kind, const char* method, const std::string& params) {
+	// 要求は最後に送った版に対するもの
+	auto id = nextId++;
+	pending.push_back(PendingRequest{ id, kind, sentVersions.empty() ? 0 : sentVersions.back().second });
+	auto body = "{\"jsonrpc\":\"2.0\",\"id\":" + std::to_string(id) + ",\"method\":\"" + method + "\"";
+	if (!params.empty()) {
+		body += ",\"params\":" + params;
+	}
+	outgoing.push_back(body + "}");
+	return id;
+}
+
+std::string LspClient::DocumentParams() const {
+	std::string params = "{\"textDocument\":{\"uri\":";
+	AppendJsonString(params, uri);
+	return params + "}}";
+}
+
+void LspClient::AddNotification(const char* method, const std::string& params) {
+	auto body = "{\"jsonrpc\":\"2.0\",\"method\":\"" + std::string(method) + "\"";
+	if (!params.empty()) {
+		body += ",\"params\":" + params;
+	}
+	outgoing.push_back(body + "}");
+}
+
+void LspClient::ReaderLoop() {
+	std::string buffer;
+	std::vector<char> chunk(64 * 1024);
+	for (;;) {
+		auto read = process.Read(chunk.data(), chunk.size());
+		if (read == 0) {
+			break;
+		}
+		buffer.append(chunk.data(), read);
+
+		// 揃ったメッセージを順に処理する
+		std::size_t pos = 0;
+		bool updated = false;
+		for (;;) {
+			auto headerEnd = buffer.find("\r\n\r\n", pos);
+			if (headerEnd == std::string::npos) {
+				break;
+			}
+
+			auto length = ContentLengthOf(buffer, pos, headerEnd);
+			auto bodyStart = headerEnd + 4;
+			if (length == SIZE_MAX) {
+				fprintf(stderr, "Language server sent a message without Content-Length\n");
+				pos = bodyStart;
+				continue;
+			}
+			if (buffer.size() - bodyStart < length) {
+				break;
+			}
+
+			try {
+				auto message = JsonValue::Parse(buffer.data() + bodyStart, length);
+				std::lock_guard<std::mutex> lock(mutex);
+				updated = HandleMessage(message) || updated;
+			} catch (const JsonException& e) {
+				fprintf(stderr, "Language server sent invalid JSON: %s\n", e.what());
+			}
+			pos = bodyStart + length;
+		}
+		buffer.erase(0, pos);
+
+		// 応答を送る必要がある場合や初期化が終わった場合に書き込みのスレッドを起こす
+		condition.notify_all();
+		if (updated && onUpdated) {
+			onUpdated();
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!stopRequested) {
+		fprintf(stderr, "Language server exited\n");
+	}
+}
+
+void LspClient::WriterLoop() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!stopRequested) {
+		// 初期化が終わったら文書を開く。それまでの変更は開いた後に送る
+		if (initialized && !opened) {
+			opened = true;
+			std::string params = "{\"textDocument\":{\"uri\":";
+			AppendJsonString(params, uri);
+			params += ",\"languageId\":";
+			AppendJsonString(params, languageId);
+			params += ",\"version\":" + std::to_string(++version) + ",\"text\":";
+			AppendJsonString(params, openText);
+			params += "}}";
+			std::wstring().swap(openText);
+
+			sentVersions.emplace_back(version, 0);
+			AddNotification("textDocument/didOpen", params);
+			if (semanticTokensFull) {
+				tokensRequest = AddRequest(RequestKind::SemanticTokens, "textDocument/semanticTokens/full", DocumentParams());
+			}
+		}
+
+		auto wakeAt = Clock::time_point::max();
+		if (opened && !changes.empty()) {
+			if (!incrementalSync) {
+				// 文書全体を送り直すことはしないので、差分に対応していないサーバーには変更を送らない
+				changes.clear();
+			} else {
+				auto deadline = std::min(
+					lastChangeTime + std::chrono::milliseconds(debounceMsec),
+					firstChangeTime + std::chrono::milliseconds(debounceMsec * MAX_DELAY_FACTOR));
+				if (Clock::now() >= deadline) {
+					FlushChanges();
+				} else {
+					wakeAt = deadline;
+				}
+			}
+		}
+
+		if (!outgoing.empty()) {
+			// 書き込んでいる間も変更を受け付ける
+			std::vector<std::string> messages;
+			messages.swap(outgoing);
+			lock.unlock();
+			for (auto& message : messages) {
+				Send(message);
+			}
+			lock.lock();
+			continue;
+		}
+
+		if (wakeAt == Clock::time_point::max()) {
+			condition.wait(lock);
+		} else {
+			condition.wait_until(lock, wakeAt);
+		}
+	}
+}
+
+void LspClient::FlushChanges() {
+	std::string params = "{\"textDocument\":{\"uri\":";
+	AppendJsonString(params, uri);
+	params += ",\"version\":" + std::to_string(++version) + "},\"contentChanges\":[";
+	for (std::size_t i = 0; i < changes.size(); i++) {
+		auto& change = changes[i];
+		params += i == 0 ? "{\"range\":{\"start\":" : ",{\"range\":{\"start\":";
+		AppendPosition(params, change.start);
+		params += ",\"end\":";
+		AppendPosition(params, change.end);
+		params += "},\"text\":";
+		AppendJsonString(params, change.text);
+		params += "}";
+	}
+	params += "]}";
+	changes.clear();
+
+	sentVersions.emplace_back(version, edits);
+	if (sentVersions.size() > MAX_SENT_VERSIONS) {
+		sentVersions.erase(sentVersions.begin());
+	}
+	AddNotification("textDocument/didChange", params);
+
+	// 前の内容に対する意味的な字句の要求は取り消し、応答が届いても捨てる
+	if (tokensRequest != -1) {
+		AddNotification("$/cancelRequest", "{\"id\":" + std::to_string(tokensRequest) + "}");
+		auto id = tokensRequest;
+		pending.erase(std::remove_if(pending.begin(), pending.end(), [id](const PendingRequest& request) {
+			return request.id == id;
+		}), pending.end());
+		tokensRequest = -1;
+	}
+	if (semanticTokensFull) {
+		tokensRequest = AddRequest(RequestKind::SemanticTokens, "textDocument/semanticTokens/full", DocumentParams());
+	}
+}
+
+bool LspClient::HandleMessage(const JsonValue& message) {
+	auto& method = message["method"].String();
+	auto& id = message["id"];
+
+	if (!method.empty()) {
+		if (!id.IsNull()) {
+			// サーバーからの要求には応えられないので、設定の要求には空の設定を、それ以外には null を返す
+			std::string result = "null";
+			if (method == "workspace/configuration") {
+				result = "[";
+				for (std::size_t i = 0; i < message["params"]["items"].Size(); i++) {
+					result += i == 0 ? "null" : ",null";
+				}
+				result += "]";
+			}
+			outgoing.push_back("{\"jsonrpc\":\"2.0\",\"id\":" + IdToJson(id) + ",\"result\":" + result + "}");
+			return false;
+		}
+
+		if (method == "textDocument/publishDiagnostics") {
+			return HandleDiagnostics(message["params"]);
+		}
+		return false;
+	}
+
+	// 取り消した要求の応答は捨てる
+	auto requestId = id.Integer(-1);
+	auto itr = std::find_if(pending.begin(), pending.end(), [requestId](const PendingRequest& request) {
+		return request.id == requestId;
+	});
+	if (itr == pending.end()) {
+		return false;
+	}
+	auto request = *itr;
+	pending.erase(itr);
+
+	if (message.Has("error")) {
+		fprintf(stderr, "Language server returned an error: %s\n", message["error"]["message"].String().c_str());
+		if (request.kind == RequestKind::SemanticTokens && request.id == tokensRequest) {
+			tokensRequest = -1;
+		}
+		return false;
+	}
+
+	switch (request.kind) {
+	case RequestKind::Initialize:
+		HandleInitialized(message["result"]);
+		return false;
+	case RequestKind::SemanticTokens:
+		tokensRequest = -1;
+		HandleSemanticTokens(message["result"], request.edits);
+		return true;
+	default:
+		return false;
+	}
+}
+
+void LspClient::HandleInitialized(const JsonValue& result) {
+	auto& capabilities = result["capabilities"];
+
+	// 同期の方法は数値か、change を持つオブジェクトで示される (2 が差分)
+	auto& sync = capabilities["textDocumentSync"];
+	auto syncKind = sync.GetType() == JsonValue::Type::Object ? sync["change"].Integer() : sync.Integer();
+	incrementalSync = syncKind == 2;
+	if (!incrementalSync) {
+		fprintf(stderr, "Language server does not support incremental sync; edits are not sent\n");
+	}
+
+	auto& provider = capabilities["semanticTokensProvider"];
+	auto& full = provider["full"];
+	semanticTokensFull = full.Bool() || full.GetType() == JsonValue::Type::Object;
+	auto& types = provider["legend"]["tokenTypes"];
+	tokenTypes.clear();
+	for (std::size_t i = 0; i < types.Size(); i++) {
+		tokenTypes.push_back(types[i].String());
+	}
+
+	initialized = true;
+	AddNotification("initialized", "{}");
+}
+
+bool LspClient::HandleDiagnostics(const JsonValue& params) {
+	if (params["uri"].String() != uri) {
+		return false;
+	}
+
+	// 版が示されていない場合は最後に送った版に対するものとする
+	uint64_t diagnosticsFor = sentVersions.empty() ? 0 : sentVersions.back().second;
+	if (params.Has("version")) {
+		auto diagnosticsVersion = params["version"].Integer();
+		auto itr = std::find_if(sentVersions.begin(), sentVersions.end(), [diagnosticsVersion](const std::pair<int64_t, uint64_t>& sent) {
+			return sent.first == diagnosticsVersion;
+		});
+		if (itr == sentVersions.end()) {
+			return false;
+		}
+		diagnosticsFor = itr->second;
+	}
+
+	auto& list = params["diagnostics"];
+	diagnostics.clear();
+	for (std::size_t i = 0; i < list.Size(); i++) {
+		auto& item = list[i];
+		LspDiagnostic diagnostic;
+		diagnostic.start = PositionOf(item["range"]["start"]);
+		diagnostic.end = PositionOf(item["range"]["end"]);
+		diagnostic.severity = static_cast<int>(item["severity"].Integer(1));
+		diagnostic.message = DecodeUtf8(item["message"].String());
+		diagnostics.push_back(std::move(diagnostic));
+	}
+
+	diagnosticsReceived = true;
+	diagnosticsEdits = diagnosticsFor;
+	return true;
+}
+
+void LspClient::HandleSemanticTokens(const JsonValue& result, uint64_t requestEdits) {
+	// 字句ごとに行の差、開始位置の差 (同じ行の場合)、長さ、種類、修飾の 5 つの数が並ぶ
+	auto& data = result["data"];
+	tokens.clear();
+	LspPosition position{ 0, 0 };
+	for (std::size_t i = 0; i + 5 <= data.Size(); i += 5) {
+		auto deltaLine = static_cast<std::size_t>(data[i].Integer());
+		auto deltaStart = static_cast<std::size_t>(data[i + 1].Integer());
+		position.line += deltaLine;
+		position.character = deltaLine == 0 ? position.character + deltaStart : deltaStart;
+
+		LspSemanticToken token;
+		token.start = position;
+		token.length = static_cast<std::size_t>(data[i + 2].Integer());
+		token.type = static_cast<uint32_t>(data[i + 3].Integer());
+		token.modifiers = static_cast<uint32_t>(data[i + 4].Integer());
+		tokens.push_back(token);
+	}
+
+	tokensReceived = true;
+	tokensEdits = requestEdits;
+}
+
+std::string LspClient::LanguageIdOf(const std::wstring& path) {
+	static const struct {
+		const wchar_t* extension;
+		const char* languageId;
+	} LANGUAGES[] = {
+		{ L"c", "c" }, { L"h", "cpp" }, { L"cpp", "cpp" }, { L"cc", "cpp" }, { L"cxx", "cpp" }, { L"hpp", "cpp" }, { L"hh", "cpp" },
+		{ L"cs", "csharp" }, { L"go", "go" }, { L"java", "java" }, { L"js", "javascript" }, { L"json", "json" },
+		{ L"md", "markdown" }, { L"py", "python" }, { L"rs", "rust" }, { L"ts", "typescript" },
+	};
+
+	auto dot = path.rfind(L'.');
+	auto separator = path.find_last_of(L"/\\");
+	if (dot == std::wstring::npos || (separator != std::wstring::npos && dot < separator)) {
+		return "plaintext";
+	}
+
+	auto extension = path.substr(dot + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](wchar_t c) {
+		return c >= L'A' && c <= L'Z' ? static_cast<wchar_t>(c - L'A' + L'a') : c;
+	});
+	for (auto& language : LANGUAGES) {
+		if (extension == language.extension) {
+			return language.languageId;
+		}
+	}
+	return "plaintext";
+}
+
+std::string LspClient::FileUriOf(const std::wstring& path) {
+	static const char HEX[] = "0123456789ABCDEF";
+
+	auto utf8 = EncodeUtf8(path);
+	std::replace(utf8.begin(), utf8.end(), '\\', '/');
+
+	// Windows の C:/... は file:///C:/...、UNC の //server/... は file://server/... にする
+	std::string uri = "file://";
+	std::size_t start = 0;
+	if (utf8.size() >= 2 && utf8[0] == '/' && utf8[1] == '/') {
+		start = 2;
+	} else if (utf8.empty() || utf8[0] != '/') {
+		uri += '/';
+	}
+
+	for (auto i = start; i < utf8.size(); i++) {
+		auto c = static_cast<unsigned char>(utf8[i]);
+		if ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || (c != 0 && strchr("-._~/:", c))) {
+			uri.push_back(static_cast<char>(c));
+		} else {
+			uri.push_back('%');
+			uri.push_back(HEX[c >> 4]);
+			uri.push_back(HEX[c & 0xF]);
+		}
+	}
+	return uri;
+}
+
+std::size_t LspClient::Utf16Length(const wchar_t* text, std::size_t length) {
+	// Windows の wchar_t は UTF-16 なのでそのままの数。UTF-32 の環境では BMP の外の文字を 2 つと数える
+	std::size_t units = length;
+	if (sizeof(wchar_t) > 2) {
+		for (std::size_t i = 0; i < length; i++) {
+			if (static_cast<uint32_t>(text[i]) > 0xFFFF) {
+				units++;
+			}
+		}
+	}
+	return units;
+}
@@ -0,0 +1,164 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "Platform.h"
+#include "Json.h"
+
+// 言語サーバーとやり取りする位置。character は行の先頭からの UTF-16 の符号単位の数
+struct LspPosition {
+	std::size_t line;
+	std::size_t character;
+};
+
+// [start, end) を text に置き換える変更。位置は 1 つ前の変更を反映した後の文書のもの
+struct LspTextChange {
+	LspPosition start;
+	LspPosition end;
+	std::wstring text;
+};
+
+struct LspDiagnostic {
+	LspPosition start;
+	LspPosition end;
+	// 1: エラー、2: 警告、3: 情報、4: ヒント
+	int severity;
+	std::wstring message;
+};
+
+// 意味的な字句。行をまたがない
+struct LspSemanticToken {
+	LspPosition start;
+	std::size_t length;
+	// サーバーが initialize の応答で示した種類の一覧 (TokenTypes) の番号
+	uint32_t type;
+	uint32_t modifiers;
+};
+
+// 言語サーバーのクライアント
+//
+// サーバーを子プロセスとして起動し、標準入出力で JSON-RPC のメッセージをやり取りする。
+// 読み込みと書き込みはそれぞれのスレッドで行うので、UI スレッドはサーバーの応答を待たない。
+// 編集は UI スレッドから Change で渡した範囲の変更だけを送り、文書全体を送り直すことはしない
+// (差分の同期に対応していないサーバーには、開いたときの内容だけを送る)。
+// 変更は最後の変更から debounceMsec 経つまでためておき、続けて入力された文字などはまとめてから
+// 1 つの didChange で送る。送るたびに前の意味的な字句の要求は取り消して要求し直す。
+// 診断と意味的な字句が届くと読み込みのスレッドから onUpdated が呼ばれるので、UI スレッドで Take で取り出す。
+// 取り出した時点までの変更をすべて反映した内容に対する結果だけを返し、古い内容に対する結果は捨てる。
+class LspClient {
+private:
+	// 入力が続いている間も、最初の変更からこの倍数だけ待ったら送る
+	static constexpr unsigned int MAX_DELAY_FACTOR = 4;
+	// 終了を要求してから強制終了するまで待つ時間
+	static constexpr unsigned int SHUTDOWN_WAIT_MSEC = 500;
+	// 版ごとの変更の数を覚えておく数
+	static constexpr std::size_t MAX_SENT_VERSIONS = 64;
+
+	enum class RequestKind : uint8_t {
+		Initialize,
+		SemanticTokens,
+		Shutdown,
+	};
+
+	struct PendingRequest {
+		int64_t id;
+		RequestKind kind;
+		// 要求した版までに Change が呼ばれた回数
+		uint64_t edits;
+	};
+
+	using Clock = std::chrono::steady_clock;
+
+	ChildProcess process;
+	std::thread reader;
+	std::thread writer;
+	std::function<void()> onUpdated;
+	unsigned int debounceMsec;
+	std::string uri;
+	std::string languageId;
+
+	std::mutex mutex;
+	std::condition_variable condition;
+	// 以下は mutex で保護する
+	bool stopRequested;
+	bool initialized;
+	bool opened;
+	bool incrementalSync;
+	bool semanticTokensFull;
+	std::vector<std::string> tokenTypes;
+	// didOpen で送る内容 (送ったら解放する)
+	std::wstring openText;
+	// 書き込みのスレッドが送るメッセージ (本体だけ)
+	std::vector<std::string> outgoing;
+	// まだ送っていない変更と、最初と最後の変更の時刻
+	std::vector<LspTextChange> changes;
+	Clock::time_point firstChangeTime;
+	Clock::time_point lastChangeTime;
+	// Change が呼ばれた回数
+	uint64_t edits;
+	// 最後に送った版と、送った版ごとの Change の回数
+	int64_t version;
+	std::vector<std::pair<int64_t, uint64_t>> sentVersions;
+	int64_t nextId;
+	std::vector<PendingRequest> pending;
+	// 応答を待っている意味的な字句の要求 (ない場合は -1)
+	int64_t tokensRequest;
+	bool diagnosticsReceived;
+	uint64_t diagnosticsEdits;
+	std::vector<LspDiagnostic> diagnostics;
+	bool tokensReceived;
+	uint64_t tokensEdits;
+	std::vector<LspSemanticToken> tokens;
+
+	void ReaderLoop();
+	void WriterLoop();
+	// Content-Length を付けて書き込む
+	bool Send(const std::string& body);
+	// mutex を取った状態で呼ぶ。結果が届いた場合は true を返す
+	bool HandleMessage(const JsonValue& message);
+	void HandleInitialized(const JsonValue& result);
+	// この文書の診断だった場合は true を返す
+	bool HandleDiagnostics(const JsonValue& params);
+	void HandleSemanticTokens(const JsonValue& result, uint64_t requestEdits);
+	// mutex を取った状態で呼ぶ。ためている変更を didChange にして outgoing に追加する
+	void FlushChanges();
+	// mutex を取った状態で呼ぶ。outgoing に追加し、要求の場合は ID を返す (params が空の場合は付けない)
+	int64_t AddRequest(RequestKind kind, const char* method, const std::string& params);
+	void AddNotification(const char* method, const std::string& params);
+	// 文書だけを指定する要求の引数
+	std::string DocumentParams() const;
+public:
+	LspClient();
+	~LspClient();
+
+	LspClient(const LspClient&) = delete;
+	LspClient& operator=(const LspClient&) = delete;
+
+	// サーバーを起動して path の文書を text の内容で開く。起動できなかった場合は false を返す
+	bool Start(const std::wstring& command, const std::wstring& path, const std::wstring& text, unsigned int debounceMsec, std::function<void()> onUpdated);
+	// サーバーに終了を要求し、終了しない場合は強制終了する
+	void Stop();
+	bool IsRunning() const;
+
+	// 文書を編集した後に呼ぶ
+	void Change(const LspTextChange& change);
+	// 新しい結果がある場合は out に設定して true を返す
+	bool TakeDiagnostics(std::vector<LspDiagnostic>& out);
+	bool TakeSemanticTokens(std::vector<LspSemanticToken>& out);
+	std::vector<std::string> TokenTypes();
+
+	// 拡張子から決める言語の名前 (LSP の languageId)
+	static std::string LanguageIdOf(const std::wstring& path);
+	// 絶対パスを file: の URI にする
+	static std::string FileUriOf(const std::wstring& path);
+	// 文字列の UTF-16 の符号単位の数
+	static std::size_t Utf16Length(const wchar_t* text, std::size_t length);
+};
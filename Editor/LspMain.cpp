@@ -0,0 +1,172 @@
+﻿// 言語サーバーに文書を開いて編集を送り、届いた診断を表示するコマンド
+//
+//   editor-lsp [-d 待つ時間] [-w 待つ時間] [-e 行:桁:終わりの行:終わりの桁:文字列]... <ファイル> <サーバーのコマンド>...
+//
+// エディタと同じ LspClient を使い、-e で指定した変更を順に Change で渡す (行と桁は 0 から数える。文字列の \n は改行)。
+// 最後の変更を反映した内容に対する診断が届くまで -w ミリ秒 (既定は 10000) 待ち、届かなかった場合は 1 を返す。
+// -d は変更をまとめて送るまで待つ時間 (既定は 200 ミリ秒)。
+// LspCheck.py は最小限の言語サーバー LspStub.py に対してこのコマンドを動かし、送った変更を確かめる。
+// エディタ本体とは別に、Direct2D や Win32 を使わないファイルだけでビルドする。
+//   g++ -std=c++14 -O2 -pthread LspMain.cpp LspClient.cpp Json.cpp Encoding.cpp Platform.cpp -o editor-lsp
+//   cl /std:c++14 /O2 /EHsc LspMain.cpp LspClient.cpp Json.cpp Encoding.cpp Platform.cpp /Fe:editor-lsp.exe
+#include "LspClient.h"
+#include "Encoding.h"
+#include "Platform.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace {
+	void PrintUsage() {
+		fprintf(stderr, "usage: editor-lsp [-d debounce-ms] [-w wait-ms] [-e line:character:end-line:end-character:text]... <file> <server-command...>\n");
+	}
+
+	bool ParseChange(const std::wstring& arg, LspTextChange* change) {
+		std::size_t numbers[4];
+		std::size_t pos = 0;
+		for (auto& number : numbers) {
+			auto colon = arg.find(L':', pos);
+			if (colon == std::wstring::npos || colon == pos) {
+				return false;
+			}
+			number = static_cast<std::size_t>(std::wcstoul(arg.substr(pos, colon - pos).c_str(), nullptr, 10));
+			pos = colon + 1;
+		}
+
+		change->start = LspPosition{ numbers[0], numbers[1] };
+		change->end = LspPosition{ numbers[2], numbers[3] };
+		change->text.clear();
+		for (auto i = pos; i < arg.size(); i++) {
+			if (arg[i] == L'\\' && i + 1 < arg.size() && arg[i + 1] == L'n') {
+				change->text.push_back(L'\n');
+				i++;
+			} else {
+				change->text.push_back(arg[i]);
+			}
+		}
+		return true;
+	}
+
+	const char* SeverityName(int severity) {
+		switch (severity) {
+		case 1: return "error";
+		case 2: return "warning";
+		case 3: return "info";
+		default: return "hint";
+		}
+	}
+
+	int Run(const std::vector<std::wstring>& args) {
+		unsigned int debounceMsec = 200;
+		unsigned int waitMsec = 10000;
+		std::vector<LspTextChange> changes;
+		std::size_t i = 0;
+		for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; i++) {
+			LspTextChange change;
+			if (args[i] == L"-d" && i + 1 < args.size()) {
+				debounceMsec = static_cast<unsigned int>(std::wcstoul(args[++i].c_str(), nullptr, 10));
+			} else if (args[i] == L"-w" && i + 1 < args.size()) {
+				waitMsec = static_cast<unsigned int>(std::wcstoul(args[++i].c_str(), nullptr, 10));
+			} else if (args[i] == L"-e" && i + 1 < args.size() && ParseChange(args[++i], &change)) {
+				changes.push_back(change);
+			} else {
+				PrintUsage();
+				return 2;
+			}
+		}
+		if (args.size() - i < 2) {
+			PrintUsage();
+			return 2;
+		}
+
+		auto& path = args[i];
+		std::wstring command;
+		for (auto k = i + 1; k < args.size(); k++) {
+			command += (k == i + 1 ? L"" : L" ") + args[k];
+		}
+
+		// エディタで開いたときと同じく改行を \n に統一する
+		std::string bytes;
+		if (!ReadFileBytes(path, bytes)) {
+			fprintf(stderr, "Unable to read file: %s\n", EncodeUtf8(path).c_str());
+			return 2;
+		}
+		std::wstring text;
+		TextStreamDecoder decoder;
+		decoder.Decode(bytes.data(), bytes.size(), text);
+		decoder.Finish(text);
+
+		std::mutex mutex;
+		std::condition_variable condition;
+		bool updated = false;
+		LspClient client;
+		if (!client.Start(command, path, text, debounceMsec, [&]() {
+			std::lock_guard<std::mutex> lock(mutex);
+			updated = true;
+			condition.notify_all();
+		})) {
+			fprintf(stderr, "Unable to start language server: %s\n", EncodeUtf8(command).c_str());
+			return 2;
+		}
+
+		for (auto& change : changes) {
+			client.Change(change);
+		}
+
+		// 最後の変更を反映した内容に対する診断を待つ
+		std::vector<LspDiagnostic> diagnostics;
+		std::vector<LspSemanticToken> tokens;
+		bool diagnosticsReceived = false;
+		bool tokensReceived = false;
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(waitMsec);
+		while (!diagnosticsReceived) {
+			std::unique_lock<std::mutex> lock(mutex);
+			if (!condition.wait_until(lock, deadline, [&]() { return updated; })) {
+				break;
+			}
+			updated = false;
+			lock.unlock();
+
+			diagnosticsReceived = client.TakeDiagnostics(diagnostics) || diagnosticsReceived;
+			tokensReceived = client.TakeSemanticTokens(tokens) || tokensReceived;
+		}
+		auto tokenTypes = client.TokenTypes();
+		client.Stop();
+
+		if (!diagnosticsReceived) {
+			fprintf(stderr, "No diagnostics for the edited document within %ums\n", waitMsec);
+			return 1;
+		}
+
+		auto file = EncodeUtf8(path);
+		for (auto& diagnostic : diagnostics) {
+			printf("%s:%zu:%zu: %s: %s\n", file.c_str(), diagnostic.start.line + 1, diagnostic.start.character + 1,
+				SeverityName(diagnostic.severity), EncodeUtf8(diagnostic.message).c_str());
+		}
+		if (tokensReceived) {
+			for (auto& token : tokens) {
+				printf("token %zu:%zu+%zu %s\n", token.start.line + 1, token.start.character + 1, token.length,
+					token.type < tokenTypes.size() ? tokenTypes[token.type].c_str() : "?");
+			}
+		}
+		printf("%zu diagnostics, %zu semantic tokens, %zu changes\n", diagnostics.size(), tokens.size(), changes.size());
+		return 0;
+	}
+}
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t* argv[]) {
+	return Run(std::vector<std::wstring>(argv + 1, argv + argc));
+}
+#else
+int main(int argc, char* argv[]) {
+	std::vector<std::wstring> args;
+	for (int i = 1; i < argc; i++) {
+		args.push_back(DecodeUtf8(argv[i]));
+	}
+	return Run(args);
+}
+#endif
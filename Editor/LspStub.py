@@ -0,0 +1,75 @@
+# editor-lsp を試すための最小限の言語サーバー (LspCheck.py から起動する)
+#
+#   python3 LspStub.py [意味的な字句を返すまで待つ秒数]
+#
+# didChange の範囲 (UTF-16 の桁) を自分の持つ文書に適用し、そのたびに文書全体を JSON の文字列にした
+# info の診断と、TODO ごとの warning の診断を送る。意味的な字句は英字の並びを返し、取り消された要求には応答しない。
+import json, re, sys, threading, time
+
+inp, out, lock = sys.stdin.buffer, sys.stdout.buffer, threading.Lock()
+doc, cancelled = {'text': ''}, set()
+
+def send(message):
+    body = json.dumps(message).encode()
+    with lock:
+        out.write(b'Content-Length: %d\r\n\r\n' % len(body) + body)
+        out.flush()
+
+def read():
+    length = None
+    for line in iter(inp.readline, b''):
+        if not line.strip():
+            return json.loads(inp.read(length))
+        name, value = line.split(b':', 1)
+        length = int(value) if name.strip().lower() == b'content-length' else length
+
+def offset(text, position):
+    # 行の先頭から UTF-16 の単位で数えた桁を文字の位置にする
+    start = sum(len(line) + 1 for line in text.split('\n')[:position['line']])
+    units, i = 0, start
+    while units < position['character']:
+        units, i = units + (2 if ord(text[i]) > 0xFFFF else 1), i + 1
+    return i
+
+def diagnostic(index, length, severity, message):
+    text = doc['text']
+    line, character = text.count('\n', 0, index), index - (text.rfind('\n', 0, index) + 1)
+    end = {'line': line, 'character': character + length}
+    return {'range': {'start': {'line': line, 'character': character}, 'end': end}, 'severity': severity, 'message': message}
+
+def publish():
+    items = [diagnostic(0, 0, 3, json.dumps(doc['text']))] + [diagnostic(m.start(), 4, 2, 'TODO') for m in re.finditer('TODO', doc['text'])]
+    send({'jsonrpc': '2.0', 'method': 'textDocument/publishDiagnostics', 'params': {'uri': doc['uri'], 'version': doc['version'], 'diagnostics': items}})
+
+def tokens(id):
+    time.sleep(float(sys.argv[1]) if len(sys.argv) > 1 else 0)
+    data, previous = [], (0, 0)
+    for line, text in enumerate(doc['text'].split('\n')):
+        for m in re.finditer('[A-Za-z]+', text):
+            data += [line - previous[0], m.start() - (previous[1] if line == previous[0] else 0), len(m.group()), 0, 0]
+            previous = (line, m.start())
+    if id not in cancelled:
+        send({'jsonrpc': '2.0', 'id': id, 'result': {'data': data}})
+
+for message in iter(read, None):
+    method, params = message.get('method'), message.get('params', {})
+    if method == 'initialize':
+        capabilities = {'textDocumentSync': {'openClose': True, 'change': 2}, 'semanticTokensProvider': {'legend': {'tokenTypes': ['variable'], 'tokenModifiers': []}, 'full': True}}
+        send({'jsonrpc': '2.0', 'id': message['id'], 'result': {'capabilities': capabilities}})
+    elif method == 'textDocument/didOpen':
+        doc.update(text=params['textDocument']['text'], version=params['textDocument']['version'], uri=params['textDocument']['uri'])
+        publish()
+    elif method == 'textDocument/didChange':
+        for change in params['contentChanges']:
+            text = doc['text']
+            doc['text'] = text[:offset(text, change['range']['start'])] + change['text'] + text[offset(text, change['range']['end']):]
+        doc['version'] = params['textDocument']['version']
+        publish()
+    elif method == 'textDocument/semanticTokens/full':
+        threading.Thread(target=tokens, args=(message['id'],), daemon=True).start()
+    elif method == '$/cancelRequest':
+        cancelled.add(params['id'])
+    elif method == 'shutdown':
+        send({'jsonrpc': '2.0', 'id': message['id'], 'result': None})
+    elif method == 'exit':
+        break
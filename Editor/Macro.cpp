@@ -0,0 +1,97 @@
+﻿#include "Macro.h"
+#include "Encoding.h"
+#include "Platform.h"
+
+#include <algorithm>
+
+namespace {
+	const char* const KEY_NAMES[] = { "left", "right", "up", "down", "home", "end", "delete" };
+	// MacroKey の順の仮想キーコード (Windows 以外でも使えるように値で持つ)
+	// VK_LEFT, VK_RIGHT, VK_UP, VK_DOWN, VK_HOME, VK_END, VK_DELETE
+	const int VIRTUAL_KEYS[] = { 0x25, 0x27, 0x26, 0x28, 0x24, 0x23, 0x2E };
+}
+
+MacroEvent MacroEvent::Char(wchar_t character) {
+	return MacroEvent{ Type::Char, character, MacroKey::Left };
+}
+
+MacroEvent MacroEvent::Key(MacroKey key) {
+	return MacroEvent{ Type::Key, 0, key };
+}
+
+bool MacroKeyOf(int virtualKey, MacroKey* key) {
+	for (int i = 0; i < static_cast<int>(sizeof(VIRTUAL_KEYS) / sizeof(VIRTUAL_KEYS[0])); i++) {
+		if (VIRTUAL_KEYS[i] == virtualKey) {
+			*key = static_cast<MacroKey>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+void SaveMacro(const std::wstring& path, const std::vector<MacroEvent>& events) {
+	std::string data;
+	for (auto& event : events) {
+		if (event.type == MacroEvent::Type::Char) {
+			data += "char " + std::to_string(static_cast<unsigned int>(event.character)) + "\n";
+		} else {
+			data += std::string("key ") + KEY_NAMES[static_cast<int>(event.key)] + "\n";
+		}
+	}
+
+	if (!WriteFileAtomically(path, data)) {
+		throw MacroException("Unable to save macro");
+	}
+}
+
+std::vector<MacroEvent> LoadMacro(const std::wstring& path) {
+	std::string data;
+	if (!ReadFileBytes(path, data)) {
+		throw MacroException("Unable to read macro: " + EncodeUtf8(path));
+	}
+
+	std::vector<MacroEvent> events;
+	std::size_t lineNumber = 0;
+	for (std::size_t pos = 0; pos < data.size(); ) {
+		auto end = data.find('\n', pos);
+		if (end == std::string::npos) {
+			end = data.size();
+		}
+		auto line = data.substr(pos, end - pos);
+		pos = end + 1;
+		lineNumber++;
+
+		if (!line.empty() && line.back() == '\r') {
+			line.pop_back();
+		}
+		if (line.empty()) {
+			continue;
+		}
+
+		auto space = line.find(' ');
+		auto type = line.substr(0, space);
+		auto value = space == std::string::npos ? std::string() : line.substr(space + 1);
+		bool parsed = false;
+		if (type == "char" && !value.empty() && value.find_first_not_of("0123456789") == std::string::npos) {
+			auto code = std::stoul(value);
+			if (code <= 0xFFFF) {
+				events.push_back(MacroEvent::Char(static_cast<wchar_t>(code)));
+				parsed = true;
+			}
+		} else if (type == "key") {
+			for (int i = 0; i < static_cast<int>(sizeof(KEY_NAMES) / sizeof(KEY_NAMES[0])); i++) {
+				if (value == KEY_NAMES[i]) {
+					events.push_back(MacroEvent::Key(static_cast<MacroKey>(i)));
+					parsed = true;
+					break;
+				}
+			}
+		}
+
+		if (!parsed) {
+			throw MacroException("Invalid macro event at line " + std::to_string(lineNumber));
+		}
+	}
+
+	return events;
+}
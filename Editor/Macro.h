@@ -0,0 +1,132 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <exception>
+#include <algorithm>
+
+// 記録できるキー (文字の入力以外)
+enum class MacroKey {
+	Left,
+	Right,
+	Up,
+	Down,
+	Home,
+	End,
+	Delete,
+};
+
+// 記録した入力 1 つ分。OnChar に渡された文字か OnKeyDown に渡されたキー
+struct MacroEvent {
+	enum class Type {
+		Char,
+		Key,
+	};
+
+	Type type;
+	wchar_t character;
+	MacroKey key;
+
+	static MacroEvent Char(wchar_t character);
+	static MacroEvent Key(MacroKey key);
+};
+
+// Windows の仮想キーコードに対応するキー。記録できないキーの場合は false を返す
+bool MacroKeyOf(int virtualKey, MacroKey* key);
+
+// 1 行に 1 つずつ "char <文字コード>" または "key <キーの名前>" の形式で保存する
+void SaveMacro(const std::wstring& path, const std::vector<MacroEvent>& events);
+std::vector<MacroEvent> LoadMacro(const std::wstring& path);
+
+// 画面を使わずにマクロを再生する。caret は再生を始める位置で、再生後の位置を返す
+// 選択範囲は扱わない。上下の移動は折り返しを考えずに論理行の同じ桁に移動する
+// Document は Length()、CharAt(pos)、Insert(pos, text, length)、Erase(pos, length) を持つ文書 (PieceTable など)
+template <typename Document>
+void PlayMacro(Document& document, const std::vector<MacroEvent>& events, std::size_t& caret);
+
+class MacroException : public std::exception {
+private:
+	std::string message;
+public:
+	MacroException(const std::string& message) : message(message) {}
+	const char* what() const noexcept { return message.c_str(); }
+};
+
+template <typename Document>
+void PlayMacro(Document& document, const std::vector<MacroEvent>& events, std::size_t& caret) {
+	auto lineStartOf = [&document](std::size_t pos) {
+		while (pos > 0 && document.CharAt(pos - 1) != '\n') {
+			pos--;
+		}
+		return pos;
+	};
+	auto lineEndOf = [&document](std::size_t pos) {
+		auto length = document.Length();
+		while (pos < length && document.CharAt(pos) != '\n') {
+			pos++;
+		}
+		return pos;
+	};
+
+	caret = std::min(caret, document.Length());
+
+	for (auto& event : events) {
+		if (event.type == MacroEvent::Type::Char) {
+			// Editor::OnChar と同じく \b はキャレットの前の文字を削除し、それ以外の制御文字は無視する
+			auto character = event.character;
+			if (character == '\b') {
+				if (caret > 0) {
+					document.Erase(caret - 1, 1);
+					caret--;
+				}
+			} else if (character >= 0x20 || character == '\n' || character == '\t') {
+				document.Insert(caret, &character, 1);
+				caret++;
+			}
+			continue;
+		}
+
+		switch (event.key) {
+		case MacroKey::Left:
+			if (caret > 0) {
+				caret--;
+			}
+			break;
+		case MacroKey::Right:
+			if (caret < document.Length()) {
+				caret++;
+			}
+			break;
+		case MacroKey::Up:
+		{
+			auto start = lineStartOf(caret);
+			if (start > 0) {
+				auto previous = lineStartOf(start - 1);
+				caret = std::min(previous + (caret - start), start - 1);
+			}
+		}
+			break;
+		case MacroKey::Down:
+		{
+			auto end = lineEndOf(caret);
+			if (end < document.Length()) {
+				auto column = caret - lineStartOf(caret);
+				caret = std::min(end + 1 + column, lineEndOf(end + 1));
+			}
+		}
+			break;
+		case MacroKey::Home:
+			caret = lineStartOf(caret);
+			break;
+		case MacroKey::End:
+			caret = lineEndOf(caret);
+			break;
+		case MacroKey::Delete:
+			if (caret < document.Length()) {
+				document.Erase(caret, 1);
+			}
+			break;
+		}
+	}
+}
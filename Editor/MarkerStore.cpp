@@ -0,0 +1,356 @@
+﻿#include "MarkerStore.h"
+
+#include <algorithm>
+
+MarkerStore::MarkerStore() :
+	root(NIL),
+	count(0),
+	randomState(2463534242u) {
+}
+
+uint8_t MarkerStore::KindBit(MarkerKind kind) {
+	return static_cast<uint8_t>(1u << static_cast<unsigned>(kind));
+}
+
+uint32_t MarkerStore::NextPriority() {
+	// xorshift32
+	randomState ^= randomState << 13;
+	randomState ^= randomState >> 17;
+	randomState ^= randomState << 5;
+	return randomState;
+}
+
+void MarkerStore::Apply(uint32_t node, std::ptrdiff_t shift) {
+	if (node == NIL) {
+		return;
+	}
+
+	auto& n = nodes[node];
+	n.start += shift;
+	n.end += shift;
+	n.maxEnd += shift;
+	n.shift += shift;
+}
+
+void MarkerStore::PushDown(uint32_t node) {
+	auto& n = nodes[node];
+	if (n.shift != 0) {
+		Apply(n.left, n.shift);
+		Apply(n.right, n.shift);
+		n.shift = 0;
+	}
+}
+
+void MarkerStore::Update(uint32_t node) {
+	auto& n = nodes[node];
+	n.maxEnd = n.end;
+	n.kinds = KindBit(n.kind);
+	for (auto child : { n.left, n.right }) {
+		if (child != NIL) {
+			nodes[child].parent = node;
+			n.maxEnd = std::max(n.maxEnd, nodes[child].maxEnd + n.shift);
+			n.kinds |= nodes[child].kinds;
+		}
+	}
+}
+
+void MarkerStore::Split(uint32_t node, std::size_t key, uint32_t* left, uint32_t* right) {
+	if (node == NIL) {
+		*left = NIL;
+		*right = NIL;
+		return;
+	}
+
+	PushDown(node);
+	if (nodes[node].start < key) {
+		uint32_t rest;
+		Split(nodes[node].right, key, &rest, right);
+		nodes[node].right = rest;
+		Update(node);
+		*left = node;
+	} else {
+		uint32_t rest;
+		Split(nodes[node].left, key, left, &rest);
+		nodes[node].left = rest;
+		Update(node);
+		*right = node;
+	}
+}
+
+uint32_t MarkerStore::Merge(uint32_t left, uint32_t right) {
+	if (left == NIL) {
+		return right;
+	}
+	if (right == NIL) {
+		return left;
+	}
+
+	if (nodes[left].priority > nodes[right].priority) {
+		PushDown(left);
+		nodes[left].right = Merge(nodes[left].right, right);
+		Update(left);
+		return left;
+	}
+
+	PushDown(right);
+	nodes[right].left = Merge(left, nodes[right].left);
+	Update(right);
+	return right;
+}
+
+void MarkerStore::Collect(uint32_t node, std::vector<uint32_t>& out) {
+	std::vector<uint32_t> stack;
+	while (node != NIL || !stack.empty()) {
+		if (node != NIL) {
+			PushDown(node);
+			stack.push_back(node);
+			node = nodes[node].left;
+			continue;
+		}
+
+		node = stack.back();
+		stack.pop_back();
+		out.push_back(node);
+		node = nodes[node].right;
+	}
+}
+
+uint32_t MarkerStore::Build(const std::vector<uint32_t>& sorted) {
+	uint32_t tree = NIL;
+	for (auto node : sorted) {
+		auto& n = nodes[node];
+		n.left = NIL;
+		n.right = NIL;
+		n.maxEnd = n.end;
+		n.kinds = KindBit(n.kind);
+		tree = Merge(tree, node);
+	}
+
+	return tree;
+}
+
+template <typename Adjust>
+void MarkerStore::AdjustOverlapping(uint32_t node, std::size_t pos, Adjust adjust) {
+	if (node == NIL || nodes[node].maxEnd < pos) {
+		return;
+	}
+
+	PushDown(node);
+	AdjustOverlapping(nodes[node].left, pos, adjust);
+	if (nodes[node].end >= pos) {
+		adjust(nodes[node]);
+	}
+	AdjustOverlapping(nodes[node].right, pos, adjust);
+	Update(node);
+}
+
+void MarkerStore::Clear() {
+	std::vector<Node>().swap(nodes);
+	std::vector<uint32_t>().swap(freeNodes);
+	root = NIL;
+	count = 0;
+}
+
+std::size_t MarkerStore::Size() const {
+	return count;
+}
+
+MarkerId MarkerStore::Add(std::size_t start, std::size_t end, MarkerKind kind, MarkerStickiness stickiness, uint16_t value) {
+	uint32_t id;
+	if (!freeNodes.empty()) {
+		id = freeNodes.back();
+		freeNodes.pop_back();
+	} else {
+		id = static_cast<uint32_t>(nodes.size());
+		nodes.emplace_back();
+	}
+
+	auto& n = nodes[id];
+	n.start = start;
+	n.end = std::max(start, end);
+	n.maxEnd = n.end;
+	n.kinds = KindBit(kind);
+	n.shift = 0;
+	n.left = NIL;
+	n.right = NIL;
+	n.parent = NIL;
+	n.priority = NextPriority();
+	n.kind = kind;
+	n.stickiness = stickiness;
+	n.alive = true;
+	n.value = value;
+
+	uint32_t left, right;
+	Split(root, start, &left, &right);
+	root = Merge(Merge(left, id), right);
+	nodes[root].parent = NIL;
+	count++;
+
+	return id;
+}
+
+void MarkerStore::Remove(MarkerId id) {
+	if (id >= nodes.size() || !nodes[id].alive) {
+		return;
+	}
+
+	// 根からこのノードまでの差分を伝えてから、子をつなげて置き換える
+	std::vector<uint32_t> path;
+	for (auto node = id; node != NIL; node = nodes[node].parent) {
+		path.push_back(node);
+	}
+	for (auto itr = path.rbegin(); itr != path.rend(); itr++) {
+		PushDown(*itr);
+	}
+
+	auto parent = nodes[id].parent;
+	auto merged = Merge(nodes[id].left, nodes[id].right);
+	if (parent == NIL) {
+		root = merged;
+	} else if (nodes[parent].left == id) {
+		nodes[parent].left = merged;
+	} else {
+		nodes[parent].right = merged;
+	}
+	if (merged != NIL) {
+		nodes[merged].parent = parent;
+	}
+	for (auto node = parent; node != NIL; node = nodes[node].parent) {
+		Update(node);
+	}
+
+	nodes[id].alive = false;
+	freeNodes.push_back(id);
+	count--;
+}
+
+void MarkerStore::RemoveAll(MarkerKind kind) {
+	// 残す印を順に取り出して木を作り直す
+	std::vector<uint32_t> all;
+	Collect(root, all);
+
+	std::vector<uint32_t> kept;
+	for (auto node : all) {
+		if (nodes[node].kind == kind) {
+			nodes[node].alive = false;
+			freeNodes.push_back(node);
+			count--;
+		} else {
+			kept.push_back(node);
+		}
+	}
+
+	root = Build(kept);
+	if (root != NIL) {
+		nodes[root].parent = NIL;
+	}
+}
+
+Marker MarkerStore::Get(MarkerId id) const {
+	// 祖先にまだ子に伝えていない差分があれば足す
+	auto& n = nodes[id];
+	std::ptrdiff_t shift = 0;
+	for (auto node = n.parent; node != NIL; node = nodes[node].parent) {
+		shift += nodes[node].shift;
+	}
+
+	return Marker{ id, n.start + shift, n.end + shift, n.kind, n.value };
+}
+
+void MarkerStore::Insert(std::size_t pos, std::size_t length) {
+	if (root == NIL || length == 0) {
+		return;
+	}
+
+	// pos より前から始まる印、pos から始まる印、pos より後ろから始まる印に分ける
+	uint32_t before, rest, at, after;
+	Split(root, pos, &before, &rest);
+	Split(rest, pos + 1, &at, &after);
+
+	// pos より後ろから始まる印はまとめてずらす
+	Apply(after, static_cast<std::ptrdiff_t>(length));
+
+	// pos にかかっている印は端ごとに直す
+	auto adjust = [pos, length](Node& n) {
+		auto stickiness = n.stickiness;
+		bool startMoves = n.start == pos && (stickiness == MarkerStickiness::Outside || stickiness == MarkerStickiness::After);
+		bool endMoves = n.end > pos || startMoves || stickiness == MarkerStickiness::Inside || stickiness == MarkerStickiness::After;
+		if (startMoves) {
+			n.start += length;
+		}
+		if (endMoves) {
+			n.end += length;
+		}
+	};
+	AdjustOverlapping(before, pos, adjust);
+
+	// pos から始まる印は開始位置が動くものと動かないものが混ざるので、動かないものを前にして並べ直す
+	if (at != NIL) {
+		std::vector<uint32_t> sorted;
+		Collect(at, sorted);
+		for (auto node : sorted) {
+			adjust(nodes[node]);
+		}
+		std::stable_partition(sorted.begin(), sorted.end(), [this, pos](uint32_t node) {
+			return nodes[node].start == pos;
+		});
+		at = Build(sorted);
+	}
+
+	root = Merge(Merge(before, at), after);
+	nodes[root].parent = NIL;
+}
+
+void MarkerStore::Erase(std::size_t pos, std::size_t length) {
+	if (root == NIL || length == 0) {
+		return;
+	}
+
+	// 削除された範囲より後ろから始まる印はまとめてずらす
+	auto end = pos + length;
+	uint32_t left, right;
+	Split(root, end, &left, &right);
+	Apply(right, -static_cast<std::ptrdiff_t>(length));
+
+	// 削除された範囲にかかっている印の端は pos に寄せる
+	AdjustOverlapping(left, pos, [pos, end, length](Node& n) {
+		if (n.start > pos) {
+			n.start = pos;
+		}
+		n.end = n.end < end ? pos : n.end - length;
+	});
+
+	root = Merge(left, right);
+	nodes[root].parent = NIL;
+}
+
+bool MarkerStore::FindFirst(uint32_t node, std::ptrdiff_t shift, MarkerKind kind, std::size_t from, Marker* marker) const {
+	auto bit = KindBit(kind);
+	while (node != NIL && (nodes[node].kinds & bit) != 0) {
+		auto& n = nodes[node];
+		auto start = n.start + shift;
+		if (start >= from) {
+			if (FindFirst(n.left, shift + n.shift, kind, from, marker)) {
+				return true;
+			}
+			if (n.kind == kind) {
+				*marker = Marker{ node, start, n.end + shift, n.kind, n.value };
+				return true;
+			}
+		}
+
+		shift += n.shift;
+		node = n.right;
+	}
+
+	return false;
+}
+
+bool MarkerStore::FindFirst(MarkerKind kind, std::size_t from, Marker* marker) const {
+	// kind の印を含まない部分木は飛ばしながら開始位置の順にたどる
+	return FindFirst(root, 0, kind, from, marker);
+}
+
+std::size_t MarkerStore::MemoryUsage() const {
+	return BytesOf(nodes) + BytesOf(freeNodes);
+}
@@ -0,0 +1,145 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "MemoryUsage.h"
+
+// 印の種類
+enum class MarkerKind : uint8_t {
+	Bookmark, // 行に付けたブックマーク
+	Anchor, // 外部からの変更の前後で位置を引き継ぐための一時的な印
+	Diagnostic, // 言語サーバーから届いた診断
+	SemanticToken, // 言語サーバーから届いた意味的な字句
+};
+
+// 印の端にちょうど文字が挿入されたときに、端がどちらの文字に付くか
+enum class MarkerStickiness : uint8_t {
+	Inside, // 挿入された文字を範囲に含める (開始位置は前、終了位置は後ろの文字に付く)
+	Outside, // 含めない (開始位置は後ろ、終了位置は前の文字に付く。空の範囲は後ろに付く)
+	Before, // 両端とも前の文字に付き、挿入された文字の前に残る
+	After, // 両端とも後ろの文字に付き、挿入された文字の後ろに移る
+};
+
+using MarkerId = uint32_t;
+
+struct Marker {
+	MarkerId id;
+	std::size_t start;
+	std::size_t end;
+	MarkerKind kind;
+	uint16_t value;
+};
+
+// 文書の位置に付けた印 (検索の一致やブックマークなど) の集まり
+//
+// 印を開始位置の順に並べた平衡二分木 (treap) で持ち、各ノードに部分木の終了位置の最大値と
+// 部分木全体をずらす量 (まだ子に伝えていない差分) を持つ。編集された位置より後ろから始まる印は
+// 木を分けて差分を付けるだけなので、印の数によらず O(log n) でずれる。
+// 編集された位置にかかっている k 個の印だけを個別に直すので、編集は O(log n + k)。
+// 範囲と重なる印を探すときは終了位置の最大値で部分木を飛ばすので、画面に表示されている分だけをたどる。
+// 各ノードには部分木に含まれる印の種類も持ち、種類を指定して探すときはその種類を含まない部分木を飛ばす。
+class MarkerStore {
+private:
+	static constexpr uint32_t NIL = UINT32_MAX;
+
+	struct Node {
+		std::size_t start;
+		std::size_t end;
+		std::size_t maxEnd; // 部分木の end の最大値
+		std::ptrdiff_t shift; // 子の部分木にまだ足していない差分 (このノード自身には足してある)
+		uint8_t kinds; // 部分木に含まれる印の種類 (KindBit の論理和)
+		uint32_t left;
+		uint32_t right;
+		uint32_t parent;
+		uint32_t priority;
+		MarkerKind kind;
+		MarkerStickiness stickiness;
+		bool alive;
+		uint16_t value;
+	};
+
+	// ID はノードの位置。削除したノードは freeNodes に入れて再利用する
+	std::vector<Node> nodes;
+	std::vector<uint32_t> freeNodes;
+	uint32_t root;
+	std::size_t count;
+	uint32_t randomState;
+
+	static uint8_t KindBit(MarkerKind kind);
+	uint32_t NextPriority();
+	void Apply(uint32_t node, std::ptrdiff_t shift);
+	void PushDown(uint32_t node);
+	void Update(uint32_t node);
+	// start < key の印を left、それ以外を right に分ける
+	void Split(uint32_t node, std::size_t key, uint32_t* left, uint32_t* right);
+	uint32_t Merge(uint32_t left, uint32_t right);
+	// 部分木のノードを順に out の末尾に追加する
+	void Collect(uint32_t node, std::vector<uint32_t>& out);
+	// 順に並んだノードから木を作る
+	uint32_t Build(const std::vector<uint32_t>& sorted);
+	// 終了位置が pos 以上の印について、adjust(Node&) で位置を直して最大値を計算し直す
+	template <typename Adjust>
+	void AdjustOverlapping(uint32_t node, std::size_t pos, Adjust adjust);
+	template <typename Func>
+	void Visit(uint32_t node, std::ptrdiff_t shift, std::size_t from, std::size_t to, Func& func) const;
+	bool FindFirst(uint32_t node, std::ptrdiff_t shift, MarkerKind kind, std::size_t from, Marker* marker) const;
+public:
+	MarkerStore();
+
+	void Clear();
+	std::size_t Size() const;
+	// [start, end) に印を付ける。value は印の種類ごとの値 (診断の番号や字句の色など)
+	MarkerId Add(std::size_t start, std::size_t end, MarkerKind kind, MarkerStickiness stickiness = MarkerStickiness::Inside, uint16_t value = 0);
+	// 削除した ID は後で付けた印に再利用される
+	void Remove(MarkerId id);
+	// kind の印をすべて削除する
+	void RemoveAll(MarkerKind kind);
+	// 今の位置を返す (O(log n))
+	Marker Get(MarkerId id) const;
+
+	// pos に length 文字を挿入した後に呼ぶ
+	void Insert(std::size_t pos, std::size_t length);
+	// pos から length 文字を削除した後に呼ぶ。削除された範囲の中の端は pos に寄せる
+	void Erase(std::size_t pos, std::size_t length);
+
+	// [from, to) と重なる印 (空の印は from 以上 to 未満にあるもの) を開始位置の順に func(const Marker&) に渡す
+	// func の中で印を追加したり削除したりしてはいけない
+	template <typename Func>
+	void ForEachInRange(std::size_t from, std::size_t to, Func func) const;
+	// 開始位置が from 以上の kind の印のうち最初のものを探す
+	bool FindFirst(MarkerKind kind, std::size_t from, Marker* marker) const;
+
+	// 確保しているメモリの大きさ (バイト)
+	std::size_t MemoryUsage() const;
+};
+
+template <typename Func>
+void MarkerStore::ForEachInRange(std::size_t from, std::size_t to, Func func) const {
+	Visit(root, 0, from, to, func);
+}
+
+template <typename Func>
+void MarkerStore::Visit(uint32_t node, std::ptrdiff_t shift, std::size_t from, std::size_t to, Func& func) const {
+	// 子の位置はまだ足していない差分を足して求める
+	while (node != NIL) {
+		auto& n = nodes[node];
+		if (n.maxEnd + shift < from) {
+			return;
+		}
+
+		auto start = n.start + shift;
+		auto end = n.end + shift;
+		Visit(n.left, shift + n.shift, from, to, func);
+		if (start >= to) {
+			return;
+		}
+		if (end > from || (start == end && start >= from)) {
+			func(Marker{ node, start, end, n.kind, n.value });
+		}
+
+		shift += n.shift;
+		node = n.right;
+	}
+}
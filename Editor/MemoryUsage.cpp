@@ -0,0 +1,42 @@
+﻿#include "MemoryUsage.h"
+
+MemoryReport::MemoryReport() :
+	bytes() {
+}
+
+void MemoryReport::Add(MemoryCategory category, uint64_t size) {
+	bytes[static_cast<int>(category)] += size;
+}
+
+uint64_t MemoryReport::Get(MemoryCategory category) const {
+	return bytes[static_cast<int>(category)];
+}
+
+uint64_t MemoryReport::Total() const {
+	uint64_t total = 0;
+	for (auto size : bytes) {
+		total += size;
+	}
+	return total;
+}
+
+const wchar_t* MemoryReport::NameOf(MemoryCategory category) {
+	switch (category) {
+	case MemoryCategory::Buffer:
+		return L"Buffer";
+	case MemoryCategory::Layout:
+		return L"Layout";
+	case MemoryCategory::Composition:
+		return L"Composition";
+	case MemoryCategory::GlyphCache:
+		return L"Glyph cache";
+	case MemoryCategory::Undo:
+		return L"Undo";
+	case MemoryCategory::Index:
+		return L"Index";
+	case MemoryCategory::Scratch:
+		return L"Scratch";
+	default:
+		return L"";
+	}
+}
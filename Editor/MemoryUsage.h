@@ -0,0 +1,43 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// メモリの用途
+enum class MemoryCategory {
+	Buffer, // 文書の文字
+	Layout, // 文字の位置と幅、行の幅のチェックポイント
+	Composition, // 未確定文字列
+	GlyphCache, // 描画済みの帯と縮小表示の画像、文字の幅の表
+	Undo, // ジャーナルのまだ書き込まれていない操作とチェックポイント
+	Index, // 差分、括弧の対応、縮小表示の集計、単語の索引、折りたたみ、印
+	Scratch, // フレームごとの一時的なデータ
+	Count,
+};
+
+// 用途ごとのメモリ使用量 (バイト)
+class MemoryReport {
+private:
+	uint64_t bytes[static_cast<int>(MemoryCategory::Count)];
+public:
+	MemoryReport();
+
+	void Add(MemoryCategory category, uint64_t size);
+	uint64_t Get(MemoryCategory category) const;
+	uint64_t Total() const;
+
+	static const wchar_t* NameOf(MemoryCategory category);
+};
+
+// コンテナが確保しているメモリの大きさ (使っていない容量も含む)
+template <typename T>
+std::size_t BytesOf(const std::vector<T>& v) {
+	return v.capacity() * sizeof(T);
+}
+
+template <typename T>
+std::size_t BytesOf(const std::basic_string<T>& s) {
+	return (s.capacity() + 1) * sizeof(T);
+}
@@ -0,0 +1,285 @@
+﻿#include "Minimap.h"
+
+std::size_t LineDensity::Length() const {
+	std::size_t length = 0;
+	for (auto count : counts) {
+		length += count;
+	}
+	return length;
+}
+
+MinimapSummary::Block::Block() :
+	levels(1),
+	dirty(false),
+	dirtyStart(0),
+	dirtyEnd(0) {
+}
+
+std::size_t MinimapSummary::Block::LineCount() const {
+	return levels[0].size();
+}
+
+void MinimapSummary::Block::MarkDirty(std::size_t start, std::size_t end) {
+	dirtyStart = dirty ? std::min(dirtyStart, start) : start;
+	dirtyEnd = dirty ? std::max(dirtyEnd, end) : end;
+	dirty = true;
+}
+
+// std::min に参照で渡すので、C++14 では定義も必要
+constexpr std::size_t MinimapSummary::BLOCK_LINES;
+
+MinimapSummary::MinimapSummary() :
+	blocks(1),
+	blockStarts(1, 0),
+	lineCount(0),
+	version(0) {
+}
+
+LineDensity::Class MinimapSummary::ClassOf(wchar_t ch) {
+	if (ch == ' ' || ch == '\t' || ch == '\r' || ch == 0x3000) {
+		return LineDensity::SPACE;
+	}
+	if (ch >= 0x80) {
+		return LineDensity::WIDE;
+	}
+	if ((ch >= '0' && ch <= '9') || (ch >= 'A' && ch <= 'Z') || (ch >= 'a' && ch <= 'z') || ch == '_') {
+		return LineDensity::WORD;
+	}
+	return LineDensity::SYMBOL;
+}
+
+LineDensity MinimapSummary::Pack(const uint32_t* counts) {
+	uint64_t total = 0;
+	for (int i = 0; i < LineDensity::CLASS_COUNT; i++) {
+		total += counts[i];
+	}
+
+	// 収まらない場合は比率を保ったまま縮める
+	LineDensity density;
+	for (int i = 0; i < LineDensity::CLASS_COUNT; i++) {
+		density.counts[i] = static_cast<uint16_t>(total <= UINT16_MAX ? counts[i] : counts[i] * uint64_t(UINT16_MAX) / total);
+	}
+	return density;
+}
+
+LineDensity MinimapSummary::Average(const LineDensity* densities, std::size_t count) {
+	LineDensity average;
+	for (int i = 0; i < LineDensity::CLASS_COUNT; i++) {
+		uint64_t sum = 0;
+		for (std::size_t j = 0; j < count; j++) {
+			sum += densities[j].counts[i];
+		}
+		average.counts[i] = static_cast<uint16_t>((sum + count / 2) / count);
+	}
+	return average;
+}
+
+void MinimapSummary::Clear() {
+	blocks.assign(1, Block());
+	blockStarts.assign(1, 0);
+	lineCount = 0;
+	version++;
+}
+
+std::size_t MinimapSummary::FindBlock(std::size_t line, std::size_t* local) const {
+	auto index = static_cast<std::size_t>(std::upper_bound(blockStarts.begin(), blockStarts.end(), line) - blockStarts.begin()) - 1;
+	*local = line - blockStarts[index];
+	return index;
+}
+
+void MinimapSummary::UpdateBlockStarts(std::size_t index) {
+	blockStarts.resize(blocks.size());
+	for (auto i = std::max<std::size_t>(index, 1); i < blocks.size(); i++) {
+		blockStarts[i] = blockStarts[i - 1] + blocks[i - 1].LineCount();
+	}
+	lineCount = blockStarts.back() + blocks.back().LineCount();
+}
+
+void MinimapSummary::ReplaceLines(std::size_t first, std::size_t removed, const std::vector<LineDensity>& lines) {
+	first = std::min(first, lineCount);
+	removed = std::min(removed, lineCount - first);
+	version++;
+
+	std::size_t local;
+	auto index = FindBlock(first, &local);
+	auto& block = blocks[index];
+	auto& base = block.levels[0];
+
+	if (removed == lines.size() && local + removed <= base.size()) {
+		// 行数が変わらない場合は上書きするだけなので、縮小版も上書きした行の分だけ計算し直す
+		std::copy(lines.begin(), lines.end(), base.begin() + local);
+		block.MarkDirty(local, local + lines.size());
+		return;
+	}
+
+	// 削除する行がブロックをまたぐ場合は、後ろのブロックから削除した分を取り除く
+	auto inBlock = std::min(removed, base.size() - local);
+	auto remaining = removed - inBlock;
+	auto next = index + 1;
+	while (remaining > 0 && next < blocks.size()) {
+		auto& following = blocks[next].levels[0];
+		auto count = std::min(remaining, following.size());
+		following.erase(following.begin(), following.begin() + count);
+		blocks[next].MarkDirty(0, SIZE_MAX);
+		remaining -= count;
+		if (following.empty()) {
+			blocks.erase(blocks.begin() + next);
+		} else {
+			next++;
+		}
+	}
+
+	// ブロックの中では、重なっている部分は上書きし、増減した分だけ挿入または削除する
+	// 行数が変わった場合は、ブロックの中のそれより後ろの縮小版がすべてずれる
+	auto common = std::min(inBlock, lines.size());
+	std::copy(lines.begin(), lines.begin() + common, base.begin() + local);
+	if (inBlock > common) {
+		base.erase(base.begin() + local + common, base.begin() + local + inBlock);
+	} else {
+		base.insert(base.begin() + local + common, lines.begin() + common, lines.end());
+	}
+	block.MarkDirty(local, SIZE_MAX);
+
+	// 後ろのブロックは先頭の行をずらすだけにする
+	Rebalance(index);
+}
+
+void MinimapSummary::Rebalance(std::size_t index) {
+	auto& base = blocks[index].levels[0];
+	if (base.size() > BLOCK_LINES * 2) {
+		// BLOCK_LINES 行ずつに分ける
+		std::vector<Block> created((base.size() - 1) / BLOCK_LINES);
+		for (std::size_t i = 0; i < created.size(); i++) {
+			auto from = base.begin() + (i + 1) * BLOCK_LINES;
+			auto to = base.begin() + std::min(base.size(), (i + 2) * BLOCK_LINES);
+			created[i].levels[0].assign(from, to);
+			created[i].MarkDirty(0, SIZE_MAX);
+		}
+		base.resize(BLOCK_LINES);
+		blocks.insert(blocks.begin() + index + 1, std::make_move_iterator(created.begin()), std::make_move_iterator(created.end()));
+	} else if (blocks.size() > 1 && base.size() < BLOCK_LINES / 4) {
+		// 前のブロック (最初のブロックの場合は後ろのブロック) にまとめる
+		auto into = index > 0 ? index - 1 : 0;
+		auto from = into + 1;
+		auto& target = blocks[into].levels[0];
+		blocks[into].MarkDirty(target.size(), SIZE_MAX);
+		if (into < index) {
+			target.insert(target.end(), base.begin(), base.end());
+		} else {
+			target.insert(target.end(), blocks[from].levels[0].begin(), blocks[from].levels[0].end());
+		}
+		blocks.erase(blocks.begin() + from);
+		index = into;
+		if (blocks[index].LineCount() > BLOCK_LINES * 2) {
+			Rebalance(index);
+			return;
+		}
+	}
+
+	UpdateBlockStarts(index);
+}
+
+void MinimapSummary::UpdateLevels(Block& block) {
+	if (!block.dirty) {
+		return;
+	}
+
+	auto& levels = block.levels;
+	auto start = block.dirtyStart;
+	auto end = block.dirtyEnd;
+	std::size_t level = 1;
+	for (; levels[level - 1].size() > 1; level++) {
+		if (levels.size() <= level) {
+			levels.emplace_back();
+		}
+
+		auto& lower = levels[level - 1];
+		auto& upper = levels[level];
+		upper.resize((lower.size() + 1) / 2);
+
+		// 下の段の [start, end) にかかる部分だけを計算し直す
+		start /= 2;
+		end = end == SIZE_MAX ? SIZE_MAX : (end + 1) / 2;
+		auto pairs = std::min(std::min(end, upper.size()), lower.size() / 2);
+		for (auto i = start; i < pairs; i++) {
+			auto& left = lower[i * 2];
+			auto& right = lower[i * 2 + 1];
+			for (int j = 0; j < LineDensity::CLASS_COUNT; j++) {
+				upper[i].counts[j] = static_cast<uint16_t>((left.counts[j] + right.counts[j] + 1) / 2);
+			}
+		}
+		// 奇数個の場合、最後の 1 つはそのまま使う
+		if (lower.size() % 2 == 1 && start < upper.size() && end >= upper.size()) {
+			upper.back() = lower.back();
+		}
+	}
+
+	levels.resize(level);
+	block.dirty = false;
+}
+
+std::size_t MinimapSummary::LineCount() const {
+	return lineCount;
+}
+
+uint64_t MinimapSummary::Version() const {
+	return version;
+}
+
+std::size_t MinimapSummary::MemoryUsage() const {
+	std::size_t bytes = BytesOf(blocks) + BytesOf(blockStarts);
+	for (auto& block : blocks) {
+		bytes += BytesOf(block.levels);
+		for (auto& level : block.levels) {
+			bytes += BytesOf(level);
+		}
+	}
+	return bytes;
+}
+
+LineDensity MinimapSummary::SampleBlock(Block& block, std::size_t first, std::size_t last) {
+	UpdateLevels(block);
+
+	// 1 つが範囲の行数以下になる最も粗い段を使うと、範囲にかかるのは高々 3 つになる
+	auto& levels = block.levels;
+	std::size_t level = 0;
+	while (level + 1 < levels.size() && (std::size_t(2) << level) <= last - first) {
+		level++;
+	}
+
+	auto from = first >> level;
+	auto to = (last - 1) >> level;
+	return Average(levels[level].data() + from, to - from + 1);
+}
+
+LineDensity MinimapSummary::Sample(std::size_t first, std::size_t last) {
+	last = std::min(last, LineCount());
+	if (first >= last) {
+		return LineDensity();
+	}
+
+	std::size_t local;
+	auto index = FindBlock(first, &local);
+	if (local + (last - first) <= blocks[index].LineCount()) {
+		return SampleBlock(blocks[index], local, local + (last - first));
+	}
+
+	// 複数のブロックにかかる場合は、ブロックごとの平均を行数で重み付けして平均する
+	uint64_t sums[LineDensity::CLASS_COUNT] = {};
+	for (auto line = first; line < last; index++, local = 0) {
+		auto& block = blocks[index];
+		auto count = std::min(block.LineCount() - local, last - line);
+		auto density = SampleBlock(block, local, local + count);
+		for (int j = 0; j < LineDensity::CLASS_COUNT; j++) {
+			sums[j] += uint64_t(density.counts[j]) * count;
+		}
+		line += count;
+	}
+
+	LineDensity average;
+	auto total = last - first;
+	for (int j = 0; j < LineDensity::CLASS_COUNT; j++) {
+		average.counts[j] = static_cast<uint16_t>((sums[j] + total / 2) / total);
+	}
+	return average;
+}
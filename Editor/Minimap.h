@@ -0,0 +1,125 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+
+#include "MemoryUsage.h"
+
+// 1 行 (または複数の行の平均) の文字の種類ごとの数
+// 65535 文字を超える行は比率を保ったまま縮める
+struct LineDensity {
+	enum Class {
+		SPACE, // 空白
+		WORD, // 英数字
+		SYMBOL, // 記号
+		WIDE, // ASCII 以外 (全角の文字など)
+		CLASS_COUNT
+	};
+
+	uint16_t counts[CLASS_COUNT];
+
+	std::size_t Length() const;
+};
+
+// 縮小表示のための行ごとの文字の密度の集計
+//
+// 行を BLOCK_LINES 行程度ずつのブロックに分け、ブロックごとに行ごとの集計と、隣り合う 2 つを平均した縮小版を
+// 段階ごとに持つ (k 段目の 1 つが 2^k 行分)。
+// 編集されたときは編集された行だけを数え直し、縮小版は次に参照されたときに変わった部分だけを計算し直す。
+// 行数が変わってもそれより後ろのブロックは先頭の行番号をずらすだけなので、計算し直すのは編集されたブロックの中だけで済む。
+// 何行分をまとめて表示する場合でも、ブロックごとにその行数に合った段から高々 3 つを平均するだけで求められる。
+class MinimapSummary {
+private:
+	struct Block {
+		// levels[0] が行ごとの集計
+		std::vector<std::vector<LineDensity>> levels;
+		// 縮小版を計算し直す必要があるブロックの中の行の範囲 (行数が変わった場合はブロックの末尾まで)
+		bool dirty;
+		std::size_t dirtyStart;
+		std::size_t dirtyEnd;
+
+		Block();
+		std::size_t LineCount() const;
+		void MarkDirty(std::size_t start, std::size_t end);
+	};
+
+	std::vector<Block> blocks;
+	// blockStarts[i] は i 番目のブロックの先頭の行
+	std::vector<std::size_t> blockStarts;
+	std::size_t lineCount;
+	uint64_t version;
+	// 数え直した行を集めるための作業領域 (確保し直さないように使い回す)
+	std::vector<LineDensity> editLines;
+
+	static LineDensity::Class ClassOf(wchar_t ch);
+	static LineDensity Pack(const uint32_t* counts);
+	static LineDensity Average(const LineDensity* densities, std::size_t count);
+
+	void ReplaceLines(std::size_t first, std::size_t removed, const std::vector<LineDensity>& lines);
+	// line を含むブロックとその中での位置。line が行数と同じ場合は最後のブロックの末尾
+	std::size_t FindBlock(std::size_t line, std::size_t* local) const;
+	// index 番目以降のブロックの先頭の行を数え直す
+	void UpdateBlockStarts(std::size_t index);
+	// 大きくなりすぎたブロックを分け、小さくなりすぎたブロックを前のブロックにまとめる
+	void Rebalance(std::size_t index);
+	static void UpdateLevels(Block& block);
+	static LineDensity SampleBlock(Block& block, std::size_t first, std::size_t last);
+public:
+	static constexpr std::size_t BLOCK_LINES = 1024;
+
+	MinimapSummary();
+
+	void Clear();
+	// 文書全体を数え直す。charAt(std::size_t index) は index 番目の文字
+	template <typename CharAt>
+	void Reset(std::size_t length, CharAt charAt);
+	// firstLine 行目から removedLines 行を含む範囲を編集した後に呼ぶ
+	// start は編集後の firstLine 行目の先頭、end は挿入された部分の末尾、length は編集後の文書の長さ
+	template <typename CharAt>
+	void Edit(std::size_t firstLine, std::size_t removedLines, std::size_t start, std::size_t end, std::size_t length, CharAt charAt);
+
+	std::size_t LineCount() const;
+	// 編集されるたびに増える
+	uint64_t Version() const;
+	// 確保しているメモリの大きさ (バイト)
+	std::size_t MemoryUsage() const;
+	// first 行目から last 行目の前までの平均
+	LineDensity Sample(std::size_t first, std::size_t last);
+};
+
+template <typename CharAt>
+void MinimapSummary::Reset(std::size_t length, CharAt charAt) {
+	Clear();
+	Edit(0, 0, 0, length, length, charAt);
+}
+
+template <typename CharAt>
+void MinimapSummary::Edit(std::size_t firstLine, std::size_t removedLines, std::size_t start, std::size_t end, std::size_t length, CharAt charAt) {
+	// 編集された範囲を含む行を数え直す (挿入された部分の後の最初の改行まで)
+	auto& lines = editLines;
+	lines.clear();
+	uint32_t counts[LineDensity::CLASS_COUNT] = {};
+	bool closed = false;
+	for (auto i = start; i < length; i++) {
+		auto ch = charAt(i);
+		if (ch == '\n') {
+			lines.push_back(Pack(counts));
+			if (i >= end) {
+				closed = true;
+				break;
+			}
+			std::fill(counts, counts + LineDensity::CLASS_COUNT, 0);
+		} else {
+			counts[ClassOf(ch)]++;
+		}
+	}
+
+	if (!closed) {
+		// 改行で終わっていない最後の行まで読んだ
+		lines.push_back(Pack(counts));
+	}
+
+	ReplaceLines(firstLine, removedLines, lines);
+}
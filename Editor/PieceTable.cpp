@@ -0,0 +1,297 @@
+﻿#include "PieceTable.h"
+
+#include <algorithm>
+#include <numeric>
+
+PieceTable::PieceTable() :
+	root(nullptr),
+	seed(2463534242u) {
+}
+
+PieceTable::PieceTable(std::wstring original) :
+	original(std::move(original)),
+	root(nullptr),
+	seed(2463534242u) {
+	if (!this->original.empty()) {
+		root = NewNode(Source::Original, 0, this->original.size());
+	}
+}
+
+PieceTable::~PieceTable() {
+	FreeTree(root);
+}
+
+PieceTable::Node* PieceTable::NewNode(Source source, std::size_t start, std::size_t length) {
+	auto node = nodes.New();
+	node->source = source;
+	node->start = start;
+	node->length = length;
+	node->total = length;
+	node->priority = NextPriority();
+	node->left = nullptr;
+	node->right = nullptr;
+
+	return node;
+}
+
+void PieceTable::FreeTree(Node* node) {
+	while (node) {
+		FreeTree(node->left);
+
+		auto right = node->right;
+		nodes.Delete(node);
+		node = right;
+	}
+}
+
+uint32_t PieceTable::NextPriority() {
+	// xorshift32
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+
+	return seed;
+}
+
+std::size_t PieceTable::Total(const Node* node) {
+	return node ? node->total : 0;
+}
+
+void PieceTable::Update(Node* node) {
+	node->total = Total(node->left) + node->length + Total(node->right);
+}
+
+void PieceTable::Split(Node* node, std::size_t pos, Node*& left, Node*& right) {
+	if (!node) {
+		left = nullptr;
+		right = nullptr;
+		return;
+	}
+
+	auto leftTotal = Total(node->left);
+	if (pos <= leftTotal) {
+		Split(node->left, pos, left, node->left);
+		Update(node);
+		right = node;
+	} else if (pos >= leftTotal + node->length) {
+		Split(node->right, pos - leftTotal - node->length, node->right, right);
+		Update(node);
+		left = node;
+	} else {
+		// ピースの途中で分割する場合は後半を新しいピースにする
+		auto offset = pos - leftTotal;
+		auto tail = NewNode(node->source, node->start + offset, node->length - offset);
+		node->length = offset;
+
+		right = Merge(tail, node->right);
+		node->right = nullptr;
+		Update(node);
+		left = node;
+	}
+}
+
+PieceTable::Node* PieceTable::Merge(Node* left, Node* right) {
+	if (!left) {
+		return right;
+	}
+	if (!right) {
+		return left;
+	}
+
+	if (left->priority > right->priority) {
+		left->right = Merge(left->right, right);
+		Update(left);
+		return left;
+	} else {
+		right->left = Merge(left, right->left);
+		Update(right);
+		return right;
+	}
+}
+
+PieceTable::Node* PieceTable::Build(const std::vector<Node*>& list) {
+	// 優先度が高いものが上になるように、右端の経路をスタックに持ちながら順に繋ぐ (O(ピース数))
+	std::vector<Node*> stack;
+	for (auto node : list) {
+		Node* last = nullptr;
+		while (!stack.empty() && stack.back()->priority < node->priority) {
+			last = stack.back();
+			stack.pop_back();
+		}
+		node->left = last;
+		if (!stack.empty()) {
+			stack.back()->right = node;
+		}
+		stack.push_back(node);
+	}
+
+	if (stack.empty()) {
+		return nullptr;
+	}
+	UpdateTree(stack.front());
+	return stack.front();
+}
+
+void PieceTable::UpdateTree(Node* node) {
+	if (node) {
+		UpdateTree(node->left);
+		UpdateTree(node->right);
+		Update(node);
+	}
+}
+
+void PieceTable::Insert(std::size_t pos, const wchar_t* text, std::size_t length) {
+	if (length == 0) {
+		return;
+	}
+
+	auto node = NewNode(Source::Added, added.size(), length);
+	added.append(text, length);
+
+	Node* left;
+	Node* right;
+	Split(root, pos, left, right);
+	root = Merge(Merge(left, node), right);
+}
+
+void PieceTable::Erase(std::size_t pos, std::size_t length) {
+	if (length == 0) {
+		return;
+	}
+
+	Node* left;
+	Node* middle;
+	Node* right;
+	Split(root, pos, left, right);
+	Split(right, length, middle, right);
+	FreeTree(middle);
+
+	root = Merge(left, right);
+}
+
+void PieceTable::ReplaceAll(const std::vector<std::size_t>& positions, std::size_t length, const wchar_t* text, std::size_t textLength) {
+	if (positions.empty()) {
+		return;
+	}
+
+	auto textStart = added.size();
+	added.append(text, textLength);
+
+	// 今のピースの並びを取り出してから木を作り直す (解放したノードは作り直すときに使われる)
+	struct Piece {
+		Source source;
+		std::size_t start;
+		std::size_t length;
+	};
+	std::vector<Piece> pieces;
+	std::vector<Node*> stack;
+	for (auto node = root; node || !stack.empty(); ) {
+		if (node) {
+			stack.push_back(node);
+			node = node->left;
+		} else {
+			node = stack.back();
+			stack.pop_back();
+			pieces.push_back(Piece{ node->source, node->start, node->length });
+			node = node->right;
+		}
+	}
+	FreeTree(root);
+	root = nullptr;
+
+	// 置き換えた後のピースが細かくなりすぎる場合は、1 つの文字列にまとめ直したほうが後の操作も速い
+	auto pieceCount = pieces.size() + positions.size() * 2;
+	auto newLength = std::accumulate(pieces.begin(), pieces.end(), std::size_t(0), [](std::size_t sum, const Piece& piece) {
+		return sum + piece.length;
+	}) - positions.size() * length + positions.size() * textLength;
+	bool flatten = pieceCount > newLength / FLATTEN_PIECE_LENGTH;
+
+	std::wstring flat;
+	std::vector<Node*> list;
+	if (flatten) {
+		flat.reserve(newLength);
+	} else {
+		list.reserve(pieceCount);
+	}
+
+	auto append = [&](Source source, std::size_t start, std::size_t count) {
+		if (count == 0) {
+			return;
+		}
+		if (flatten) {
+			auto& buffer = source == Source::Original ? original : added;
+			flat.append(buffer, start, count);
+		} else {
+			list.push_back(NewNode(source, start, count));
+		}
+	};
+
+	std::size_t offset = 0;
+	std::size_t next = 0;
+	// 前のピースから続いている置き換える範囲の残り
+	std::size_t skip = 0;
+	for (auto& piece : pieces) {
+		auto begin = std::min(skip, piece.length);
+		skip -= begin;
+
+		while (begin < piece.length) {
+			if (next < positions.size() && positions[next] < offset + piece.length) {
+				auto match = positions[next++] - offset;
+				append(piece.source, piece.start + begin, match - begin);
+				append(Source::Added, textStart, textLength);
+
+				auto end = match + length;
+				skip = end > piece.length ? end - piece.length : 0;
+				begin = std::min(end, piece.length);
+			} else {
+				append(piece.source, piece.start + begin, piece.length - begin);
+				begin = piece.length;
+			}
+		}
+
+		offset += piece.length;
+	}
+
+	if (flatten) {
+		original = std::move(flat);
+		added.clear();
+		if (!original.empty()) {
+			root = NewNode(Source::Original, 0, original.size());
+		}
+	} else {
+		root = Build(list);
+	}
+}
+
+std::size_t PieceTable::Length() const {
+	return Total(root);
+}
+
+wchar_t PieceTable::CharAt(std::size_t pos) const {
+	auto node = root;
+	while (node) {
+		auto leftTotal = Total(node->left);
+		if (pos < leftTotal) {
+			node = node->left;
+		} else if (pos < leftTotal + node->length) {
+			auto& buffer = node->source == Source::Original ? original : added;
+			return buffer[node->start + pos - leftTotal];
+		} else {
+			pos -= leftTotal + node->length;
+			node = node->right;
+		}
+	}
+
+	return 0;
+}
+
+std::wstring PieceTable::ToString() const {
+	std::wstring str;
+	str.reserve(Length());
+
+	ForEachPiece([&str](const wchar_t* text, std::size_t length) {
+		str.append(text, length);
+	});
+
+	return str;
+}
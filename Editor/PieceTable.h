@@ -0,0 +1,93 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Arena.h"
+
+// 元のテキストと追加されたテキストの断片 (ピース) の並びで文書を表現するバッファ
+// ピースは長さで索引付けされた treap で管理するので挿入・削除は O(log ピース数) で済む
+class PieceTable {
+private:
+	// ReplaceAll の後のピースの平均の長さがこれより短くなる場合は 1 つにまとめる
+	static constexpr std::size_t FLATTEN_PIECE_LENGTH = 64;
+
+	enum class Source : uint8_t {
+		Original,
+		Added,
+	};
+
+	struct Node {
+		Source source;
+		std::size_t start;
+		std::size_t length;
+		// 部分木に含まれる文字数の合計
+		std::size_t total;
+		uint32_t priority;
+		Node* left;
+		Node* right;
+	};
+
+	std::wstring original;
+	std::wstring added;
+	Node* root;
+	uint32_t seed;
+	// 分割のたびに確保されるのでノードはプールから確保する
+	NodePool<Node> nodes;
+
+	Node* NewNode(Source source, std::size_t start, std::size_t length);
+	void FreeTree(Node* node);
+	uint32_t NextPriority();
+
+	static std::size_t Total(const Node* node);
+	static void Update(Node* node);
+	void Split(Node* node, std::size_t pos, Node*& left, Node*& right);
+	Node* Merge(Node* left, Node* right);
+	// 並びの順のノードから木を作る
+	Node* Build(const std::vector<Node*>& list);
+	// 子から順に total を計算し直す
+	static void UpdateTree(Node* node);
+
+	template <typename Func>
+	void Walk(const Node* node, Func& func) const;
+public:
+	PieceTable();
+	explicit PieceTable(std::wstring original);
+	~PieceTable();
+
+	PieceTable(const PieceTable&) = delete;
+	PieceTable& operator=(const PieceTable&) = delete;
+
+	void Insert(std::size_t pos, const wchar_t* text, std::size_t length);
+	void Erase(std::size_t pos, std::size_t length);
+	// positions の各位置から length 文字を text に置き換える
+	// positions は昇順で、置き換える範囲は重なっていないこと。text は 1 回だけ追加して共有する
+	void ReplaceAll(const std::vector<std::size_t>& positions, std::size_t length, const wchar_t* text, std::size_t textLength);
+	std::size_t Length() const;
+	// O(log ピース数)
+	wchar_t CharAt(std::size_t pos) const;
+
+	// 先頭から順にピースの内容を func(const wchar_t* text, std::size_t length) に渡す
+	template <typename Func>
+	void ForEachPiece(Func func) const;
+	std::wstring ToString() const;
+};
+
+template <typename Func>
+void PieceTable::Walk(const Node* node, Func& func) const {
+	while (node) {
+		Walk(node->left, func);
+
+		auto& buffer = node->source == Source::Original ? original : added;
+		func(buffer.data() + node->start, node->length);
+
+		node = node->right;
+	}
+}
+
+template <typename Func>
+void PieceTable::ForEachPiece(Func func) const {
+	Walk(root, func);
+}
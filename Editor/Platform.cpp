@@ -0,0 +1,572 @@
+﻿#include "Platform.h"
+#include "Encoding.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <io.h>
+#else
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+FILE* OpenFileStream(const std::wstring& path, const wchar_t* mode) {
+	FILE* fp = nullptr;
+#ifdef _WIN32
+	if (_wfopen_s(&fp, path.c_str(), mode) != 0) {
+		return nullptr;
+	}
+#else
+	std::wstring wmode(mode);
+	fp = fopen(EncodeUtf8(path).c_str(), EncodeUtf8(wmode).c_str());
+#endif
+	return fp;
+}
+
+bool SyncFileStream(FILE* fp) {
+	if (fflush(fp) != 0) {
+		return false;
+	}
+#ifdef _WIN32
+	return _commit(_fileno(fp)) == 0;
+#else
+	return fsync(fileno(fp)) == 0;
+#endif
+}
+
+bool TruncateFileStream(FILE* fp, uint64_t size) {
+	if (fflush(fp) != 0) {
+		return false;
+	}
+#ifdef _WIN32
+	return _chsize_s(_fileno(fp), static_cast<__int64>(size)) == 0;
+#else
+	return ftruncate(fileno(fp), static_cast<off_t>(size)) == 0;
+#endif
+}
+
+bool MoveFileReplacing(const std::wstring& from, const std::wstring& to) {
+#ifdef _WIN32
+	return MoveFileExW(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(EncodeUtf8(from).c_str(), EncodeUtf8(to).c_str()) == 0;
+#endif
+}
+
+bool RemoveFileIfExists(const std::wstring& path) {
+	if (!FileExists(path)) {
+		return true;
+	}
+#ifdef _WIN32
+	return DeleteFileW(path.c_str()) != 0;
+#else
+	return remove(EncodeUtf8(path).c_str()) == 0;
+#endif
+}
+
+bool FileExists(const std::wstring& path) {
+#ifdef _WIN32
+	return GetFileAttributesW(path.c_str()) != INVALID_FILE_ATTRIBUTES;
+#else
+	struct stat st;
+	return stat(EncodeUtf8(path).c_str(), &st) == 0;
+#endif
+}
+
+std::wstring AbsolutePath(const std::wstring& path) {
+#ifdef _WIN32
+	auto length = GetFullPathNameW(path.c_str(), 0, nullptr, nullptr);
+	if (length == 0) {
+		return path;
+	}
+	std::vector<wchar_t> buffer(length);
+	length = GetFullPathNameW(path.c_str(), length, buffer.data(), nullptr);
+	return length == 0 ? path : std::wstring(buffer.data(), length);
+#else
+	char buffer[PATH_MAX];
+	if (!path.empty() && path[0] == '/') {
+		return path;
+	}
+	if (!getcwd(buffer, sizeof(buffer))) {
+		return path;
+	}
+	return DecodeUtf8(buffer) + L"/" + path;
+#endif
+}
+
+bool IsStreamPath(const std::wstring& path) {
+	if (path == L"-") {
+		return true;
+	}
+#ifdef _WIN32
+	// 名前付きパイプは \\.\pipe\ の下にある
+	static const wchar_t prefix[] = L"\\\\.\\pipe\\";
+	auto length = wcslen(prefix);
+	return path.size() > length && _wcsnicmp(path.c_str(), prefix, length) == 0;
+#else
+	struct stat st;
+	return stat(EncodeUtf8(path).c_str(), &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode) || S_ISSOCK(st.st_mode));
+#endif
+}
+
+bool IsStandardInputPipe() {
+#ifdef _WIN32
+	auto input = GetStdHandle(STD_INPUT_HANDLE);
+	return input != nullptr && input != INVALID_HANDLE_VALUE && GetFileType(input) == FILE_TYPE_PIPE;
+#else
+	struct stat st;
+	return fstat(STDIN_FILENO, &st) == 0 && S_ISFIFO(st.st_mode);
+#endif
+}
+
+bool ReadFileBytes(const std::wstring& path, std::string& out) {
+	auto fp = OpenFileStream(path, L"rb");
+	if (!fp) {
+		return false;
+	}
+
+	// 2GB を超えるファイルもあるので fseek でサイズを取らずに末尾まで読む
+	char buf[64 * 1024];
+	std::size_t read;
+	while ((read = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		out.append(buf, read);
+	}
+
+	bool ok = ferror(fp) == 0;
+	fclose(fp);
+
+	return ok;
+}
+
+bool SeekFileStream(FILE* fp, uint64_t offset, int origin) {
+#ifdef _WIN32
+	return _fseeki64(fp, static_cast<__int64>(offset), origin) == 0;
+#else
+	return fseeko(fp, static_cast<off_t>(offset), origin) == 0;
+#endif
+}
+
+uint64_t TellFileStream(FILE* fp) {
+#ifdef _WIN32
+	return static_cast<uint64_t>(_ftelli64(fp));
+#else
+	return static_cast<uint64_t>(ftello(fp));
+#endif
+}
+
+bool FileIdentity::operator==(const FileIdentity& other) const {
+	return device == other.device && index == other.index;
+}
+
+bool FileIdentity::operator!=(const FileIdentity& other) const {
+	return !(*this == other);
+}
+
+bool GetFileStreamIdentity(FILE* fp, FileIdentity* identity) {
+#ifdef _WIN32
+	BY_HANDLE_FILE_INFORMATION info;
+	auto handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(fp)));
+	if (handle == INVALID_HANDLE_VALUE || !GetFileInformationByHandle(handle, &info)) {
+		return false;
+	}
+	identity->device = info.dwVolumeSerialNumber;
+	identity->index = (static_cast<uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+#else
+	struct stat st;
+	if (fstat(fileno(fp), &st) != 0) {
+		return false;
+	}
+	identity->device = static_cast<uint64_t>(st.st_dev);
+	identity->index = static_cast<uint64_t>(st.st_ino);
+#endif
+	return true;
+}
+
+bool ReadFileRange(const std::wstring& path, uint64_t offset, uint64_t length, std::string& out, uint64_t* fileSize) {
+	auto fp = OpenFileStream(path, L"rb");
+	if (!fp) {
+		return false;
+	}
+
+	bool ok = SeekFileStream(fp, 0, SEEK_END);
+	auto size = ok ? TellFileStream(fp) : 0;
+	if (fileSize) {
+		*fileSize = size;
+	}
+
+	if (ok && offset < size) {
+		ok = SeekFileStream(fp, offset, SEEK_SET);
+
+		char buf[64 * 1024];
+		auto rest = std::min(length, size - offset);
+		while (ok && rest > 0) {
+			auto read = fread(buf, 1, static_cast<std::size_t>(std::min<uint64_t>(rest, sizeof(buf))), fp);
+			if (read == 0) {
+				break;
+			}
+			out.append(buf, read);
+			rest -= read;
+		}
+		ok = ok && ferror(fp) == 0;
+	}
+
+	fclose(fp);
+
+	return ok;
+}
+
+bool WriteFileAtomically(const std::wstring& path, const std::string& data) {
+	auto tmpPath = path + L".tmp";
+	auto fp = OpenFileStream(tmpPath, L"wb");
+	if (!fp) {
+		return false;
+	}
+
+	bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+	ok = SyncFileStream(fp) && ok;
+	fclose(fp);
+
+	if (!ok) {
+		RemoveFileIfExists(tmpPath);
+		return false;
+	}
+
+	return MoveFileReplacing(tmpPath, path);
+}
+
+MappedFile::MappedFile() :
+#ifdef _WIN32
+	file(INVALID_HANDLE_VALUE),
+	mapping(nullptr),
+#else
+	fd(-1),
+#endif
+	data(nullptr),
+	size(0) {
+}
+
+MappedFile::~MappedFile() {
+	Close();
+}
+
+bool MappedFile::Open(const std::wstring& path) {
+	Close();
+#ifdef _WIN32
+	file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	return file != INVALID_HANDLE_VALUE;
+#else
+	fd = open(EncodeUtf8(path).c_str(), O_RDONLY);
+	return fd != -1;
+#endif
+}
+
+bool MappedFile::IsOpen() const {
+#ifdef _WIN32
+	return file != INVALID_HANDLE_VALUE;
+#else
+	return fd != -1;
+#endif
+}
+
+bool MappedFile::Map() {
+	Unmap();
+	if (!IsOpen()) {
+		return false;
+	}
+
+#ifdef _WIN32
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || static_cast<uint64_t>(fileSize.QuadPart) > SIZE_MAX) {
+		return false;
+	}
+	// 0 バイトのファイルは割り当てられない
+	if (fileSize.QuadPart == 0) {
+		return true;
+	}
+
+	mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		return false;
+	}
+	data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!data) {
+		CloseHandle(mapping);
+		mapping = nullptr;
+		return false;
+	}
+	size = static_cast<std::size_t>(fileSize.QuadPart);
+#else
+	struct stat st;
+	if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) > SIZE_MAX) {
+		return false;
+	}
+	if (st.st_size == 0) {
+		return true;
+	}
+
+	auto address = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	if (address == MAP_FAILED) {
+		return false;
+	}
+	data = static_cast<const char*>(address);
+	size = static_cast<std::size_t>(st.st_size);
+#endif
+
+	return true;
+}
+
+void MappedFile::Unmap() {
+	if (data) {
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+		CloseHandle(mapping);
+		mapping = nullptr;
+#else
+		munmap(const_cast<char*>(data), size);
+#endif
+	}
+
+	data = nullptr;
+	size = 0;
+}
+
+void MappedFile::Close() {
+	Unmap();
+#ifdef _WIN32
+	if (file != INVALID_HANDLE_VALUE) {
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (fd != -1) {
+		close(fd);
+		fd = -1;
+	}
+#endif
+}
+
+const char* MappedFile::Data() const {
+	return data;
+}
+
+std::size_t MappedFile::Size() const {
+	return size;
+}
+
+ChildProcess::ChildProcess() :
+#ifdef _WIN32
+	process(nullptr),
+	input(nullptr),
+	output(nullptr) {
+#else
+	pid(-1),
+	fd(-1) {
+#endif
+}
+
+ChildProcess::~ChildProcess() {
+	if (IsStarted()) {
+		CloseInput();
+		Wait(0);
+	}
+	Close();
+}
+
+bool ChildProcess::Start(const std::wstring& command) {
+#ifdef _WIN32
+	// 子プロセスに渡す側だけを継承させる
+	SECURITY_ATTRIBUTES attributes = {};
+	attributes.nLength = sizeof(attributes);
+	attributes.bInheritHandle = TRUE;
+
+	HANDLE childInput, childOutput, parentInput, parentOutput;
+	if (!CreatePipe(&childInput, &parentInput, &attributes, 0)) {
+		return false;
+	}
+	if (!CreatePipe(&parentOutput, &childOutput, &attributes, 0)) {
+		CloseHandle(childInput);
+		CloseHandle(parentInput);
+		return false;
+	}
+	SetHandleInformation(parentInput, HANDLE_FLAG_INHERIT, 0);
+	SetHandleInformation(parentOutput, HANDLE_FLAG_INHERIT, 0);
+
+	STARTUPINFOW startup = {};
+	startup.cb = sizeof(startup);
+	startup.dwFlags = STARTF_USESTDHANDLES;
+	startup.hStdInput = childInput;
+	startup.hStdOutput = childOutput;
+	startup.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+
+	// CreateProcessW はコマンドラインを書き換えることがある
+	std::vector<wchar_t> commandLine(command.begin(), command.end());
+	commandLine.push_back(L'\0');
+	PROCESS_INFORMATION info = {};
+	bool ok = CreateProcessW(nullptr, commandLine.data(), nullptr, nullptr, TRUE, CREATE_NO_WINDOW, nullptr, nullptr, &startup, &info) != 0;
+	CloseHandle(childInput);
+	CloseHandle(childOutput);
+	if (!ok) {
+		CloseHandle(parentInput);
+		CloseHandle(parentOutput);
+		return false;
+	}
+
+	CloseHandle(info.hThread);
+	process = info.hProcess;
+	input = parentInput;
+	output = parentOutput;
+	return true;
+#else
+	// パイプではなくソケットにして、終了した子プロセスに書き込んでも SIGPIPE を受けないようにする
+	int sockets[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0) {
+		return false;
+	}
+	fcntl(sockets[0], F_SETFD, FD_CLOEXEC);
+
+	auto utf8Command = EncodeUtf8(command);
+	pid = fork();
+	if (pid == -1) {
+		close(sockets[0]);
+		close(sockets[1]);
+		return false;
+	}
+	if (pid == 0) {
+		dup2(sockets[1], 0);
+		dup2(sockets[1], 1);
+		close(sockets[0]);
+		close(sockets[1]);
+		execl("/bin/sh", "sh", "-c", utf8Command.c_str(), static_cast<char*>(nullptr));
+		_exit(127);
+	}
+
+	close(sockets[1]);
+	fd = sockets[0];
+	return true;
+#endif
+}
+
+bool ChildProcess::IsStarted() const {
+#ifdef _WIN32
+	return process != nullptr;
+#else
+	return pid != -1;
+#endif
+}
+
+bool ChildProcess::Write(const char* data, std::size_t size) {
+	while (size > 0) {
+#ifdef _WIN32
+		DWORD written;
+		auto chunk = static_cast<DWORD>(std::min<std::size_t>(size, 64 * 1024));
+		if (!input || !WriteFile(input, data, chunk, &written, nullptr)) {
+			return false;
+		}
+#else
+		auto written = send(fd, data, size, MSG_NOSIGNAL);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+#endif
+		data += written;
+		size -= static_cast<std::size_t>(written);
+	}
+
+	return true;
+}
+
+std::size_t ChildProcess::Read(char* buffer, std::size_t size) {
+#ifdef _WIN32
+	DWORD read;
+	// 子プロセスが終了すると ERROR_BROKEN_PIPE で失敗する
+	if (!ReadFile(output, buffer, static_cast<DWORD>(std::min<std::size_t>(size, 64 * 1024)), &read, nullptr)) {
+		return 0;
+	}
+	return read;
+#else
+	for (;;) {
+		auto read = recv(fd, buffer, size, 0);
+		if (read < 0 && errno == EINTR) {
+			continue;
+		}
+		return read < 0 ? 0 : static_cast<std::size_t>(read);
+	}
+#endif
+}
+
+void ChildProcess::CloseInput() {
+#ifdef _WIN32
+	if (input) {
+		CloseHandle(input);
+		input = nullptr;
+	}
+#else
+	if (fd != -1) {
+		shutdown(fd, SHUT_WR);
+	}
+#endif
+}
+
+void ChildProcess::Wait(unsigned int timeoutMsec) {
+	if (!IsStarted()) {
+		return;
+	}
+
+#ifdef _WIN32
+	if (WaitForSingleObject(process, timeoutMsec) != WAIT_OBJECT_0) {
+		TerminateProcess(process, 1);
+		WaitForSingleObject(process, INFINITE);
+	}
+#else
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMsec);
+	while (waitpid(pid, nullptr, WNOHANG) == 0) {
+		if (std::chrono::steady_clock::now() >= deadline) {
+			kill(pid, SIGKILL);
+			waitpid(pid, nullptr, 0);
+			break;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	pid = -1;
+
+	// 子プロセスが起動したプロセスが出力を開いたままにしていても、読んでいるスレッドが戻るようにする
+	if (fd != -1) {
+		shutdown(fd, SHUT_RDWR);
+	}
+#endif
+}
+
+void ChildProcess::Close() {
+#ifdef _WIN32
+	for (auto handle : { &process, &input, &output }) {
+		if (*handle) {
+			CloseHandle(*handle);
+			*handle = nullptr;
+		}
+	}
+#else
+	pid = -1;
+	if (fd != -1) {
+		close(fd);
+		fd = -1;
+	}
+#endif
+}
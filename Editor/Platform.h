@@ -0,0 +1,113 @@
+﻿#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+
+// OS ごとに異なるファイル操作をまとめたもの
+// パスは Windows に合わせて wchar_t で受け取り、それ以外の環境では UTF-8 に変換して扱う
+
+FILE* OpenFileStream(const std::wstring& path, const wchar_t* mode);
+// バッファをフラッシュしてディスクへの書き込みを完了させる
+bool SyncFileStream(FILE* fp);
+bool TruncateFileStream(FILE* fp, uint64_t size);
+// 2GB を超えるファイルでも使えるシークと位置の取得
+bool SeekFileStream(FILE* fp, uint64_t offset, int origin);
+uint64_t TellFileStream(FILE* fp);
+
+// 同じパスのファイルが別のファイルに置き換えられたかどうかを調べるための識別子
+// Windows ではボリュームのシリアル番号とファイル インデックス、それ以外ではデバイスと i ノード番号
+struct FileIdentity {
+	uint64_t device;
+	uint64_t index;
+
+	bool operator==(const FileIdentity& other) const;
+	bool operator!=(const FileIdentity& other) const;
+};
+bool GetFileStreamIdentity(FILE* fp, FileIdentity* identity);
+// to が存在する場合は置き換える
+bool MoveFileReplacing(const std::wstring& from, const std::wstring& to);
+bool RemoveFileIfExists(const std::wstring& path);
+bool FileExists(const std::wstring& path);
+// 今の作業ディレクトリを基準にした絶対パス。求められない場合は path をそのまま返す
+std::wstring AbsolutePath(const std::wstring& path);
+// 標準入力を表す "-" や、パイプなどメモリに割り当てられない入力かどうか
+bool IsStreamPath(const std::wstring& path);
+// 標準入力がパイプにつながっているかどうか
+bool IsStandardInputPipe();
+
+bool ReadFileBytes(const std::wstring& path, std::string& out);
+// offset から最大 length バイトを out に追加する。*fileSize にはその時点のファイルサイズを返す
+bool ReadFileRange(const std::wstring& path, uint64_t offset, uint64_t length, std::string& out, uint64_t* fileSize);
+// 一時ファイルに書き込んでから置き換えるので途中で失敗しても元のファイルは壊れない
+bool WriteFileAtomically(const std::wstring& path, const std::string& data);
+
+// 読み取り専用でメモリに割り当てたファイル
+//
+// 開いている間も他のプログラムによる書き込み、置き換え、削除は妨げない。
+// 置き換えや削除をされても開いたときの内容を読めるが、その場で書き換えられた場合は新しい内容が見える。
+// 割り当てている間はファイルを切り詰められないことがあるので、内容を読む間だけ Map する。
+class MappedFile {
+private:
+#ifdef _WIN32
+	void* file;
+	void* mapping;
+#else
+	int fd;
+#endif
+	const char* data;
+	std::size_t size;
+public:
+	MappedFile();
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Open(const std::wstring& path);
+	bool IsOpen() const;
+	// ファイル全体を割り当てる。空のファイルの場合は Data() が nullptr になる
+	bool Map();
+	void Unmap();
+	void Close();
+
+	const char* Data() const;
+	std::size_t Size() const;
+};
+
+// 標準入力と標準出力をパイプにつないだ子プロセス
+//
+// 標準エラー出力はこのプロセスのものをそのまま使う。
+// Read と Write は別々のスレッドから同時に呼んでもよい。
+class ChildProcess {
+private:
+#ifdef _WIN32
+	void* process;
+	void* input;
+	void* output;
+#else
+	int pid;
+	// 子プロセスの標準入力と標準出力の両方につないだソケット
+	int fd;
+#endif
+public:
+	ChildProcess();
+	~ChildProcess();
+
+	ChildProcess(const ChildProcess&) = delete;
+	ChildProcess& operator=(const ChildProcess&) = delete;
+
+	// Windows では command を CreateProcess のコマンドラインとして、それ以外では /bin/sh -c で実行する
+	bool Start(const std::wstring& command);
+	bool IsStarted() const;
+	// すべて書き込むまで戻らない。子プロセスが終了している場合は false を返す
+	bool Write(const char* data, std::size_t size);
+	// 少なくとも 1 バイト読めるまで待つ。子プロセスが標準出力を閉じた場合は 0 を返す
+	std::size_t Read(char* buffer, std::size_t size);
+	// 子プロセスの標準入力を閉じる
+	void CloseInput();
+	// 終了するまで最大 timeoutMsec 待ち、終了しない場合は強制終了する
+	void Wait(unsigned int timeoutMsec);
+	// Wait した後に呼ぶ
+	void Close();
+};
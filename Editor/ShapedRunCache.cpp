@@ -0,0 +1,243 @@
+﻿#include "stdafx.h"
+#include "ShapedRunCache.h"
+#include "MemoryUsage.h"
+#include "Utils.h"
+
+namespace {
+	const wchar_t* const LOCALE_NAME = L"ja-JP";
+
+	// 文字列を IDWriteTextAnalyzer に渡し、文字体系ごとの区切りを受け取る
+	class ScriptAnalysis : public IDWriteTextAnalysisSource, public IDWriteTextAnalysisSink {
+	private:
+		const wchar_t* text;
+		UINT32 length;
+	public:
+		struct Segment {
+			UINT32 position;
+			UINT32 length;
+			DWRITE_SCRIPT_ANALYSIS analysis;
+		};
+		std::vector<Segment> segments;
+
+		ScriptAnalysis(const wchar_t* text, UINT32 length) : text(text), length(length) {}
+
+		// スタックに置いて使うので参照カウントは数えない
+		HRESULT STDMETHODCALLTYPE QueryInterface(REFIID iid, void** object) override {
+			if (iid == __uuidof(IUnknown) || iid == __uuidof(IDWriteTextAnalysisSource)) {
+				*object = static_cast<IDWriteTextAnalysisSource*>(this);
+				return S_OK;
+			}
+			if (iid == __uuidof(IDWriteTextAnalysisSink)) {
+				*object = static_cast<IDWriteTextAnalysisSink*>(this);
+				return S_OK;
+			}
+			*object = nullptr;
+			return E_NOINTERFACE;
+		}
+		ULONG STDMETHODCALLTYPE AddRef() override { return 1; }
+		ULONG STDMETHODCALLTYPE Release() override { return 1; }
+
+		HRESULT STDMETHODCALLTYPE GetTextAtPosition(UINT32 position, const WCHAR** textString, UINT32* textLength) override {
+			*textString = position < length ? text + position : nullptr;
+			*textLength = position < length ? length - position : 0;
+			return S_OK;
+		}
+		HRESULT STDMETHODCALLTYPE GetTextBeforePosition(UINT32 position, const WCHAR** textString, UINT32* textLength) override {
+			*textString = position > 0 && position <= length ? text : nullptr;
+			*textLength = position > 0 && position <= length ? position : 0;
+			return S_OK;
+		}
+		DWRITE_READING_DIRECTION STDMETHODCALLTYPE GetParagraphReadingDirection() override {
+			return DWRITE_READING_DIRECTION_LEFT_TO_RIGHT;
+		}
+		HRESULT STDMETHODCALLTYPE GetLocaleName(UINT32 position, UINT32* textLength, const WCHAR** localeName) override {
+			*textLength = length - position;
+			*localeName = LOCALE_NAME;
+			return S_OK;
+		}
+		HRESULT STDMETHODCALLTYPE GetNumberSubstitution(UINT32 position, UINT32* textLength, IDWriteNumberSubstitution** substitution) override {
+			*textLength = length - position;
+			*substitution = nullptr;
+			return S_OK;
+		}
+
+		HRESULT STDMETHODCALLTYPE SetScriptAnalysis(UINT32 position, UINT32 textLength, const DWRITE_SCRIPT_ANALYSIS* analysis) override {
+			segments.push_back({ position, textLength, *analysis });
+			return S_OK;
+		}
+		HRESULT STDMETHODCALLTYPE SetLineBreakpoints(UINT32, UINT32, const DWRITE_LINE_BREAKPOINT*) override {
+			return S_OK;
+		}
+		HRESULT STDMETHODCALLTYPE SetBidiLevel(UINT32, UINT32, UINT8, UINT8) override {
+			return S_OK;
+		}
+		HRESULT STDMETHODCALLTYPE SetNumberSubstitution(UINT32, UINT32, IDWriteNumberSubstitution*) override {
+			return S_OK;
+		}
+	};
+
+	// 双方向の解析はしないので、右から左に書く文字は整形しない
+	bool IsRightToLeft(wchar_t character) {
+		return (character >= 0x0590 && character <= 0x08FF)
+			|| (character >= 0xFB1D && character <= 0xFDFF)
+			|| (character >= 0xFE70 && character <= 0xFEFF);
+	}
+}
+
+ShapedRunCache::ShapedRunCache(IDWriteTextAnalyzer* analyzer, IDWriteFontFace* fontFace, float fontSize, uint64_t fontKey) :
+	analyzer(analyzer),
+	fontFace(fontFace),
+	fontSize(fontSize),
+	fontKey(fontKey),
+	hits(0),
+	misses(0) {
+	analyzer->AddRef();
+	fontFace->AddRef();
+}
+
+ShapedRunCache::~ShapedRunCache() {
+	analyzer->Release();
+	fontFace->Release();
+}
+
+const ShapedRun& ShapedRunCache::Shape(const wchar_t* text, std::size_t length) {
+	auto key = Fnv1a(fontKey, text, length);
+
+	auto itr = current.find(key);
+	if (itr != current.end() && itr->second.text.compare(0, std::wstring::npos, text, length) == 0) {
+		hits++;
+		return itr->second;
+	}
+
+	// 一杯になったら古い世代を捨て、今の世代を古い世代にする
+	if (current.size() >= GENERATION_RUNS) {
+		previous.clear();
+		previous.swap(current);
+	}
+
+	// 古い世代にあれば今の世代に移す
+	auto old = previous.find(key);
+	if (old != previous.end() && old->second.text.compare(0, std::wstring::npos, text, length) == 0) {
+		hits++;
+		auto& run = current[key];
+		run = std::move(old->second);
+		previous.erase(old);
+		return run;
+	}
+
+	// ハッシュが衝突した場合は上書きする
+	misses++;
+	auto& run = current[key];
+	ShapeRun(text, length, &run);
+	return run;
+}
+
+void ShapedRunCache::ShapeRun(const wchar_t* text, std::size_t length, ShapedRun* run) {
+	run->text.assign(text, length);
+	run->glyphIndices.clear();
+	run->glyphAdvances.clear();
+	run->glyphOffsets.clear();
+	run->clusterMap.assign(length, 0);
+	run->fallback = true;
+
+	if (length == 0 || std::any_of(text, text + length, IsRightToLeft)) {
+		return;
+	}
+
+	auto textLength = static_cast<UINT32>(length);
+	ScriptAnalysis analysis(text, textLength);
+	if (FAILED(analyzer->AnalyzeScript(&analysis, 0, textLength, &analysis))) {
+		return;
+	}
+
+	std::vector<DWRITE_SHAPING_TEXT_PROPERTIES> textProps(length);
+	std::vector<DWRITE_SHAPING_GLYPH_PROPERTIES> glyphProps;
+	std::vector<UINT16> glyphIndices;
+
+	// 文字体系ごとに整形してつなげる
+	for (auto& segment : analysis.segments) {
+		auto segmentText = text + segment.position;
+		auto clusterMap = &run->clusterMap[segment.position];
+		auto textProp = &textProps[segment.position];
+
+		// 字形の数は文字数より多くなることがあるので、足りなければ増やしてやり直す
+		UINT32 maxGlyphs = segment.length * 3 / 2 + 16;
+		UINT32 glyphCount = 0;
+		HRESULT hr;
+		do {
+			glyphIndices.resize(maxGlyphs);
+			glyphProps.resize(maxGlyphs);
+			hr = analyzer->GetGlyphs(segmentText, segment.length, fontFace, FALSE, FALSE, &segment.analysis, LOCALE_NAME,
+				nullptr, nullptr, nullptr, 0, maxGlyphs, clusterMap, textProp, glyphIndices.data(), glyphProps.data(), &glyphCount);
+			maxGlyphs *= 2;
+		} while (hr == E_NOT_SUFFICIENT_BUFFER);
+
+		if (FAILED(hr)) {
+			return;
+		}
+
+		// フォントに字形がない文字は DirectWrite の代替フォントに任せる
+		if (std::find(glyphIndices.begin(), glyphIndices.begin() + glyphCount, 0) != glyphIndices.begin() + glyphCount) {
+			return;
+		}
+
+		std::vector<float> advances(glyphCount);
+		std::vector<DWRITE_GLYPH_OFFSET> offsets(glyphCount);
+		hr = analyzer->GetGlyphPlacements(segmentText, clusterMap, textProp, segment.length,
+			glyphIndices.data(), glyphProps.data(), glyphCount, fontFace, fontSize, FALSE, FALSE, &segment.analysis, LOCALE_NAME,
+			nullptr, nullptr, 0, advances.data(), offsets.data());
+
+		if (FAILED(hr)) {
+			return;
+		}
+
+		// 文字から字形への対応を文字列全体での位置にする
+		auto firstGlyph = static_cast<UINT16>(run->glyphIndices.size());
+		for (UINT32 i = 0; i < segment.length; i++) {
+			clusterMap[i] += firstGlyph;
+		}
+
+		run->glyphIndices.insert(run->glyphIndices.end(), glyphIndices.begin(), glyphIndices.begin() + glyphCount);
+		run->glyphAdvances.insert(run->glyphAdvances.end(), advances.begin(), advances.end());
+		run->glyphOffsets.insert(run->glyphOffsets.end(), offsets.begin(), offsets.end());
+	}
+
+	run->fallback = run->glyphIndices.empty();
+}
+
+IDWriteFontFace* ShapedRunCache::FontFace() const {
+	return fontFace;
+}
+
+float ShapedRunCache::FontSize() const {
+	return fontSize;
+}
+
+uint64_t ShapedRunCache::Hits() const {
+	return hits;
+}
+
+uint64_t ShapedRunCache::Misses() const {
+	return misses;
+}
+
+double ShapedRunCache::HitRate() const {
+	auto lookups = hits + misses;
+	return lookups > 0 ? static_cast<double>(hits) / lookups : 0;
+}
+
+std::size_t ShapedRunCache::MemoryUsage() const {
+	std::size_t bytes = 0;
+	for (auto table : { &current, &previous }) {
+		// 表の要素ごとの管理領域はおおよその大きさ
+		bytes += table->bucket_count() * sizeof(void*);
+		for (auto& entry : *table) {
+			auto& run = entry.second;
+			bytes += sizeof(entry) + sizeof(void*) * 2;
+			bytes += BytesOf(run.text) + BytesOf(run.glyphIndices) + BytesOf(run.glyphAdvances)
+				+ BytesOf(run.glyphOffsets) + BytesOf(run.clusterMap);
+		}
+	}
+
+	return bytes;
+}
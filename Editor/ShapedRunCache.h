@@ -0,0 +1,56 @@
+﻿#pragma once
+
+#include "stdafx.h"
+#include <unordered_map>
+
+// 整形済みの字形の並び
+struct ShapedRun {
+	std::wstring text; // ハッシュが衝突していないかを確認するための元の文字列
+	std::vector<UINT16> glyphIndices;
+	std::vector<float> glyphAdvances;
+	std::vector<DWRITE_GLYPH_OFFSET> glyphOffsets;
+	std::vector<UINT16> clusterMap; // 文字ごとの最初の字形の位置
+	// フォントに字形がない文字や右から左に書く文字を含むため、1 文字ずつ DrawText で描画する
+	bool fallback;
+};
+
+// 文字列を整形した結果のキャッシュ
+//
+// 合字やカーニング、複雑な文字体系の整形は IDWriteTextAnalyzer で文字列ごとに行う。
+// 同じ文字列 (ログの接頭辞やキーワードなど) は行や文書が違っても結果を共有し、
+// キーは文字列とフォントのハッシュ。古い世代と新しい世代の 2 つの表を持ち、
+// 新しい世代が一杯になったら古い世代を捨てることで最近使われていないものから捨てる。
+class ShapedRunCache {
+private:
+	static constexpr std::size_t GENERATION_RUNS = 8192;
+
+	IDWriteTextAnalyzer* analyzer;
+	IDWriteFontFace* fontFace;
+	float fontSize;
+	uint64_t fontKey;
+	std::unordered_map<uint64_t, ShapedRun> current;
+	std::unordered_map<uint64_t, ShapedRun> previous;
+	uint64_t hits;
+	uint64_t misses;
+
+	void ShapeRun(const wchar_t* text, std::size_t length, ShapedRun* run);
+public:
+	// fontKey はフォント名や大きさ、太さなどから求めたハッシュ
+	ShapedRunCache(IDWriteTextAnalyzer* analyzer, IDWriteFontFace* fontFace, float fontSize, uint64_t fontKey);
+	~ShapedRunCache();
+
+	ShapedRunCache(const ShapedRunCache&) = delete;
+	ShapedRunCache& operator=(const ShapedRunCache&) = delete;
+
+	// 返した参照は次に Shape を呼ぶまで有効
+	const ShapedRun& Shape(const wchar_t* text, std::size_t length);
+
+	IDWriteFontFace* FontFace() const;
+	float FontSize() const;
+	uint64_t Hits() const;
+	uint64_t Misses() const;
+	// キャッシュにあった割合 (まだ一度も探していない場合は 0)
+	double HitRate() const;
+	// 確保しているメモリの大きさ (バイト)
+	std::size_t MemoryUsage() const;
+};
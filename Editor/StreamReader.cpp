@@ -0,0 +1,241 @@
+﻿#include "StreamReader.h"
+#include "Platform.h"
+
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+
+StreamReader::StreamReader() :
+	finished(false),
+	stopRequested(false),
+	running(false),
+	bytesRead(0) {
+#ifdef _WIN32
+	input = nullptr;
+#else
+	input = -1;
+	stopPipe[0] = stopPipe[1] = -1;
+#endif
+}
+
+StreamReader::~StreamReader() {
+	Stop();
+}
+
+bool StreamReader::Start(const std::wstring& path, std::function<void()> onReceived) {
+	Stop();
+
+#ifdef _WIN32
+	if (path == L"-") {
+		// 標準入力のハンドルは閉じないように複製して使う
+		auto process = GetCurrentProcess();
+		auto standardInput = GetStdHandle(STD_INPUT_HANDLE);
+		if (standardInput == nullptr || standardInput == INVALID_HANDLE_VALUE
+			|| !DuplicateHandle(process, standardInput, process, &input, 0, FALSE, DUPLICATE_SAME_ACCESS)) {
+			input = nullptr;
+			return false;
+		}
+	} else {
+		// 名前付きパイプ (\\.\pipe\...) も通常のファイルと同じように開ける
+		auto file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		input = file;
+	}
+#else
+	if (path == L"-") {
+		// 標準入力は閉じないように複製して使う
+		input = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+	} else {
+		// 書き込む側がまだいない FIFO でも待たずに開き、読むときは poll で待つ
+		input = open(EncodeUtf8(path).c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+		if (input >= 0) {
+			fcntl(input, F_SETFL, fcntl(input, F_GETFL) & ~O_NONBLOCK);
+		}
+	}
+	if (input < 0) {
+		input = -1;
+		return false;
+	}
+	if (pipe(stopPipe) != 0) {
+		stopPipe[0] = stopPipe[1] = -1;
+		CloseInput();
+		return false;
+	}
+#endif
+
+	pending.clear();
+	finished = false;
+	stopRequested = false;
+	bytesRead = 0;
+	decoder.Reset();
+	running = true;
+	thread = std::thread(&StreamReader::Run, this, std::move(onReceived));
+
+	return true;
+}
+
+void StreamReader::Stop() {
+	if (!thread.joinable()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopRequested = true;
+	}
+	taken.notify_all();
+
+#ifdef _WIN32
+	// パイプの ReadFile は書き込む側が何か書くまで戻らないので、終わるまで取り消し続ける
+	while (running) {
+		CancelSynchronousIo(thread.native_handle());
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	thread.join();
+#else
+	char c = 0;
+	(void)write(stopPipe[1], &c, 1);
+	thread.join();
+	close(stopPipe[0]);
+	close(stopPipe[1]);
+	stopPipe[0] = stopPipe[1] = -1;
+#endif
+
+	CloseInput();
+	std::wstring().swap(pending);
+}
+
+void StreamReader::CloseInput() {
+#ifdef _WIN32
+	if (input) {
+		CloseHandle(input);
+		input = nullptr;
+	}
+#else
+	if (input >= 0) {
+		close(input);
+		input = -1;
+	}
+#endif
+}
+
+bool StreamReader::IsReading() const {
+	return thread.joinable();
+}
+
+bool StreamReader::Take(std::wstring& out) {
+	bool result;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		out.clear();
+		out.swap(pending);
+		result = finished;
+	}
+	taken.notify_all();
+
+	return result;
+}
+
+uint64_t StreamReader::BytesRead() const {
+	return bytesRead;
+}
+
+bool StreamReader::Push(std::wstring& decoded, bool last, const std::function<void()>& onReceived) {
+	bool notify;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		taken.wait(lock, [this]() { return stopRequested || pending.size() < MAX_PENDING_CHARS; });
+		if (stopRequested) {
+			return false;
+		}
+
+		// 前に送った分がまだ取り出されていない場合はそのメッセージで一緒に取り出される
+		notify = pending.empty();
+		if (pending.empty()) {
+			pending.swap(decoded);
+		} else {
+			pending.append(decoded);
+		}
+		decoded.clear();
+		if (last) {
+			finished = true;
+		}
+	}
+
+	if (notify) {
+		onReceived();
+	}
+	return true;
+}
+
+void StreamReader::Run(std::function<void()> onReceived) {
+	std::vector<char> buffer(CHUNK_BYTES);
+	std::wstring decoded;
+
+	for (;;) {
+		std::size_t size = 0;
+		bool end = false;
+#ifdef _WIN32
+		DWORD read = 0;
+		if (stopRequested) {
+			break;
+		}
+		if (!ReadFile(input, buffer.data(), static_cast<DWORD>(buffer.size()), &read, nullptr)) {
+			// 書き込む側がパイプを閉じた場合は ERROR_BROKEN_PIPE になる
+			// Stop で取り消された場合は Push で止まる
+			end = true;
+		} else if (read == 0) {
+			end = true;
+		}
+		size = read;
+#else
+		pollfd fds[] = { { input, POLLIN, 0 }, { stopPipe[0], POLLIN, 0 } };
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			end = true;
+		} else if (fds[1].revents != 0) {
+			break;
+		} else {
+			auto read = ::read(input, buffer.data(), buffer.size());
+			if (read < 0 && (errno == EINTR || errno == EAGAIN)) {
+				continue;
+			}
+			if (read <= 0) {
+				end = true;
+			} else {
+				size = static_cast<std::size_t>(read);
+			}
+		}
+#endif
+
+		bytesRead += size;
+		decoder.Decode(buffer.data(), size, decoded);
+		if (end) {
+			decoder.Finish(decoded);
+		}
+		// \r だけを読んだ場合などは送るものがない
+		if (decoded.empty() && !end) {
+			continue;
+		}
+		if (!Push(decoded, end, onReceived) || end) {
+			break;
+		}
+	}
+
+	running = false;
+}
@@ -0,0 +1,65 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "Encoding.h"
+
+// パイプや標準入力など、メモリに割り当てられない入力を読み込む
+//
+// 読み込みのスレッドで CHUNK_BYTES ずつ読み、チャンクの境界で切れた UTF-8 の文字や \r\n を続きからデコードする。
+// デコードした文字列は UI スレッドが Take で取り出すまで溜めておき、溜まっていなかったときだけ onReceived を呼ぶ。
+// 溜まっている文字列が MAX_PENDING_CHARS を超えたら取り出されるまで読むのを待つので、
+// UI スレッドが追いつかなくても、文書の内容のほかに使うメモリはチャンク数個分に収まる。
+class StreamReader {
+private:
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable taken;
+	// まだ取り出されていない文字列
+	std::wstring pending;
+	bool finished;
+	std::atomic<bool> stopRequested;
+	// 読み込みのスレッドが終わるまで true
+	std::atomic<bool> running;
+	std::atomic<uint64_t> bytesRead;
+#ifdef _WIN32
+	void* input;
+#else
+	int input;
+	int stopPipe[2];
+#endif
+	TextStreamDecoder decoder;
+
+	void Run(std::function<void()> onReceived);
+	// 読み込みのスレッドで呼ぶ。止めるように言われた場合は false を返す
+	bool Push(std::wstring& decoded, bool last, const std::function<void()>& onReceived);
+	void CloseInput();
+public:
+	static constexpr std::size_t CHUNK_BYTES = 1024 * 1024;
+	static constexpr std::size_t MAX_PENDING_CHARS = 4 * CHUNK_BYTES;
+
+	StreamReader();
+	~StreamReader();
+
+	StreamReader(const StreamReader&) = delete;
+	StreamReader& operator=(const StreamReader&) = delete;
+
+	// path が "-" の場合は標準入力から読む。開けなかった場合は false を返す
+	// onReceived は読み込みのスレッドで呼ばれるので、UI の更新はメッセージを送るなどして UI スレッドで行うこと
+	bool Start(const std::wstring& path, std::function<void()> onReceived);
+	// 読み込みの途中でも止める
+	void Stop();
+	bool IsReading() const;
+	// 届いた文字列を out に移す (out の元の内容は捨て、その領域を次の受け取りに使い回す)
+	// 最後まで読み終わり、すべて取り出した場合は true を返す
+	bool Take(std::wstring& out);
+	// 今までに読んだバイト数
+	uint64_t BytesRead() const;
+};
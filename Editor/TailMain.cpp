@@ -0,0 +1,322 @@
+﻿// 別のプロセスがファイルに書き込んでいる間に FileTail が追記と書き換えを正しく見分けるかを確かめるコマンド
+//
+//   editor-tail-check [-n 回数] [-s シード] <ファイル>
+//
+// 自分自身を書き込む側として起動し (--writer <ファイル>)、標準入力で指示した書き込みを 1 回ずつ行わせる。
+// 書き込みは次の 3 種類で、追記する内容は UTF-8 の文字や \r\n の途中で区切る。
+//   追記 (ファイルを開いて末尾に書き込む)
+//   置き換え (先頭を同じにした別のファイルを書いて名前を変える)
+//   書き換え (先頭の HEAD_CHECK_BYTES の中の 1 バイトをその場で書き換え、末尾にも追記する)
+// 書き込むたびに FileWatcher の通知を待ってから Poll し、読み込んだ内容がファイル全体をデコードし直した結果と
+// 一致するかを確かめる。一致しなかった場合や、通知が届かなかった場合は 1 を返す。
+// 見本を取っていない位置だけの書き換えは見分けられないので、ここでは試さない。
+// エディタ本体とは別に、Direct2D や Win32 を使わないファイルだけでビルドする。
+//   g++ -std=c++14 -O2 -pthread TailMain.cpp FileWatcher.cpp Encoding.cpp Platform.cpp -o editor-tail-check
+//   cl /std:c++14 /O2 /EHsc TailMain.cpp FileWatcher.cpp Encoding.cpp Platform.cpp /Fe:editor-tail-check.exe
+#include "FileWatcher.h"
+#include "Encoding.h"
+#include "Platform.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <random>
+
+namespace {
+	void PrintUsage() {
+		fprintf(stderr, "usage: editor-tail-check [-n steps] [-s seed] <file>\n");
+	}
+
+	std::string ToHex(const std::string& bytes) {
+		static const char digits[] = "0123456789abcdef";
+		std::string hex;
+		for (unsigned char c : bytes) {
+			hex.push_back(digits[c >> 4]);
+			hex.push_back(digits[c & 0xF]);
+		}
+		return hex;
+	}
+
+	std::string FromHex(const std::string& hex) {
+		std::string bytes;
+		for (std::size_t i = 0; i + 1 < hex.size(); i += 2) {
+			bytes.push_back(static_cast<char>(std::strtoul(hex.substr(i, 2).c_str(), nullptr, 16)));
+		}
+		return bytes;
+	}
+
+	// 書き込む側。1 行に 1 つの指示を読んで実行し、ファイルを閉じてから ok を返す
+	//   a <内容>          末尾に追記する
+	//   r <内容>          別のファイルに書いてから名前を変えて置き換える
+	//   w <位置> <内容>   位置の 1 バイトをその場で書き換え、内容を末尾に追記する
+	int RunWriter(const std::wstring& path) {
+		std::string line;
+		while (std::getline(std::cin, line)) {
+			auto op = line.empty() ? '\0' : line[0];
+			auto rest = line.size() > 2 ? line.substr(2) : std::string();
+			bool ok = false;
+
+			if (op == 'a') {
+				if (auto fp = OpenFileStream(path, L"ab")) {
+					auto bytes = FromHex(rest);
+					ok = fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+					ok = fclose(fp) == 0 && ok;
+				}
+			} else if (op == 'r') {
+				ok = WriteFileAtomically(path, FromHex(rest));
+			} else if (op == 'w') {
+				auto space = rest.find(' ');
+				auto offset = std::strtoull(rest.substr(0, space).c_str(), nullptr, 10);
+				auto bytes = FromHex(space == std::string::npos ? std::string() : rest.substr(space + 1));
+				if (auto fp = OpenFileStream(path, L"r+b")) {
+					int c = 0;
+					ok = SeekFileStream(fp, offset, SEEK_SET) && (c = fgetc(fp)) != EOF
+						&& SeekFileStream(fp, offset, SEEK_SET) && fputc(c == 'x' ? 'y' : 'x', fp) != EOF
+						&& SeekFileStream(fp, 0, SEEK_END) && fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+					ok = fclose(fp) == 0 && ok;
+				}
+			}
+
+			printf(ok ? "ok\n" : "error\n");
+			fflush(stdout);
+		}
+		return 0;
+	}
+
+	// 追記する内容の材料。UTF-8 の 2 から 4 バイトの文字と、\r\n を含む改行
+	const char* const PIECES[] = {
+		"abc", "0123456789", " ", "\n", "\r\n", "\r", "\xC3\xA9", "\xE3\x81\x82", "\xE6\xBC\xA2\xE5\xAD\x97", "\xF0\x9F\x98\x80",
+	};
+
+	class Checker {
+	private:
+		std::wstring path;
+		ChildProcess writer;
+		std::string received;
+		std::mt19937 random;
+		// 書き込む予定の内容。ここから区切りを気にせずに切り出して追記する
+		std::string stream;
+
+		std::mutex mutex;
+		std::condition_variable notified;
+		std::size_t notifications;
+	public:
+		Checker(const std::wstring& path, unsigned int seed) : path(path), random(seed), notifications(0) {}
+
+		bool Start(const std::wstring& program) {
+			return writer.Start(L"\"" + program + L"\" --writer \"" + path + L"\"");
+		}
+
+		void Stop() {
+			writer.CloseInput();
+			writer.Wait(5000);
+			writer.Close();
+		}
+
+		void Notify() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				notifications++;
+			}
+			notified.notify_all();
+		}
+
+		std::size_t Notifications() {
+			std::lock_guard<std::mutex> lock(mutex);
+			return notifications;
+		}
+
+		// 前の書き込みの通知が遅れて届いた場合もあるので、数が before より増えるまで待つ
+		bool WaitNotification(std::size_t before) {
+			std::unique_lock<std::mutex> lock(mutex);
+			return notified.wait_for(lock, std::chrono::seconds(5), [&]() { return notifications > before; });
+		}
+
+		bool Send(const std::string& command) {
+			auto line = command + "\n";
+			if (!writer.Write(line.data(), line.size())) {
+				return false;
+			}
+			char buffer[256];
+			std::size_t newline;
+			while ((newline = received.find('\n')) == std::string::npos) {
+				auto read = writer.Read(buffer, sizeof(buffer));
+				if (read == 0) {
+					return false;
+				}
+				received.append(buffer, read);
+			}
+			auto reply = received.substr(0, newline);
+			received.erase(0, newline + 1);
+			return reply == "ok";
+		}
+
+		// 1 から 16 バイトを切り出す。材料の区切りとは関係なく切るので、文字や \r\n の途中で終わることがある
+		std::string NextChunk() {
+			while (stream.size() < 64) {
+				stream += PIECES[random() % (sizeof(PIECES) / sizeof(PIECES[0]))];
+			}
+			auto size = 1 + random() % 16;
+			auto chunk = stream.substr(0, size);
+			stream.erase(0, size);
+			return chunk;
+		}
+
+		std::size_t Random(std::size_t limit) {
+			return random() % limit;
+		}
+	};
+
+	std::wstring DecodeAll(const std::string& bytes) {
+		// FileTail と同じく、最後の文字が途中で切れている場合は出力しない
+		TextStreamDecoder decoder;
+		std::wstring text;
+		decoder.Decode(bytes.data(), bytes.size(), text);
+		return text;
+	}
+
+	const char* ChangeName(FileTail::Change change) {
+		switch (change) {
+		case FileTail::Change::Appended: return "appended";
+		case FileTail::Change::Replaced: return "replaced";
+		default: return "none";
+		}
+	}
+
+	int Run(const std::wstring& program, const std::vector<std::wstring>& args) {
+		if (args.size() == 2 && args[0] == L"--writer") {
+			return RunWriter(args[1]);
+		}
+
+		std::size_t steps = 1000;
+		unsigned int seed = 1;
+		std::size_t i = 0;
+		for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; i++) {
+			if (args[i] == L"-n" && i + 1 < args.size()) {
+				steps = static_cast<std::size_t>(std::wcstoul(args[++i].c_str(), nullptr, 10));
+			} else if (args[i] == L"-s" && i + 1 < args.size()) {
+				seed = static_cast<unsigned int>(std::wcstoul(args[++i].c_str(), nullptr, 10));
+			} else {
+				PrintUsage();
+				return 2;
+			}
+		}
+		if (args.size() - i != 1) {
+			PrintUsage();
+			return 2;
+		}
+		auto path = args[i];
+
+		// ファイルの内容として期待するバイト列
+		std::string expected = "start\r\n";
+		if (!WriteFileAtomically(path, expected)) {
+			fprintf(stderr, "Unable to write file: %s\n", EncodeUtf8(path).c_str());
+			return 2;
+		}
+
+		Checker checker(path, seed);
+		FileWatcher watcher;
+		if (!watcher.Start(path, [&checker]() { checker.Notify(); })) {
+			fprintf(stderr, "Unable to watch file: %s\n", EncodeUtf8(path).c_str());
+			return 2;
+		}
+		if (!checker.Start(program)) {
+			fprintf(stderr, "Unable to start writer\n");
+			return 2;
+		}
+
+		FileTail tail;
+		std::wstring text;
+		tail.Reset(path, expected, text);
+
+		std::size_t appendCount = 0, replaceCount = 0, rewriteCount = 0, missed = 0;
+		bool failed = false;
+		for (std::size_t step = 0; step < steps && !failed; step++) {
+			auto chunk = checker.NextChunk();
+			auto kind = checker.Random(10);
+			std::string command;
+			auto want = FileTail::Change::Appended;
+			if (kind == 0) {
+				// 先頭は同じなので、見本では見分けられない。識別子の違いで書き換えとみなす
+				command = "r " + ToHex(expected + chunk);
+				expected += chunk;
+				want = FileTail::Change::Replaced;
+				replaceCount++;
+			} else if (kind == 1) {
+				auto offset = checker.Random(std::min<uint64_t>(expected.size(), FileTail::HEAD_CHECK_BYTES));
+				command = "w " + std::to_string(offset) + " " + ToHex(chunk);
+				expected[offset] = expected[offset] == 'x' ? 'y' : 'x';
+				expected += chunk;
+				want = FileTail::Change::Replaced;
+				rewriteCount++;
+			} else {
+				command = "a " + ToHex(chunk);
+				expected += chunk;
+				appendCount++;
+			}
+
+			auto before = checker.Notifications();
+			if (!checker.Send(command)) {
+				fprintf(stderr, "step %zu: writer failed\n", step);
+				failed = true;
+				break;
+			}
+			if (!checker.WaitNotification(before)) {
+				missed++;
+			}
+
+			std::wstring appended;
+			FileAppend append;
+			auto change = tail.Poll(appended, &append);
+			if (change != want) {
+				fprintf(stderr, "step %zu: expected %s but got %s\n", step, ChangeName(want), ChangeName(change));
+				failed = true;
+			} else if (change == FileTail::Change::Appended) {
+				// 追記として読んだバイト列だけをデコードし直しても同じ文字列になる
+				TextStreamDecoder decoder(append.offset == 0);
+				std::wstring redecoded;
+				decoder.Decode(append.bytes.data(), append.bytes.size(), redecoded);
+				if (redecoded != appended || append.offset + append.bytes.size() != expected.size()) {
+					fprintf(stderr, "step %zu: append record does not reproduce the appended text\n", step);
+					failed = true;
+				}
+				text += appended;
+			} else {
+				std::string bytes;
+				ReadFileBytes(path, bytes);
+				text.clear();
+				tail.Reset(path, bytes, text);
+			}
+
+			if (!failed && text != DecodeAll(expected)) {
+				fprintf(stderr, "step %zu: text does not match the file\n", step);
+				failed = true;
+			}
+		}
+
+		checker.Stop();
+		watcher.Stop();
+
+		printf("%zu appends, %zu replacements, %zu rewrites, %zu notifications, %zu missed, %llu bytes\n",
+			appendCount, replaceCount, rewriteCount, checker.Notifications(), missed, static_cast<unsigned long long>(expected.size()));
+		return failed || missed > 0 ? 1 : 0;
+	}
+}
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t* argv[]) {
+	return Run(argv[0], std::vector<std::wstring>(argv + 1, argv + argc));
+}
+#else
+int main(int argc, char* argv[]) {
+	std::vector<std::wstring> args;
+	for (int i = 1; i < argc; i++) {
+		args.push_back(DecodeUtf8(argv[i]));
+	}
+	return Run(DecodeUtf8(argv[0]), args);
+}
+#endif
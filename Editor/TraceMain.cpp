@@ -0,0 +1,157 @@
+﻿// 記録した入力を画面を使わずに再生して、編集の処理時間の分布を出すコマンド
+//
+//   editor-replay [--max-p99 マイクロ秒] <入力の記録> [ファイル]
+//
+// 文字の入力とキャレットの移動・削除のキーを PlayMacro と同じ規則で再生する。
+// 編集はエディタと同じ EditCore に対して行うので、文字の配列と索引 (差分、括弧、折りたたみ、印、単語、縮小表示) の
+// 更新にかかる時間を含む。差分と単語の索引のバックグラウンドのスレッドも動かす。文字の幅はすべて 1 とする。
+// 配置と描画、マウスと未確定文字列を含めた再生は Windows 版の Editor.exe --replay で行う。
+// --max-p99 を指定した場合は、いずれかの種類の 99 パーセンタイルがそれを超えると 1 を返す。
+//   g++ -std=c++14 -O2 -pthread TraceMain.cpp EditCore.cpp InputTrace.cpp Macro.cpp LineDiff.cpp BracketIndex.cpp Minimap.cpp WordIndex.cpp FoldIndex.cpp MarkerStore.cpp MemoryUsage.cpp Encoding.cpp Platform.cpp Arena.cpp -o editor-replay
+#include "InputTrace.h"
+#include "Macro.h"
+#include "EditCore.h"
+#include "Encoding.h"
+#include "Platform.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+
+namespace {
+	void PrintUsage() {
+		fprintf(stderr, "usage: editor-replay [--max-p99 microseconds] <trace> [file]\n");
+	}
+
+	// 配置しないので、位置は 0、幅は 1 にする
+	Char CreateChar(wchar_t character) {
+		Char ch;
+		ch.x = 0;
+		ch.y = 0;
+		ch.width = 1;
+		ch.wchar = character;
+		return ch;
+	}
+
+	// PlayMacro から EditCore を編集するための窓口
+	class ReplayDocument {
+	private:
+		EditCore& core;
+	public:
+		explicit ReplayDocument(EditCore& core) : core(core) {}
+
+		std::size_t Length() const {
+			return core.chars.size();
+		}
+
+		wchar_t CharAt(std::size_t pos) const {
+			return core.chars[pos].wchar;
+		}
+
+		void Insert(std::size_t pos, const wchar_t* text, std::size_t length) {
+			std::size_t revealedFrom;
+			core.Insert(pos, text, length, CreateChar, &revealedFrom);
+		}
+
+		void Erase(std::size_t pos, std::size_t length) {
+			std::size_t revealedFrom;
+			core.Erase(pos, pos + length, &revealedFrom);
+		}
+	};
+
+	int Run(const std::vector<std::wstring>& args) {
+		double maxP99 = 0;
+		std::size_t i = 0;
+		if (args.size() >= 2 && args[0] == L"--max-p99") {
+			maxP99 = std::wcstod(args[1].c_str(), nullptr);
+			i = 2;
+		}
+		if (i >= args.size() || args.size() - i > 2) {
+			PrintUsage();
+			return 2;
+		}
+
+		std::vector<TraceEvent> events;
+		std::wstring text;
+		try {
+			events = LoadInputTrace(args[i]);
+		} catch (const InputTraceException& e) {
+			fprintf(stderr, "%s\n", e.what());
+			return 2;
+		}
+		if (i + 1 < args.size()) {
+			// エディタで開いたときと同じく改行を \n に統一する
+			std::string bytes;
+			if (!ReadFileBytes(args[i + 1], bytes)) {
+				fprintf(stderr, "Unable to read file: %s\n", EncodeUtf8(args[i + 1]).c_str());
+				return 2;
+			}
+			TextStreamDecoder decoder;
+			decoder.Decode(bytes.data(), bytes.size(), text);
+			decoder.Finish(text);
+		}
+
+		EditCore core;
+		core.lineDiff.Start([]() {});
+		core.wordIndex.Start();
+		core.SetText(text, CreateChar);
+		ReplayDocument document(core);
+		std::size_t caret = 0;
+		std::vector<MacroEvent> macro(1);
+		LatencyStats stats[static_cast<int>(TraceEvent::Type::TYPE_COUNT)];
+		std::size_t skipped = 0;
+
+		for (auto& event : events) {
+			MacroKey key;
+			if (event.type == TraceEvent::Type::Char) {
+				macro[0] = MacroEvent::Char(static_cast<wchar_t>(event.value));
+			} else if (event.type == TraceEvent::Type::KeyDown && MacroKeyOf(event.value, &key)) {
+				macro[0] = MacroEvent::Key(key);
+			} else {
+				skipped++;
+				continue;
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			PlayMacro(document, macro, caret);
+			auto elapsed = std::chrono::steady_clock::now() - start;
+			stats[static_cast<int>(event.type)].Add(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+		}
+
+		core.lineDiff.Stop();
+		core.wordIndex.Stop();
+
+		bool overBudget = false;
+		for (int type = 0; type < static_cast<int>(TraceEvent::Type::TYPE_COUNT); type++) {
+			auto& stat = stats[type];
+			if (stat.Count() == 0) {
+				continue;
+			}
+			printf("%s\n", stat.Format(TraceEvent::NameOf(static_cast<TraceEvent::Type>(type))).c_str());
+			if (maxP99 > 0 && stat.Percentile(99) > maxP99 * 1000) {
+				overBudget = true;
+			}
+		}
+		printf("%zu events replayed, %zu skipped (mouse, IME composition and frames need Editor.exe --replay)\n", events.size() - skipped, skipped);
+
+		if (overBudget) {
+			fprintf(stderr, "p99 exceeds %.1fus\n", maxP99);
+			return 1;
+		}
+		return 0;
+	}
+}
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t* argv[]) {
+	return Run(std::vector<std::wstring>(argv + 1, argv + argc));
+}
+#else
+int main(int argc, char* argv[]) {
+	std::vector<std::wstring> args;
+	for (int i = 1; i < argc; i++) {
+		args.push_back(DecodeUtf8(argv[i]));
+	}
+	return Run(args);
+}
+#endif
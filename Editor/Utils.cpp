@@ -1,6 +1,8 @@
 #include "stdafx.h"
 #include "Utils.h"
 
+#include <unicode/unistr.h>
+
 const wchar_t* char_to_wchar(const char* src) {
 	icu::UnicodeString ustr(src, static_cast<int32_t>(strlen(src)), "shift_jis");
 
@@ -1,6 +1,8 @@
-#pragma once
+﻿#pragma once
 
-#include <unicode/unistr.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
 
 const wchar_t* char_to_wchar(const char* text);
 
@@ -10,4 +12,34 @@ inline std::wstring rswprintf(const wchar_t* format, Args const& ...args) {
 	swprintf_s(buf, format, args...);
 
 	return std::wstring(buf);
-}
\ No newline at end of file
+}
+
+// FNV-1a のハッシュ
+// ジャーナルやファイルの見本のハッシュはファイルに書いて次に開くときに比べるので、定数も混ぜ方も変えないこと
+const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+const uint64_t FNV_PRIME = 1099511628211ull;
+const uint32_t FNV32_OFFSET_BASIS = 2166136261u;
+const uint32_t FNV32_PRIME = 16777619u;
+
+// hash に value を 1 つ混ぜる
+inline uint64_t Fnv1a(uint64_t hash, uint64_t value) {
+	return (hash ^ value) * FNV_PRIME;
+}
+
+inline uint64_t Fnv1a(uint64_t hash, const wchar_t* text, std::size_t length) {
+	for (std::size_t i = 0; i < length; i++) {
+		hash = Fnv1a(hash, static_cast<uint64_t>(text[i]));
+	}
+
+	return hash;
+}
+
+// 32 ビット版。バイト列を 1 バイトずつ混ぜる
+inline uint32_t Fnv1a32(uint32_t hash, const char* data, std::size_t size) {
+	for (std::size_t i = 0; i < size; i++) {
+		hash ^= static_cast<unsigned char>(data[i]);
+		hash *= FNV32_PRIME;
+	}
+
+	return hash;
+}
@@ -0,0 +1,407 @@
+﻿#include "WordIndex.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+
+namespace {
+	// pred(i) が true になる最初の位置 (pred は途中から true になる)
+	template <typename Pred>
+	std::size_t FirstOf(std::size_t count, Pred pred) {
+		std::size_t low = 0;
+		std::size_t high = count;
+		while (low < high) {
+			auto middle = low + (high - low) / 2;
+			if (pred(middle)) {
+				high = middle;
+			} else {
+				low = middle + 1;
+			}
+		}
+
+		return low;
+	}
+
+	// text の単語ごとに func(const wchar_t* word, std::size_t length) を呼ぶ
+	template <typename Func>
+	void ForEachWord(const wchar_t* text, std::size_t length, Func func) {
+		std::size_t i = 0;
+		while (i < length) {
+			if (!WordIndex::IsWordChar(text[i])) {
+				i++;
+				continue;
+			}
+
+			auto start = i;
+			while (i < length && WordIndex::IsWordChar(text[i])) {
+				i++;
+			}
+
+			// 短すぎる単語と長すぎる単語 (エンコードされたデータなど) は数えない
+			auto wordLength = i - start;
+			if (wordLength >= WordIndex::MIN_WORD_LENGTH && wordLength <= WordIndex::MAX_WORD_LENGTH) {
+				func(text + start, wordLength);
+			}
+		}
+	}
+}
+
+WordIndex::Table::Table() :
+	offsets(1, 0),
+	leaves(1),
+	tree(2, 0) {
+}
+
+std::size_t WordIndex::Table::Size() const {
+	return counts.size();
+}
+
+const wchar_t* WordIndex::Table::Word(std::size_t i) const {
+	return pool.data() + offsets[i];
+}
+
+std::size_t WordIndex::Table::Length(std::size_t i) const {
+	return offsets[i + 1] - offsets[i];
+}
+
+int WordIndex::Table::Compare(std::size_t i, const wchar_t* word, std::size_t length, bool prefixOnly) const {
+	auto text = Word(i);
+	auto textLength = prefixOnly ? std::min(Length(i), length) : Length(i);
+
+	for (std::size_t k = 0; k < textLength && k < length; k++) {
+		if (text[k] != word[k]) {
+			return text[k] < word[k] ? -1 : 1;
+		}
+	}
+
+	if (textLength != length) {
+		return textLength < length ? -1 : 1;
+	}
+	return 0;
+}
+
+void WordIndex::Table::BuildTree() {
+	leaves = 1;
+	while (leaves < counts.size()) {
+		leaves *= 2;
+	}
+
+	tree.assign(leaves * 2, 0);
+	std::copy(counts.begin(), counts.end(), tree.begin() + leaves);
+	for (auto node = leaves - 1; node > 0; node--) {
+		tree[node] = std::max(tree[node * 2], tree[node * 2 + 1]);
+	}
+}
+
+void WordIndex::Table::Update(std::size_t i, uint32_t count) {
+	counts[i] = count;
+
+	auto node = leaves + i;
+	tree[node] = count;
+	for (node /= 2; node > 0; node /= 2) {
+		tree[node] = std::max(tree[node * 2], tree[node * 2 + 1]);
+	}
+}
+
+std::size_t WordIndex::Table::MemoryUsage() const {
+	return BytesOf(pool) + BytesOf(offsets) + BytesOf(counts) + BytesOf(tree);
+}
+
+WordIndex::WordIndex() :
+	stopRequested(false) {
+}
+
+WordIndex::~WordIndex() {
+	Stop();
+}
+
+void WordIndex::Start() {
+	Stop();
+
+	stopRequested = false;
+	worker = std::thread(&WordIndex::WorkerLoop, this);
+}
+
+void WordIndex::Stop() {
+	if (!worker.joinable()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopRequested = true;
+	}
+	condition.notify_one();
+	worker.join();
+}
+
+void WordIndex::SetText(const std::wstring& text) {
+	auto copy = std::make_shared<const std::wstring>(text);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		// それまでの編集は作り直す内容に含まれている
+		pendingText = copy;
+		pendingChars.clear();
+		pendingWords.clear();
+	}
+	condition.notify_one();
+}
+
+void WordIndex::Clear() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		pendingText = std::make_shared<const std::wstring>();
+		std::vector<wchar_t>().swap(pendingChars);
+		std::vector<PendingWord>().swap(pendingWords);
+	}
+	condition.notify_one();
+
+	std::vector<wchar_t>().swap(editBuffer);
+}
+
+void WordIndex::AddWords(const wchar_t* text, std::size_t length, int diff) {
+	ForEachWord(text, length, [this, diff](const wchar_t* word, std::size_t wordLength) {
+		pendingWords.push_back({ pendingChars.size(), wordLength, diff });
+		pendingChars.insert(pendingChars.end(), word, word + wordLength);
+	});
+}
+
+void WordIndex::ApplyWord(const wchar_t* word, std::size_t length, int diff) {
+	auto i = FirstOf(table.Size(), [&](std::size_t i) { return table.Compare(i, word, length, false) >= 0; });
+	if (i < table.Size() && table.Compare(i, word, length, false) == 0) {
+		auto count = table.counts[i];
+		table.Update(i, diff > 0 ? count + 1 : (count > 0 ? count - 1 : 0));
+		return;
+	}
+
+	// 配列にない単語。回数が 0 になったら取り除く
+	std::wstring key(word, length);
+	if (diff > 0) {
+		recent[key]++;
+	} else {
+		auto itr = recent.find(key);
+		if (itr != recent.end() && --itr->second == 0) {
+			recent.erase(itr);
+		}
+	}
+}
+
+void WordIndex::Build(const std::wstring& text, Table* out) {
+	// 単語ごとに最初に現れた位置と回数を数える
+	struct Entry {
+		std::size_t offset;
+		std::size_t length;
+		uint32_t count;
+	};
+	std::vector<Entry> entries;
+	std::unordered_map<uint64_t, std::size_t> slots;
+
+	auto data = text.data();
+	ForEachWord(data, text.size(), [&](const wchar_t* word, std::size_t length) {
+		// ハッシュが衝突した場合は次の値を使う
+		for (auto hash = Fnv1a(FNV_OFFSET_BASIS, word, length);; hash++) {
+			auto itr = slots.find(hash);
+			if (itr == slots.end()) {
+				slots.emplace(hash, entries.size());
+				entries.push_back({ static_cast<std::size_t>(word - data), length, 1 });
+				return;
+			}
+
+			auto& entry = entries[itr->second];
+			if (entry.length == length && std::equal(word, word + length, data + entry.offset)) {
+				entry.count++;
+				return;
+			}
+		}
+	});
+	std::unordered_map<uint64_t, std::size_t>().swap(slots);
+
+	std::sort(entries.begin(), entries.end(), [data](const Entry& a, const Entry& b) {
+		return std::lexicographical_compare(data + a.offset, data + a.offset + a.length, data + b.offset, data + b.offset + b.length);
+	});
+
+	Table table;
+	table.counts.reserve(entries.size());
+	table.offsets.reserve(entries.size() + 1);
+	for (auto& entry : entries) {
+		table.pool.insert(table.pool.end(), data + entry.offset, data + entry.offset + entry.length);
+		table.offsets.push_back(static_cast<uint32_t>(table.pool.size()));
+		table.counts.push_back(entry.count);
+	}
+	table.BuildTree();
+
+	std::swap(*out, table);
+}
+
+void WordIndex::Merge(Table* out) const {
+	// 辞書順に並んでいる配列と std::map をつなげる (回数が 0 になった単語は除く)
+	Table merged;
+	auto append = [&merged](const wchar_t* word, std::size_t length, uint32_t count) {
+		if (count > 0) {
+			merged.pool.insert(merged.pool.end(), word, word + length);
+			merged.offsets.push_back(static_cast<uint32_t>(merged.pool.size()));
+			merged.counts.push_back(count);
+		}
+	};
+
+	std::size_t i = 0;
+	auto itr = recent.begin();
+	while (i < table.Size() || itr != recent.end()) {
+		if (itr == recent.end() || (i < table.Size() && table.Compare(i, itr->first.data(), itr->first.size(), false) < 0)) {
+			append(table.Word(i), table.Length(i), table.counts[i]);
+			i++;
+		} else {
+			append(itr->first.data(), itr->first.size(), itr->second);
+			itr++;
+		}
+	}
+	merged.BuildTree();
+
+	std::swap(*out, merged);
+}
+
+void WordIndex::Complete(const wchar_t* prefix, std::size_t prefixLength, std::size_t count, std::vector<WordCandidate>& out) {
+	std::vector<WordCandidate> found;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// 接頭辞が一致する単語の範囲
+		auto low = FirstOf(table.Size(), [&](std::size_t i) { return table.Compare(i, prefix, prefixLength, true) >= 0; });
+		auto high = FirstOf(table.Size(), [&](std::size_t i) { return table.Compare(i, prefix, prefixLength, true) > 0; });
+
+		// 範囲を覆うセグメント木のノードから、回数の最大値が大きいものを順に展開する
+		std::priority_queue<std::pair<uint32_t, std::size_t>> queue;
+		auto leaves = table.leaves;
+		for (auto left = low + leaves, right = high + leaves; left < right; left /= 2, right /= 2) {
+			if (left & 1) {
+				queue.emplace(table.tree[left], left);
+				left++;
+			}
+			if (right & 1) {
+				right--;
+				queue.emplace(table.tree[right], right);
+			}
+		}
+
+		while (!queue.empty() && found.size() < count) {
+			auto node = queue.top();
+			queue.pop();
+			if (node.first == 0) {
+				break;
+			}
+
+			if (node.second >= leaves) {
+				auto i = node.second - leaves;
+				if (table.Length(i) != prefixLength) {
+					found.push_back({ std::wstring(table.Word(i), table.Length(i)), node.first });
+				}
+			} else {
+				queue.emplace(table.tree[node.second * 2], node.second * 2);
+				queue.emplace(table.tree[node.second * 2 + 1], node.second * 2 + 1);
+			}
+		}
+
+		// 配列にない単語は数が少ないのですべて調べる
+		for (auto itr = recent.lower_bound(std::wstring(prefix, prefixLength)); itr != recent.end(); itr++) {
+			if (itr->first.compare(0, prefixLength, prefix, prefixLength) != 0) {
+				break;
+			}
+			if (itr->first.size() != prefixLength) {
+				found.push_back({ itr->first, itr->second });
+			}
+		}
+	}
+
+	std::sort(found.begin(), found.end(), [](const WordCandidate& a, const WordCandidate& b) {
+		return a.count != b.count ? a.count > b.count : a.word < b.word;
+	});
+	if (found.size() > count) {
+		found.resize(count);
+	}
+	std::move(found.begin(), found.end(), std::back_inserter(out));
+}
+
+std::size_t WordIndex::MemoryUsage() {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	auto bytes = table.MemoryUsage() + BytesOf(pendingChars) + BytesOf(pendingWords) + BytesOf(editBuffer);
+	for (auto& entry : recent) {
+		// 木のノードの管理領域はおおよその大きさ
+		bytes += sizeof(entry) + sizeof(void*) * 3 + BytesOf(entry.first);
+	}
+
+	return bytes;
+}
+
+bool WordIndex::IsWordChar(wchar_t character) {
+	if ((character >= L'0' && character <= L'9') || (character >= L'A' && character <= L'Z') || (character >= L'a' && character <= L'z') || character == L'_') {
+		return true;
+	}
+
+	// ASCII 以外は記号と空白を除いて単語の文字とする
+	return character >= 0xC0 && character != 0xD7 && character != 0xF7
+		&& !(character >= 0x2000 && character <= 0x2BFF)
+		&& !(character >= 0x3000 && character <= 0x303F)
+		&& !(character >= 0xFF01 && character <= 0xFF0F)
+		&& !(character >= 0xFF1A && character <= 0xFF20)
+		&& !(character >= 0xD800 && character <= 0xDFFF);
+}
+
+void WordIndex::WorkerLoop() {
+	std::unique_lock<std::mutex> lock(mutex);
+	std::vector<wchar_t> chars;
+	std::vector<PendingWord> words;
+
+	while (true) {
+		condition.wait(lock, [this]() { return pendingText || !pendingWords.empty() || stopRequested; });
+		if (stopRequested) {
+			break;
+		}
+
+		if (pendingText) {
+			auto text = pendingText;
+			pendingText.reset();
+
+			// 作っている間は編集できるようにロックを外す
+			lock.unlock();
+			Table built;
+			Build(*text, &built);
+			text.reset();
+			lock.lock();
+
+			if (stopRequested) {
+				break;
+			}
+			if (pendingText) {
+				// 作っている間に別の内容で作り直すことになった
+				continue;
+			}
+
+			std::swap(table, built);
+			recent.clear();
+		}
+
+		// 作り直してから後の編集による増減を反映する
+		chars.swap(pendingChars);
+		words.swap(pendingWords);
+		for (auto& word : words) {
+			ApplyWord(chars.data() + word.offset, word.length, word.diff);
+		}
+		chars.clear();
+		words.clear();
+
+		if (recent.size() > MERGE_WORDS) {
+			// 書き換えるのはこのスレッドだけなので、ロックを外して読んでもよい
+			lock.unlock();
+			Table merged;
+			Merge(&merged);
+			lock.lock();
+
+			std::swap(table, merged);
+			recent.clear();
+		}
+	}
+}
@@ -0,0 +1,178 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "MemoryUsage.h"
+
+// 補完の候補
+struct WordCandidate {
+	std::wstring word;
+	uint32_t count; // 文書に現れる回数
+};
+
+// 単語の補完のための、文書に現れる単語と回数の索引
+//
+// 単語は辞書順に並べた配列に回数と一緒に持ち、回数の最大値のセグメント木で
+// 接頭辞に一致する範囲から回数の多い順に取り出す (候補 1 つにつき O(log n))。
+// 配列にない新しい単語は小さな std::map に入れ、一定の数を超えたら配列に併合する。
+//
+// 文書全体からの作成と編集による回数の増減はバックグラウンドのスレッドで行う。
+// 編集されたときは、編集された位置を含む単語の前後の境界までだけを編集の前後で数えて差を送る。
+class WordIndex {
+private:
+	// 単語の辞書順の配列と回数のセグメント木
+	struct Table {
+		std::vector<wchar_t> pool; // 単語の文字をつなげたもの
+		std::vector<uint32_t> offsets; // i 番目の単語は pool[offsets[i]] から offsets[i + 1] の前まで
+		std::vector<uint32_t> counts;
+		std::size_t leaves; // セグメント木の葉の数 (2 の累乗)
+		std::vector<uint32_t> tree; // tree[leaves + i] が counts[i]、それ以外は子の最大値
+
+		Table();
+		std::size_t Size() const;
+		const wchar_t* Word(std::size_t i) const;
+		std::size_t Length(std::size_t i) const;
+		// i 番目の単語と word を辞書順で比べる (prefixOnly の場合は単語の先頭の length 文字だけを比べる)
+		int Compare(std::size_t i, const wchar_t* word, std::size_t length, bool prefixOnly) const;
+		void BuildTree();
+		void Update(std::size_t i, uint32_t count);
+		std::size_t MemoryUsage() const;
+	};
+
+	// 送られてきた単語と回数の増減
+	struct PendingWord {
+		std::size_t offset; // pendingChars の位置
+		std::size_t length;
+		int diff;
+	};
+
+	// 配列にない単語がこの数を超えたら併合する
+	static constexpr std::size_t MERGE_WORDS = 4096;
+
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopRequested;
+
+	// 以下は UI スレッドからだけ使う
+	// 編集前の単語を並べ直すための作業領域 (確保し直さないように使い回す)
+	std::vector<wchar_t> editBuffer;
+
+	// 以下は mutex で保護する
+	// 作り直す文書の内容 (nullptr の場合は作り直さない)
+	std::shared_ptr<const std::wstring> pendingText;
+	std::vector<wchar_t> pendingChars;
+	std::vector<PendingWord> pendingWords;
+	Table table;
+	std::map<std::wstring, uint32_t> recent;
+
+	// text の単語を数えて pendingWords に追加する
+	void AddWords(const wchar_t* text, std::size_t length, int diff);
+	void ApplyWord(const wchar_t* word, std::size_t length, int diff);
+	static void Build(const std::wstring& text, Table* out);
+	void Merge(Table* out) const;
+	void WorkerLoop();
+public:
+	static constexpr std::size_t MIN_WORD_LENGTH = 2;
+	static constexpr std::size_t MAX_WORD_LENGTH = 64;
+
+	WordIndex();
+	~WordIndex();
+
+	WordIndex(const WordIndex&) = delete;
+	WordIndex& operator=(const WordIndex&) = delete;
+
+	void Start();
+	void Stop();
+
+	// 文書全体から作り直す
+	void SetText(const std::wstring& text);
+	// 空にして、確保していたメモリを解放する
+	void Clear();
+	// pos に inserted 文字を挿入した後に呼ぶ
+	// charAt(std::size_t index) は編集後の文書の index 番目の文字、length は編集後の文書の長さ
+	template <typename CharAt>
+	void Insert(std::size_t pos, std::size_t inserted, std::size_t length, CharAt charAt);
+	// pos から removed の文字を削除した後に呼ぶ
+	template <typename CharAt>
+	void Erase(std::size_t pos, const wchar_t* removed, std::size_t removedLength, std::size_t length, CharAt charAt);
+
+	// prefix で始まる単語を回数の多い順に最大 count 個、out の末尾に追加する (prefix と同じ単語は除く)
+	void Complete(const wchar_t* prefix, std::size_t prefixLength, std::size_t count, std::vector<WordCandidate>& out);
+	// 確保しているメモリの大きさ (バイト)
+	std::size_t MemoryUsage();
+
+	static bool IsWordChar(wchar_t character);
+};
+
+template <typename CharAt>
+void WordIndex::Insert(std::size_t pos, std::size_t inserted, std::size_t length, CharAt charAt) {
+	// 挿入された部分を含む単語の境界まで広げる (その外側の単語は変わらない)
+	auto start = pos;
+	while (start > 0 && IsWordChar(charAt(start - 1))) {
+		start--;
+	}
+	auto end = pos + inserted;
+	while (end < length && IsWordChar(charAt(end))) {
+		end++;
+	}
+
+	// 編集前は挿入された部分を除いたもの
+	editBuffer.clear();
+	for (auto i = start; i < pos; i++) {
+		editBuffer.push_back(charAt(i));
+	}
+	for (auto i = pos + inserted; i < end; i++) {
+		editBuffer.push_back(charAt(i));
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	AddWords(editBuffer.data(), editBuffer.size(), -1);
+
+	editBuffer.clear();
+	for (auto i = start; i < end; i++) {
+		editBuffer.push_back(charAt(i));
+	}
+	AddWords(editBuffer.data(), editBuffer.size(), 1);
+	condition.notify_one();
+}
+
+template <typename CharAt>
+void WordIndex::Erase(std::size_t pos, const wchar_t* removed, std::size_t removedLength, std::size_t length, CharAt charAt) {
+	auto start = pos;
+	while (start > 0 && IsWordChar(charAt(start - 1))) {
+		start--;
+	}
+	auto end = pos;
+	while (end < length && IsWordChar(charAt(end))) {
+		end++;
+	}
+
+	// 編集前は削除された文字が pos にあったもの
+	editBuffer.clear();
+	for (auto i = start; i < pos; i++) {
+		editBuffer.push_back(charAt(i));
+	}
+	editBuffer.insert(editBuffer.end(), removed, removed + removedLength);
+	for (auto i = pos; i < end; i++) {
+		editBuffer.push_back(charAt(i));
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	AddWords(editBuffer.data(), editBuffer.size(), -1);
+
+	editBuffer.clear();
+	for (auto i = start; i < end; i++) {
+		editBuffer.push_back(charAt(i));
+	}
+	AddWords(editBuffer.data(), editBuffer.size(), 1);
+	condition.notify_one();
+}
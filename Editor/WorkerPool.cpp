@@ -0,0 +1,93 @@
+﻿#include "WorkerPool.h"
+
+WorkerPool::WorkerPool() :
+	stopRequested(false),
+	task(nullptr),
+	taskCount(0),
+	generation(0),
+	running(0),
+	next(0) {
+}
+
+WorkerPool::~WorkerPool() {
+	Stop();
+}
+
+void WorkerPool::Start(std::size_t threadCount) {
+	Stop();
+
+	stopRequested = false;
+	for (std::size_t i = 0; i < threadCount; i++) {
+		threads.emplace_back(&WorkerPool::WorkerLoop, this, generation);
+	}
+}
+
+void WorkerPool::Stop() {
+	if (threads.empty()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopRequested = true;
+	}
+	wake.notify_all();
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	threads.clear();
+}
+
+bool WorkerPool::IsRunning() const {
+	return !threads.empty();
+}
+
+std::size_t WorkerPool::ThreadCount() const {
+	return threads.size();
+}
+
+void WorkerPool::Run(std::size_t count, const std::function<void(std::size_t)>& task) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->task = &task;
+		taskCount = count;
+		next = 0;
+		running = threads.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	RunTasks();
+
+	// 他のスレッドが実行している処理が終わるまで待つ
+	std::unique_lock<std::mutex> lock(mutex);
+	finished.wait(lock, [this]() { return running == 0; });
+	this->task = nullptr;
+}
+
+void WorkerPool::RunTasks() {
+	for (auto i = next.fetch_add(1); i < taskCount; i = next.fetch_add(1)) {
+		(*task)(i);
+	}
+}
+
+void WorkerPool::WorkerLoop(uint64_t seen) {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (true) {
+		wake.wait(lock, [this, seen]() { return stopRequested || generation != seen; });
+		if (stopRequested) {
+			break;
+		}
+		seen = generation;
+
+		lock.unlock();
+		RunTasks();
+		lock.lock();
+
+		if (--running == 0) {
+			finished.notify_one();
+		}
+	}
+}
@@ -0,0 +1,49 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 決まった数のスレッドで、番号を付けた処理を分担して実行する
+//
+// Run を呼び出したスレッドも分担し、すべての処理が終わるまで戻らない。
+// スレッドは Start から Stop まで待機し続けるので、フレームごとに呼び出してもスレッドを作り直さない。
+class WorkerPool {
+private:
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable finished;
+	bool stopRequested;
+	// 以下は mutex で保護する
+	const std::function<void(std::size_t)>* task;
+	std::size_t taskCount;
+	uint64_t generation;
+	// 今の処理をまだ終えていないスレッドの数
+	std::size_t running;
+	// 次に実行する処理の番号
+	std::atomic<std::size_t> next;
+
+	// seen は作成したときの世代 (それより後に Run されたものを実行する)
+	void WorkerLoop(uint64_t seen);
+	void RunTasks();
+public:
+	WorkerPool();
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	void Start(std::size_t threadCount);
+	void Stop();
+	bool IsRunning() const;
+	// 呼び出したスレッドを含まない数
+	std::size_t ThreadCount() const;
+	// task(0) から task(count - 1) までを分担して実行する。Start していない場合は呼び出したスレッドだけで実行する
+	void Run(std::size_t count, const std::function<void(std::size_t)>& task);
+};